@@ -0,0 +1,984 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#include "ecs.h"
+#include "job.h"
+#include "status.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The alignment of the arrays in a chunk, a cache line so arrays never share one
+ */
+#define ECS_COLUMN_ALIGNMENT 64
+
+/**
+ * The alignment of recorded commands and their values
+ */
+#define ECS_COMMAND_ALIGNMENT 16
+
+/**
+ * The number of jobs per worker a system runs with, each job runs the system on a batch of chunks
+ */
+#define ECS_JOBS_PER_WORKER 8
+
+/**
+ * The mask of the generation in an entity handle, after shifting out the index
+ */
+#define ECS_GENERATION_MASK ((1U << (32 - ECS_ENTITY_INDEX_BITS)) - 1)
+
+/**
+ * Marks the end of the free list of entity records and records of destroyed entities
+ */
+#define ECS_NO_INDEX UINT32_MAX
+
+_Static_assert(ECS_MAX_COMPONENTS <= 64, "component masks are 64 bits");
+
+/**
+ * A chunk of entities of an archetype
+ */
+struct ecs_chunk {
+
+  /**
+   * The arrays: entities first, then each component in the order of the component types
+   */
+  char * data;
+
+  /**
+   * The number of entities
+   */
+  size_t count;
+};
+
+/**
+ * The entities with the same set of components, in chunks that are full but for the last one
+ */
+struct ecs_archetype {
+
+  /**
+   * The mask of the components
+   */
+  uint64_t components;
+
+  /**
+   * The offset of the array of each component in a chunk
+   */
+  size_t offsets[ECS_MAX_COMPONENTS];
+
+  /**
+   * The number of entities a chunk holds
+   */
+  size_t capacity;
+
+  /**
+   * The chunks
+   */
+  struct ecs_chunk * chunks;
+
+  /**
+   * The number of chunks
+   */
+  size_t chunk_len;
+
+  /**
+   * The capacity of the chunk array
+   */
+  size_t chunk_cap;
+};
+
+/**
+ * Where an entity is stored
+ */
+struct ecs_record {
+
+  /**
+   * The index of the archetype of the entity, ECS_NO_INDEX if the entity was destroyed
+   */
+  uint32_t archetype;
+
+  /**
+   * The index of the chunk of the entity
+   */
+  uint32_t chunk;
+
+  /**
+   * The row of the entity in its chunk, the next free record if the entity was destroyed
+   */
+  uint32_t row;
+
+  /**
+   * The generation of the entity, or the generation of the next entity using the record
+   */
+  uint32_t generation;
+};
+
+/**
+ * The kinds of recorded commands
+ */
+enum ecs_command_type {
+		       /**
+			* Creates an entity, followed by the values of its components
+			*/
+		       ECS_COMMAND_CREATE,
+
+		       /**
+			* Destroys an entity
+			*/
+		       ECS_COMMAND_DESTROY,
+
+		       /**
+			* Adds or sets a component, followed by its value
+			*/
+		       ECS_COMMAND_ADD,
+
+		       /**
+			* Removes a component
+			*/
+		       ECS_COMMAND_REMOVE
+};
+
+/**
+ * A recorded command, padded to the command alignment with its values
+ */
+struct ecs_command {
+
+  /**
+   * The size of the command and its values
+   */
+  size_t size;
+
+  /**
+   * The components of a created entity
+   */
+  uint64_t components;
+
+  /**
+   * The entity
+   */
+  ecs_entity entity;
+
+  /**
+   * The component added or removed
+   */
+  ecs_component component;
+
+  /**
+   * The kind of command
+   */
+  enum ecs_command_type type;
+};
+
+/**
+ * The run of a system on a chunk, the data of its job
+ */
+struct ecs_task {
+
+  /**
+   * The system
+   */
+  ecs_system system;
+
+  /**
+   * The data passed to the system
+   */
+  void * data;
+
+  /**
+   * The chunk
+   */
+  struct ecs_view view;
+};
+
+/**
+ * The size of each component type
+ */
+static size_t component_sizes[ECS_MAX_COMPONENTS];
+
+/**
+ * The number of component types
+ */
+static size_t component_len;
+
+/**
+ * The archetypes, few enough to be searched one after another
+ */
+static struct ecs_archetype * archetypes;
+
+/**
+ * The number of archetypes
+ */
+static size_t archetype_len;
+
+/**
+ * The capacity of the archetype array
+ */
+static size_t archetype_cap;
+
+/**
+ * The entity records, indexed by the index of the entity
+ */
+static struct ecs_record * records;
+
+/**
+ * The number of entity records
+ */
+static size_t record_len;
+
+/**
+ * The capacity of the entity record array
+ */
+static size_t record_cap;
+
+/**
+ * The first record of a destroyed entity, reused by the next entity
+ */
+static uint32_t free_record;
+
+/**
+ * The number of live entities
+ */
+static size_t entity_count;
+
+/**
+ * The number of systems running, structural changes are only allowed without
+ */
+static int running_systems;
+
+/**
+ * The tasks of the system running with jobs
+ */
+static struct ecs_task * tasks;
+
+/**
+ * The number of tasks
+ */
+static size_t task_len;
+
+/**
+ * The capacity of the task array
+ */
+static size_t task_cap;
+
+/**
+ * The number of tasks a job runs
+ */
+static size_t task_batch;
+
+/*
+ * Archetype functions
+ */
+
+/**
+ * Rounds a size up to an alignment
+ * \param size the size
+ * \param alignment the alignment, a power of two
+ * \return the rounded size
+ */
+static size_t align_ecs_size(size_t size, size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * Returns the archetype of a set of components, creating it if there is none yet
+ * \param components the mask of the components
+ * \return the index of the archetype or -1 on failure
+ */
+static long get_ecs_archetype(uint64_t components) {
+  for(size_t i = 0; i < archetype_len; ++i) {
+    if(archetypes[i].components == components) {
+      return (long)i;
+    }
+  }
+
+  // every array may need padding up to the column alignment
+  size_t row_size = sizeof(ecs_entity);
+  size_t padding = ECS_COLUMN_ALIGNMENT;
+  for(size_t i = 0; i < component_len; ++i) {
+    if((components & ECS_MASK(i)) != 0) {
+      row_size += component_sizes[i];
+      padding += ECS_COLUMN_ALIGNMENT;
+    }
+  }
+  if(padding >= ECS_CHUNK_SIZE || (ECS_CHUNK_SIZE - padding) / row_size == 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  if(archetype_len == archetype_cap) {
+    size_t new_cap = archetype_cap == 0 ? 8 : archetype_cap * 2;
+    struct ecs_archetype * buf = (struct ecs_archetype *)realloc(archetypes, new_cap * sizeof(struct ecs_archetype));
+    if(buf == NULL) {
+      SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+      return -1;
+    }
+    archetypes = buf;
+    archetype_cap = new_cap;
+  }
+
+  struct ecs_archetype * archetype = archetypes + archetype_len;
+  archetype->components = components;
+  archetype->capacity = (ECS_CHUNK_SIZE - padding) / row_size;
+  size_t offset = archetype->capacity * sizeof(ecs_entity);
+  for(size_t i = 0; i < ECS_MAX_COMPONENTS; ++i) {
+    archetype->offsets[i] = 0;
+    if(i < component_len && (components & ECS_MASK(i)) != 0) {
+      offset = align_ecs_size(offset, ECS_COLUMN_ALIGNMENT);
+      archetype->offsets[i] = offset;
+      offset += archetype->capacity * component_sizes[i];
+    }
+  }
+  assert(offset <= ECS_CHUNK_SIZE);
+  archetype->chunks = NULL;
+  archetype->chunk_len = 0;
+  archetype->chunk_cap = 0;
+  return (long)archetype_len++;
+}
+
+/**
+ * Appends a row for an entity to an archetype, its components are left uninitialized
+ * \param archetype the archetype
+ * \param entity the entity
+ * \param chunk receives the index of the chunk
+ * \param row receives the row in the chunk
+ * \return 0 on success, -1 on failure
+ */
+static int add_ecs_row(struct ecs_archetype * archetype, ecs_entity entity, uint32_t * chunk, uint32_t * row) {
+  if(archetype->chunk_len == 0 || archetype->chunks[archetype->chunk_len - 1].count == archetype->capacity) {
+    if(archetype->chunk_len == archetype->chunk_cap) {
+      size_t new_cap = archetype->chunk_cap == 0 ? 4 : archetype->chunk_cap * 2;
+      struct ecs_chunk * buf = (struct ecs_chunk *)realloc(archetype->chunks, new_cap * sizeof(struct ecs_chunk));
+      if(buf == NULL) {
+	SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+	return -1;
+      }
+      archetype->chunks = buf;
+      archetype->chunk_cap = new_cap;
+    }
+    char * data = (char *)aligned_alloc(ECS_COLUMN_ALIGNMENT, ECS_CHUNK_SIZE);
+    if(data == NULL) {
+      SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+      return -1;
+    }
+    archetype->chunks[archetype->chunk_len].data = data;
+    archetype->chunks[archetype->chunk_len].count = 0;
+    ++archetype->chunk_len;
+  }
+  struct ecs_chunk * last = archetype->chunks + archetype->chunk_len - 1;
+  ((ecs_entity *)last->data)[last->count] = entity;
+  *chunk = (uint32_t)(archetype->chunk_len - 1);
+  *row = (uint32_t)last->count++;
+  return 0;
+}
+
+/**
+ * Removes a row from an archetype, moving its last row into the gap
+ * \param archetype the archetype
+ * \param chunk the index of the chunk
+ * \param row the row in the chunk
+ */
+static void remove_ecs_row(struct ecs_archetype * archetype, uint32_t chunk, uint32_t row) {
+  struct ecs_chunk * last = archetype->chunks + archetype->chunk_len - 1;
+  size_t last_row = last->count - 1;
+  if(archetype->chunks + chunk != last || row != last_row) {
+    char * data = archetype->chunks[chunk].data;
+    ecs_entity moved = ((ecs_entity *)last->data)[last_row];
+    ((ecs_entity *)data)[row] = moved;
+    for(size_t i = 0; i < component_len; ++i) {
+      if((archetype->components & ECS_MASK(i)) != 0) {
+	memcpy(data + archetype->offsets[i] + row * component_sizes[i], last->data + archetype->offsets[i] + last_row * component_sizes[i], component_sizes[i]);
+      }
+    }
+    struct ecs_record * record = records + (moved & (ECS_MAX_ENTITIES - 1));
+    record->chunk = chunk;
+    record->row = row;
+  }
+  if(--last->count == 0) {
+    free(last->data);
+    --archetype->chunk_len;
+  }
+}
+
+/**
+ * Returns the record of a live entity
+ * \param entity the entity
+ * \return the record or NULL if the entity is not alive
+ */
+static struct ecs_record * get_ecs_record(ecs_entity entity) {
+  uint32_t index = entity & (ECS_MAX_ENTITIES - 1);
+  if(index >= record_len) {
+    return NULL;
+  }
+  struct ecs_record * record = records + index;
+  if(record->archetype == ECS_NO_INDEX || record->generation != entity >> ECS_ENTITY_INDEX_BITS) {
+    return NULL;
+  }
+  return record;
+}
+
+/**
+ * Moves an entity to the archetype of another set of components, keeping the components both
+ * sets have and zeroing the others
+ * \param entity the entity
+ * \param record the record of the entity
+ * \param components the mask of the components
+ * \return 0 on success, -1 on failure
+ */
+static int move_ecs_entity(ecs_entity entity, struct ecs_record * record, uint64_t components) {
+  long index = get_ecs_archetype(components);
+  if(index < 0) {
+    return -1;
+  }
+  struct ecs_archetype * from = archetypes + record->archetype;
+  struct ecs_archetype * to = archetypes + index;
+  uint32_t chunk;
+  uint32_t row;
+  if(add_ecs_row(to, entity, &chunk, &row) != 0) {
+    return -1;
+  }
+  char * from_data = from->chunks[record->chunk].data;
+  char * to_data = to->chunks[chunk].data;
+  for(size_t i = 0; i < component_len; ++i) {
+    if((components & ECS_MASK(i)) == 0) {
+      continue;
+    }
+    char * target = to_data + to->offsets[i] + row * component_sizes[i];
+    if((from->components & ECS_MASK(i)) != 0) {
+      memcpy(target, from_data + from->offsets[i] + record->row * component_sizes[i], component_sizes[i]);
+    } else {
+      memset(target, 0, component_sizes[i]);
+    }
+  }
+  remove_ecs_row(from, record->chunk, record->row);
+  record->archetype = (uint32_t)index;
+  record->chunk = chunk;
+  record->row = row;
+  return 0;
+}
+
+/*
+ * System functions
+ */
+
+/**
+ * Tells whether an archetype matches a query
+ * \param archetype the archetype
+ * \param query the query
+ * \return true if the entities of the archetype match
+ */
+static bool is_ecs_query_match(const struct ecs_archetype * archetype, const struct ecs_query * query) {
+  return (archetype->components & query->all) == query->all && (archetype->components & query->none) == 0;
+}
+
+/**
+ * Fills a view of a chunk
+ * \param archetype the archetype of the chunk
+ * \param chunk the chunk
+ * \param view the view
+ */
+static void get_ecs_view(const struct ecs_archetype * archetype, const struct ecs_chunk * chunk, struct ecs_view * view) {
+  view->entities = (const ecs_entity *)chunk->data;
+  view->count = chunk->count;
+  view->data = chunk->data;
+  view->offsets = archetype->offsets;
+  view->components = archetype->components;
+}
+
+/**
+ * Job function running a system on a batch of chunks
+ * \param job the job
+ * \param data the first task of the batch cast as a void *
+ */
+static void run_ecs_task(struct job * job, void * data) {
+  (void)job;
+  struct ecs_task * task = (struct ecs_task *)data;
+  struct ecs_task * end = task + task_batch < tasks + task_len ? task + task_batch : tasks + task_len;
+  for(; task != end; ++task) {
+    task->system(&task->view, task->data);
+  }
+}
+
+/**
+ * Job function starting a job per task, as children so waiting for it waits for all tasks
+ * \param job the job
+ * \param data unused
+ */
+static void run_ecs_tasks(struct job * job, void * data) {
+  (void)data;
+  for(size_t i = 0; i < task_len; i += task_batch) {
+    struct job * child = create_job(run_ecs_task, tasks + i, job);
+    if(child != NULL) {
+      run_job(child);
+    } else {
+      // without a job the batch still gets processed, here
+      clear_status();
+      run_ecs_task(job, tasks + i);
+    }
+  }
+}
+
+/*
+ * Command buffer functions
+ */
+
+/**
+ * Reserves room for a command in a command buffer
+ * \param commands the command buffer
+ * \param type the kind of command
+ * \param entity the entity
+ * \param component the component
+ * \param value_size the size of the values following the command
+ * \return the command or NULL on failure
+ */
+static struct ecs_command * reserve_ecs_command(struct ecs_commands * commands, enum ecs_command_type type, ecs_entity entity, ecs_component component, size_t value_size) {
+  size_t size = align_ecs_size(sizeof(struct ecs_command), ECS_COMMAND_ALIGNMENT) + value_size;
+  if(commands->cap - commands->len < size) {
+    size_t new_cap = commands->cap == 0 ? 1024 : commands->cap * 2;
+    while(new_cap - commands->len < size) {
+      new_cap *= 2;
+    }
+    char * buf = (char *)realloc(commands->data, new_cap);
+    if(buf == NULL) {
+      SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+      return NULL;
+    }
+    commands->data = buf;
+    commands->cap = new_cap;
+  }
+  struct ecs_command * command = (struct ecs_command *)(commands->data + commands->len);
+  command->size = size;
+  command->components = 0;
+  command->entity = entity;
+  command->component = component;
+  command->type = type;
+  commands->len += size;
+  return command;
+}
+
+/**
+ * Returns the values following a command
+ * \param command the command
+ * \return the values
+ */
+static char * get_ecs_command_values(struct ecs_command * command) {
+  return (char *)command + align_ecs_size(sizeof(struct ecs_command), ECS_COMMAND_ALIGNMENT);
+}
+
+/**
+ * Applies a command
+ * \param command the command
+ * \return 0 on success, -1 on failure
+ */
+static int apply_ecs_command(struct ecs_command * command) {
+  char * values = get_ecs_command_values(command);
+  switch(command->type) {
+  case ECS_COMMAND_CREATE: {
+    ecs_entity entity = create_ecs_entity(command->components);
+    if(entity == ECS_NULL_ENTITY) {
+      return -1;
+    }
+    for(size_t i = 0; i < component_len; ++i) {
+      if((command->components & ECS_MASK(i)) != 0) {
+	memcpy(get_ecs_component(entity, (ecs_component)i), values, component_sizes[i]);
+	values += align_ecs_size(component_sizes[i], ECS_COMMAND_ALIGNMENT);
+      }
+    }
+    return 0;
+  }
+  case ECS_COMMAND_DESTROY:
+    destroy_ecs_entity(command->entity);
+    return 0;
+  case ECS_COMMAND_ADD: {
+    if(!is_ecs_entity_alive(command->entity)) {
+      return 0;
+    }
+    void * component = get_ecs_component(command->entity, command->component);
+    if(component != NULL) {
+      memcpy(component, values, component_sizes[command->component]);
+      return 0;
+    }
+    return add_ecs_component(command->entity, command->component, values);
+  }
+  case ECS_COMMAND_REMOVE:
+    if(get_ecs_component(command->entity, command->component) != NULL) {
+      return remove_ecs_component(command->entity, command->component);
+    }
+    return 0;
+  }
+  return -1;
+}
+
+/*
+ * Public API implementation
+ */
+
+int init_ecs() {
+  component_len = 0;
+  archetypes = NULL;
+  archetype_len = 0;
+  archetype_cap = 0;
+  records = NULL;
+  record_len = 0;
+  record_cap = 0;
+  free_record = ECS_NO_INDEX;
+  entity_count = 0;
+  running_systems = 0;
+  tasks = NULL;
+  task_len = 0;
+  task_cap = 0;
+  // every entity lives in an archetype, even one without components
+  return get_ecs_archetype(0) == 0 ? 0 : -1;
+}
+
+int register_ecs_component(size_t size, size_t alignment) {
+  if(component_len == ECS_MAX_COMPONENTS || alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > ECS_COLUMN_ALIGNMENT) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  // an entity with just this component needs a row in a chunk, with its entity and both arrays padded
+  if(size > ECS_CHUNK_SIZE || align_ecs_size(size, alignment) + 2 * ECS_COLUMN_ALIGNMENT + sizeof(ecs_entity) > ECS_CHUNK_SIZE) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  // arrays of components keep each element aligned when sizes are multiples of the alignment
+  component_sizes[component_len] = align_ecs_size(size, alignment);
+  return (int)component_len++;
+}
+
+ecs_entity create_ecs_entity(uint64_t components) {
+  assert(running_systems == 0);
+
+  if(component_len < ECS_MAX_COMPONENTS && (components >> component_len) != 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return ECS_NULL_ENTITY;
+  }
+  long archetype_index = get_ecs_archetype(components);
+  if(archetype_index < 0) {
+    return ECS_NULL_ENTITY;
+  }
+
+  uint32_t index = free_record;
+  if(index == ECS_NO_INDEX) {
+    if(record_len == ECS_MAX_ENTITIES) {
+      SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+      return ECS_NULL_ENTITY;
+    }
+    if(record_len == record_cap) {
+      size_t new_cap = record_cap == 0 ? 1024 : record_cap * 2;
+      struct ecs_record * buf = (struct ecs_record *)realloc(records, new_cap * sizeof(struct ecs_record));
+      if(buf == NULL) {
+	SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+	return ECS_NULL_ENTITY;
+      }
+      records = buf;
+      record_cap = new_cap;
+    }
+    index = (uint32_t)record_len;
+    records[index].archetype = ECS_NO_INDEX;
+    records[index].row = ECS_NO_INDEX;
+    records[index].generation = 1;
+    ++record_len;
+  }
+
+  struct ecs_record * record = records + index;
+  struct ecs_archetype * archetype = archetypes + archetype_index;
+  ecs_entity entity = record->generation << ECS_ENTITY_INDEX_BITS | index;
+  uint32_t chunk;
+  uint32_t row;
+  if(add_ecs_row(archetype, entity, &chunk, &row) != 0) {
+    // a new record goes to the free list, so it is not lost
+    if(index != free_record) {
+      record->row = free_record;
+      free_record = index;
+    }
+    return ECS_NULL_ENTITY;
+  }
+  char * data = archetype->chunks[chunk].data;
+  for(size_t i = 0; i < component_len; ++i) {
+    if((components & ECS_MASK(i)) != 0) {
+      memset(data + archetype->offsets[i] + row * component_sizes[i], 0, component_sizes[i]);
+    }
+  }
+  if(index == free_record) {
+    free_record = record->row;
+  }
+  record->archetype = (uint32_t)archetype_index;
+  record->chunk = chunk;
+  record->row = row;
+  ++entity_count;
+  return entity;
+}
+
+int destroy_ecs_entity(ecs_entity entity) {
+  assert(running_systems == 0);
+
+  struct ecs_record * record = get_ecs_record(entity);
+  if(record == NULL) {
+    return -1;
+  }
+  remove_ecs_row(archetypes + record->archetype, record->chunk, record->row);
+  // generation 0 is skipped, so no handle equals ECS_NULL_ENTITY
+  record->generation = (record->generation + 1) & ECS_GENERATION_MASK;
+  if(record->generation == 0) {
+    record->generation = 1;
+  }
+  record->archetype = ECS_NO_INDEX;
+  record->row = free_record;
+  free_record = (uint32_t)(record - records);
+  --entity_count;
+  return 0;
+}
+
+bool is_ecs_entity_alive(ecs_entity entity) {
+  return get_ecs_record(entity) != NULL;
+}
+
+size_t get_ecs_entity_count() {
+  return entity_count;
+}
+
+void * get_ecs_component(ecs_entity entity, ecs_component component) {
+  assert(component < component_len);
+
+  struct ecs_record * record = get_ecs_record(entity);
+  if(record == NULL) {
+    return NULL;
+  }
+  struct ecs_archetype * archetype = archetypes + record->archetype;
+  if((archetype->components & ECS_MASK(component)) == 0) {
+    return NULL;
+  }
+  return archetype->chunks[record->chunk].data + archetype->offsets[component] + record->row * component_sizes[component];
+}
+
+int add_ecs_component(ecs_entity entity, ecs_component component, const void * value) {
+  assert(running_systems == 0);
+  assert(component < component_len);
+
+  struct ecs_record * record = get_ecs_record(entity);
+  if(record == NULL || (archetypes[record->archetype].components & ECS_MASK(component)) != 0) {
+    return -1;
+  }
+  if(move_ecs_entity(entity, record, archetypes[record->archetype].components | ECS_MASK(component)) != 0) {
+    return -1;
+  }
+  if(value != NULL) {
+    memcpy(get_ecs_component(entity, component), value, component_sizes[component]);
+  }
+  return 0;
+}
+
+int remove_ecs_component(ecs_entity entity, ecs_component component) {
+  assert(running_systems == 0);
+  assert(component < component_len);
+
+  struct ecs_record * record = get_ecs_record(entity);
+  if(record == NULL || (archetypes[record->archetype].components & ECS_MASK(component)) == 0) {
+    return -1;
+  }
+  return move_ecs_entity(entity, record, archetypes[record->archetype].components & ~ECS_MASK(component));
+}
+
+void run_ecs_system(const struct ecs_query * query, ecs_system system, void * data) {
+  assert(query != NULL);
+  assert(system != NULL);
+
+  ++running_systems;
+  struct ecs_view view;
+  for(size_t i = 0; i < archetype_len; ++i) {
+    if(!is_ecs_query_match(archetypes + i, query)) {
+      continue;
+    }
+    for(size_t j = 0; j < archetypes[i].chunk_len; ++j) {
+      get_ecs_view(archetypes + i, archetypes[i].chunks + j, &view);
+      system(&view, data);
+    }
+  }
+  --running_systems;
+}
+
+int run_ecs_system_jobs(const struct ecs_query * query, ecs_system system, void * data) {
+  assert(query != NULL);
+  assert(system != NULL);
+
+  // without a job system there are no workers to share the chunks among
+  if(get_job_worker_index() < 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+
+  size_t chunk_count = 0;
+  for(size_t i = 0; i < archetype_len; ++i) {
+    if(is_ecs_query_match(archetypes + i, query)) {
+      chunk_count += archetypes[i].chunk_len;
+    }
+  }
+  if(chunk_count > task_cap) {
+    struct ecs_task * buf = (struct ecs_task *)realloc(tasks, chunk_count * sizeof(struct ecs_task));
+    if(buf == NULL) {
+      SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+      return -1;
+    }
+    tasks = buf;
+    task_cap = chunk_count;
+  }
+  task_len = 0;
+  for(size_t i = 0; i < archetype_len; ++i) {
+    if(!is_ecs_query_match(archetypes + i, query)) {
+      continue;
+    }
+    for(size_t j = 0; j < archetypes[i].chunk_len; ++j) {
+      struct ecs_task * task = tasks + task_len++;
+      task->system = system;
+      task->data = data;
+      get_ecs_view(archetypes + i, archetypes[i].chunks + j, &task->view);
+    }
+  }
+
+  size_t job_count = get_job_worker_count() * ECS_JOBS_PER_WORKER;
+  task_batch = (task_len + job_count - 1) / job_count;
+  if(task_batch == 0) {
+    task_batch = 1;
+  }
+
+  struct job * root = create_job(run_ecs_tasks, NULL, NULL);
+  if(root == NULL) {
+    return -1;
+  }
+  ++running_systems;
+  run_job(root);
+  int result = wait_for_job(root);
+  --running_systems;
+  return result;
+}
+
+void init_ecs_commands(struct ecs_commands * commands) {
+  assert(commands != NULL);
+  commands->data = NULL;
+  commands->len = 0;
+  commands->cap = 0;
+}
+
+int defer_create_ecs_entity(struct ecs_commands * commands, uint64_t components, const void * const * values) {
+  assert(commands != NULL);
+
+  if(component_len < ECS_MAX_COMPONENTS && (components >> component_len) != 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  size_t value_size = 0;
+  for(size_t i = 0; i < component_len; ++i) {
+    if((components & ECS_MASK(i)) != 0) {
+      value_size += align_ecs_size(component_sizes[i], ECS_COMMAND_ALIGNMENT);
+    }
+  }
+  struct ecs_command * command = reserve_ecs_command(commands, ECS_COMMAND_CREATE, ECS_NULL_ENTITY, 0, value_size);
+  if(command == NULL) {
+    return -1;
+  }
+  command->components = components;
+  char * target = get_ecs_command_values(command);
+  size_t value = 0;
+  for(size_t i = 0; i < component_len; ++i) {
+    if((components & ECS_MASK(i)) == 0) {
+      continue;
+    }
+    if(values != NULL && values[value] != NULL) {
+      memcpy(target, values[value], component_sizes[i]);
+    } else {
+      memset(target, 0, component_sizes[i]);
+    }
+    target += align_ecs_size(component_sizes[i], ECS_COMMAND_ALIGNMENT);
+    ++value;
+  }
+  return 0;
+}
+
+int defer_destroy_ecs_entity(struct ecs_commands * commands, ecs_entity entity) {
+  assert(commands != NULL);
+  return reserve_ecs_command(commands, ECS_COMMAND_DESTROY, entity, 0, 0) != NULL ? 0 : -1;
+}
+
+int defer_add_ecs_component(struct ecs_commands * commands, ecs_entity entity, ecs_component component, const void * value) {
+  assert(commands != NULL);
+  assert(component < component_len);
+
+  struct ecs_command * command = reserve_ecs_command(commands, ECS_COMMAND_ADD, entity, component, align_ecs_size(component_sizes[component], ECS_COMMAND_ALIGNMENT));
+  if(command == NULL) {
+    return -1;
+  }
+  if(value != NULL) {
+    memcpy(get_ecs_command_values(command), value, component_sizes[component]);
+  } else {
+    memset(get_ecs_command_values(command), 0, component_sizes[component]);
+  }
+  return 0;
+}
+
+int defer_remove_ecs_component(struct ecs_commands * commands, ecs_entity entity, ecs_component component) {
+  assert(commands != NULL);
+  assert(component < component_len);
+  return reserve_ecs_command(commands, ECS_COMMAND_REMOVE, entity, component, 0) != NULL ? 0 : -1;
+}
+
+int apply_ecs_commands(struct ecs_commands * commands) {
+  assert(commands != NULL);
+  assert(running_systems == 0);
+
+  int result = 0;
+  size_t offset = 0;
+  while(offset < commands->len) {
+    struct ecs_command * command = (struct ecs_command *)(commands->data + offset);
+    if(apply_ecs_command(command) != 0) {
+      result = -1;
+    }
+    offset += command->size;
+  }
+  commands->len = 0;
+  return result;
+}
+
+void dispose_ecs_commands(struct ecs_commands * commands) {
+  assert(commands != NULL);
+  free(commands->data);
+  init_ecs_commands(commands);
+}
+
+void dispose_ecs() {
+  assert(running_systems == 0);
+
+  for(size_t i = 0; i < archetype_len; ++i) {
+    for(size_t j = 0; j < archetypes[i].chunk_len; ++j) {
+      free(archetypes[i].chunks[j].data);
+    }
+    free(archetypes[i].chunks);
+  }
+  free(archetypes);
+  archetypes = NULL;
+  archetype_len = 0;
+  archetype_cap = 0;
+  free(records);
+  records = NULL;
+  record_len = 0;
+  record_cap = 0;
+  free_record = ECS_NO_INDEX;
+  entity_count = 0;
+  free(tasks);
+  tasks = NULL;
+  task_len = 0;
+  task_cap = 0;
+  component_len = 0;
+}
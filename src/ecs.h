@@ -0,0 +1,309 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Entity component system storing components as arrays per archetype, the set of components
+ * entities have, in fixed size chunks
+ */
+
+#ifndef ECS_H
+#define ECS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The maximum number of component types
+ */
+#define ECS_MAX_COMPONENTS 64
+
+/**
+ * The size of a chunk of entities of an archetype, holding an array of each component
+ */
+#define ECS_CHUNK_SIZE 16384
+
+/**
+ * The number of bits of an entity handle holding the index of the entity, the others hold its
+ * generation
+ */
+#define ECS_ENTITY_INDEX_BITS 20
+
+/**
+ * The maximum number of entities alive at once
+ */
+#define ECS_MAX_ENTITIES (1U << ECS_ENTITY_INDEX_BITS)
+
+/**
+ * No entity, never returned for a live entity
+ */
+#define ECS_NULL_ENTITY 0
+
+/**
+ * Returns the mask of a component, masks of components are or'ed to describe a set of them
+ */
+#define ECS_MASK(component) ((uint64_t)1 << (component))
+
+/**
+ * A handle of an entity, its index and a generation that changes when the index is reused, so
+ * handles of destroyed entities are told apart from those of the entities reusing their index
+ */
+typedef uint32_t ecs_entity;
+
+/**
+ * A component type, as registered
+ */
+typedef unsigned int ecs_component;
+
+/**
+ * A chunk of entities handed to a system, with one array per component
+ */
+struct ecs_view {
+
+  /**
+   * The entities
+   */
+  const ecs_entity * entities;
+
+  /**
+   * The number of entities
+   */
+  size_t count;
+
+  /**
+   * The start of the chunk
+   */
+  char * data;
+
+  /**
+   * The offset of the array of each component in the chunk, unused for components the chunk
+   * does not have
+   */
+  const size_t * offsets;
+
+  /**
+   * The components of the entities
+   */
+  uint64_t components;
+};
+
+/**
+ * The entities a system runs on
+ */
+struct ecs_query {
+
+  /**
+   * The components the entities must all have
+   */
+  uint64_t all;
+
+  /**
+   * The components the entities must not have
+   */
+  uint64_t none;
+};
+
+/**
+ * The function of a system, run on a chunk of entities
+ * It may change components but not add or remove entities and components, which it records in
+ * a command buffer instead
+ * \param view the entities
+ * \param data the data the system was run with
+ */
+typedef void (*ecs_system)(const struct ecs_view * view, void * data);
+
+/**
+ * Structural changes recorded to be applied later, e.g. by a system running in parallel
+ * One command buffer must only be used by one thread at a time
+ */
+struct ecs_commands {
+
+  /**
+   * The commands
+   */
+  char * data;
+
+  /**
+   * The size of the commands
+   */
+  size_t len;
+
+  /**
+   * The capacity of the buffer
+   */
+  size_t cap;
+};
+
+/**
+ * Initializes the entity component system, without components and entities
+ * \return 0 on success, -1 on failure
+ */
+int init_ecs();
+
+/**
+ * Registers a component type
+ * \param size the size of the component, small enough for a row of it to fit in a chunk
+ * \param alignment the alignment of the component, a power of two of at most 64
+ * \return the component or -1 if there are ECS_MAX_COMPONENTS already or the component is invalid
+ */
+int register_ecs_component(size_t size, size_t alignment);
+
+/**
+ * Creates an entity with components, filled with zero bytes
+ * \param components the mask of the components
+ * \return the entity or ECS_NULL_ENTITY on failure
+ */
+ecs_entity create_ecs_entity(uint64_t components);
+
+/**
+ * Destroys an entity
+ * \param entity the entity
+ * \return 0 on success, -1 if the entity is not alive
+ */
+int destroy_ecs_entity(ecs_entity entity);
+
+/**
+ * Tells whether an entity is alive
+ * \param entity the entity
+ * \return true if the entity was created and not yet destroyed
+ */
+bool is_ecs_entity_alive(ecs_entity entity);
+
+/**
+ * Returns the number of live entities
+ * \return the number of entities
+ */
+size_t get_ecs_entity_count();
+
+/**
+ * Returns a component of an entity, valid until the next structural change
+ * \param entity the entity
+ * \param component the component
+ * \return the component or NULL if the entity is not alive or does not have it
+ */
+void * get_ecs_component(ecs_entity entity, ecs_component component);
+
+/**
+ * Adds a component to an entity, moving it to another archetype
+ * \param entity the entity
+ * \param component the component
+ * \param value the value of the component or NULL for zero bytes
+ * \return 0 on success, -1 if the entity is not alive, already has the component or on failure
+ */
+int add_ecs_component(ecs_entity entity, ecs_component component, const void * value);
+
+/**
+ * Removes a component from an entity, moving it to another archetype
+ * \param entity the entity
+ * \param component the component
+ * \return 0 on success, -1 if the entity is not alive, does not have the component or on failure
+ */
+int remove_ecs_component(ecs_entity entity, ecs_component component);
+
+/**
+ * Returns the array of a component in a view
+ * \param view the view
+ * \param component the component, one the view has
+ * \return the array, with one component per entity of the view
+ */
+static inline void * get_ecs_column(const struct ecs_view * view, ecs_component component) {
+  return view->data + view->offsets[component];
+}
+
+/**
+ * Runs a system on all chunks holding entities that match a query, on this thread
+ * \param query the query
+ * \param system the system
+ * \param data the data passed to the system
+ */
+void run_ecs_system(const struct ecs_query * query, ecs_system system, void * data);
+
+/**
+ * Runs a system on all chunks holding entities that match a query, with jobs running batches
+ * of chunks
+ * The calling thread must be a worker of the job system, see job.h, and runs jobs until the
+ * system ran on every chunk
+ * \param query the query
+ * \param system the system
+ * \param data the data passed to the system
+ * \return 0 on success, -1 if the calling thread is no worker or a job set its status, which
+ * becomes the status of this thread
+ */
+int run_ecs_system_jobs(const struct ecs_query * query, ecs_system system, void * data);
+
+/**
+ * Initializes an empty command buffer
+ * \param commands the command buffer
+ */
+void init_ecs_commands(struct ecs_commands * commands);
+
+/**
+ * Records the creation of an entity
+ * \param commands the command buffer
+ * \param components the mask of the components
+ * \param values the value of each component in the order of their masks, or NULL for all zero
+ *               bytes, a value may be NULL for zero bytes
+ * \return 0 on success, -1 on failure
+ */
+int defer_create_ecs_entity(struct ecs_commands * commands, uint64_t components, const void * const * values);
+
+/**
+ * Records the destruction of an entity
+ * \param commands the command buffer
+ * \param entity the entity
+ * \return 0 on success, -1 on failure
+ */
+int defer_destroy_ecs_entity(struct ecs_commands * commands, ecs_entity entity);
+
+/**
+ * Records adding a component to an entity, or setting it if the entity has it by then
+ * \param commands the command buffer
+ * \param entity the entity
+ * \param component the component
+ * \param value the value of the component or NULL for zero bytes
+ * \return 0 on success, -1 on failure
+ */
+int defer_add_ecs_component(struct ecs_commands * commands, ecs_entity entity, ecs_component component, const void * value);
+
+/**
+ * Records removing a component from an entity, nothing happens if it does not have it by then
+ * \param commands the command buffer
+ * \param entity the entity
+ * \param component the component
+ * \return 0 on success, -1 on failure
+ */
+int defer_remove_ecs_component(struct ecs_commands * commands, ecs_entity entity, ecs_component component);
+
+/**
+ * Applies the recorded commands in order and empties the buffer
+ * Commands for entities that are no longer alive are skipped
+ * \param commands the command buffer
+ * \return 0 if all commands applied, -1 if one failed
+ */
+int apply_ecs_commands(struct ecs_commands * commands);
+
+/**
+ * Frees a command buffer
+ * \param commands the command buffer
+ */
+void dispose_ecs_commands(struct ecs_commands * commands);
+
+/**
+ * Destroys all entities and frees the entity component system
+ */
+void dispose_ecs();
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Iteration throughput benchmark for the entity component system, moving entities by their
+ * velocity, compared to an array of structures holding every component of an entity
+ * Usage: ecs_bench [-n entities] [-c cold bytes per entity] [-p passes] [-t workers, 0 for one
+ *                  per core]
+ * Prints one line of key=value pairs per layout, to be compared across builds
+ */
+
+#include "ecs.h"
+#include "job.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#define DEFAULT_ENTITIES 1000000
+#define DEFAULT_COLD_SIZE 64
+#define DEFAULT_PASSES 20
+
+/**
+ * The largest number of cold bytes, data the update does not touch
+ */
+#define MAX_COLD_SIZE 1024
+
+/**
+ * The time step of a pass
+ */
+#define STEP (1.0f / 120.0f)
+
+/**
+ * A vector component, for positions and velocities
+ */
+struct vector {
+  float x;
+  float y;
+  float z;
+};
+
+/**
+ * An entity as an array of structures stores it, all of its components together
+ */
+struct aos_entity {
+  struct vector position;
+  struct vector velocity;
+  unsigned char cold[];
+};
+
+/**
+ * The benchmark settings
+ */
+struct settings {
+
+  /**
+   * The number of entities
+   */
+  size_t entities;
+
+  /**
+   * The number of bytes of other components of each entity
+   */
+  size_t cold_size;
+
+  /**
+   * The number of passes over all entities
+   */
+  size_t passes;
+
+  /**
+   * The number of workers of the parallel pass, 0 for one per core
+   */
+  size_t workers;
+};
+
+static struct settings settings;
+
+/**
+ * The component types
+ */
+static int position_component;
+static int velocity_component;
+static int cold_component;
+
+/**
+ * Returns the current monotonic time in nanoseconds
+ * \return the time
+ */
+static unsigned long long get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Returns the initial velocity of an entity
+ * \param index the index of the entity
+ * \param velocity receives the velocity
+ */
+static void get_velocity(size_t index, struct vector * velocity) {
+  velocity->x = (float)(index % 7) - 3.0f;
+  velocity->y = (float)(index % 5) - 2.0f;
+  velocity->z = (float)(index % 3) - 1.0f;
+}
+
+/**
+ * System moving a chunk of entities by their velocity
+ * \param view the entities
+ * \param data unused
+ */
+static void move_entities(const struct ecs_view * view, void * data) {
+  (void)data;
+  struct vector * restrict positions = (struct vector *)get_ecs_column(view, (ecs_component)position_component);
+  const struct vector * restrict velocities = (const struct vector *)get_ecs_column(view, (ecs_component)velocity_component);
+  for(size_t i = 0; i < view->count; ++i) {
+    positions[i].x += velocities[i].x * STEP;
+    positions[i].y += velocities[i].y * STEP;
+    positions[i].z += velocities[i].z * STEP;
+  }
+}
+
+/**
+ * System summing the positions of a chunk of entities
+ * \param view the entities
+ * \param data the sum cast as a void *
+ */
+static void sum_positions(const struct ecs_view * view, void * data) {
+  double * sum = (double *)data;
+  const struct vector * positions = (const struct vector *)get_ecs_column(view, (ecs_component)position_component);
+  for(size_t i = 0; i < view->count; ++i) {
+    *sum += positions[i].x + positions[i].y + positions[i].z;
+  }
+}
+
+/**
+ * Prints the result of a layout
+ * \param layout the name of the layout
+ * \param workers the number of threads that ran the passes
+ * \param time the time of all passes in nanoseconds
+ * \param sum the sum of all positions after the passes
+ */
+static void print_result(const char * layout, size_t workers, unsigned long long time, double sum) {
+  double updates = (double)(settings.entities * settings.passes);
+  double seconds = (double)time * 1e-9;
+  printf("layout=%s entities=%zu cold_size=%zu passes=%zu workers=%zu seconds=%.6f ns_per_entity=%.3f entities_per_second=%.0f checksum=%.6e\n",
+	 layout, settings.entities, settings.cold_size, settings.passes, workers, seconds, (double)time / updates, updates / seconds, sum);
+}
+
+/**
+ * Runs the passes over an array of structures
+ * \return 0 on success, -1 on failure
+ */
+static int run_aos() {
+  size_t stride = sizeof(struct aos_entity) + settings.cold_size;
+  stride = (stride + _Alignof(struct aos_entity) - 1) / _Alignof(struct aos_entity) * _Alignof(struct aos_entity);
+  char * entities = (char *)calloc(settings.entities, stride);
+  if(entities == NULL) {
+    return -1;
+  }
+  for(size_t i = 0; i < settings.entities; ++i) {
+    get_velocity(i, &((struct aos_entity *)(entities + i * stride))->velocity);
+  }
+
+  unsigned long long start = get_time();
+  for(size_t pass = 0; pass < settings.passes; ++pass) {
+    for(size_t i = 0; i < settings.entities; ++i) {
+      struct aos_entity * entity = (struct aos_entity *)(entities + i * stride);
+      entity->position.x += entity->velocity.x * STEP;
+      entity->position.y += entity->velocity.y * STEP;
+      entity->position.z += entity->velocity.z * STEP;
+    }
+  }
+  unsigned long long time = get_time() - start;
+
+  double sum = 0.0;
+  for(size_t i = 0; i < settings.entities; ++i) {
+    struct aos_entity * entity = (struct aos_entity *)(entities + i * stride);
+    sum += entity->position.x + entity->position.y + entity->position.z;
+  }
+  print_result("aos", 1, time, sum);
+  free(entities);
+  return 0;
+}
+
+/**
+ * Runs the passes over the entity component system, on this thread and with a job per chunk
+ * \return 0 on success, -1 on failure
+ */
+static int run_ecs() {
+  if(init_ecs() != 0) {
+    return -1;
+  }
+  position_component = register_ecs_component(sizeof(struct vector), _Alignof(struct vector));
+  velocity_component = register_ecs_component(sizeof(struct vector), _Alignof(struct vector));
+  cold_component = register_ecs_component(settings.cold_size, 1);
+  uint64_t components = ECS_MASK(position_component) | ECS_MASK(velocity_component) | ECS_MASK(cold_component);
+  int result = 0;
+  for(size_t i = 0; result == 0 && i < settings.entities; ++i) {
+    ecs_entity entity = create_ecs_entity(components);
+    if(entity == ECS_NULL_ENTITY) {
+      result = -1;
+    } else {
+      get_velocity(i, (struct vector *)get_ecs_component(entity, (ecs_component)velocity_component));
+    }
+  }
+
+  struct ecs_query move_query = { ECS_MASK(position_component) | ECS_MASK(velocity_component), 0 };
+  struct ecs_query sum_query = { ECS_MASK(position_component), 0 };
+  if(result == 0) {
+    unsigned long long start = get_time();
+    for(size_t pass = 0; pass < settings.passes; ++pass) {
+      run_ecs_system(&move_query, move_entities, NULL);
+    }
+    unsigned long long time = get_time() - start;
+    double sum = 0.0;
+    run_ecs_system(&sum_query, sum_positions, &sum);
+    print_result("ecs", 1, time, sum);
+  }
+
+  struct job_options options;
+  init_job_options(&options);
+  options.worker_count = settings.workers;
+  if(result == 0 && init_jobs_with_options(&options) == 0) {
+    // the positions start over, so the checksum matches the other layouts
+    struct vector zero = { 0.0f, 0.0f, 0.0f };
+    for(size_t i = 0; i < settings.entities; ++i) {
+      ecs_entity entity = (ecs_entity)(1U << ECS_ENTITY_INDEX_BITS | i);
+      *(struct vector *)get_ecs_component(entity, (ecs_component)position_component) = zero;
+    }
+    unsigned long long start = get_time();
+    for(size_t pass = 0; result == 0 && pass < settings.passes; ++pass) {
+      result = run_ecs_system_jobs(&move_query, move_entities, NULL);
+    }
+    unsigned long long time = get_time() - start;
+    double sum = 0.0;
+    run_ecs_system(&sum_query, sum_positions, &sum);
+    if(result == 0) {
+      print_result("ecs_jobs", get_job_worker_count(), time, sum);
+    }
+    dispose_jobs();
+  } else {
+    result = -1;
+  }
+  dispose_ecs();
+  return result;
+}
+
+/**
+ * Parses the command line into the settings
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return 0 on success, -1 on invalid arguments
+ */
+static int parse_settings(int arg_count, char * args[]) {
+  settings.entities = DEFAULT_ENTITIES;
+  settings.cold_size = DEFAULT_COLD_SIZE;
+  settings.passes = DEFAULT_PASSES;
+  settings.workers = 0;
+
+  int option;
+  while((option = getopt(arg_count, args, "n:c:p:t:")) != -1) {
+    switch(option) {
+    case 'n':
+      settings.entities = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      settings.cold_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      settings.passes = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      settings.workers = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      return -1;
+    }
+  }
+  if(optind != arg_count || settings.entities == 0 || settings.entities > ECS_MAX_ENTITIES
+     || settings.cold_size > MAX_COLD_SIZE || settings.passes == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if the benchmark ran, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, char * args[]) {
+  if(parse_settings(arg_count, args) != 0) {
+    fputs("usage: ecs_bench [-n entities] [-c cold bytes per entity] [-p passes] [-t workers, 0 for one\n"
+	  "                 per core]\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  if(run_aos() != 0 || run_ecs() != 0) {
+    fputs("benchmark failed\n", stderr);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
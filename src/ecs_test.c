@@ -0,0 +1,382 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Tests the entity component system: components, entity handles, structural changes, deferred
+ * commands and systems run by jobs
+ */
+
+#include "ecs.h"
+#include "job.h"
+#include "status.h"
+#include "test.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+/**
+ * The number of entities of the tests spanning many chunks
+ */
+#define ENTITY_COUNT 20000
+
+/**
+ * The number of workers running systems
+ */
+#define WORKER_COUNT 4
+
+/**
+ * The entities of the structure test
+ */
+static ecs_entity entities[ENTITY_COUNT];
+
+/**
+ * The counter component
+ */
+static ecs_component counter_component;
+
+/**
+ * The large component, holding a few values
+ */
+static ecs_component block_component;
+
+/**
+ * The tag component, without data
+ */
+static ecs_component tag_component;
+
+/**
+ * A component of a few values, filling several cache lines
+ */
+struct block {
+  long long values[20];
+};
+
+/**
+ * What the counting system saw
+ */
+struct count {
+
+  /**
+   * The number of entities
+   */
+  atomic_size_t entities;
+
+  /**
+   * The number of chunks
+   */
+  atomic_size_t chunks;
+
+  /**
+   * Entities with components the query excludes or lacking components it requires
+   */
+  atomic_size_t mismatches;
+};
+
+/**
+ * Returns the counter of an entity
+ * \param entity the entity
+ * \return the counter or -1 if the entity does not have one
+ */
+static int get_counter(ecs_entity entity) {
+  const int * counter = (const int *)get_ecs_component(entity, counter_component);
+  return counter != NULL ? *counter : -1;
+}
+
+/**
+ * Checks registering components, rejecting those that do not fit in a chunk
+ */
+static void test_components() {
+  CHECK(register_ecs_component(4, 3) == -1);
+  CHECK(register_ecs_component(4, 128) == -1);
+  CHECK(register_ecs_component(20000, 8) == -1);
+  CHECK(register_ecs_component((size_t)-1, 1) == -1);
+  // the largest component leaves room for both padded arrays and the entity
+  size_t largest = ECS_CHUNK_SIZE - 2 * 64 - sizeof(ecs_entity);
+  CHECK(register_ecs_component(largest + 1, 1) == -1);
+  int huge = register_ecs_component(largest, 4);
+  CHECK(huge >= 0);
+
+  counter_component = (ecs_component)register_ecs_component(sizeof(int), _Alignof(int));
+  block_component = (ecs_component)register_ecs_component(sizeof(struct block), _Alignof(struct block));
+  tag_component = (ecs_component)register_ecs_component(0, 1);
+  CHECK(counter_component != block_component && block_component != tag_component);
+
+  if(huge >= 0) {
+    ecs_entity entity = create_ecs_entity(ECS_MASK(huge));
+    CHECK(entity != ECS_NULL_ENTITY);
+    CHECK(get_ecs_component(entity, (ecs_component)huge) != NULL);
+    CHECK(destroy_ecs_entity(entity) == 0);
+  }
+  clear_status();
+}
+
+/**
+ * Checks handles of destroyed entities stay dead when their index is reused
+ */
+static void test_generations() {
+  size_t count = get_ecs_entity_count();
+  CHECK(!is_ecs_entity_alive(ECS_NULL_ENTITY));
+  ecs_entity first = create_ecs_entity(ECS_MASK(counter_component));
+  CHECK(first != ECS_NULL_ENTITY && is_ecs_entity_alive(first));
+  CHECK(get_counter(first) == 0);
+  CHECK(get_ecs_entity_count() == count + 1);
+  CHECK(destroy_ecs_entity(first) == 0);
+  CHECK(!is_ecs_entity_alive(first));
+  CHECK(destroy_ecs_entity(first) == -1);
+  CHECK(get_ecs_component(first, counter_component) == NULL);
+
+  // the index gets reused with another generation, many times over
+  ecs_entity previous = first;
+  for(int i = 0; i < 1000; ++i) {
+    ecs_entity next = create_ecs_entity(ECS_MASK(counter_component));
+    CHECK(next != ECS_NULL_ENTITY && next != previous && next != first);
+    CHECK(is_ecs_entity_alive(next) && !is_ecs_entity_alive(previous) && !is_ecs_entity_alive(first));
+    CHECK(add_ecs_component(previous, tag_component, NULL) == -1);
+    CHECK(remove_ecs_component(previous, counter_component) == -1);
+    CHECK(destroy_ecs_entity(next) == 0);
+    previous = next;
+  }
+  CHECK(get_ecs_entity_count() == count);
+  clear_status();
+}
+
+/**
+ * Checks adding and removing components keeps the values of the others, also of the entities
+ * moved to fill the rows left behind
+ */
+static void test_structure() {
+  for(int i = 0; i < ENTITY_COUNT; ++i) {
+    entities[i] = create_ecs_entity(ECS_MASK(counter_component));
+    CHECK(entities[i] != ECS_NULL_ENTITY);
+    *(int *)get_ecs_component(entities[i], counter_component) = i;
+  }
+
+  struct block block;
+  for(int i = 0; i < ENTITY_COUNT; i += 3) {
+    for(size_t j = 0; j < sizeof(block.values) / sizeof(block.values[0]); ++j) {
+      block.values[j] = (long long)i * 100 + (long long)j;
+    }
+    CHECK(add_ecs_component(entities[i], block_component, &block) == 0);
+  }
+  CHECK(add_ecs_component(entities[0], block_component, NULL) == -1);
+  for(int i = 0; i < ENTITY_COUNT; i += 2) {
+    CHECK(add_ecs_component(entities[i], tag_component, NULL) == 0);
+  }
+  for(int i = 0; i < ENTITY_COUNT; i += 6) {
+    CHECK(remove_ecs_component(entities[i], counter_component) == 0);
+  }
+  CHECK(remove_ecs_component(entities[0], counter_component) == -1);
+  for(int i = 5; i < ENTITY_COUNT; i += 10) {
+    CHECK(destroy_ecs_entity(entities[i]) == 0);
+  }
+
+  for(int i = 0; i < ENTITY_COUNT; ++i) {
+    if(i % 10 == 5) {
+      CHECK(!is_ecs_entity_alive(entities[i]));
+      continue;
+    }
+    CHECK(get_counter(entities[i]) == (i % 6 == 0 ? -1 : i));
+    CHECK((get_ecs_component(entities[i], tag_component) != NULL) == (i % 2 == 0));
+    const struct block * value = (const struct block *)get_ecs_component(entities[i], block_component);
+    CHECK((value != NULL) == (i % 3 == 0));
+    if(value != NULL) {
+      CHECK(value->values[0] == (long long)i * 100 && value->values[19] == (long long)i * 100 + 19);
+    }
+  }
+  clear_status();
+}
+
+/**
+ * System counting its entities and checking they match the query
+ * \param view the entities
+ * \param data the count
+ */
+static void count_entities(const struct ecs_view * view, void * data) {
+  struct count * count = (struct count *)data;
+  atomic_fetch_add_explicit(&count->entities, view->count, memory_order_relaxed);
+  atomic_fetch_add_explicit(&count->chunks, 1, memory_order_relaxed);
+  if((view->components & ECS_MASK(counter_component)) == 0 || (view->components & ECS_MASK(tag_component)) != 0) {
+    atomic_fetch_add_explicit(&count->mismatches, 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * System incrementing counters, recording the removal of counters that reach a limit
+ * \param view the entities
+ * \param data the command buffer of each worker
+ */
+static void increment_counters(const struct ecs_view * view, void * data) {
+  struct ecs_commands * commands = (struct ecs_commands *)data + get_job_worker_index();
+  int * counters = (int *)get_ecs_column(view, counter_component);
+  for(size_t i = 0; i < view->count; ++i) {
+    if(++counters[i] >= ENTITY_COUNT) {
+      defer_remove_ecs_component(commands, view->entities[i], counter_component);
+    }
+  }
+}
+
+/**
+ * System failing on chunks with blocks
+ * \param view the entities
+ * \param data unused
+ */
+static void fail_on_blocks(const struct ecs_view * view, void * data) {
+  (void)data;
+  if((view->components & ECS_MASK(block_component)) != 0) {
+    SET_STATUS(STATUS_CODE_IO_ERROR);
+  }
+}
+
+/**
+ * Checks systems run by jobs see every matching entity once, and structural changes recorded
+ * meanwhile are applied afterwards
+ */
+static void test_jobs() {
+  // without a job system there is no worker to run the system
+  struct ecs_query counted = { ECS_MASK(counter_component), ECS_MASK(tag_component) };
+  clear_status();
+  CHECK(run_ecs_system_jobs(&counted, count_entities, NULL) == -1);
+  CHECK(get_status() == STATUS_CODE_INVALID_ARGUMENT);
+  clear_status();
+
+  struct job_options options;
+  init_job_options(&options);
+  options.worker_count = WORKER_COUNT;
+  CHECK(init_jobs_with_options(&options) == 0);
+
+  // the entities of the structure test with a counter and no tag
+  struct count count = { 0, 0, 0 };
+  run_ecs_system(&counted, count_entities, &count);
+  size_t expected = atomic_load(&count.entities);
+  CHECK(expected > 0 && atomic_load(&count.mismatches) == 0);
+  for(int round = 0; round < 10; ++round) {
+    struct count parallel = { 0, 0, 0 };
+    CHECK(run_ecs_system_jobs(&counted, count_entities, &parallel) == 0);
+    CHECK(atomic_load(&parallel.entities) == expected);
+    CHECK(atomic_load(&parallel.chunks) == atomic_load(&count.chunks));
+    CHECK(atomic_load(&parallel.mismatches) == 0);
+  }
+
+  // counters at the limit lose their counter once the commands of all workers are applied
+  struct ecs_commands commands[WORKER_COUNT];
+  for(size_t i = 0; i < WORKER_COUNT; ++i) {
+    init_ecs_commands(commands + i);
+  }
+  struct ecs_query all = { ECS_MASK(counter_component), 0 };
+  count = (struct count){ 0, 0, 0 };
+  run_ecs_system(&all, count_entities, &count);
+  size_t with_counter = atomic_load(&count.entities);
+  CHECK(run_ecs_system_jobs(&all, increment_counters, commands) == 0);
+  for(size_t i = 0; i < WORKER_COUNT; ++i) {
+    size_t before = get_ecs_entity_count();
+    CHECK(apply_ecs_commands(commands + i) == 0);
+    CHECK(get_ecs_entity_count() == before);
+    dispose_ecs_commands(commands + i);
+  }
+  for(int i = 0; i < ENTITY_COUNT - 1; ++i) {
+    if(is_ecs_entity_alive(entities[i])) {
+      CHECK(get_counter(entities[i]) == (i % 6 == 0 ? -1 : i + 1));
+    }
+  }
+  // only the last entity reached the limit
+  CHECK(get_counter(entities[ENTITY_COUNT - 1]) == -1);
+  count = (struct count){ 0, 0, 0 };
+  run_ecs_system(&all, count_entities, &count);
+  CHECK(atomic_load(&count.entities) + 1 == with_counter);
+
+  // a failing system fails the run with its status
+  clear_status();
+  struct ecs_query blocks = { ECS_MASK(block_component), 0 };
+  CHECK(run_ecs_system_jobs(&blocks, fail_on_blocks, NULL) == -1);
+  CHECK(get_status() == STATUS_CODE_IO_ERROR);
+  clear_status();
+  CHECK(run_ecs_system_jobs(&counted, count_entities, &count) == 0);
+
+  dispose_jobs();
+}
+
+/**
+ * System counting the entities whose counter is 7
+ * \param view the entities
+ * \param data the count, a size_t cast as a void *
+ */
+static void count_sevens(const struct ecs_view * view, void * data) {
+  const int * counters = (const int *)get_ecs_column(view, counter_component);
+  for(size_t i = 0; i < view->count; ++i) {
+    *(size_t *)data += counters[i] == 7;
+  }
+}
+
+/**
+ * Checks recorded commands apply in order, skipping entities no longer alive
+ */
+static void test_commands() {
+  struct ecs_commands commands;
+  init_ecs_commands(&commands);
+  size_t count = get_ecs_entity_count();
+  struct ecs_query tagged = { ECS_MASK(counter_component) | ECS_MASK(tag_component), 0 };
+  size_t sevens = 0;
+  run_ecs_system(&tagged, count_sevens, &sevens);
+
+  int counter = 7;
+  const void * values[] = { &counter, NULL };
+  CHECK(defer_create_ecs_entity(&commands, ECS_MASK(counter_component) | ECS_MASK(tag_component), values) == 0);
+  CHECK(defer_create_ecs_entity(&commands, ECS_MASK(counter_component), NULL) == 0);
+  ecs_entity kept = create_ecs_entity(ECS_MASK(counter_component));
+  ecs_entity doomed = create_ecs_entity(ECS_MASK(counter_component));
+  int set = 3;
+  CHECK(defer_add_ecs_component(&commands, kept, tag_component, NULL) == 0);
+  CHECK(defer_add_ecs_component(&commands, kept, counter_component, &set) == 0);
+  CHECK(defer_remove_ecs_component(&commands, kept, block_component) == 0);
+  CHECK(defer_destroy_ecs_entity(&commands, doomed) == 0);
+  CHECK(defer_add_ecs_component(&commands, doomed, tag_component, NULL) == 0);
+  // nothing changes until the commands are applied
+  CHECK(get_ecs_entity_count() == count + 2);
+  CHECK(get_ecs_component(kept, tag_component) == NULL);
+  CHECK(apply_ecs_commands(&commands) == 0);
+
+  CHECK(get_ecs_entity_count() == count + 3);
+  CHECK(!is_ecs_entity_alive(doomed));
+  CHECK(get_ecs_component(kept, tag_component) != NULL);
+  CHECK(get_counter(kept) == 3);
+  size_t created_sevens = 0;
+  run_ecs_system(&tagged, count_sevens, &created_sevens);
+  CHECK(created_sevens == sevens + 1);
+
+  // the buffer is empty and reusable after applying
+  CHECK(apply_ecs_commands(&commands) == 0);
+  CHECK(get_ecs_entity_count() == count + 3);
+  CHECK(defer_destroy_ecs_entity(&commands, kept) == 0);
+  CHECK(apply_ecs_commands(&commands) == 0);
+  CHECK(!is_ecs_entity_alive(kept));
+  dispose_ecs_commands(&commands);
+  clear_status();
+}
+
+/**
+ * Main function
+ * \return EXIT_SUCCESS if all checks pass, EXIT_FAILURE otherwise
+ */
+int main() {
+  CHECK(init_ecs() == 0);
+  test_components();
+  test_generations();
+  test_structure();
+  test_jobs();
+  test_commands();
+  dispose_ecs();
+  return TEST_RESULT();
+}
@@ -0,0 +1,485 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+// for naming threads
+#define _GNU_SOURCE
+
+#include "job.h"
+#include "profiler.h"
+#include "status.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * The size of a cache line, separating what different threads write
+ */
+#define JOB_CACHE_LINE_SIZE 64
+
+/**
+ * The number of times an idle worker looks for jobs before it sleeps
+ */
+#define JOB_SPIN_COUNT 64
+
+_Static_assert((JOB_POOL_SIZE & (JOB_POOL_SIZE - 1)) == 0, "the job pool size must be a power of two");
+_Static_assert((JOB_QUEUE_SIZE & (JOB_QUEUE_SIZE - 1)) == 0, "the job queue size must be a power of two");
+
+struct job {
+
+  /**
+   * The function of the job
+   */
+  _Alignas(JOB_CACHE_LINE_SIZE) job_function function;
+
+  /**
+   * The data passed to the function
+   */
+  void * data;
+
+  /**
+   * The parent job or NULL
+   */
+  struct job * parent;
+
+  /**
+   * The number of unfinished jobs, the job itself and its children, 0 once it finished
+   */
+  atomic_uint unfinished;
+
+  /**
+   * The status of the first job of the job and its descendants that failed
+   */
+  atomic_int status;
+
+  /**
+   * Whether the job can be created again, set only after its parent and status were read
+   */
+  atomic_bool free;
+};
+
+/**
+ * A worker, owning a Chase-Lev deque of jobs: it queues and takes jobs at the bottom, other
+ * workers steal them from the top
+ */
+struct job_worker {
+
+  /**
+   * The position of the oldest job, moved by thieves
+   */
+  _Alignas(JOB_CACHE_LINE_SIZE) atomic_long top;
+
+  /**
+   * The position after the newest job, only moved by the worker
+   */
+  _Alignas(JOB_CACHE_LINE_SIZE) atomic_long bottom;
+
+  /**
+   * The queued jobs, a ring indexed by position
+   */
+  _Atomic(struct job *) queue[JOB_QUEUE_SIZE];
+
+  /**
+   * The jobs created on the worker
+   */
+  struct job pool[JOB_POOL_SIZE];
+
+  /**
+   * The number of jobs created on the worker, the next one is tried at this index modulo the pool
+   * size
+   */
+  size_t pool_next;
+
+  /**
+   * The state of the random numbers choosing whom to steal from
+   */
+  unsigned int random;
+
+  /**
+   * The thread of the worker
+   */
+  pthread_t thread;
+};
+
+/**
+ * The workers, the first one is the thread that initialized the job system
+ */
+static struct job_worker * workers;
+
+/**
+ * The number of workers
+ */
+static size_t worker_len;
+
+/**
+ * Whether the workers run
+ */
+static atomic_bool running;
+
+/**
+ * Futex word idle workers sleep on, incremented to wake them
+ */
+static atomic_uint wake;
+
+/**
+ * The number of workers sleeping on the wake futex
+ */
+static atomic_uint sleeping;
+
+/**
+ * The worker of this thread, NULL for threads that are no worker
+ */
+static __thread struct job_worker * worker;
+
+/*
+ * Job queue functions
+ */
+
+/**
+ * Queues a job at the bottom of the deque of a worker
+ * \param worker the worker of this thread
+ * \param job the job
+ * \return true if the job was queued, false if the deque is full
+ */
+static bool push_job(struct job_worker * worker, struct job * job) {
+  long bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&worker->top, memory_order_acquire);
+  if(bottom - top >= JOB_QUEUE_SIZE) {
+    return false;
+  }
+  atomic_store_explicit(worker->queue + (bottom & (JOB_QUEUE_SIZE - 1)), job, memory_order_relaxed);
+  atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_release);
+  return true;
+}
+
+/**
+ * Takes the newest job from the bottom of the deque of a worker
+ * \param worker the worker of this thread
+ * \return the job or NULL if the deque is empty or a thief stole its last job
+ */
+static struct job * take_job(struct job_worker * worker) {
+  long bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+  // the bottom moves before the top is read, so a thief and the worker never both get a job
+  atomic_store_explicit(&worker->bottom, bottom, memory_order_seq_cst);
+  long top = atomic_load_explicit(&worker->top, memory_order_seq_cst);
+  if(top > bottom) {
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+  struct job * job = atomic_load_explicit(worker->queue + (bottom & (JOB_QUEUE_SIZE - 1)), memory_order_relaxed);
+  if(top == bottom) {
+    // the last job goes to whoever moves the top first
+    if(!atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      job = NULL;
+    }
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+/**
+ * Steals the oldest job from the top of the deque of another worker
+ * \param victim the worker
+ * \return the job or NULL if the deque is empty or another thread got the job first
+ */
+static struct job * steal_job(struct job_worker * victim) {
+  long top = atomic_load_explicit(&victim->top, memory_order_seq_cst);
+  long bottom = atomic_load_explicit(&victim->bottom, memory_order_seq_cst);
+  if(top >= bottom) {
+    return NULL;
+  }
+  struct job * job = atomic_load_explicit(victim->queue + (top & (JOB_QUEUE_SIZE - 1)), memory_order_relaxed);
+  if(!atomic_compare_exchange_strong_explicit(&victim->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return job;
+}
+
+/**
+ * Tells whether any worker has queued jobs
+ * \return true if there are jobs to steal
+ */
+static bool has_queued_jobs() {
+  for(size_t i = 0; i < worker_len; ++i) {
+    if(atomic_load_explicit(&workers[i].top, memory_order_seq_cst) < atomic_load_explicit(&workers[i].bottom, memory_order_seq_cst)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Returns the next job for a worker, its own newest job or the oldest job of another worker
+ * \param worker the worker of this thread
+ * \return the job or NULL if none was found
+ */
+static struct job * get_job(struct job_worker * worker) {
+  struct job * job = take_job(worker);
+  if(job != NULL || worker_len == 1) {
+    return job;
+  }
+  worker->random ^= worker->random << 13;
+  worker->random ^= worker->random >> 17;
+  worker->random ^= worker->random << 5;
+  size_t first = worker->random % worker_len;
+  for(size_t i = 0; i < worker_len && job == NULL; ++i) {
+    struct job_worker * victim = workers + (first + i) % worker_len;
+    if(victim != worker) {
+      job = steal_job(victim);
+    }
+  }
+  return job;
+}
+
+/*
+ * Job functions
+ */
+
+/**
+ * Marks a job finished, and its parent once all of its children finished too
+ * \param job the job
+ */
+static void finish_job(struct job * job) {
+  while(job != NULL) {
+    // the job stays unfree until it is released below, so its fields can be read once it finished
+    struct job * parent = job->parent;
+    if(atomic_fetch_sub_explicit(&job->unfinished, 1, memory_order_acq_rel) != 1) {
+      return;
+    }
+    int status = atomic_load_explicit(&job->status, memory_order_relaxed);
+    if(parent != NULL && status != STATUS_CODE_OK) {
+      int expected = STATUS_CODE_OK;
+      atomic_compare_exchange_strong_explicit(&parent->status, &expected, status, memory_order_relaxed, memory_order_relaxed);
+    }
+    atomic_store_explicit(&job->free, true, memory_order_release);
+    job = parent;
+  }
+}
+
+/**
+ * Runs a job on this thread, keeping the status of the thread
+ * \param job the job
+ */
+static void execute_job(struct job * job) {
+  enum status_code status = get_status();
+  clear_status();
+  job->function(job, job->data);
+  if(get_status() != STATUS_CODE_OK) {
+    int expected = STATUS_CODE_OK;
+    atomic_compare_exchange_strong_explicit(&job->status, &expected, (int)get_status(), memory_order_relaxed, memory_order_relaxed);
+  }
+  set_status(status);
+  finish_job(job);
+}
+
+/**
+ * Wakes the workers sleeping for jobs
+ */
+static void wake_job_workers() {
+  atomic_fetch_add_explicit(&wake, 1, memory_order_seq_cst);
+  syscall(SYS_futex, &wake, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Sleeps until jobs get queued or the workers stop
+ */
+static void wait_for_jobs() {
+  unsigned int expected = atomic_load_explicit(&wake, memory_order_seq_cst);
+  atomic_fetch_add_explicit(&sleeping, 1, memory_order_seq_cst);
+  if(!has_queued_jobs() && atomic_load_explicit(&running, memory_order_seq_cst)) {
+    syscall(SYS_futex, &wake, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+  }
+  atomic_fetch_sub_explicit(&sleeping, 1, memory_order_relaxed);
+}
+
+/**
+ * Worker thread function, runs jobs until the job system stops
+ * \param arg the worker cast as a void *
+ * \return always NULL
+ */
+static void * run_job_worker(void * arg) {
+  worker = (struct job_worker *)arg;
+  pthread_setname_np(pthread_self(), "job worker");
+  register_profile_thread();
+  clear_status();
+
+  unsigned int idle = 0;
+  while(atomic_load_explicit(&running, memory_order_acquire)) {
+    struct job * job = get_job(worker);
+    if(job != NULL) {
+      execute_job(job);
+      idle = 0;
+    } else if(++idle < JOB_SPIN_COUNT) {
+      sched_yield();
+    } else {
+      wait_for_jobs();
+      idle = 0;
+    }
+  }
+  worker = NULL;
+  return NULL;
+}
+
+/*
+ * Public API implementation
+ */
+
+int init_jobs() {
+  struct job_options options;
+  init_job_options(&options);
+  return init_jobs_with_options(&options);
+}
+
+void init_job_options(struct job_options * options) {
+  assert(options != NULL);
+  options->worker_count = 0;
+}
+
+int init_jobs_with_options(const struct job_options * options) {
+  assert(options != NULL);
+  assert(workers == NULL);
+
+  size_t count = options->worker_count;
+  if(count == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cores > 0 ? (size_t)cores : 1;
+  }
+  workers = (struct job_worker *)aligned_alloc(JOB_CACHE_LINE_SIZE, count * sizeof(struct job_worker));
+  if(workers == NULL) {
+    SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+    return -1;
+  }
+  for(size_t i = 0; i < count; ++i) {
+    atomic_init(&workers[i].top, 0);
+    atomic_init(&workers[i].bottom, 0);
+    for(size_t j = 0; j < JOB_POOL_SIZE; ++j) {
+      atomic_init(&workers[i].pool[j].unfinished, 0);
+      atomic_init(&workers[i].pool[j].free, true);
+    }
+    workers[i].pool_next = 0;
+    workers[i].random = 2654435761U * (unsigned int)(i + 1);
+  }
+  worker_len = count;
+  atomic_store_explicit(&running, true, memory_order_relaxed);
+  atomic_store_explicit(&sleeping, 0, memory_order_relaxed);
+  worker = workers;
+
+  for(size_t i = 1; i < count; ++i) {
+    if(pthread_create(&workers[i].thread, NULL, run_job_worker, workers + i) != 0) {
+      // the workers that started stop again, with worker_len covering just them
+      worker_len = i;
+      dispose_jobs();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+size_t get_job_worker_count() {
+  return worker_len;
+}
+
+int get_job_worker_index() {
+  return worker != NULL ? (int)(worker - workers) : -1;
+}
+
+struct job * create_job(job_function function, void * data, struct job * parent) {
+  assert(function != NULL);
+
+  if(worker == NULL) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return NULL;
+  }
+  // jobs finish out of order, so the next free job is searched for rather than assumed
+  struct job * job = NULL;
+  for(size_t i = 0; i < JOB_POOL_SIZE && job == NULL; ++i) {
+    struct job * next = worker->pool + (worker->pool_next++ & (JOB_POOL_SIZE - 1));
+    if(atomic_load_explicit(&next->free, memory_order_acquire)) {
+      job = next;
+    }
+  }
+  if(job == NULL) {
+    SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+    return NULL;
+  }
+  job->function = function;
+  job->data = data;
+  job->parent = parent;
+  atomic_store_explicit(&job->free, false, memory_order_relaxed);
+  atomic_store_explicit(&job->unfinished, 1, memory_order_relaxed);
+  atomic_store_explicit(&job->status, STATUS_CODE_OK, memory_order_relaxed);
+  if(parent != NULL) {
+    atomic_fetch_add_explicit(&parent->unfinished, 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+void run_job(struct job * job) {
+  assert(job != NULL);
+  assert(worker != NULL);
+
+  if(!push_job(worker, job)) {
+    execute_job(job);
+    return;
+  }
+  // the job is visible before the sleepers are counted, as they count before looking for jobs
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load_explicit(&sleeping, memory_order_seq_cst) != 0) {
+    wake_job_workers();
+  }
+}
+
+int wait_for_job(struct job * job) {
+  assert(job != NULL);
+
+  while(atomic_load_explicit(&job->unfinished, memory_order_acquire) != 0) {
+    struct job * next = worker != NULL ? get_job(worker) : NULL;
+    if(next != NULL) {
+      execute_job(next);
+    } else {
+      sched_yield();
+    }
+  }
+  int status = atomic_load_explicit(&job->status, memory_order_relaxed);
+  if(status != STATUS_CODE_OK) {
+    set_status((enum status_code)status);
+    return -1;
+  }
+  return 0;
+}
+
+void dispose_jobs() {
+  if(workers == NULL) {
+    return;
+  }
+  atomic_store_explicit(&running, false, memory_order_seq_cst);
+  wake_job_workers();
+  for(size_t i = 1; i < worker_len; ++i) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  free(workers);
+  workers = NULL;
+  worker_len = 0;
+  worker = NULL;
+}
@@ -0,0 +1,126 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Job system spreading work across all cores, with a work stealing worker thread per core
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stddef.h>
+
+/**
+ * The number of jobs in the pool of each thread, at most this many jobs of a thread can be alive
+ * at once, a finished job is reused as soon as the creation of a job reaches it
+ */
+#define JOB_POOL_SIZE 4096
+
+/**
+ * The number of jobs each worker queues, jobs run beyond it are run right away
+ */
+#define JOB_QUEUE_SIZE 4096
+
+/**
+ * A unit of work, created from a pool and valid until it finished and the thread that created it
+ * creates its next job, which may take the finished one
+ */
+struct job;
+
+/**
+ * The function of a job
+ * Errors are reported by setting the status of the calling thread, see status.h
+ * \param job the job, to create children with
+ * \param data the data the job was created with
+ */
+typedef void (*job_function)(struct job * job, void * data);
+
+/**
+ * Options of the job system
+ */
+struct job_options {
+
+  /**
+   * The number of threads running jobs, including the thread initializing the job system, 0 for
+   * one per online core
+   */
+  size_t worker_count;
+};
+
+/**
+ * Initializes the job system with the default options, starting one worker per core
+ * The calling thread becomes the first worker, it runs jobs while it waits for them
+ * \return 0 on success, -1 on failure
+ */
+int init_jobs();
+
+/**
+ * Initializes job options with the defaults
+ * \param options the options
+ */
+void init_job_options(struct job_options * options);
+
+/**
+ * Initializes the job system, the calling thread becomes the first worker
+ * \param options the options
+ * \return 0 on success, -1 on failure
+ */
+int init_jobs_with_options(const struct job_options * options);
+
+/**
+ * Returns the number of workers, including the thread that initialized the job system
+ * \return the number of workers
+ */
+size_t get_job_worker_count();
+
+/**
+ * Returns the index of the worker of this thread, e.g. to keep per worker state without locks
+ * \return the index, 0 for the thread that initialized the job system, or -1 if this thread is
+ *         no worker
+ */
+int get_job_worker_index();
+
+/**
+ * Creates a job on a worker, it runs once given to run_job
+ * A job with a parent finishes before its parent does, so waiting for the parent waits for all
+ * of its descendants
+ * \param function the function of the job
+ * \param data the data passed to the function
+ * \param parent the parent job or NULL
+ * \return the job or NULL if this thread is no worker or its job pool is exhausted
+ */
+struct job * create_job(job_function function, void * data, struct job * parent);
+
+/**
+ * Queues a job on the worker of this thread, from where idle workers steal it
+ * \param job the job, created on this thread
+ */
+void run_job(struct job * job);
+
+/**
+ * Waits for a job and its descendants to finish, running queued jobs meanwhile
+ * \param job the job
+ * \return 0 if the job and all of its descendants succeeded, -1 if one of them set its status,
+ *         which becomes the status of this thread
+ */
+int wait_for_job(struct job * job);
+
+/**
+ * Stops the workers and frees the job system, once no job is queued or running
+ */
+void dispose_jobs();
+
+#endif
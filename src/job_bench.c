@@ -0,0 +1,336 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Scaling benchmark for the job system, a fork/join workload splitting a range of items in
+ * halves down to leaves of a grain size
+ * Usage: job_bench [-t max workers, 0 for one per core] [-n items] [-g grain] [-w work per item]
+ *                  [-r repetitions]
+ * Runs a round for 1, 2, 4 ... max workers and prints one line of key=value pairs per round,
+ * with the speedup over a single worker
+ */
+
+#include "job.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#define DEFAULT_ITEMS 4194304
+#define DEFAULT_GRAIN 1024
+#define DEFAULT_WORK 64
+#define DEFAULT_REPETITIONS 5
+
+/**
+ * A range of items and the sum computed for it, a node of the tree the range is split into
+ */
+struct range {
+
+  /**
+   * The first item
+   */
+  size_t begin;
+
+  /**
+   * The item after the last one
+   */
+  size_t end;
+
+  /**
+   * The sum of the leaf, unused for inner nodes
+   */
+  unsigned long long sum;
+};
+
+/**
+ * The benchmark settings
+ */
+struct settings {
+
+  /**
+   * The maximum number of workers, 0 for one per core
+   */
+  size_t max_workers;
+
+  /**
+   * The number of items
+   */
+  size_t items;
+
+  /**
+   * The maximum number of items of a leaf
+   */
+  size_t grain;
+
+  /**
+   * The number of hashing rounds per item
+   */
+  unsigned int work;
+
+  /**
+   * The number of timed runs per round, the fastest counts
+   */
+  size_t repetitions;
+};
+
+static struct settings settings;
+
+/**
+ * The nodes of the split tree, the children of node i are nodes 2i + 1 and 2i + 2
+ */
+static struct range * ranges;
+
+/**
+ * The number of nodes
+ */
+static size_t range_len;
+
+/**
+ * The number of leaves
+ */
+static size_t leaf_len;
+
+/**
+ * Returns the current monotonic time in nanoseconds
+ * \return the time
+ */
+static unsigned long long get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Hashes an item a number of times, the work done per item
+ * \param item the item
+ * \return the hash
+ */
+static unsigned long long hash_item(size_t item) {
+  unsigned long long hash = item;
+  for(unsigned int i = 0; i < settings.work; ++i) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+/**
+ * Builds the split tree of a range below a node
+ * \param node the index of the node
+ * \param begin the first item
+ * \param end the item after the last one
+ */
+static void build_ranges(size_t node, size_t begin, size_t end) {
+  ranges[node].begin = begin;
+  ranges[node].end = end;
+  ranges[node].sum = 0;
+  if(end - begin > settings.grain) {
+    size_t middle = begin + (end - begin) / 2;
+    build_ranges(2 * node + 1, begin, middle);
+    build_ranges(2 * node + 2, middle, end);
+  } else {
+    ++leaf_len;
+  }
+}
+
+/**
+ * Job function splitting a range in two child jobs, or summing it if it is a leaf
+ * \param job the job
+ * \param data the range cast as a void *
+ */
+static void run_range(struct job * job, void * data) {
+  struct range * range = (struct range *)data;
+  if(range->end - range->begin > settings.grain) {
+    size_t node = (size_t)(range - ranges);
+    for(size_t child = 2 * node + 1; child <= 2 * node + 2; ++child) {
+      struct job * child_job = create_job(run_range, ranges + child, job);
+      if(child_job != NULL) {
+	run_job(child_job);
+      }
+    }
+    return;
+  }
+  unsigned long long sum = 0;
+  for(size_t item = range->begin; item < range->end; ++item) {
+    sum += hash_item(item);
+  }
+  range->sum = sum;
+}
+
+/**
+ * Sums the leaves of the split tree
+ * \return the sum
+ */
+static unsigned long long sum_ranges() {
+  unsigned long long sum = 0;
+  for(size_t i = 0; i < range_len; ++i) {
+    sum += ranges[i].sum;
+  }
+  return sum;
+}
+
+/**
+ * Runs the workload once on the job system
+ * \return the time taken in nanoseconds, or 0 on failure
+ */
+static unsigned long long run_workload() {
+  for(size_t i = 0; i < range_len; ++i) {
+    ranges[i].sum = 0;
+  }
+  unsigned long long start = get_time();
+  struct job * root = create_job(run_range, ranges, NULL);
+  if(root == NULL) {
+    return 0;
+  }
+  run_job(root);
+  if(wait_for_job(root) != 0) {
+    return 0;
+  }
+  return get_time() - start;
+}
+
+/**
+ * Runs a single round of the benchmark
+ * \param worker_count the number of workers
+ * \param expected the sum of all items
+ * \param base the time of a single worker, 0 for the round measuring it
+ * \return the time of the round in nanoseconds, or 0 on failure
+ */
+static unsigned long long run_round(size_t worker_count, unsigned long long expected, unsigned long long base) {
+  struct job_options options;
+  init_job_options(&options);
+  options.worker_count = worker_count;
+  if(init_jobs_with_options(&options) != 0) {
+    return 0;
+  }
+
+  // a first run brings the workers and the caches up
+  unsigned long long best = run_workload();
+  for(size_t i = 0; best != 0 && i < settings.repetitions; ++i) {
+    unsigned long long time = run_workload();
+    if(time == 0 || sum_ranges() != expected) {
+      best = 0;
+    } else if(time < best) {
+      best = time;
+    }
+  }
+  dispose_jobs();
+
+  if(best != 0) {
+    double seconds = (double)best * 1e-9;
+    double speedup = base != 0 ? (double)base / (double)best : 1.0;
+    printf("workers=%zu items=%zu grain=%zu work=%u leaves=%zu seconds=%.6f items_per_second=%.0f speedup=%.2f efficiency=%.2f\n",
+	   worker_count, settings.items, settings.grain, settings.work, leaf_len, seconds,
+	   (double)settings.items / seconds, speedup, speedup / (double)worker_count);
+  }
+  return best;
+}
+
+/**
+ * Parses the command line into the settings
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return 0 on success, -1 on invalid arguments
+ */
+static int parse_settings(int arg_count, char * args[]) {
+  settings.max_workers = 0;
+  settings.items = DEFAULT_ITEMS;
+  settings.grain = DEFAULT_GRAIN;
+  settings.work = DEFAULT_WORK;
+  settings.repetitions = DEFAULT_REPETITIONS;
+
+  int option;
+  while((option = getopt(arg_count, args, "t:n:g:w:r:")) != -1) {
+    switch(option) {
+    case 't':
+      settings.max_workers = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      settings.items = strtoul(optarg, NULL, 10);
+      break;
+    case 'g':
+      settings.grain = strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      settings.work = (unsigned int)strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      settings.repetitions = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      return -1;
+    }
+  }
+  if(optind != arg_count || settings.items == 0 || settings.grain == 0) {
+    return -1;
+  }
+  if(settings.max_workers == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    settings.max_workers = cores > 0 ? (size_t)cores : 1;
+  }
+  return 0;
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if the benchmark ran, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, char * args[]) {
+  if(parse_settings(arg_count, args) != 0) {
+    fputs("usage: job_bench [-t max workers, 0 for one per core] [-n items] [-g grain] [-w work per item]\n"
+	  "                 [-r repetitions]\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  // halving down to the grain gives a tree with fewer than 4 * items / grain nodes
+  range_len = 1;
+  while(range_len * settings.grain < settings.items) {
+    range_len *= 2;
+  }
+  range_len = 4 * range_len;
+  ranges = (struct range *)calloc(range_len, sizeof(struct range));
+  if(ranges == NULL) {
+    fputs("out of memory\n", stderr);
+    return EXIT_FAILURE;
+  }
+  build_ranges(0, 0, settings.items);
+  unsigned long long expected = 0;
+  for(size_t item = 0; item < settings.items; ++item) {
+    expected += hash_item(item);
+  }
+
+  unsigned long long base = run_round(1, expected, 0);
+  int result = base != 0 ? 0 : -1;
+  for(size_t workers = 2; result == 0 && workers < 2 * settings.max_workers; workers *= 2) {
+    size_t count = workers < settings.max_workers ? workers : settings.max_workers;
+    if(run_round(count, expected, base) == 0) {
+      result = -1;
+    }
+  }
+  free(ranges);
+
+  if(result == 0) {
+    return EXIT_SUCCESS;
+  } else {
+    fputs("benchmark failed\n", stderr);
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,176 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Expands log files written by compressed logger outputs
+ * Usage: log_cat [file...], reads the standard input without files
+ * Uncompressed files are copied as they are. A stream cut short, as a crash leaves it, is
+ * expanded up to its last write before the error is reported. Binary logs can be piped on
+ * to log_decode.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+/**
+ * The size of the input and output buffers
+ */
+#define BUFFER_SIZE 65536
+
+/**
+ * The window bits accepting gzip and zlib streams with any window
+ */
+#define AUTO_WINDOW_BITS (15 + 32)
+
+/**
+ * Copies a file to the standard output as it is
+ * \param file the input file
+ * \param buffer the buffer, holding the first bytes of the file
+ * \param len the number of bytes in the buffer
+ * \return 0 on success, -1 on failure
+ */
+static int copy_file(FILE * file, unsigned char * buffer, size_t len) {
+  do {
+    if(fwrite(buffer, 1, len, stdout) != len) {
+      return -1;
+    }
+    len = fread(buffer, 1, BUFFER_SIZE, file);
+  } while(len != 0);
+  return ferror(file) ? -1 : 0;
+}
+
+/**
+ * Expands the compressed streams of a file to the standard output
+ * Streams written one after another are expanded one after another
+ * \param file the input file
+ * \param in the input buffer, holding the first bytes of the file
+ * \param len the number of bytes in the input buffer
+ * \return 0 on success, -1 on failure
+ */
+static int inflate_file(FILE * file, unsigned char * in, size_t len) {
+  unsigned char * out = (unsigned char *)malloc(BUFFER_SIZE);
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if(out == NULL || inflateInit2(&stream, AUTO_WINDOW_BITS) != Z_OK) {
+    free(out);
+    return -1;
+  }
+
+  int result = Z_OK;
+  stream.next_in = in;
+  stream.avail_in = (uInt)len;
+  while(true) {
+    if(stream.avail_in == 0) {
+      stream.next_in = in;
+      stream.avail_in = (uInt)fread(in, 1, BUFFER_SIZE, file);
+      if(stream.avail_in == 0) {
+	break;
+      }
+    }
+    stream.next_out = out;
+    stream.avail_out = BUFFER_SIZE;
+    result = inflate(&stream, Z_NO_FLUSH);
+    size_t out_len = BUFFER_SIZE - stream.avail_out;
+    if(fwrite(out, 1, out_len, stdout) != out_len) {
+      result = Z_ERRNO;
+    }
+    if(result == Z_STREAM_END) {
+      // the next stream starts right after, the padding of a segment cut short ends here
+      if(stream.avail_in != 0 && stream.next_in[0] != 0x1f) {
+	break;
+      }
+      inflateReset(&stream);
+    } else if(result != Z_OK && result != Z_BUF_ERROR) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  free(out);
+
+  if(result == Z_STREAM_END) {
+    return 0;
+  }
+  if(result == Z_OK || result == Z_BUF_ERROR) {
+    fputs("compressed stream ends early\n", stderr);
+  } else {
+    fprintf(stderr, "corrupt compressed stream: %s\n", stream.msg != NULL ? stream.msg : zError(result));
+  }
+  return -1;
+}
+
+/**
+ * Expands or copies a file to the standard output
+ * \param file the input file
+ * \param buffer the input buffer, BUFFER_SIZE bytes
+ * \return 0 on success, -1 on failure
+ */
+static int cat_file(FILE * file, unsigned char * buffer) {
+  size_t len = fread(buffer, 1, BUFFER_SIZE, file);
+  if(len == 0) {
+    return ferror(file) ? -1 : 0;
+  }
+  // the magic bytes of gzip
+  if(len >= 2 && buffer[0] == 0x1f && buffer[1] == 0x8b) {
+    return inflate_file(file, buffer, len);
+  }
+  return copy_file(file, buffer, len);
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if all files were expanded, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, const char * args[]) {
+  unsigned char * buffer = (unsigned char *)malloc(BUFFER_SIZE);
+  if(buffer == NULL) {
+    fputs("out of memory\n", stderr);
+    return EXIT_FAILURE;
+  }
+  int result = 0;
+
+  if(arg_count < 2) {
+    result = cat_file(stdin, buffer);
+  }
+  for(int i = 1; i < arg_count; ++i) {
+    FILE * file = fopen(args[i], "rb");
+    if(file == NULL) {
+      fprintf(stderr, "could not open '%s'\n", args[i]);
+      result = -1;
+      continue;
+    }
+    if(cat_file(file, buffer) != 0) {
+      fprintf(stderr, "could not expand '%s'\n", args[i]);
+      result = -1;
+    }
+    fclose(file);
+  }
+  free(buffer);
+
+  if(fflush(stdout) != 0) {
+    result = -1;
+  }
+  if(result == 0) {
+    return EXIT_SUCCESS;
+  } else {
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,509 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Expands binary log files written by binary logger outputs into text
+ * Usage: log_decode [-j] [-f key=value]... [file...], reads the standard input without files
+ * -j prints JSON lines instead of text, -f only prints structured messages with a field of
+ * that key and value, compared with the decoded field rather than the text
+ */
+
+#include "log_format.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+/**
+ * A call site read from a binary log file
+ */
+struct decoded_site {
+
+  /**
+   * The file of the call site or NULL if the site has not been read
+   */
+  char * file;
+
+  /**
+   * The line of the call site
+   */
+  int line;
+
+  /**
+   * The format string of the call site
+   */
+  char * format;
+};
+
+/**
+ * The state of the decoder
+ */
+struct decoder {
+
+  /**
+   * The call sites, indexed by identifier
+   */
+  struct decoded_site * sites;
+
+  /**
+   * The number of call sites
+   */
+  size_t site_cap;
+
+  /**
+   * Buffer for the bytes of a record
+   */
+  char * data;
+
+  /**
+   * The capacity of the data buffer
+   */
+  size_t data_cap;
+
+  /**
+   * Buffer for rendered text
+   */
+  char * text;
+
+  /**
+   * The capacity of the text buffer
+   */
+  size_t text_cap;
+
+  /**
+   * Buffer for rendered fields
+   */
+  char * fields;
+
+  /**
+   * The capacity of the fields buffer
+   */
+  size_t fields_cap;
+
+  /**
+   * Whether messages are printed as JSON lines
+   */
+  bool json;
+
+  /**
+   * The key=value filters structured messages have to match, all of them
+   */
+  char ** filters;
+
+  /**
+   * The number of filters
+   */
+  size_t filter_len;
+};
+
+/**
+ * Makes sure a buffer has a minimum capacity
+ * \param buffer the buffer
+ * \param cap the capacity of the buffer
+ * \param min the minimum capacity
+ * \return 0 on success, -1 on failure
+ */
+static int reserve_buffer(char ** buffer, size_t * cap, size_t min) {
+  if(min <= *cap) {
+    return 0;
+  }
+  char * b = (char *)realloc(*buffer, min);
+  if(b == NULL) {
+    return -1;
+  }
+  *buffer = b;
+  *cap = min;
+  return 0;
+}
+
+/**
+ * Reads a fixed number of bytes
+ * \param file the input file
+ * \param data the destination
+ * \param size the number of bytes
+ * \return 0 on success, -1 on failure
+ */
+static int read_bytes(FILE * file, void * data, size_t size) {
+  return fread(data, 1, size, file) == size ? 0 : -1;
+}
+
+/**
+ * Reads a string with its length
+ * \param file the input file
+ * \return a newly allocated string or NULL on failure
+ */
+static char * read_string(FILE * file) {
+  uint32_t len;
+  if(read_bytes(file, &len, sizeof(len)) != 0) {
+    return NULL;
+  }
+  char * string = (char *)malloc((size_t)len + 1);
+  if(string == NULL) {
+    return NULL;
+  }
+  if(read_bytes(file, string, len) != 0) {
+    free(string);
+    return NULL;
+  }
+  string[len] = '\0';
+  return string;
+}
+
+/**
+ * Reads the bytes of a message into the data buffer, NUL terminated
+ * \param decoder the decoder
+ * \param file the input file
+ * \param len receives the number of bytes
+ * \return 0 on success, -1 on failure
+ */
+static int read_message_data(struct decoder * decoder, FILE * file, uint32_t * len) {
+  if(read_bytes(file, len, sizeof(*len)) != 0
+     || reserve_buffer(&decoder->data, &decoder->data_cap, (size_t)*len + 1) != 0
+     || read_bytes(file, decoder->data, *len) != 0) {
+    return -1;
+  }
+  decoder->data[*len] = '\0';
+  return 0;
+}
+
+/**
+ * Reads a call site record
+ * \param decoder the decoder
+ * \param file the input file
+ * \return 0 on success, -1 on failure
+ */
+static int decode_site(struct decoder * decoder, FILE * file) {
+  uint32_t id;
+  int32_t line;
+  if(read_bytes(file, &id, sizeof(id)) != 0 || read_bytes(file, &line, sizeof(line)) != 0) {
+    return -1;
+  }
+  if(id >= decoder->site_cap) {
+    size_t cap = (size_t)id + 1;
+    struct decoded_site * sites = (struct decoded_site *)realloc(decoder->sites, cap * sizeof(struct decoded_site));
+    if(sites == NULL) {
+      return -1;
+    }
+    memset(sites + decoder->site_cap, 0, (cap - decoder->site_cap) * sizeof(struct decoded_site));
+    decoder->sites = sites;
+    decoder->site_cap = cap;
+  }
+
+  struct decoded_site * site = decoder->sites + id;
+  free(site->file);
+  free(site->format);
+  site->line = line;
+  site->file = read_string(file);
+  site->format = read_string(file);
+  if(site->file == NULL || site->format == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Checks whether structured fields have a field of a key and value
+ * \param data the encoded fields
+ * \param len the number of encoded bytes
+ * \param filter the key and value, separated by '='
+ * \return true if a field matches
+ */
+static bool has_field(const char * data, size_t len, const char * filter) {
+  const char * value = strchr(filter, '=');
+  size_t key_len = (size_t)(value - filter);
+  ++value;
+  size_t offset = 0;
+  struct log_field_view field;
+  while(decode_log_field(data, len, &offset, &field) == 1) {
+    if(field.key_len != key_len || memcmp(field.key, filter, key_len) != 0) {
+      continue;
+    }
+    if(field.type == LOG_FIELD_STRING) {
+      if(field.string_len == strlen(value) && memcmp(field.string, value, field.string_len) == 0) {
+	return true;
+      }
+      continue;
+    }
+    char text[64];
+    if(render_log_field_value(&field, false, text, sizeof(text)) >= 0 && strcmp(text, value) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Prints a string as a JSON string, without quotes
+ * \param string the string
+ */
+static void print_json_string(const char * string) {
+  for(const char * c = string; *c != '\0'; ++c) {
+    if(*c == '"' || *c == '\\') {
+      printf("\\%c", *c);
+    } else if((unsigned char)*c < 0x20) {
+      printf("\\u%04x", (unsigned int)*c);
+    } else {
+      putchar(*c);
+    }
+  }
+}
+
+/**
+ * Prints a message, unless filters reject it
+ * \param decoder the decoder
+ * \param level the log level
+ * \param thread the thread that logged the message
+ * \param time the time the message was logged
+ * \param file the file where the message originates from
+ * \param line the line where the message originates from
+ * \param text the text
+ * \param fields the encoded fields of a structured message or NULL
+ * \param fields_len the number of encoded bytes
+ * \return 0 on success, -1 on failure
+ */
+static int print_message(struct decoder * decoder, uint8_t level, uint32_t thread, int64_t time, const char * file, int line, const char * text, const char * fields, size_t fields_len) {
+  for(size_t i = 0; i < decoder->filter_len; ++i) {
+    if(fields == NULL || !has_field(fields, fields_len, decoder->filters[i])) {
+      return 0;
+    }
+  }
+
+  const char * fields_text = "";
+  if(fields != NULL) {
+    int len = render_log_fields(fields, fields_len, decoder->json, decoder->fields, decoder->fields_cap);
+    if(len >= 0 && (size_t)len >= decoder->fields_cap) {
+      if(reserve_buffer(&decoder->fields, &decoder->fields_cap, (size_t)len + 1) != 0) {
+	return -1;
+      }
+      len = render_log_fields(fields, fields_len, decoder->json, decoder->fields, decoder->fields_cap);
+    }
+    if(len < 0) {
+      fputs("malformed fields\n", stderr);
+      return -1;
+    }
+    fields_text = decoder->fields;
+  }
+
+  char time_text[LOG_TIME_LENGTH + 1];
+  if(level > LOG_LEVEL_ERROR) {
+    level = LOG_LEVEL_ERROR;
+  }
+  format_log_time(time, time_text);
+  if(decoder->json) {
+    printf("{\"time\":\"%s\",\"thread\":%u,\"level\":\"%s\",\"file\":\"", time_text, (unsigned int)thread, get_log_level_name((enum log_level)level));
+    print_json_string(file);
+    printf("\",\"line\":%d,\"message\":\"", line);
+    print_json_string(text);
+    printf("\"%s}\n", fields_text);
+  } else {
+    printf("%s [%u] %s %s:%d: %s%s\n", time_text, (unsigned int)thread, get_log_level_label((enum log_level)level), file, line, text, fields_text);
+  }
+  return 0;
+}
+
+/**
+ * Reads and prints a message record
+ * \param decoder the decoder
+ * \param file the input file
+ * \return 0 on success, -1 on failure
+ */
+static int decode_message(struct decoder * decoder, FILE * file) {
+  uint32_t id;
+  uint8_t level;
+  uint8_t payload;
+  uint32_t thread;
+  int64_t time;
+  uint32_t len;
+  if(read_bytes(file, &id, sizeof(id)) != 0
+     || read_bytes(file, &level, sizeof(level)) != 0
+     || read_bytes(file, &payload, sizeof(payload)) != 0
+     || read_bytes(file, &thread, sizeof(thread)) != 0
+     || read_bytes(file, &time, sizeof(time)) != 0
+     || read_message_data(decoder, file, &len) != 0) {
+    return -1;
+  }
+  if(id >= decoder->site_cap || decoder->sites[id].file == NULL) {
+    fprintf(stderr, "message from unknown call site %u\n", (unsigned int)id);
+    return -1;
+  }
+
+  const struct decoded_site * site = decoder->sites + id;
+  const char * text = decoder->data;
+  if(payload == LOG_PAYLOAD_FIELDS) {
+    // the format string of a structured message is its text
+    return print_message(decoder, level, thread, time, site->file, site->line, site->format, decoder->data, len);
+  } else if(payload == LOG_PAYLOAD_ARGS) {
+    int text_len = render_log_args(site->format, decoder->data, len, decoder->text, decoder->text_cap);
+    if(text_len >= 0 && (size_t)text_len >= decoder->text_cap) {
+      if(reserve_buffer(&decoder->text, &decoder->text_cap, (size_t)text_len + 1) != 0) {
+	return -1;
+      }
+      text_len = render_log_args(site->format, decoder->data, len, decoder->text, decoder->text_cap);
+    }
+    if(text_len < 0) {
+      fprintf(stderr, "arguments do not match format '%s'\n", site->format);
+      return -1;
+    }
+    text = decoder->text;
+  } else if(payload != LOG_PAYLOAD_TEXT) {
+    fprintf(stderr, "unknown payload %d\n", (int)payload);
+    return -1;
+  }
+  return print_message(decoder, level, thread, time, site->file, site->line, text, NULL, 0);
+}
+
+/**
+ * Reads and prints a text record
+ * \param decoder the decoder
+ * \param file the input file
+ * \return 0 on success, -1 on failure
+ */
+static int decode_text(struct decoder * decoder, FILE * file) {
+  uint8_t level;
+  uint32_t thread;
+  int64_t time;
+  int32_t line;
+  uint32_t len;
+  if(read_bytes(file, &level, sizeof(level)) != 0
+     || read_bytes(file, &thread, sizeof(thread)) != 0
+     || read_bytes(file, &time, sizeof(time)) != 0
+     || read_bytes(file, &line, sizeof(line)) != 0) {
+    return -1;
+  }
+  char * source = read_string(file);
+  if(source == NULL) {
+    return -1;
+  }
+  int result = read_message_data(decoder, file, &len);
+  if(result == 0) {
+    result = print_message(decoder, level, thread, time, source, line, decoder->data, NULL, 0);
+  }
+  free(source);
+  return result;
+}
+
+/**
+ * Decodes a binary log file
+ * \param decoder the decoder
+ * \param file the input file
+ * \return 0 on success, -1 on failure
+ */
+static int decode_file(struct decoder * decoder, FILE * file) {
+  char magic[LOG_BINARY_MAGIC_LENGTH];
+  uint32_t version;
+  if(read_bytes(file, magic, sizeof(magic)) != 0
+     || memcmp(magic, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH) != 0
+     || read_bytes(file, &version, sizeof(version)) != 0
+     || version != LOG_BINARY_VERSION) {
+    fputs("not a binary log file\n", stderr);
+    return -1;
+  }
+
+  int type;
+  while((type = fgetc(file)) != EOF) {
+    int result;
+    switch(type) {
+    case LOG_RECORD_SITE:
+      result = decode_site(decoder, file);
+      break;
+    case LOG_RECORD_MESSAGE:
+      result = decode_message(decoder, file);
+      break;
+    case LOG_RECORD_TEXT:
+      result = decode_text(decoder, file);
+      break;
+    default:
+      fprintf(stderr, "unknown record type %d\n", type);
+      result = -1;
+    }
+    if(result != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if all files were decoded, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, char * args[]) {
+  struct decoder decoder = { NULL, 0, NULL, 0, NULL, 0, NULL, 0, false, NULL, 0 };
+  int result = 0;
+
+  decoder.filters = (char **)malloc((size_t)arg_count * sizeof(char *));
+  if(decoder.filters == NULL) {
+    return EXIT_FAILURE;
+  }
+  int option;
+  while((option = getopt(arg_count, args, "jf:")) != -1) {
+    if(option == 'j') {
+      decoder.json = true;
+    } else if(option == 'f' && strchr(optarg, '=') != NULL) {
+      decoder.filters[decoder.filter_len++] = optarg;
+    } else {
+      fputs("usage: log_decode [-j] [-f key=value]... [file...]\n", stderr);
+      free(decoder.filters);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(optind == arg_count) {
+    result = decode_file(&decoder, stdin);
+  }
+  for(int i = optind; i < arg_count; ++i) {
+    FILE * file = fopen(args[i], "rb");
+    if(file == NULL) {
+      fprintf(stderr, "could not open '%s'\n", args[i]);
+      result = -1;
+      continue;
+    }
+    // call site identifiers are only unique within a file
+    for(size_t j = 0; j < decoder.site_cap; ++j) {
+      free(decoder.sites[j].file);
+      free(decoder.sites[j].format);
+      decoder.sites[j].file = NULL;
+      decoder.sites[j].format = NULL;
+    }
+    if(decode_file(&decoder, file) != 0) {
+      fprintf(stderr, "could not decode '%s'\n", args[i]);
+      result = -1;
+    }
+    fclose(file);
+  }
+
+  for(size_t i = 0; i < decoder.site_cap; ++i) {
+    free(decoder.sites[i].file);
+    free(decoder.sites[i].format);
+  }
+  free(decoder.sites);
+  free(decoder.data);
+  free(decoder.text);
+  free(decoder.fields);
+  free(decoder.filters);
+
+  if(result == 0) {
+    return EXIT_SUCCESS;
+  } else {
+    return EXIT_FAILURE;
+  }
+}
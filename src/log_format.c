@@ -0,0 +1,798 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#include "log_format.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The maximum length of a single conversion specification, after expanding '*'
+ */
+#define MAX_SPEC_LENGTH 64
+
+/**
+ * The length stored for a NULL string argument
+ */
+#define NULL_STRING_LENGTH UINT32_MAX
+
+/**
+ * The length modifiers of a conversion specification
+ */
+enum log_length {
+		 LOG_LENGTH_NONE,
+		 LOG_LENGTH_CHAR,
+		 LOG_LENGTH_SHORT,
+		 LOG_LENGTH_LONG,
+		 LOG_LENGTH_LONG_LONG,
+		 LOG_LENGTH_INTMAX,
+		 LOG_LENGTH_SIZE,
+		 LOG_LENGTH_PTRDIFF,
+		 LOG_LENGTH_LONG_DOUBLE
+};
+
+/**
+ * A parsed conversion specification
+ */
+struct log_spec {
+
+  /**
+   * The first character of the specification, the '%'
+   */
+  const char * start;
+
+  /**
+   * One past the last character of the specification
+   */
+  const char * end;
+
+  /**
+   * The number of '*' in the specification, each consuming an int argument
+   */
+  int stars;
+
+  /**
+   * Whether the specification has a precision
+   */
+  bool precision;
+
+  /**
+   * The kind of the converted argument
+   */
+  enum log_arg_kind kind;
+};
+
+/**
+ * Prefixes for log level messages
+ */
+static const char * log_level_labels[] = {
+					  "DEBUG:  ",
+					  "INFO:   ",
+					  "WARNING:",
+					  "ERROR:  "
+};
+
+/**
+ * Names of the log levels
+ */
+static const char * log_level_names[] = {
+					 "DEBUG",
+					 "INFO",
+					 "WARNING",
+					 "ERROR"
+};
+
+/**
+ * Returns the argument kind of an integer conversion
+ * \param length the length modifier
+ * \return the kind
+ */
+static enum log_arg_kind get_integer_kind(enum log_length length) {
+  switch(length) {
+  case LOG_LENGTH_LONG:
+    return LOG_ARG_LONG;
+  case LOG_LENGTH_LONG_LONG:
+    return LOG_ARG_LONG_LONG;
+  case LOG_LENGTH_INTMAX:
+    return LOG_ARG_INTMAX;
+  case LOG_LENGTH_SIZE:
+    return LOG_ARG_SIZE;
+  case LOG_LENGTH_PTRDIFF:
+    return LOG_ARG_PTRDIFF;
+  default:
+    return LOG_ARG_INT;
+  }
+}
+
+/**
+ * Parses the conversion specification starting at a '%'
+ * \param start the '%'
+ * \param spec receives the specification
+ * \return 1 for a conversion consuming an argument, 0 for "%%", -1 if it can not be captured
+ */
+static int parse_log_spec(const char * start, struct log_spec * spec) {
+  assert(*start == '%');
+
+  const char * c = start + 1;
+  spec->start = start;
+  spec->stars = 0;
+  spec->precision = false;
+  if(*c == '%') {
+    spec->end = c + 1;
+    return 0;
+  }
+
+  while(*c == '-' || *c == '+' || *c == ' ' || *c == '#' || *c == '0' || *c == '\'') {
+    ++c;
+  }
+  if(*c == '*') {
+    ++spec->stars;
+    ++c;
+  } else {
+    while(*c >= '0' && *c <= '9') {
+      ++c;
+    }
+    if(*c == '$') {
+      // positional arguments are not supported
+      return -1;
+    }
+  }
+  if(*c == '.') {
+    spec->precision = true;
+    ++c;
+    if(*c == '*') {
+      ++spec->stars;
+      ++c;
+    } else {
+      while(*c >= '0' && *c <= '9') {
+	++c;
+      }
+    }
+  }
+
+  enum log_length length = LOG_LENGTH_NONE;
+  switch(*c) {
+  case 'h':
+    ++c;
+    if(*c == 'h') {
+      ++c;
+      length = LOG_LENGTH_CHAR;
+    } else {
+      length = LOG_LENGTH_SHORT;
+    }
+    break;
+  case 'l':
+    ++c;
+    if(*c == 'l') {
+      ++c;
+      length = LOG_LENGTH_LONG_LONG;
+    } else {
+      length = LOG_LENGTH_LONG;
+    }
+    break;
+  case 'q':
+    ++c;
+    length = LOG_LENGTH_LONG_LONG;
+    break;
+  case 'j':
+    ++c;
+    length = LOG_LENGTH_INTMAX;
+    break;
+  case 'z':
+    ++c;
+    length = LOG_LENGTH_SIZE;
+    break;
+  case 't':
+    ++c;
+    length = LOG_LENGTH_PTRDIFF;
+    break;
+  case 'L':
+    ++c;
+    length = LOG_LENGTH_LONG_DOUBLE;
+    break;
+  }
+
+  switch(*c) {
+  case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+    spec->kind = get_integer_kind(length);
+    break;
+  case 'c':
+    if(length != LOG_LENGTH_NONE) {
+      return -1;
+    }
+    spec->kind = LOG_ARG_INT;
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    spec->kind = length == LOG_LENGTH_LONG_DOUBLE ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+    break;
+  case 's':
+    if(length != LOG_LENGTH_NONE) {
+      return -1;
+    }
+    spec->kind = LOG_ARG_STRING;
+    break;
+  case 'p':
+    spec->kind = LOG_ARG_POINTER;
+    break;
+  default:
+    // %n, %m, wide characters and anything unknown
+    return -1;
+  }
+  spec->end = c + 1;
+  return 1;
+}
+
+const char * get_log_level_label(enum log_level level) {
+  return log_level_labels[(size_t)level];
+}
+
+const char * get_log_level_name(enum log_level level) {
+  return log_level_names[(size_t)level];
+}
+
+void format_log_time(long long time, char * buffer) {
+  assert(buffer != NULL);
+
+  time_t second = (time_t)(time / 1000000000LL);
+  long long nanoseconds = time % 1000000000LL;
+  if(nanoseconds < 0) {
+    nanoseconds += 1000000000LL;
+    --second;
+  }
+  struct tm local;
+  localtime_r(&second, &local);
+  strftime(buffer, LOG_TIME_LENGTH + 1, "%Y-%m-%d %H:%M:%S", &local);
+  snprintf(buffer + LOG_TIME_LENGTH - 7, 8, ".%06ld", (long)(nanoseconds / 1000));
+}
+
+int parse_log_format(const char * format, unsigned char * kinds) {
+  assert(format != NULL);
+  assert(kinds != NULL);
+
+  int count = 0;
+  for(const char * c = format; *c != '\0';) {
+    if(*c != '%') {
+      ++c;
+      continue;
+    }
+    struct log_spec spec;
+    int result = parse_log_spec(c, &spec);
+    if(result < 0 || count + spec.stars + result > LOG_SITE_MAX_ARGS) {
+      return -1;
+    }
+    if(result != 0 && spec.kind == LOG_ARG_STRING && spec.precision) {
+      // the string may not be NUL terminated within its precision, capturing it could read past its end
+      return -1;
+    }
+    for(int i = 0; i < spec.stars; ++i) {
+      kinds[count++] = LOG_ARG_INT;
+    }
+    if(result != 0) {
+      kinds[count++] = (unsigned char)spec.kind;
+    }
+    c = spec.end;
+  }
+  return count;
+}
+
+/**
+ * Appends bytes to a capture buffer if they fit
+ * \param buffer the buffer
+ * \param cap the capacity of the buffer
+ * \param len the number of bytes needed so far
+ * \param data the bytes
+ * \param size the number of bytes
+ * \return the number of bytes needed including these
+ */
+static size_t append_log_arg(char * buffer, size_t cap, size_t len, const void * data, size_t size) {
+  if(len + size <= cap) {
+    memcpy(buffer + len, data, size);
+  }
+  return len + size;
+}
+
+size_t capture_log_args(const unsigned char * kinds, int count, va_list args, char * buffer, size_t cap) {
+  assert(kinds != NULL);
+
+  size_t len = 0;
+  for(int i = 0; i < count; ++i) {
+    switch((enum log_arg_kind)kinds[i]) {
+    case LOG_ARG_INT: {
+      int value = va_arg(args, int);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_LONG: {
+      long value = va_arg(args, long);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_LONG_LONG: {
+      long long value = va_arg(args, long long);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_INTMAX: {
+      intmax_t value = va_arg(args, intmax_t);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_SIZE: {
+      size_t value = va_arg(args, size_t);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_PTRDIFF: {
+      ptrdiff_t value = va_arg(args, ptrdiff_t);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_DOUBLE: {
+      double value = va_arg(args, double);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_LONG_DOUBLE: {
+      long double value = va_arg(args, long double);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    case LOG_ARG_STRING: {
+      const char * value = va_arg(args, const char *);
+      uint32_t size = value == NULL ? NULL_STRING_LENGTH : (uint32_t)strlen(value);
+      len = append_log_arg(buffer, cap, len, &size, sizeof(size));
+      if(value != NULL) {
+	len = append_log_arg(buffer, cap, len, value, (size_t)size + 1);
+      }
+      break;
+    }
+    case LOG_ARG_POINTER: {
+      void * value = va_arg(args, void *);
+      len = append_log_arg(buffer, cap, len, &value, sizeof(value));
+      break;
+    }
+    }
+  }
+  return len;
+}
+
+/**
+ * Takes the next captured argument
+ * \param args the captured bytes
+ * \param args_len the number of captured bytes
+ * \param offset the offset of the argument, moved past it
+ * \param value receives the bytes of the argument
+ * \param size the size of the argument
+ * \return 0 on success, -1 if the captured bytes are too short
+ */
+static int take_log_arg(const char * args, size_t args_len, size_t * offset, void * value, size_t size) {
+  if(*offset + size > args_len) {
+    return -1;
+  }
+  memcpy(value, args + *offset, size);
+  *offset += size;
+  return 0;
+}
+
+/**
+ * Renders a single conversion specification with its captured argument
+ * \param spec the specification
+ * \param args the captured bytes
+ * \param args_len the number of captured bytes
+ * \param offset the offset of the next argument, moved past the arguments of the specification
+ * \param buffer the buffer receiving the text or NULL
+ * \param cap the capacity of the buffer
+ * \return the length of the text or -1 on error
+ */
+static int render_log_spec(const struct log_spec * spec, const char * args, size_t args_len, size_t * offset, char * buffer, size_t cap) {
+  // copy the specification, replacing every '*' by the captured int
+  char format[MAX_SPEC_LENGTH];
+  size_t len = 0;
+  for(const char * c = spec->start; c != spec->end; ++c) {
+    int written;
+    if(*c == '*') {
+      int value;
+      if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+	return -1;
+      }
+      written = snprintf(format + len, MAX_SPEC_LENGTH - len, "%d", value);
+    } else {
+      written = snprintf(format + len, MAX_SPEC_LENGTH - len, "%c", *c);
+    }
+    if(written < 0 || len + (size_t)written >= MAX_SPEC_LENGTH) {
+      return -1;
+    }
+    len += (size_t)written;
+  }
+
+  switch(spec->kind) {
+  case LOG_ARG_INT: {
+    int value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_LONG: {
+    long value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_LONG_LONG: {
+    long long value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_INTMAX: {
+    intmax_t value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_SIZE: {
+    size_t value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_PTRDIFF: {
+    ptrdiff_t value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_DOUBLE: {
+    double value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_LONG_DOUBLE: {
+    long double value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_STRING: {
+    uint32_t size;
+    if(take_log_arg(args, args_len, offset, &size, sizeof(size)) != 0) {
+      return -1;
+    }
+    const char * value = NULL;
+    if(size != NULL_STRING_LENGTH) {
+      if(*offset + size + 1 > args_len || args[*offset + size] != '\0') {
+	return -1;
+      }
+      value = args + *offset;
+      *offset += (size_t)size + 1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  case LOG_ARG_POINTER: {
+    void * value;
+    if(take_log_arg(args, args_len, offset, &value, sizeof(value)) != 0) {
+      return -1;
+    }
+    return snprintf(buffer, cap, format, value);
+  }
+  }
+  return -1;
+}
+
+int render_log_args(const char * format, const char * args, size_t args_len, char * buffer, size_t cap) {
+  assert(format != NULL);
+
+  size_t len = 0;
+  size_t offset = 0;
+  const char * c = format;
+  while(*c != '\0') {
+    const char * literal = c;
+    while(*c != '\0' && *c != '%') {
+      ++c;
+    }
+    size_t literal_len = (size_t)(c - literal);
+    if(len < cap) {
+      memcpy(buffer + len, literal, len + literal_len < cap ? literal_len : cap - len);
+    }
+    len += literal_len;
+    if(*c == '\0') {
+      break;
+    }
+
+    struct log_spec spec;
+    int result = parse_log_spec(c, &spec);
+    if(result < 0) {
+      return -1;
+    }
+    if(result == 0) {
+      if(len < cap) {
+	buffer[len] = '%';
+      }
+      ++len;
+    } else {
+      int written = render_log_spec(&spec, args, args_len, &offset, len < cap ? buffer + len : NULL, len < cap ? cap - len : 0);
+      if(written < 0) {
+	return -1;
+      }
+      len += (size_t)written;
+    }
+    c = spec.end;
+  }
+
+  if(cap != 0) {
+    buffer[len < cap ? len : cap - 1] = '\0';
+  }
+  return (int)len;
+}
+
+/**
+ * Appends a varint to a capture buffer if it fits
+ * \param buffer the buffer
+ * \param cap the capacity of the buffer
+ * \param len the number of bytes needed so far
+ * \param value the value
+ * \return the number of bytes needed including the varint
+ */
+static size_t append_log_varint(char * buffer, size_t cap, size_t len, unsigned long long value) {
+  unsigned char bytes[10];
+  size_t size = 0;
+  do {
+    bytes[size] = (unsigned char)(value & 0x7f);
+    value >>= 7;
+    if(value != 0) {
+      bytes[size] |= 0x80;
+    }
+    ++size;
+  } while(value != 0);
+  return append_log_arg(buffer, cap, len, bytes, size);
+}
+
+/**
+ * Reads a varint from encoded bytes
+ * \param data the bytes
+ * \param len the number of bytes
+ * \param offset the offset of the varint, moved past it
+ * \param value receives the value
+ * \return 0 on success, -1 if the bytes are too short or the varint too long
+ */
+static int take_log_varint(const char * data, size_t len, size_t * offset, unsigned long long * value) {
+  *value = 0;
+  for(unsigned int shift = 0; shift < 64; shift += 7) {
+    if(*offset >= len) {
+      return -1;
+    }
+    unsigned char byte = (unsigned char)data[(*offset)++];
+    *value |= (unsigned long long)(byte & 0x7f) << shift;
+    if((byte & 0x80) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+size_t encode_log_fields(const struct log_field * fields, size_t field_len, char * buffer, size_t cap, size_t * len) {
+  assert(fields != NULL || field_len == 0);
+  assert(len != NULL);
+
+  size_t size = 0;
+  *len = 0;
+  for(size_t i = 0; i < field_len; ++i) {
+    const struct log_field * field = fields + i;
+    if((unsigned int)field->type > LOG_FIELD_ENTITY) {
+      continue;
+    }
+    size_t key_len = strlen(field->key);
+    unsigned char header[2] = { (unsigned char)field->type, (unsigned char)(key_len < LOG_FIELD_MAX_KEY_LENGTH ? key_len : LOG_FIELD_MAX_KEY_LENGTH) };
+    size = append_log_arg(buffer, cap, size, header, sizeof(header));
+    size = append_log_arg(buffer, cap, size, field->key, header[1]);
+    switch(field->type) {
+    case LOG_FIELD_INT: {
+      unsigned long long value = (unsigned long long)field->value.integer;
+      // zigzag, so small negative numbers stay short
+      size = append_log_varint(buffer, cap, size, value << 1 ^ (field->value.integer < 0 ? ~0ULL : 0ULL));
+      break;
+    }
+    case LOG_FIELD_FLOAT:
+      size = append_log_arg(buffer, cap, size, &field->value.real, sizeof(double));
+      break;
+    case LOG_FIELD_STRING: {
+      const char * string = field->value.string != NULL ? field->value.string : "";
+      size_t string_len = strlen(string);
+      size = append_log_varint(buffer, cap, size, string_len);
+      size = append_log_arg(buffer, cap, size, string, string_len);
+      break;
+    }
+    case LOG_FIELD_ENTITY:
+      size = append_log_varint(buffer, cap, size, field->value.entity);
+      break;
+    }
+    if(size <= cap) {
+      *len = size;
+    }
+  }
+  return size;
+}
+
+int decode_log_field(const char * data, size_t len, size_t * offset, struct log_field_view * field) {
+  assert(offset != NULL);
+  assert(field != NULL);
+
+  if(*offset >= len) {
+    return 0;
+  }
+  unsigned char header[2];
+  if(take_log_arg(data, len, offset, header, sizeof(header)) != 0 || header[1] > len - *offset) {
+    return -1;
+  }
+  field->type = (enum log_field_type)header[0];
+  field->key = data + *offset;
+  field->key_len = header[1];
+  field->string = NULL;
+  field->string_len = 0;
+  *offset += header[1];
+
+  unsigned long long value;
+  switch(header[0]) {
+  case LOG_FIELD_INT:
+    if(take_log_varint(data, len, offset, &value) != 0) {
+      return -1;
+    }
+    field->value.integer = (long long)(value >> 1) ^ -(long long)(value & 1);
+    return 1;
+  case LOG_FIELD_FLOAT:
+    return take_log_arg(data, len, offset, &field->value.real, sizeof(double)) == 0 ? 1 : -1;
+  case LOG_FIELD_STRING:
+    if(take_log_varint(data, len, offset, &value) != 0 || value > len - *offset) {
+      return -1;
+    }
+    field->string = data + *offset;
+    field->string_len = (size_t)value;
+    *offset += (size_t)value;
+    return 1;
+  case LOG_FIELD_ENTITY:
+    return take_log_varint(data, len, offset, &field->value.entity) == 0 ? 1 : -1;
+  }
+  return -1;
+}
+
+size_t get_log_fields_prefix(const char * data, size_t len, size_t cap) {
+  size_t offset = 0;
+  size_t prefix = 0;
+  struct log_field_view field;
+  while(decode_log_field(data, len, &offset, &field) == 1 && offset <= cap) {
+    prefix = offset;
+  }
+  return prefix;
+}
+
+/**
+ * Appends bytes to a text buffer, as far as they fit
+ * \param buffer the buffer or NULL
+ * \param cap the capacity of the buffer
+ * \param len the length of the text so far
+ * \param data the bytes
+ * \param size the number of bytes
+ * \return the length of the text including the bytes
+ */
+static size_t append_log_chars(char * buffer, size_t cap, size_t len, const char * data, size_t size) {
+  if(len < cap) {
+    memcpy(buffer + len, data, len + size < cap ? size : cap - len);
+  }
+  return len + size;
+}
+
+/**
+ * Appends a string to a text buffer in double quotes, escaped like a JSON string
+ * \param buffer the buffer or NULL
+ * \param cap the capacity of the buffer
+ * \param len the length of the text so far
+ * \param string the string
+ * \param size the length of the string
+ * \return the length of the text including the quoted string
+ */
+static size_t append_log_quoted(char * buffer, size_t cap, size_t len, const char * string, size_t size) {
+  len = append_log_chars(buffer, cap, len, "\"", 1);
+  for(size_t i = 0; i < size; ++i) {
+    unsigned char c = (unsigned char)string[i];
+    char escape[7];
+    if(c == '"' || c == '\\') {
+      escape[0] = '\\';
+      escape[1] = (char)c;
+      len = append_log_chars(buffer, cap, len, escape, 2);
+    } else if(c < 0x20) {
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      len = append_log_chars(buffer, cap, len, escape, 6);
+    } else {
+      len = append_log_chars(buffer, cap, len, string + i, 1);
+    }
+  }
+  return append_log_chars(buffer, cap, len, "\"", 1);
+}
+
+int render_log_field_value(const struct log_field_view * field, bool json, char * buffer, size_t cap) {
+  assert(field != NULL);
+
+  switch(field->type) {
+  case LOG_FIELD_INT:
+    return snprintf(buffer, cap, "%lld", field->value.integer);
+  case LOG_FIELD_FLOAT:
+    if(json && !isfinite(field->value.real)) {
+      return snprintf(buffer, cap, "null");
+    }
+    // enough digits for the numbers a game logs, without the noise of exact round trips
+    return snprintf(buffer, cap, "%.15g", field->value.real);
+  case LOG_FIELD_STRING: {
+    size_t len = append_log_quoted(buffer, cap, 0, field->string, field->string_len);
+    if(cap != 0) {
+      buffer[len < cap ? len : cap - 1] = '\0';
+    }
+    return (int)len;
+  }
+  case LOG_FIELD_ENTITY:
+    return snprintf(buffer, cap, "%llu", field->value.entity);
+  }
+  return -1;
+}
+
+int render_log_fields(const char * data, size_t len, bool json, char * buffer, size_t cap) {
+  size_t text_len = 0;
+  size_t offset = 0;
+  struct log_field_view field;
+  int result;
+  while((result = decode_log_field(data, len, &offset, &field)) == 1) {
+    if(json) {
+      const char * separator = text_len == 0 ? ",\"fields\":{" : ",";
+      text_len = append_log_chars(buffer, cap, text_len, separator, strlen(separator));
+      text_len = append_log_quoted(buffer, cap, text_len, field.key, field.key_len);
+      text_len = append_log_chars(buffer, cap, text_len, ":", 1);
+    } else {
+      text_len = append_log_chars(buffer, cap, text_len, " ", 1);
+      text_len = append_log_chars(buffer, cap, text_len, field.key, field.key_len);
+      text_len = append_log_chars(buffer, cap, text_len, "=", 1);
+    }
+    int written = render_log_field_value(&field, json, text_len < cap ? buffer + text_len : NULL, text_len < cap ? cap - text_len : 0);
+    if(written < 0) {
+      return -1;
+    }
+    text_len += (size_t)written;
+  }
+  if(result < 0) {
+    return -1;
+  }
+  if(json && text_len != 0) {
+    text_len = append_log_chars(buffer, cap, text_len, "}", 1);
+  }
+
+  if(cap != 0) {
+    buffer[text_len < cap ? text_len : cap - 1] = '\0';
+  }
+  return (int)text_len;
+}
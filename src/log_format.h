@@ -0,0 +1,312 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Capturing and rendering of printf style log arguments, used to format log messages
+ * away from the thread that logs them
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include "logger.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The magic bytes at the start of a binary log file
+ */
+#define LOG_BINARY_MAGIC "GUARDLOG"
+
+/**
+ * The length of the magic bytes
+ */
+#define LOG_BINARY_MAGIC_LENGTH 8
+
+/**
+ * The version of the binary log file layout, stored as a uint32_t after the magic bytes
+ */
+#define LOG_BINARY_VERSION 3
+
+/**
+ * The length of a time formatted by format_log_time, e.g. "2026-01-31 23:59:59.999999"
+ */
+#define LOG_TIME_LENGTH 26
+
+/**
+ * The record types of a binary log file, each record starts with its type as a single byte
+ * Multi-byte fields are stored in native byte order, so files are decoded on the machine
+ * architecture that wrote them
+ */
+enum log_record_type {
+		      /**
+		       * A call site, written before its first message:
+		       * uint32_t id, int32_t line, uint32_t file length, file, uint32_t format length, format
+		       */
+		      LOG_RECORD_SITE = 1,
+
+		      /**
+		       * A message from a call site:
+		       * uint32_t site id, uint8_t level, uint8_t payload, uint32_t thread, int64_t time,
+		       * uint32_t length, text, captured arguments or fields as told by the payload
+		       */
+		      LOG_RECORD_MESSAGE,
+
+		      /**
+		       * A formatted message without call site:
+		       * uint8_t level, uint32_t thread, int64_t time, int32_t line, uint32_t file length, file,
+		       * uint32_t length, text
+		       */
+		      LOG_RECORD_TEXT
+};
+
+/**
+ * What a message record from a call site holds
+ */
+enum log_payload {
+		  /**
+		   * The formatted text
+		   */
+		  LOG_PAYLOAD_TEXT,
+
+		  /**
+		   * The arguments captured for the format string of the call site
+		   */
+		  LOG_PAYLOAD_ARGS,
+
+		  /**
+		   * Structured fields, the format string of the call site is the text
+		   */
+		  LOG_PAYLOAD_FIELDS
+};
+
+/*
+ * Structured fields are stored one after another as uint8_t type, uint8_t key length, key and
+ * the value: a zigzag encoded varint for LOG_FIELD_INT, a double for LOG_FIELD_FLOAT, a varint
+ * length and the bytes for LOG_FIELD_STRING and a varint for LOG_FIELD_ENTITY. Varints hold 7
+ * bits per byte, lowest first, with the high bit set on all but the last byte.
+ */
+
+/**
+ * A structured field decoded from its binary form, pointing into the encoded bytes
+ */
+struct log_field_view {
+
+  /**
+   * The key, not NUL terminated
+   */
+  const char * key;
+
+  /**
+   * The length of the key
+   */
+  size_t key_len;
+
+  /**
+   * The type of the value
+   */
+  enum log_field_type type;
+
+  /**
+   * The value of anything but a string
+   */
+  union {
+    long long integer;
+    double real;
+    unsigned long long entity;
+  } value;
+
+  /**
+   * The value of a string, not NUL terminated
+   */
+  const char * string;
+
+  /**
+   * The length of a string
+   */
+  size_t string_len;
+};
+
+/*
+ * Times are stored as nanoseconds since the epoch, threads as the small identifiers the logger
+ * assigns to every thread on its first message
+ */
+
+/**
+ * The kinds of captured arguments
+ */
+enum log_arg_kind {
+		   /**
+		    * An int, or a smaller integer promoted to int
+		    */
+		   LOG_ARG_INT,
+
+		   /**
+		    * A long
+		    */
+		   LOG_ARG_LONG,
+
+		   /**
+		    * A long long
+		    */
+		   LOG_ARG_LONG_LONG,
+
+		   /**
+		    * An intmax_t
+		    */
+		   LOG_ARG_INTMAX,
+
+		   /**
+		    * A size_t
+		    */
+		   LOG_ARG_SIZE,
+
+		   /**
+		    * A ptrdiff_t
+		    */
+		   LOG_ARG_PTRDIFF,
+
+		   /**
+		    * A double, or a float promoted to double
+		    */
+		   LOG_ARG_DOUBLE,
+
+		   /**
+		    * A long double
+		    */
+		   LOG_ARG_LONG_DOUBLE,
+
+		   /**
+		    * A NUL terminated string, captured by value
+		    */
+		   LOG_ARG_STRING,
+
+		   /**
+		    * A pointer, captured by address only
+		    */
+		   LOG_ARG_POINTER
+};
+
+/**
+ * Returns the label printed in front of messages of a log level
+ * \param level the log level
+ * \return a string constant
+ */
+const char * get_log_level_label(enum log_level level);
+
+/**
+ * Returns the name of a log level
+ * \param level the log level
+ * \return a string constant
+ */
+const char * get_log_level_name(enum log_level level);
+
+/**
+ * Formats a time as local date and time with microseconds
+ * \param time the time in nanoseconds since the epoch
+ * \param buffer the buffer receiving the text, LOG_TIME_LENGTH + 1 bytes long
+ */
+void format_log_time(long long time, char * buffer);
+
+/**
+ * Parses a format string into the kinds of the arguments it consumes
+ * Strings with a precision can not be captured, they need not be NUL terminated
+ * \param format the format string
+ * \param kinds array receiving the kinds, at least LOG_SITE_MAX_ARGS long
+ * \return the number of arguments, or -1 if the format string can not be captured
+ */
+int parse_log_format(const char * format, unsigned char * kinds);
+
+/**
+ * Captures the arguments of a format string as raw bytes
+ * \param kinds the argument kinds as parsed by parse_log_format
+ * \param count the number of arguments
+ * \param args the arguments
+ * \param buffer the buffer receiving the bytes
+ * \param cap the capacity of the buffer
+ * \return the number of bytes needed, the buffer only holds all of them if this does not exceed cap
+ */
+size_t capture_log_args(const unsigned char * kinds, int count, va_list args, char * buffer, size_t cap);
+
+/**
+ * Renders a format string with captured arguments, like snprintf
+ * \param format the format string the arguments were captured for
+ * \param args the captured bytes
+ * \param args_len the number of captured bytes
+ * \param buffer the buffer receiving the text
+ * \param cap the capacity of the buffer
+ * \return the length of the text, which only fits in the buffer if it is less than cap, or -1 on error
+ */
+int render_log_args(const char * format, const char * args, size_t args_len, char * buffer, size_t cap);
+
+/**
+ * Encodes structured fields in their binary form
+ * \param fields the fields
+ * \param field_len the number of fields
+ * \param buffer the buffer receiving the bytes
+ * \param cap the capacity of the buffer
+ * \param len receives the number of bytes of the leading fields that fit in the buffer whole
+ * \return the number of bytes needed for all fields
+ */
+size_t encode_log_fields(const struct log_field * fields, size_t field_len, char * buffer, size_t cap, size_t * len);
+
+/**
+ * Decodes the next structured field
+ * \param data the encoded fields
+ * \param len the number of encoded bytes
+ * \param offset the offset of the field, moved past it
+ * \param field receives the field
+ * \return 1 if a field was decoded, 0 at the end of the fields or -1 if they are malformed
+ */
+int decode_log_field(const char * data, size_t len, size_t * offset, struct log_field_view * field);
+
+/**
+ * Returns the number of bytes of the leading structured fields that fit in a buffer whole
+ * \param data the encoded fields
+ * \param len the number of encoded bytes
+ * \param cap the capacity of the buffer
+ * \return the number of bytes
+ */
+size_t get_log_fields_prefix(const char * data, size_t len, size_t cap);
+
+/**
+ * Renders the value of a structured field, like snprintf
+ * Strings are quoted and escaped like JSON strings, numbers that JSON can not represent
+ * become null for JSON
+ * \param field the field
+ * \param json whether the value is rendered for JSON
+ * \param buffer the buffer receiving the text or NULL
+ * \param cap the capacity of the buffer
+ * \return the length of the text, which only fits in the buffer if it is less than cap, or -1 on error
+ */
+int render_log_field_value(const struct log_field_view * field, bool json, char * buffer, size_t cap);
+
+/**
+ * Renders structured fields, like snprintf
+ * As text, each field is a space followed by key=value, for JSON the fields are a "fields"
+ * object member after a comma, nothing without fields
+ * \param data the encoded fields
+ * \param len the number of encoded bytes
+ * \param json whether the fields are rendered for JSON
+ * \param buffer the buffer receiving the text
+ * \param cap the capacity of the buffer
+ * \return the length of the text, which only fits in the buffer if it is less than cap, or -1 on error
+ */
+int render_log_fields(const char * data, size_t len, bool json, char * buffer, size_t cap);
+
+#endif
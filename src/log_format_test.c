@@ -0,0 +1,129 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Tests capturing and rendering log arguments, alone and through deferred formatting of the logger
+ */
+
+#include "log_format.h"
+#include "logger.h"
+#include "test.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+/**
+ * The size of the capture and render buffers
+ */
+#define BUFFER_SIZE 256
+
+/**
+ * Captures arguments and renders them again
+ * \param buffer the buffer receiving the text, BUFFER_SIZE bytes long
+ * \param format the format string
+ * \param ... the arguments
+ * \return the length of the text or -1 if the format can not be captured or on failure
+ */
+static int capture_and_render(char * buffer, const char * format, ...) {
+  unsigned char kinds[LOG_SITE_MAX_ARGS];
+  int count = parse_log_format(format, kinds);
+  if(count < 0) {
+    return -1;
+  }
+  char args[BUFFER_SIZE];
+  va_list list;
+  va_start(list, format);
+  size_t len = capture_log_args(kinds, count, list, args, BUFFER_SIZE);
+  va_end(list);
+  if(len > BUFFER_SIZE) {
+    return -1;
+  }
+  return render_log_args(format, args, len, buffer, BUFFER_SIZE);
+}
+
+/**
+ * Checks which formats get captured
+ */
+static void test_parse() {
+  unsigned char kinds[LOG_SITE_MAX_ARGS];
+  CHECK(parse_log_format("no arguments 100%%", kinds) == 0);
+  CHECK(parse_log_format("%d %s %5s %-8s", kinds) == 4);
+  CHECK(kinds[1] == LOG_ARG_STRING);
+  CHECK(parse_log_format("%*d %.*f %.3f", kinds) == 5);
+  CHECK(kinds[0] == LOG_ARG_INT && kinds[1] == LOG_ARG_INT && kinds[2] == LOG_ARG_INT && kinds[3] == LOG_ARG_DOUBLE);
+  CHECK(parse_log_format("%zu %lld %Lf %p", kinds) == 4);
+  CHECK(kinds[0] == LOG_ARG_SIZE && kinds[1] == LOG_ARG_LONG_LONG && kinds[2] == LOG_ARG_LONG_DOUBLE && kinds[3] == LOG_ARG_POINTER);
+  // strings with a precision need not be NUL terminated
+  CHECK(parse_log_format("%.*s", kinds) == -1);
+  CHECK(parse_log_format("%.3s", kinds) == -1);
+  CHECK(parse_log_format("%8.3s", kinds) == -1);
+  CHECK(parse_log_format("%n", kinds) == -1);
+  CHECK(parse_log_format("%1$d", kinds) == -1);
+  CHECK(parse_log_format("%ls", kinds) == -1);
+}
+
+/**
+ * Checks captured arguments render like snprintf
+ */
+static void test_render() {
+  char buffer[BUFFER_SIZE];
+  CHECK(capture_and_render(buffer, "%d %5s|%-4s|", -12, "ab", "c") == 15);
+  CHECK(strcmp(buffer, "-12    ab|c   |") == 0);
+  CHECK(capture_and_render(buffer, "%*d %.*f %zu", 4, 7, 2, 1.5, (size_t)42) == 12);
+  CHECK(strcmp(buffer, "   7 1.50 42") == 0);
+  CHECK(capture_and_render(buffer, "%s", (const char *)NULL) >= 0);
+  const char unterminated[3] = { 'a', 'b', 'c' };
+  CHECK(capture_and_render(buffer, "%.*s", 3, unterminated) == -1);
+}
+
+/**
+ * Checks a string with a precision that is not NUL terminated is logged with deferred formatting
+ */
+static void test_deferred_precision() {
+  FILE * file = tmpfile();
+  CHECK(file != NULL);
+  if(file == NULL) {
+    return;
+  }
+  CHECK(init_logger(LOG_LEVEL_DEBUG) == 0);
+  CHECK(add_logger_output(file) == 0);
+  set_log_formatting(LOG_FORMATTING_DEFERRED);
+  CHECK(start_logger() == 0);
+  const char unterminated[3] = { 'a', 'b', 'c' };
+  LOG_INFO("bounded '%.*s' '%.2s'", 3, unterminated, unterminated);
+  LOG_INFO("captured '%s' %d", "text", 5);
+  CHECK(stop_logger() == 0);
+  dispose_logger();
+
+  char text[4 * BUFFER_SIZE];
+  rewind(file);
+  size_t len = fread(text, 1, sizeof(text) - 1, file);
+  text[len] = '\0';
+  fclose(file);
+  CHECK(strstr(text, "bounded 'abc' 'ab'") != NULL);
+  CHECK(strstr(text, "captured 'text' 5") != NULL);
+}
+
+/**
+ * Main function
+ * \return EXIT_SUCCESS if all checks pass, EXIT_FAILURE otherwise
+ */
+int main() {
+  test_parse();
+  test_render();
+  test_deferred_precision();
+  return TEST_RESULT();
+}
@@ -14,40 +14,189 @@
  * 
  */
 
+// for thread affinity and the SCHED_BATCH and SCHED_IDLE policies
+#define _GNU_SOURCE
+
+#include "config.h"
+
 #include "logger.h"
+#include "log_format.h"
+#include "profiler.h"
 
 #include <assert.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+/**
+ * The default maximum size of a message
+ */
+#define DEFAULT_LOG_MAX_MSG_SIZE 512
+
+/**
+ * The default maximum number of bytes used for queued messages
+ */
+#define DEFAULT_LOG_MEMORY_LIMIT 4194304
+
+/**
+ * The number of bytes stored inline in a message, filling its slot up to three cache lines
+ */
+#define LOG_MSG_INLINE_SIZE 104
+
+/**
+ * The maximum number of size classes of blocks for long messages
+ */
+#define LOG_MAX_SLABS 8
+
+/**
+ * The size of the smallest class of blocks for long messages, each class is four times larger
+ */
+#define LOG_MIN_BLOCK_SIZE 256
+
+/**
+ * Marks the end of a free list and messages stored inline
+ */
+#define LOG_NO_BLOCK UINT32_MAX
+
+/**
+ * The bit set in the position of a cursor while its output reads the messages after it
+ */
+#define LOG_CURSOR_READING ((size_t)1 << (sizeof(size_t) * CHAR_BIT - 1))
+
+/**
+ * The time a producer dropping the oldest messages sleeps before trying again, in nanoseconds
+ */
+#define LOG_DROP_RETRY_INTERVAL 1000000
+
+/**
+ * The maximum number of messages an output worker writes at once
+ */
+#define LOG_BATCH_SIZE 256
+
+/**
+ * The number of times a waiting thread polls before going to sleep
+ */
+#define LOG_SPIN_COUNT 64
+
+/**
+ * The size of a cache line, used to keep state written by different threads apart
+ */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * The initial capacity of the write buffer of an output
+ */
+#define DEFAULT_LOG_OUTPUT_BUFFER_SIZE 65536
+
+/**
+ * The default size threshold for outputs flushing by size
+ */
+#define DEFAULT_LOG_FLUSH_SIZE 65536
+
+/**
+ * The default interval for outputs flushing by time, in milliseconds
+ */
+#define DEFAULT_LOG_FLUSH_INTERVAL 100
+
+/**
+ * The default size of the segment files of file outputs
+ */
+#define DEFAULT_LOG_SEGMENT_SIZE 16777216
+
+/**
+ * The default interval between writebacks of file outputs, in milliseconds
+ */
+#define DEFAULT_LOG_SYNC_INTERVAL 1000
+
+/**
+ * The default compression level, the fastest
+ */
+#define DEFAULT_LOG_COMPRESSION_LEVEL 1
+
+/**
+ * The size of the buffer compressed output goes through
+ */
+#define LOG_COMPRESSED_BUFFER_SIZE 65536
+
+/**
+ * The window bits selecting a gzip stream with the largest window
+ */
+#define LOG_GZIP_WINDOW_BITS (15 + 16)
+
+/**
+ * The bytes a compressed write may add on top of deflateBound, the empty block of a sync flush
+ * and the end of the stream
+ */
+#define LOG_DEFLATE_OVERHEAD 16
+
+/**
+ * The number of registered buffers of an output writing through io_uring, which bounds its
+ * writes in flight
+ */
+#define LOG_URING_BUFFERS 8
 
-#define DEFAULT_LOG_MSG_BUFFER_SIZE 256
+/**
+ * The size of a registered buffer, the initial capacity of the write buffer
+ */
+#define LOG_URING_BUFFER_SIZE DEFAULT_LOG_OUTPUT_BUFFER_SIZE
 
+/**
+ * A message, stored in a slot of the log ring
+ * The fields are ordered so the message fills its slot without padding
+ */
 struct log_msg {
 
-  /**
-   * The log level
-   */
-  enum log_level level;
-  
   /**
    * The file where the message originates from
    */
   const char * file;
 
   /**
-   * The line where the message originates from
+   * The call site of the message or NULL
    */
-  int line;
+  struct log_site * site;
 
   /**
-   * The message buffer
+   * The format string of the message if it comes from a call site
+   */
+  const char * format;
+
+  /**
+   * The message buffer, holding text or captured arguments, either the inline text or a block
    */
   char * buffer;
 
+  /**
+   * The time the message was logged, in ticks of get_log_ticks
+   */
+  unsigned long long time;
+
   /**
    * The buffer capacity
    */
@@ -59,599 +208,3738 @@ struct log_msg {
   size_t len;
 
   /**
-   * Number of writes still to be completed
+   * The log level
    */
-  size_t count;
+  enum log_level level;
 
   /**
-   * A pointer to the next message
+   * The line where the message originates from
    */
-  struct log_msg * next;
+  int line;
 
-};
+  /**
+   * The identifier of the thread that logged the message
+   */
+  unsigned int thread;
 
-/**
- * An entry in a log queue
- */
-struct log_entry {
+  /**
+   * The block holding the message if it is too long to be stored inline, or LOG_NO_BLOCK
+   */
+  uint32_t block;
+
+  /**
+   * The size class of the block
+   */
+  unsigned char slab;
 
   /**
-   * A pointer to a message
+   * What the buffer holds, a log_payload: text, the captured arguments of the format string or
+   * structured fields
    */
-  struct log_msg * msg;
+  unsigned char payload;
 
   /**
-   * The next entry in the queue
+   * Whether the message could not be created and has to be skipped by the outputs
    */
-  struct log_entry * next;
+  bool dropped;
+
+  /**
+   * Storage for short messages, so they are read from the cache lines of their slot
+   */
+  char text[LOG_MSG_INLINE_SIZE];
 };
 
 /**
- * A queue of log messages
+ * A slot in the log ring
  */
-struct log_queue {
+struct log_slot {
 
   /**
-   * The first entry
+   * One more than the position of the last message published in this slot
    */
-  struct log_entry * head;
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t sequence;
 
   /**
-   * The last entry
+   * The message, owned by the slot and reused every time the ring wraps around
    */
-  struct log_entry * tail;
+  struct log_msg msg;
 };
 
+_Static_assert(sizeof(struct log_slot) <= 3 * CACHE_LINE_SIZE || sizeof(void *) < 8, "log slots should span three cache lines");
+
 /**
- * An output channel
+ * A size class of blocks for messages too long to be stored inline
+ * The free blocks form a lock-free stack. A producer takes a block when its message does not
+ * fit in its slot, the block is returned once every output has read the message.
  */
-struct log_output {
-
-  /**
-  * The output file
-  */
-  FILE * file;
+struct log_slab {
 
   /**
-   *  Whether this output should keep running
+   * The free block on top of the stack or LOG_NO_BLOCK in the lower half, a counter bumped on
+   * every change in the upper half, so a stale top never compares equal
    */
-  bool running;
-  
+  _Alignas(CACHE_LINE_SIZE) atomic_ullong free;
+
   /**
-   * The queue of messages to print
+   * The size of the blocks
    */
-  struct log_queue queue;
-  
+  size_t block_size;
+
   /**
-   * Mutex protecting the log queue and the running flag
+   * The number of blocks
    */
-  pthread_mutex_t mutex;
+  uint32_t block_len;
 
   /**
-   * Condition variable to signal the output worker thread
+   * The blocks
    */
-  pthread_cond_t cond;
+  char * blocks;
 
   /**
-   * The worker thread
+   * For each free block, the block below it on the stack or LOG_NO_BLOCK
    */
-  pthread_t thread;
-
+  atomic_uint * next;
 };
 
 /**
- * A ring of available messages
+ * The read position of an output in the log ring
  */
-static struct log_msg * messages;
+struct log_cursor {
 
-/**
- * A linked list of available entries
- */
-static struct log_entry * entries;
+  /**
+   * The next position to be read, with LOG_CURSOR_READING set while the output reads when
+   * producers drop the oldest messages, as they move the cursor forward while it is clear
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t position;
 
-/**
- *  The mutex protecting the available message and entry queue
- */
-static pthread_mutex_t mutex;
+  /**
+   * The number of messages dropped for the output, counted by the producers
+   */
+  atomic_size_t dropped;
+};
 
 /**
- * The minimum log level
+ * A bounded multi-producer ring of messages, broadcast to every output
+ * A slot is reused once the slowest output has read past it. The slots and the blocks for
+ * long messages are allocated with the ring, nothing is allocated while logging.
  */
-static enum log_level min_level;
+struct log_ring {
 
-/**
- * Log output array
- */
-static struct log_output * outputs;
+  /**
+   * The next position to be reserved by a producer
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
 
-/**
- * The number outputs
- */
-static size_t output_len;
+  /**
+   * The position up to which every output has read the messages and their blocks have been
+   * returned, producers reuse slots below it
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t gate;
 
-/**
- * The capacity of the output buffer
- */
-static size_t output_cap;
+  /**
+   * Whether a thread is moving the gate
+   */
+  atomic_bool reclaiming;
 
-/**
- * Prefixes for log level messages
- */
-static const char * log_level_labels[] = {
-					  "DEBUG:  ",
-					  "INFO:   ",
-					  "WARNING:",
-					  "ERROR:  "
-};
+  /**
+   * Futex word outputs sleep on while they have nothing to read, bumped by producers on wakeup
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_uint published;
 
+  /**
+   * The number of outputs sleeping on the published futex
+   */
+  atomic_uint consumers_sleeping;
 
-/*
- * Log message / entry functions
- */
+  /**
+   * Whether the outputs should keep running
+   */
+  atomic_bool running;
 
-/**
- * Destroys these entries, without destroying the message
- * \param head the first entry or NULL
- */
-static void destroy_log_entries(struct log_entry * head) {
-  while(head != NULL) {
-    struct log_entry * next = head->next;
-    free(head);
-    head = next;
-  }
-}
+  /**
+   * Futex word producers sleep on while the ring is full, bumped by the outputs on wakeup
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_uint space;
 
-/**
- * Destroys these messages
- * \param head the first message
- */
-static void destroy_log_messages(struct log_msg * head) {
-  while(head != NULL) {
-    struct log_msg * next = head->next;
-    if(head->buffer != NULL) {
-      free(head->buffer);
-    }
-    free(head);
-    head = next;
-  }
-}
+  /**
+   * The number of producers sleeping on the space futex
+   */
+  atomic_uint producers_sleeping;
 
-/**
- * Acquires a linked list of log entries linked to the same message, one for each output
- * \return a linked list or NULL on failure or if there are no outputs
- */
-struct log_entry * acquire_log_entries() {
-  if(output_len == 0) {
-    return NULL;
-  }
-  if(pthread_mutex_lock(&mutex) != 0) {
-    return NULL;
-  }
-  
-  struct log_msg * msg = messages;
-  if(msg != NULL) {
-    messages = messages->next;
-  }
+  /**
+   * The number of times a producer found the ring full or no free block for its message
+   */
+  atomic_size_t reserve_waits;
 
-  size_t count = 0;
-  struct log_entry * head = entries;
-  for(;count < output_len && entries != NULL; ++count) {
-    entries = entries->next;
-  }
-  
-  if(pthread_mutex_unlock(&mutex) != 0) {
-    return NULL;
-  }
+  /**
+   * The number of messages truncated
+   */
+  atomic_size_t truncated;
 
-  if(msg == NULL) {
-    msg = (struct log_msg *) malloc(sizeof(struct log_msg));
-    if(msg == NULL) {
-      //no sense in trying to recover this
-      return NULL;
-    }
-    char * buffer = (char *) malloc(DEFAULT_LOG_MSG_BUFFER_SIZE);
-    if(buffer == NULL) {
-      free(msg);
-      return NULL;
-    }
-    msg->buffer = buffer;
-    msg->cap = DEFAULT_LOG_MSG_BUFFER_SIZE;
-  }
+  /**
+   * The slots
+   */
+  struct log_slot * slots;
 
-  msg->next = NULL;
+  /**
+   * The number of slots, a power of two
+   */
+  size_t capacity;
 
-  struct log_entry * tail = head;
-  for(size_t i = 0; i < count; ++i, tail = tail->next) {
-    tail->msg = msg;
-  }
-  
-  for(;count < output_len; ++count) {
-    struct log_entry * entry = (struct log_entry *) malloc(sizeof(struct log_entry));
-    if(entry == NULL) {
-      //very bad => clean up as best we can
-      destroy_log_entries(head);
-      destroy_log_messages(msg);
-      return NULL;
-    }
-    if(tail == NULL) {
-      head = entry;
-      tail = entry;
-    } else {
-      tail->next = entry;
-      tail = entry;
-    }
-    entry->msg = msg;
-    entry->next = NULL;
-  }
-  msg->count = output_len;
+  /**
+   * The number of bytes stored inline in a message
+   */
+  size_t inline_cap;
 
-  return head;
-}
+  /**
+   * The maximum size of a message
+   */
+  size_t max_msg_size;
 
-/**
- * Releases the entries
- * \head the first entry or NULL
- * \return 0 on success, -1 on error
- */
-static int release_log_entries(struct log_entry * head) {
-  if(head != NULL) {
-    if(pthread_mutex_lock(&mutex) != 0) {
-      return -1;
-    }
+  /**
+   * The size classes of blocks for long messages, from small to large
+   */
+  struct log_slab slabs[LOG_MAX_SLABS];
 
-    struct log_entry * entry = head;
-    do {
-      struct log_msg * msg = entry->msg;
-      if(msg != NULL){
-	assert(msg->count != 0);
-	--msg->count;
-	if(msg->count == 0) {
-	  msg->next = messages;
-	  messages = msg;
-	}
-      }
-      entry->msg = NULL;
-      struct log_entry * next = entry->next;
-      entry->next = entries;
-      entries = entry;
-      entry = next;
-    }while(entry != NULL);
-  }
+  /**
+   * The number of size classes
+   */
+  size_t slab_len;
 
-  if(pthread_mutex_unlock(&mutex) != 0) {
-    return -1;
-  }
-  
-  return 0;
-}
+  /**
+   * What producers do when the ring is full
+   */
+  enum log_overflow_policy overflow_policy;
 
-/**
- * Destroys all entries and messages
- * Should not be called while the logger is active
- */
-static void destroy_log_buffers() {
-  destroy_log_messages(messages);
-  messages = NULL;
-  destroy_log_entries(entries);
-  entries = NULL;
-}
+  /**
+   * The level below which messages are dropped with LOG_OVERFLOW_DROP_BELOW_LEVEL
+   */
+  enum log_level drop_level;
 
+  /**
+   * The number of cursors
+   */
+  size_t cursor_len;
 
-/**
- * Destroys a linked list of log entries and its associated message
- * \param head the head of the list
- */
-static void destroy_log_entries_and_msg(struct log_entry * head) {
-  assert(head != NULL);
-  assert(head->msg != NULL);
-  destroy_log_messages(head->msg);
-  destroy_log_entries(head);
-}
+  /**
+   * One cursor for each output, allocated when the ring starts
+   */
+  struct log_cursor * cursors;
+};
 
 /**
- * Reallocates the message buffer to the specified capacity
- * \param msg the message
- * \param cap the minimum required capacity
- * \return 0 on success, -1 on failure
+ * The operations text outputs render their lines with, compiled from a line template
  */
-static int realloc_log_msg_buffer(struct log_msg * msg, size_t cap) {
-  assert(msg != NULL);
+enum log_render_op_kind {
+			 /**
+			  * Literal text
+			  */
+			 LOG_RENDER_TEXT,
 
-  char * buffer = (char *)realloc(msg->buffer, cap);
-  if(buffer == NULL) {
-    return -1;
-  } else {
-    msg->buffer = buffer;
-    msg->cap = cap;
-    return 0;
-  }
-}
+			 /**
+			  * The local time
+			  */
+			 LOG_RENDER_TIME,
 
-/*
- * Log queue functions
- */
+			 /**
+			  * The thread identifier
+			  */
+			 LOG_RENDER_THREAD,
 
-/**
- * Initializes an empty FIFO log queue
- * \param q the queue
- */
-void init_log_queue(struct log_queue * q) {
-  assert(q != NULL);
-  q->head = NULL;
-  q->tail = NULL;
-}
+			 /**
+			  * The padded level label
+			  */
+			 LOG_RENDER_LEVEL_LABEL,
 
-/**
- * Pushes an entry onto the queue
- * \param q the queue
- * \param e the entry
- */
-void push_onto_log_queue(struct log_queue * q, struct log_entry * e) {
-  assert(q != NULL);
-  assert(e != NULL);
-  if(q->tail == NULL) {
-    assert(q->head == NULL);
-    q->head = q->tail = e;
-  } else {
-    q->tail->next = e;
-    q->tail = e;
-  }
-  e->next = NULL;
-}
+			 /**
+			  * The level name
+			  */
+			 LOG_RENDER_LEVEL_NAME,
 
-/**
- * Pops an entry from a queue
- * \param q the queue
- * \return an entry from the head of the queue or NULL if the queue is empty
- */
-struct log_entry * pop_from_log_queue(struct log_queue * q) {
-  assert(q != NULL);
+			 /**
+			  * The file of the message
+			  */
+			 LOG_RENDER_FILE,
 
-  struct log_entry * e = q->head;
-  if(e == NULL) {
-    assert(q->tail == NULL);
-  } else {
-    q->head = e->next;
-    if(q->head == NULL) {
-      q->tail = NULL;
-    }
-  }
-  return e;
-} 
+			 /**
+			  * The line of the message
+			  */
+			 LOG_RENDER_LINE,
+
+			 /**
+			  * The text of the message
+			  */
+			 LOG_RENDER_MESSAGE,
+
+			 /**
+			  * The fields of a structured message
+			  */
+			 LOG_RENDER_FIELDS
+};
 
 /**
- * Moves all entries from the source queue to the destination queue
- * \param dest the destination queue
- * \param src the source queue
+ * A render operation
  */
-void move_between_log_queues(struct log_queue * dest, struct log_queue * src) {
-  assert(dest != NULL);
-  assert(src != NULL);
+struct log_render_op {
 
-  if(src->head != NULL) {
-    assert(src->tail != NULL);
-    if(dest->tail == NULL) {
-      assert(dest->head == NULL);
-      dest->head = src->head;
-      dest->tail = src->tail;
-    } else {
-      assert(dest->head != NULL);
-      dest->tail->next = src->head;
-      dest->tail = src->tail;
-    }
-    src->head = src->tail = NULL;
-  } else {
-    assert(src->tail == NULL);
+  /**
+   * What the operation appends
+   */
+  enum log_render_op_kind kind;
+
+  /**
+   * Whether strings are escaped for JSON
+   */
+  bool json;
+
+  /**
+   * The literal text, pointing into the line template of the output
+   */
+  const char * text;
+
+  /**
+   * The length of the literal text
+   */
+  size_t len;
+};
+
+/**
+ * The clocks as read by an output once per batch, to convert the times of its messages
+ */
+struct log_clock {
+
+  /**
+   * The ticks of get_log_ticks
+   */
+  unsigned long long ticks;
+
+  /**
+   * The monotonic clock, in nanoseconds
+   */
+  unsigned long long time;
+
+  /**
+   * The difference between the real time clock and the monotonic clock, in nanoseconds
+   */
+  long long wall_offset;
+
+  /**
+   * The length of a tick, in nanoseconds
+   */
+  double tick_length;
+};
+
+/**
+ * The memory mapped segment files of a file output
+ */
+struct log_segment {
+
+  /**
+   * The path of the segments, without index
+   */
+  char * path;
+
+  /**
+   * The options of the segments
+   */
+  struct log_file_options options;
+
+  /**
+   * The index of the current segment
+   */
+  unsigned int index;
+
+  /**
+   * The file descriptor of the current segment or -1 if none is open
+   */
+  int fd;
+
+  /**
+   * The mapping of the current segment
+   */
+  char * map;
+
+  /**
+   * The number of bytes written to the current segment
+   */
+  size_t len;
+
+  /**
+   * The number of bytes handed to the kernel for writeback
+   */
+  size_t synced;
+
+  /**
+   * The number of messages in the current segment
+   */
+  size_t msgs;
+
+  /**
+   * The time the current segment was opened, in nanoseconds of the monotonic clock
+   */
+  unsigned long long opened;
+
+  /**
+   * The time writeback was last started, in nanoseconds of the monotonic clock
+   */
+  unsigned long long sync_time;
+};
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/**
+ * A write of a registered buffer
+ */
+struct log_uring_write {
+
+  /**
+   * The number of bytes to write
+   */
+  size_t len;
+
+  /**
+   * The number of bytes written, short writes get resubmitted for the rest
+   */
+  size_t done;
+
+  /**
+   * The file offset of the first byte, or -1 to write at the file position
+   */
+  unsigned long long offset;
+
+  /**
+   * The number of messages the bytes hold, counted as written or dropped once the write completes
+   */
+  size_t msgs;
+
+  /**
+   * Whether the writer waits for the write and counts its bytes itself
+   */
+  bool waited;
+};
+
+/**
+ * The io_uring instance of an output, writing from registered buffers with several writes in
+ * flight while the writer renders further messages
+ */
+struct log_uring {
+
+  /**
+   * The file descriptor of the ring
+   */
+  int fd;
+
+  /**
+   * The file descriptor written to
+   */
+  int target;
+
+  /**
+   * The mapping of the submission queue ring, which holds the completion queue ring as well if
+   * the kernel maps both at once
+   */
+  void * sq_map;
+
+  /**
+   * The length of the mapping of the submission queue ring
+   */
+  size_t sq_map_len;
+
+  /**
+   * The mapping of the completion queue ring
+   */
+  void * cq_map;
+
+  /**
+   * The length of the mapping of the completion queue ring
+   */
+  size_t cq_map_len;
+
+  /**
+   * The submission queue entries
+   */
+  struct io_uring_sqe * sqes;
+
+  /**
+   * The number of submission queue entries
+   */
+  unsigned int sqe_len;
+
+  /**
+   * The tail of the submission queue
+   */
+  atomic_uint * sq_tail;
+
+  /**
+   * The mask turning a submission queue position into an index
+   */
+  unsigned int sq_mask;
+
+  /**
+   * The indices of the entries in the submission queue
+   */
+  unsigned int * sq_array;
+
+  /**
+   * The head of the completion queue
+   */
+  atomic_uint * cq_head;
+
+  /**
+   * The tail of the completion queue, moved by the kernel
+   */
+  atomic_uint * cq_tail;
+
+  /**
+   * The mask turning a completion queue position into an index
+   */
+  unsigned int cq_mask;
+
+  /**
+   * The completion queue entries
+   */
+  struct io_uring_cqe * cqes;
+
+  /**
+   * The registered buffers, LOG_URING_BUFFERS of LOG_URING_BUFFER_SIZE bytes
+   */
+  char * buffers;
+
+  /**
+   * The writes of the registered buffers
+   */
+  struct log_uring_write writes[LOG_URING_BUFFERS];
+
+  /**
+   * A bit for each registered buffer that is neither written nor rendered into
+   */
+  unsigned int free;
+
+  /**
+   * The number of writes in flight
+   */
+  unsigned int in_flight;
+
+  /**
+   * The maximum number of writes in flight, 1 unless the writes go to explicit offsets
+   */
+  unsigned int max_in_flight;
+
+  /**
+   * The file offset of the next write, or -1 to write at the file position
+   */
+  unsigned long long offset;
+
+  /**
+   * The number of bytes of completed writes the output has not counted yet
+   */
+  size_t written_bytes;
+
+  /**
+   * The number of messages of completed writes the output has not counted yet
+   */
+  size_t written_msgs;
+
+  /**
+   * The number of messages of failed or short writes the output has not counted as dropped yet
+   */
+  size_t dropped_msgs;
+
+  /**
+   * The number of bytes of the writes the writer waits for
+   */
+  size_t waited_bytes;
+};
+
+#endif
+
+/**
+ * An output channel
+ */
+struct log_output {
+
+  /**
+  * The output file or NULL for file outputs
+  */
+  FILE * file;
+
+  /**
+   * The file descriptor of the output file, written to directly, or -1 for file outputs
+   */
+  int fd;
+
+  /**
+   * The segments of a file output or NULL
+   */
+  struct log_segment * segment;
+
+  /**
+   * The compression stream of a compressed output or NULL
+   */
+  z_stream * deflater;
+
+  /**
+   * The buffer compressed output goes through, LOG_COMPRESSED_BUFFER_SIZE bytes
+   */
+  char * compressed;
+
+  /**
+   * The io_uring instance the output writes through or NULL to write directly
+   */
+  struct log_uring * uring;
+
+  /**
+   * The options of the output
+   */
+  struct log_output_options options;
+
+  /**
+   * The copy of the line template the render operations point into
+   */
+  char * line_template;
+
+  /**
+   * The render operations of text lines
+   */
+  struct log_render_op * ops;
+
+  /**
+   * The number of render operations
+   */
+  size_t op_len;
+
+  /**
+   * Scratch space for escaping text rendered from captured arguments
+   */
+  char * scratch;
+
+  /**
+   * The capacity of the scratch space
+   */
+  size_t scratch_cap;
+
+  /**
+   * The read position of this output in the log ring
+   */
+  struct log_cursor * cursor;
+
+  /**
+   * The write buffer, messages are rendered into it and written with a single system call
+   * Outputs writing through io_uring render into one of their registered buffers as long as
+   * the messages fit
+   */
+  char * buffer;
+
+  /**
+   * The number of bytes in the write buffer
+   */
+  size_t len;
+
+  /**
+   * The capacity of the write buffer
+   */
+  size_t cap;
+
+  /**
+   * The time of the last flush, for outputs flushing by time
+   */
+  struct timespec flushed;
+
+  /**
+   * The clocks read for the current batch
+   */
+  struct log_clock clock;
+
+  /**
+   * The second of the time in the time text
+   */
+  long long time_second;
+
+  /**
+   * The last time printed, only the microseconds get updated within a second
+   */
+  char time_text[LOG_TIME_LENGTH + 1];
+
+  /**
+   * For binary outputs, a flag for each call site identifier telling whether it has been written
+   */
+  bool * written_sites;
+
+  /**
+   * The number of flags for written call sites
+   */
+  size_t written_site_cap;
+
+  /**
+   * The times the messages in the write buffer were logged, sampled for the latency histogram
+   */
+  unsigned long long * pending_times;
+
+  /**
+   * The number of sampled times
+   */
+  size_t pending_time_len;
+
+  /**
+   * The number of messages in the write buffer
+   */
+  size_t pending_msgs;
+
+  /**
+   * Whether a write came up short since the messages of the write buffer were last counted,
+   * so they count as dropped rather than written
+   */
+  bool write_failed;
+
+  /**
+   * The highest number of messages queued for the output when it read them
+   */
+  atomic_size_t max_queue_depth;
+
+  /**
+   * The number of messages written
+   */
+  atomic_ullong written_msgs;
+
+  /**
+   * The number of bytes written
+   */
+  atomic_ullong written_bytes;
+
+  /**
+   * Histogram of the time from logging a message to its write
+   */
+  atomic_ullong latencies[LOG_LATENCY_BUCKETS];
+
+};
+
+/**
+ * A thread writing a range of outputs, taking a batch for each in turn
+ */
+struct log_writer {
+
+  /**
+   * The index of the first output
+   */
+  size_t first;
+
+  /**
+   * The number of outputs
+   */
+  size_t len;
+
+  /**
+   * The thread
+   */
+  pthread_t thread;
+};
+
+/**
+ * The ring all messages are published on, created when the logger is initialized
+ */
+static struct log_ring * ring;
+
+/**
+ * The minimum log level of the modules without their own level
+ */
+static atomic_int min_level;
+
+/**
+ * A module with its own minimum log level
+ */
+struct log_module_level {
+
+  /**
+   * The module, a file name or a path suffix
+   */
+  char module[64];
+
+  /**
+   * The minimum log level of the module
+   */
+  enum log_level level;
+};
+
+/**
+ * The modules with their own minimum log level
+ */
+static struct log_module_level module_levels[LOG_MAX_MODULE_LEVELS];
+
+/**
+ * The number of modules with their own minimum log level
+ */
+static size_t module_level_len;
+
+/**
+ * The mutex protecting the module levels, only taken when levels change and by call sites
+ * refreshing their cached level afterwards
+ */
+static pthread_mutex_t module_level_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+atomic_int log_level_threshold;
+
+// starts past zero, so call sites refresh their cached level on first use
+atomic_uint log_filter_epoch = 4;
+
+/**
+ * The rate limits that have suppressed calls, most recently registered first, limits are static
+ * and never leave the list
+ */
+static _Atomic(struct log_limit *) log_limits;
+
+/**
+ * Where messages get formatted
+ */
+static enum log_formatting formatting;
+
+/**
+ * The last identifier assigned to a call site
+ */
+static atomic_uint last_site_id;
+
+/**
+ * The identifier of the calling thread in log messages, 0 until it first logs
+ */
+static __thread unsigned int thread_id;
+
+/**
+ * The last identifier assigned to a thread
+ */
+static atomic_uint last_thread_id;
+
+/**
+ * Whether message times are read from the time stamp counter instead of the monotonic clock
+ */
+static bool use_tsc;
+
+/**
+ * The ticks of get_log_ticks when the logger was initialized, the length of a tick is
+ * measured from there
+ */
+static unsigned long long start_ticks;
+
+/**
+ * The monotonic clock when the logger was initialized, in nanoseconds
+ */
+static unsigned long long start_time;
+
+/**
+ * A message kept in the frame buffer of a thread, followed by its text or captured arguments
+ */
+struct log_frame_record {
+
+  /**
+   * The size of the record with its text, a multiple of 8, or 0 if the rest of the buffer is
+   * unused because the record did not fit
+   */
+  size_t size;
+
+  /**
+   * The call site of the message or NULL
+   */
+  struct log_site * site;
+
+  /**
+   * The file where the message originates from
+   */
+  const char * file;
+
+  /**
+   * The format string of the message
+   */
+  const char * format;
+
+  /**
+   * The time the message was logged, in ticks of get_log_ticks
+   */
+  unsigned long long time;
+
+  /**
+   * The length of the text or captured arguments
+   */
+  size_t len;
+
+  /**
+   * The line where the message originates from
+   */
+  int line;
+
+  /**
+   * The log level
+   */
+  enum log_level level;
+
+  /**
+   * The identifier of the thread that logged the message
+   */
+  unsigned int thread;
+
+  /**
+   * What the record holds, a log_payload
+   */
+  unsigned char payload;
+
+  /**
+   * Whether the text or fields were cut to the maximum message size
+   */
+  bool truncated;
+
+  /**
+   * The text, captured arguments or fields
+   */
+  char data[];
+};
+
+/**
+ * The frame buffer of a thread, a ring of records with a single producer, the thread, and a
+ * single consumer, the thread publishing the frame
+ */
+struct log_frame_buffer {
+
+  /**
+   * The records
+   */
+  char * data;
+
+  /**
+   * The capacity of the buffer, a power of two
+   */
+  size_t cap;
+
+  /**
+   * The frame buffer of the thread that logged before
+   */
+  struct log_frame_buffer * next;
+
+  /**
+   * The position after the last record, only moved by the thread
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+
+  /**
+   * The tail as last read by the thread, so it only reads the tail when the buffer looks full
+   */
+  size_t cached_tail;
+
+  /**
+   * The position of the first record not yet published, only moved by the publishing thread
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+};
+
+/**
+ * Log output array
+ */
+static struct log_output * outputs;
+
+/**
+ * The number outputs
+ */
+static size_t output_len;
+
+/**
+ * The capacity of the output buffer
+ */
+static size_t output_cap;
+
+/**
+ * The options of the writer threads
+ */
+static struct log_writer_options writer_options;
+
+/**
+ * The writers, allocated when the logger starts
+ */
+static struct log_writer * writers;
+
+/**
+ * The number of writers
+ */
+static size_t writer_len;
+
+/**
+ * The size of the frame buffer of each thread, 0 without frame buffering
+ */
+static size_t frame_buffer_size;
+
+/**
+ * The frame buffers of all threads that logged, the last one first
+ */
+static struct log_frame_buffer * frame_buffers;
+
+/**
+ * Mutex guarding the list of frame buffers and its publishing
+ */
+static pthread_mutex_t frame_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Counts the initializations of the logger, the frame buffer of a thread belongs to one
+ */
+static unsigned int frame_generation;
+
+/**
+ * The frame buffer of this thread
+ */
+static __thread struct log_frame_buffer * frame_buffer;
+
+/**
+ * The initialization of the logger the frame buffer of this thread belongs to
+ */
+static __thread unsigned int frame_buffer_generation;
+
+/*
+ * Log message functions
+ */
+
+/**
+ * Takes a block from the stack of free blocks of a size class
+ * \param slab the size class
+ * \return the block or LOG_NO_BLOCK if none is free
+ */
+static uint32_t pop_log_block(struct log_slab * slab) {
+  unsigned long long top = atomic_load_explicit(&slab->free, memory_order_acquire);
+  while(true) {
+    uint32_t block = (uint32_t)top;
+    if(block == LOG_NO_BLOCK) {
+      return LOG_NO_BLOCK;
+    }
+    unsigned long long next = atomic_load_explicit(&slab->next[block], memory_order_relaxed);
+    unsigned long long new_top = ((top >> 32) + 1) << 32 | next;
+    if(atomic_compare_exchange_weak_explicit(&slab->free, &top, new_top, memory_order_acquire, memory_order_acquire)) {
+      return block;
+    }
+  }
+}
+
+/**
+ * Puts a block back on the stack of free blocks of its size class
+ * \param slab the size class
+ * \param block the block
+ */
+static void push_log_block(struct log_slab * slab, uint32_t block) {
+  unsigned long long top = atomic_load_explicit(&slab->free, memory_order_relaxed);
+  unsigned long long new_top;
+  do {
+    atomic_store_explicit(&slab->next[block], (uint32_t)top, memory_order_relaxed);
+    new_top = ((top >> 32) + 1) << 32 | block;
+  } while(!atomic_compare_exchange_weak_explicit(&slab->free, &top, new_top, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Moves a message into a block of the smallest size class that holds it and has a free block
+ * \param ring the ring
+ * \param msg the message, stored inline
+ * \param size the size the message needs, at most the maximum message size
+ * \return 0 on success, -1 if no large enough block is free
+ */
+static int take_log_msg_block(struct log_ring * ring, struct log_msg * msg, size_t size) {
+  for(size_t i = 0; i < ring->slab_len; ++i) {
+    struct log_slab * slab = ring->slabs + i;
+    if(slab->block_size < size) {
+      continue;
+    }
+    uint32_t block = pop_log_block(slab);
+    if(block != LOG_NO_BLOCK) {
+      msg->buffer = slab->blocks + (size_t)block * slab->block_size;
+      msg->cap = slab->block_size;
+      msg->block = block;
+      msg->slab = (unsigned char)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Returns the block of a message every output has read to its size class
+ * \param ring the ring
+ * \param msg the message, stored inline afterwards
+ */
+static void release_log_msg_block(struct log_ring * ring, struct log_msg * msg) {
+  if(msg->block != LOG_NO_BLOCK) {
+    push_log_block(ring->slabs + msg->slab, msg->block);
+    msg->block = LOG_NO_BLOCK;
+    msg->buffer = msg->text;
+    msg->cap = ring->inline_cap;
+  }
+}
+
+/**
+ * Gets the number of arguments of the format string of a call site, parsing it on first use
+ * \param site the call site
+ * \param format the format string of the call site
+ * \return the number of arguments or -1 if formatting can not be deferred (yet)
+ */
+static int get_log_site_arg_count(struct log_site * site, const char * format) {
+  int arg_count = atomic_load_explicit(&site->arg_count, memory_order_acquire);
+  if(arg_count != 0) {
+    return arg_count - 1;
+  }
+  // claim the site, so only one thread parses it, the others format immediately meanwhile
+  if(!atomic_compare_exchange_strong_explicit(&site->arg_count, &arg_count, -1, memory_order_relaxed, memory_order_relaxed)) {
+    return -1;
+  }
+  arg_count = parse_log_format(format, site->arg_kinds);
+  atomic_store_explicit(&site->arg_count, arg_count + 1, memory_order_release);
+  return arg_count;
+}
+
+/**
+ * Gets the identifier of the calling thread, assigning one on its first message
+ * \return the identifier
+ */
+static unsigned int get_log_thread_id() {
+  if(thread_id == 0) {
+    thread_id = atomic_fetch_add_explicit(&last_thread_id, 1, memory_order_relaxed) + 1;
+  }
+  return thread_id;
+}
+
+/**
+ * Gets the identifier of a call site, assigning one on first use
+ * \param site the call site
+ * \return the identifier
+ */
+static unsigned int get_log_site_id(struct log_site * site) {
+  unsigned int id = atomic_load_explicit(&site->id, memory_order_relaxed);
+  if(id == 0) {
+    unsigned int new_id = atomic_fetch_add_explicit(&last_site_id, 1, memory_order_relaxed) + 1;
+    if(atomic_compare_exchange_strong_explicit(&site->id, &id, new_id, memory_order_relaxed, memory_order_relaxed)) {
+      id = new_id;
+    }
+  }
+  return id;
+}
+
+/*
+ * Log level functions
+ */
+
+/**
+ * Checks whether a file belongs to a module
+ * \param file the file path
+ * \param module the module
+ * \return true if the file path ends in the module, after a '/' if it is longer
+ */
+static bool is_in_log_module(const char * file, const char * module) {
+  size_t file_len = strlen(file);
+  size_t module_len = strlen(module);
+  if(module_len > file_len || strcmp(file + file_len - module_len, module) != 0) {
+    return false;
+  }
+  return module_len == file_len || file[file_len - module_len - 1] == '/';
+}
+
+/**
+ * Finds the level of a module
+ * Must be called with the module level mutex held
+ * \param module the module
+ * \return the index of the level or module_level_len if the module has no level of its own
+ */
+static size_t find_log_module_level(const char * module) {
+  size_t i = 0;
+  while(i < module_level_len && strcmp(module_levels[i].module, module) != 0) {
+    ++i;
+  }
+  return i;
+}
+
+/**
+ * Recomputes the threshold and invalidates the levels cached by call sites after a change
+ * Must be called with the module level mutex held
+ */
+static void update_log_level_threshold() {
+  int threshold = atomic_load_explicit(&min_level, memory_order_relaxed);
+  for(size_t i = 0; i < module_level_len; ++i) {
+    if((int)module_levels[i].level < threshold) {
+      threshold = (int)module_levels[i].level;
+    }
+  }
+  atomic_store_explicit(&log_level_threshold, threshold, memory_order_relaxed);
+  atomic_fetch_add_explicit(&log_filter_epoch, 4, memory_order_relaxed);
+}
+
+/*
+ * Log statistics functions
+ */
+
+/**
+ * Reads the monotonic clock
+ * \return the time in nanoseconds
+ */
+static unsigned long long get_log_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Checks whether the time stamp counter runs at a constant rate on all cores, so it can
+ * measure time
+ * \return true if the counter is invariant
+ */
+static bool has_invariant_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int a, b, c, d;
+  if(__get_cpuid(0x80000000, &a, &b, &c, &d) == 0 || a < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return (d & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Reads the clock messages are stamped with, the time stamp counter if it is invariant or the
+ * monotonic clock in nanoseconds otherwise
+ * \return the ticks
+ */
+static unsigned long long get_log_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  if(use_tsc) {
+    return __rdtsc();
+  }
+#endif
+  return get_log_time();
+}
+
+/**
+ * Reads the clocks for a batch of messages
+ * \param clock receives the clocks
+ */
+static void read_log_clock(struct log_clock * clock) {
+  struct timespec wall;
+  clock->ticks = get_log_ticks();
+  clock->time = get_log_time();
+  clock_gettime(CLOCK_REALTIME, &wall);
+  clock->wall_offset = (long long)wall.tv_sec * 1000000000LL + wall.tv_nsec - (long long)clock->time;
+  clock->tick_length = 1.0;
+  // the longer the logger runs, the more precise the measured length of a tick becomes
+  if(use_tsc && clock->ticks > start_ticks && clock->time > start_time) {
+    clock->tick_length = (double)(clock->time - start_time) / (double)(clock->ticks - start_ticks);
+  }
+}
+
+/**
+ * Converts the time of a message to the monotonic clock
+ * \param clock the clocks read after the message was published
+ * \param ticks the time of the message
+ * \return the time in nanoseconds
+ */
+static unsigned long long get_log_msg_time(const struct log_clock * clock, unsigned long long ticks) {
+  // the counters of different cores may be slightly apart
+  if(ticks >= clock->ticks) {
+    return clock->time;
+  }
+  return clock->time - (unsigned long long)((double)(clock->ticks - ticks) * clock->tick_length);
+}
+
+/**
+ * Counts the messages of a write in the statistics of an output
+ * Only called by the output, so the counters are updated without read-modify-write operations
+ * The messages of a write that came up short are counted as dropped, as producers count theirs
+ * \param output the output
+ * \param written the number of bytes written
+ */
+static void count_log_output_write(struct log_output * output, size_t written) {
+  atomic_store_explicit(&output->written_bytes, atomic_load_explicit(&output->written_bytes, memory_order_relaxed) + written, memory_order_relaxed);
+  if(output->write_failed) {
+    atomic_fetch_add_explicit(&output->cursor->dropped, output->pending_msgs, memory_order_relaxed);
+    output->write_failed = false;
+    output->pending_time_len = 0;
+    output->pending_msgs = 0;
+    return;
+  }
+  unsigned long long now = get_log_time();
+  for(size_t i = 0; i < output->pending_time_len; ++i) {
+    unsigned long long time = output->pending_times[i];
+    atomic_ullong * bucket = output->latencies + get_log_latency_bucket(now > time ? now - time : 0);
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+  }
+  atomic_store_explicit(&output->written_msgs, atomic_load_explicit(&output->written_msgs, memory_order_relaxed) + output->pending_msgs, memory_order_relaxed);
+  output->pending_time_len = 0;
+  output->pending_msgs = 0;
+}
+
+/**
+ * Counts the number of messages queued for an output when it reads them
+ * \param output the output
+ * \param ring the ring
+ * \param pos the position of the first message read
+ */
+static void count_log_queue_depth(struct log_output * output, struct log_ring * ring, size_t pos) {
+  size_t depth = atomic_load_explicit(&ring->head, memory_order_relaxed) - pos;
+  // producers waiting for a slot have already moved the head
+  if(depth > ring->capacity) {
+    depth = ring->capacity;
+  }
+  if(depth > atomic_load_explicit(&output->max_queue_depth, memory_order_relaxed)) {
+    atomic_store_explicit(&output->max_queue_depth, depth, memory_order_relaxed);
+  }
+}
+
+/*
+ * Log ring functions
+ */
+
+/**
+ * Sleeps on a futex word as long as it holds the expected value
+ * \param word the futex word
+ * \param expected the value
+ * \param timeout the maximum time to sleep or NULL to sleep until woken
+ */
+static void wait_on_futex(atomic_uint * word, unsigned int expected, const struct timespec * timeout) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+/**
+ * Wakes all threads sleeping on a futex word
+ * \param word the futex word
+ */
+static void wake_futex(atomic_uint * word) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Destroys the ring
+ * \param ring the ring
+ */
+static void destroy_log_ring(struct log_ring * ring) {
+  assert(ring != NULL);
+  free(ring->cursors);
+  for(size_t i = 0; i < ring->slab_len; ++i) {
+    free(ring->slabs[i].blocks);
+    free(ring->slabs[i].next);
+  }
+  free(ring->slots);
+  free(ring);
+}
+
+/**
+ * Adds a size class of blocks for long messages to a ring
+ * \param ring the ring
+ * \param block_size the size of the blocks
+ * \param memory the number of bytes for the blocks
+ * \return 0 on success, -1 on failure
+ */
+static int add_log_slab(struct log_ring * ring, size_t block_size, size_t memory) {
+  size_t block_len = memory / (block_size + sizeof(atomic_uint));
+  if(block_len >= LOG_NO_BLOCK) {
+    block_len = LOG_NO_BLOCK - 1;
+  }
+  struct log_slab * slab = ring->slabs + ring->slab_len;
+  slab->block_size = block_size;
+  slab->block_len = (uint32_t)block_len;
+  slab->blocks = (char *)malloc(block_len * block_size + 1);
+  slab->next = (atomic_uint *)malloc(block_len * sizeof(atomic_uint) + 1);
+  ++ring->slab_len;
+  if(slab->blocks == NULL || slab->next == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Puts every message of a ring back inline and every block on the stack of its size class
+ * \param ring the ring
+ */
+static void reset_log_msg_blocks(struct log_ring * ring) {
+  for(size_t i = 0; i < ring->capacity; ++i) {
+    struct log_msg * msg = &ring->slots[i].msg;
+    msg->buffer = msg->text;
+    msg->cap = ring->inline_cap;
+    msg->block = LOG_NO_BLOCK;
+  }
+  for(size_t i = 0; i < ring->slab_len; ++i) {
+    struct log_slab * slab = ring->slabs + i;
+    for(uint32_t j = 0; j < slab->block_len; ++j) {
+      atomic_init(&slab->next[j], j + 1 < slab->block_len ? j + 1 : LOG_NO_BLOCK);
+    }
+    atomic_init(&slab->free, slab->block_len != 0 ? 0 : LOG_NO_BLOCK);
+  }
+}
+
+/**
+ * Creates a stopped log ring within the memory limit: half of it goes to the slots, the rest
+ * is shared by the size classes of blocks for long messages
+ * \param options the memory options
+ * \return the ring or NULL on failure
+ */
+static struct log_ring * create_log_ring(const struct log_memory_options * options) {
+  assert(options != NULL);
+
+  if(options->max_msg_size == 0) {
+    return NULL;
+  }
+  size_t max_capacity = options->memory_limit / 2 / sizeof(struct log_slot);
+  size_t capacity = 1;
+  while(capacity <= max_capacity / 2) {
+    capacity *= 2;
+  }
+  if(capacity < 2) {
+    return NULL;
+  }
+
+  struct log_ring * ring = (struct log_ring *)aligned_alloc(CACHE_LINE_SIZE, sizeof(struct log_ring));
+  if(ring == NULL) {
+    return NULL;
+  }
+  ring->slots = (struct log_slot *)aligned_alloc(CACHE_LINE_SIZE, capacity * sizeof(struct log_slot));
+  ring->cursors = NULL;
+  ring->slab_len = 0;
+  if(ring->slots == NULL) {
+    destroy_log_ring(ring);
+    return NULL;
+  }
+  ring->capacity = capacity;
+  ring->max_msg_size = options->max_msg_size;
+  ring->inline_cap = options->max_msg_size < LOG_MSG_INLINE_SIZE ? options->max_msg_size : LOG_MSG_INLINE_SIZE;
+
+  // size classes grow by four up to the maximum message size, the last one always reaches it
+  size_t slab_len = 0;
+  for(size_t size = LOG_MIN_BLOCK_SIZE; ring->inline_cap < options->max_msg_size; size *= 4) {
+    ++slab_len;
+    if(size >= options->max_msg_size || slab_len == LOG_MAX_SLABS) {
+      break;
+    }
+  }
+  size_t slab_memory = options->memory_limit > capacity * sizeof(struct log_slot) ? options->memory_limit - capacity * sizeof(struct log_slot) : 0;
+  size_t size = LOG_MIN_BLOCK_SIZE;
+  for(size_t i = 0; i < slab_len; ++i, size *= 4) {
+    size_t block_size = size < options->max_msg_size && i + 1 < slab_len ? size : options->max_msg_size;
+    if(add_log_slab(ring, block_size, slab_memory / slab_len) != 0) {
+      destroy_log_ring(ring);
+      return NULL;
+    }
+  }
+
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->gate, 0);
+  atomic_init(&ring->reclaiming, false);
+  atomic_init(&ring->published, 0);
+  atomic_init(&ring->consumers_sleeping, 0);
+  atomic_init(&ring->running, false);
+  atomic_init(&ring->space, 0);
+  atomic_init(&ring->producers_sleeping, 0);
+  atomic_init(&ring->reserve_waits, 0);
+  atomic_init(&ring->truncated, 0);
+  ring->overflow_policy = options->overflow_policy;
+  ring->drop_level = options->drop_level;
+  ring->cursor_len = 0;
+  for(size_t i = 0; i < capacity; ++i) {
+    atomic_init(&ring->slots[i].sequence, 0);
+  }
+  reset_log_msg_blocks(ring);
+  return ring;
+}
+
+/**
+ * Empties the ring and lets producers publish on it
+ * \param ring the ring
+ * \param cursor_len the number of cursors
+ * \return 0 on success, -1 on failure
+ */
+static int start_log_ring(struct log_ring * ring, size_t cursor_len) {
+  assert(ring != NULL);
+
+  free(ring->cursors);
+  ring->cursor_len = 0;
+  ring->cursors = (struct log_cursor *)aligned_alloc(CACHE_LINE_SIZE, cursor_len * sizeof(struct log_cursor));
+  if(ring->cursors == NULL) {
+    return -1;
+  }
+  ring->cursor_len = cursor_len;
+  for(size_t i = 0; i < cursor_len; ++i) {
+    atomic_init(&ring->cursors[i].position, 0);
+    atomic_init(&ring->cursors[i].dropped, 0);
+  }
+  for(size_t i = 0; i < ring->capacity; ++i) {
+    atomic_init(&ring->slots[i].sequence, 0);
+  }
+  reset_log_msg_blocks(ring);
+  atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->gate, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->reserve_waits, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->truncated, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->running, true, memory_order_seq_cst);
+  return 0;
+}
+
+/**
+ * Computes the position of the slowest cursor
+ * \param ring the ring
+ * \return the position
+ */
+static size_t get_log_ring_min_position(struct log_ring * ring) {
+  size_t min = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for(size_t i = 0; i < ring->cursor_len; ++i) {
+    size_t position = atomic_load_explicit(&ring->cursors[i].position, memory_order_acquire) & ~LOG_CURSOR_READING;
+    if(position < min) {
+      min = position;
+    }
+  }
+  return min;
+}
+
+/**
+ * Checks whether the message at a position has been published
+ * \param ring the ring
+ * \param pos the position
+ * \return true if the message may be read
+ */
+static bool is_log_msg_published(struct log_ring * ring, size_t pos) {
+  return atomic_load_explicit(&ring->slots[pos & (ring->capacity - 1)].sequence, memory_order_acquire) == pos + 1;
+}
+
+/**
+ * Moves the gate up to the slowest cursor, returning the blocks of the messages it passes
+ * Blocks go back to their size class as soon as every output has read them rather than when
+ * their slot is reused, so only the messages still queued hold blocks. Only one thread moves the
+ * gate at a time, it checks for cursors that moved meanwhile before it is done.
+ * \param ring the ring
+ * \return the gate
+ */
+static size_t reclaim_log_msg_blocks(struct log_ring * ring) {
+  size_t gate;
+  do {
+    if(atomic_exchange_explicit(&ring->reclaiming, true, memory_order_seq_cst)) {
+      return atomic_load_explicit(&ring->gate, memory_order_acquire);
+    }
+    gate = atomic_load_explicit(&ring->gate, memory_order_relaxed);
+    size_t old_gate = gate;
+    size_t min = get_log_ring_min_position(ring);
+    // without outputs the minimum is the head, which may not be published yet
+    while(gate < min && is_log_msg_published(ring, gate)) {
+      release_log_msg_block(ring, &ring->slots[gate & (ring->capacity - 1)].msg);
+      ++gate;
+    }
+    atomic_store_explicit(&ring->gate, gate, memory_order_release);
+    atomic_store_explicit(&ring->reclaiming, false, memory_order_seq_cst);
+
+    if(gate != old_gate) {
+      atomic_thread_fence(memory_order_seq_cst);
+      if(atomic_load_explicit(&ring->producers_sleeping, memory_order_relaxed) != 0) {
+	atomic_fetch_add_explicit(&ring->space, 1, memory_order_relaxed);
+	wake_futex(&ring->space);
+      }
+    }
+  } while(is_log_msg_published(ring, gate) && get_log_ring_min_position(ring) > gate);
+  return gate;
+}
+
+/**
+ * Checks whether every cursor has read past the previous use of the slot for a position
+ * Only moves the gate when it is not far enough, so this is usually a single load
+ * \param ring the ring
+ * \param pos the position
+ * \return true if the slot may be reused
+ */
+static bool is_log_slot_free(struct log_ring * ring, size_t pos) {
+  if(pos < atomic_load_explicit(&ring->gate, memory_order_acquire) + ring->capacity) {
+    return true;
+  }
+  return pos < reclaim_log_msg_blocks(ring) + ring->capacity;
+}
+
+/**
+ * Counts a dropped message for every output that has not read the slot it would have used
+ * \param ring the ring
+ * \param pos the position the message would have had
+ */
+static void count_dropped_log_msg(struct log_ring * ring, size_t pos) {
+  for(size_t i = 0; i < ring->cursor_len; ++i) {
+    size_t position = atomic_load_explicit(&ring->cursors[i].position, memory_order_relaxed) & ~LOG_CURSOR_READING;
+    if(position + ring->capacity <= pos) {
+      atomic_fetch_add_explicit(&ring->cursors[i].dropped, 1, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * Drops the oldest messages the slow outputs have not read yet, to free the slot for a position
+ * A cursor is only moved while its output is not reading, and only past published messages,
+ * as the slots of the others are still being written
+ * \param ring the ring
+ * \param pos the reserved position
+ */
+static void drop_oldest_log_msgs(struct log_ring * ring, size_t pos) {
+  size_t target = pos - ring->capacity + 1;
+  for(size_t i = 0; i < ring->cursor_len; ++i) {
+    struct log_cursor * cursor = ring->cursors + i;
+    size_t position = atomic_load_explicit(&cursor->position, memory_order_acquire);
+    if((position & LOG_CURSOR_READING) != 0 || position >= target) {
+      continue;
+    }
+    size_t new_position = position;
+    size_t dropped = 0;
+    while(new_position < target && is_log_msg_published(ring, new_position)) {
+      // messages published empty were never there or already counted
+      dropped += !ring->slots[new_position & (ring->capacity - 1)].msg.dropped;
+      ++new_position;
+    }
+    if(new_position != position
+       && atomic_compare_exchange_strong_explicit(&cursor->position, &position, new_position, memory_order_acq_rel, memory_order_relaxed)) {
+      atomic_fetch_add_explicit(&cursor->dropped, dropped, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * Waits until the slot for a reserved position is no longer read by any output
+ * Only blocks while the ring is full, and with LOG_OVERFLOW_DROP_OLDEST only until the oldest
+ * messages can be dropped
+ * \param ring the ring
+ * \param pos the reserved position
+ */
+static void wait_for_log_slot(struct log_ring * ring, size_t pos) {
+  atomic_fetch_add_explicit(&ring->reserve_waits, 1, memory_order_relaxed);
+  for(unsigned int spin = 0; spin < LOG_SPIN_COUNT; ++spin) {
+    if(is_log_slot_free(ring, pos)) {
+      return;
+    }
+  }
+  bool drop_oldest = ring->overflow_policy == LOG_OVERFLOW_DROP_OLDEST;
+  // messages can only be dropped once published, which does not wake producers, so poll
+  struct timespec retry = { 0, LOG_DROP_RETRY_INTERVAL };
+  while(true) {
+    if(drop_oldest) {
+      drop_oldest_log_msgs(ring, pos);
+    }
+    unsigned int space = atomic_load_explicit(&ring->space, memory_order_seq_cst);
+    atomic_fetch_add_explicit(&ring->producers_sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(is_log_slot_free(ring, pos)) {
+      atomic_fetch_sub_explicit(&ring->producers_sleeping, 1, memory_order_relaxed);
+      return;
+    }
+    wait_on_futex(&ring->space, space, drop_oldest ? &retry : NULL);
+    atomic_fetch_sub_explicit(&ring->producers_sleeping, 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * Reserves a slot on the ring
+ * The message of the slot has to be published afterwards, even if it could not be created
+ * \param ring the ring
+ * \param pos receives the position of the slot
+ * \return the message of the slot
+ */
+static struct log_msg * reserve_log_msg(struct log_ring * ring, size_t * pos) {
+  assert(ring != NULL);
+  assert(pos != NULL);
+
+  *pos = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+  if(!is_log_slot_free(ring, *pos)) {
+    wait_for_log_slot(ring, *pos);
+  }
+  return &ring->slots[*pos & (ring->capacity - 1)].msg;
+}
+
+/**
+ * Reserves a slot on the ring unless it is full, in which case the message is dropped
+ * \param ring the ring
+ * \param pos receives the position of the slot
+ * \return the message of the slot or NULL if the ring is full
+ */
+static struct log_msg * try_reserve_log_msg(struct log_ring * ring, size_t * pos) {
+  assert(ring != NULL);
+  assert(pos != NULL);
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  do {
+    if(!is_log_slot_free(ring, head)) {
+      atomic_fetch_add_explicit(&ring->reserve_waits, 1, memory_order_relaxed);
+      count_dropped_log_msg(ring, head);
+      return NULL;
+    }
+  } while(!atomic_compare_exchange_weak_explicit(&ring->head, &head, head + 1, memory_order_relaxed, memory_order_relaxed));
+  *pos = head;
+  return &ring->slots[head & (ring->capacity - 1)].msg;
+}
+
+/**
+ * Checks whether the overflow policy drops a new message of a log level rather than waiting
+ * \param ring the ring
+ * \param level the log level of the message
+ * \return true if the message is dropped when the ring is full
+ */
+static bool is_log_msg_droppable(struct log_ring * ring, enum log_level level) {
+  return ring->overflow_policy == LOG_OVERFLOW_DROP_NEWEST
+    || (ring->overflow_policy == LOG_OVERFLOW_DROP_BELOW_LEVEL && level < ring->drop_level);
+}
+
+/**
+ * Reserves a slot on the ring, or drops the message if the overflow policy says so for its
+ * log level and the ring is full
+ * \param ring the ring
+ * \param level the log level of the message
+ * \param pos receives the position of the slot
+ * \return the message of the slot or NULL if the message is dropped
+ */
+static struct log_msg * reserve_log_msg_for_level(struct log_ring * ring, enum log_level level, size_t * pos) {
+  if(is_log_msg_droppable(ring, level)) {
+    return try_reserve_log_msg(ring, pos);
+  }
+  return reserve_log_msg(ring, pos);
+}
+
+/**
+ * Publishes the message in a reserved slot to the outputs, waking them if any is sleeping
+ * The cost does not depend on the number of outputs
+ * \param ring the ring
+ * \param pos the position of the slot
+ */
+static void publish_log_msg(struct log_ring * ring, size_t pos) {
+  atomic_store_explicit(&ring->slots[pos & (ring->capacity - 1)].sequence, pos + 1, memory_order_release);
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if(atomic_load_explicit(&ring->consumers_sleeping, memory_order_relaxed) != 0) {
+    atomic_fetch_add_explicit(&ring->published, 1, memory_order_relaxed);
+    wake_futex(&ring->published);
+  }
+}
+
+/**
+ * Waits until a block for a message is free, dropping the oldest messages for the slow outputs
+ * with LOG_OVERFLOW_DROP_OLDEST
+ * Only the messages before the reserved slot are sure to return their blocks, the later ones
+ * are not read before this one is published. Once the gate reaches the slot, every block left is
+ * held by a later message, so the slot is published empty for the outputs to skip and the
+ * message moves to a new slot after them.
+ * \param ring the ring
+ * \param msg the message, stored inline, receives the message of the new slot if it moves
+ * \param size the size the message needs, at most the maximum message size
+ * \param pos the position of the message, receives the new position if it moves
+ */
+static void wait_for_log_block(struct log_ring * ring, struct log_msg ** msg, size_t size, size_t * pos) {
+  atomic_fetch_add_explicit(&ring->reserve_waits, 1, memory_order_relaxed);
+  bool drop_oldest = ring->overflow_policy == LOG_OVERFLOW_DROP_OLDEST;
+  // messages can only be dropped while their outputs are not reading, which does not wake producers, so poll
+  struct timespec retry = { 0, LOG_DROP_RETRY_INTERVAL };
+  while(true) {
+    unsigned int space = atomic_load_explicit(&ring->space, memory_order_seq_cst);
+    atomic_fetch_add_explicit(&ring->producers_sleeping, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t gate = reclaim_log_msg_blocks(ring);
+    int result = take_log_msg_block(ring, *msg, size);
+    while(result != 0 && drop_oldest && gate < *pos) {
+      // drops the message at the gate, the oldest, for the outputs that have not read it
+      drop_oldest_log_msgs(ring, gate + ring->capacity);
+      size_t new_gate = reclaim_log_msg_blocks(ring);
+      if(new_gate == gate) {
+	break;
+      }
+      gate = new_gate;
+      result = take_log_msg_block(ring, *msg, size);
+    }
+    if(result == 0) {
+      atomic_fetch_sub_explicit(&ring->producers_sleeping, 1, memory_order_relaxed);
+      return;
+    }
+    if(gate == *pos) {
+      atomic_fetch_sub_explicit(&ring->producers_sleeping, 1, memory_order_relaxed);
+      (*msg)->dropped = true;
+      publish_log_msg(ring, *pos);
+      *msg = reserve_log_msg(ring, pos);
+      (*msg)->dropped = false;
+      continue;
+    }
+    wait_on_futex(&ring->space, space, drop_oldest ? &retry : NULL);
+    atomic_fetch_sub_explicit(&ring->producers_sleeping, 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * Moves a message into a block of the smallest size class that holds it and has a free block
+ * If none is free, the overflow policy applies as it does when the ring is full: the message is
+ * dropped for every output or the producer waits for a block, the message may move to another
+ * slot meanwhile and has to be written again
+ * \param ring the ring
+ * \param msg the message, stored inline, receives the message of the new slot if it moves
+ * \param size the size the message needs, at most the maximum message size
+ * \param level the log level of the message
+ * \param pos the position of the message, receives the new position if it moves
+ * \return 0 on success, -1 if the message is marked dropped
+ */
+static int acquire_log_msg_block(struct log_ring * ring, struct log_msg ** msg, size_t size, enum log_level level, size_t * pos) {
+  assert((*msg)->block == LOG_NO_BLOCK);
+  assert(size <= ring->max_msg_size);
+
+  if(take_log_msg_block(ring, *msg, size) == 0) {
+    return 0;
+  }
+  if(is_log_msg_droppable(ring, level)) {
+    atomic_fetch_add_explicit(&ring->reserve_waits, 1, memory_order_relaxed);
+    for(size_t i = 0; i < ring->cursor_len; ++i) {
+      atomic_fetch_add_explicit(&ring->cursors[i].dropped, 1, memory_order_relaxed);
+    }
+    (*msg)->dropped = true;
+    return -1;
+  }
+  wait_for_log_block(ring, msg, size, pos);
+  return 0;
+}
+
+/**
+ * Formats the text of a message, moving it to a block if it is too long to be stored inline
+ * Text longer than the maximum message size is truncated
+ * \param ring the ring
+ * \param msg the message, stored inline and not dropped, receives the message of the new slot if
+ * it moves
+ * \param level the log level of the message
+ * \param pos the position of the message, receives the new position if it moves
+ * \param format the format string
+ * \param args the arguments, formatting may need to run twice, hence the copy
+ * \return 0 on success, -1 on failure or if the message is dropped
+ */
+static int format_log_msg(struct log_ring * ring, struct log_msg ** msg, enum log_level level, size_t * pos, const char * format, va_list args) {
+  assert(msg != NULL);
+  assert(format != NULL);
+
+  va_list args2;
+  va_copy(args2, args);
+  int result = vsnprintf((*msg)->buffer, (*msg)->cap, format, args);
+  if(result >= 0 && (size_t)result >= (*msg)->cap) {
+    size_t size = (size_t)result < ring->max_msg_size ? (size_t)result + 1 : ring->max_msg_size;
+    if(size > (*msg)->cap && acquire_log_msg_block(ring, msg, size, level, pos) == 0) {
+      result = vsnprintf((*msg)->buffer, (*msg)->cap, format, args2);
+    }
+  }
+  va_end(args2);
+
+  if(result < 0 || (*msg)->dropped) {
+    return -1;
+  }
+  if((size_t)result >= (*msg)->cap) {
+    atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
+    (*msg)->len = (*msg)->cap - 1;
+  } else {
+    (*msg)->len = (size_t)result;
+  }
+  return 0;
+}
+
+/**
+ * Captures the arguments of a message, to be formatted by the outputs
+ * \param ring the ring
+ * \param msg the message, stored inline and not dropped, receives the message of the new slot if
+ * it moves
+ * \param level the log level of the message
+ * \param pos the position of the message, receives the new position if it moves
+ * \param site the call site, with parsed arguments
+ * \param arg_count the number of arguments
+ * \param args the arguments, capturing may need to run twice, hence the copy
+ * \return 0 on success, -1 if the arguments exceed the maximum message size or the message is
+ * dropped
+ */
+static int capture_log_msg(struct log_ring * ring, struct log_msg ** msg, enum log_level level, size_t * pos, const struct log_site * site, int arg_count, va_list args) {
+  assert(msg != NULL);
+  assert(site != NULL);
+
+  va_list args2;
+  va_copy(args2, args);
+  size_t len = capture_log_args(site->arg_kinds, arg_count, args, (*msg)->buffer, (*msg)->cap);
+  if(len > (*msg)->cap && len <= ring->max_msg_size && acquire_log_msg_block(ring, msg, len, level, pos) == 0) {
+    capture_log_args(site->arg_kinds, arg_count, args2, (*msg)->buffer, (*msg)->cap);
+  }
+  va_end(args2);
+
+  if(len > (*msg)->cap) {
+    return -1;
+  }
+  (*msg)->len = len;
+  return 0;
+}
+
+/**
+ * Claims the published messages following a cursor for reading
+ * With LOG_OVERFLOW_DROP_OLDEST the cursor is marked, so producers leave it alone meanwhile
+ * \param ring the ring
+ * \param cursor the cursor
+ * \param cap the maximum number of messages to claim
+ * \param pos receives the position of the first message
+ * \return the number of messages that may be read, the cursor has to be advanced past them
+ */
+static size_t claim_log_msgs(struct log_ring * ring, struct log_cursor * cursor, size_t cap, size_t * pos) {
+  bool drop_oldest = ring->overflow_policy == LOG_OVERFLOW_DROP_OLDEST;
+  size_t position = atomic_load_explicit(&cursor->position, memory_order_acquire);
+  if(drop_oldest) {
+    // only fails when a producer has just dropped messages for this output
+    while(!atomic_compare_exchange_weak_explicit(&cursor->position, &position, position | LOG_CURSOR_READING, memory_order_acquire, memory_order_acquire)) {
+    }
+  }
+  size_t len = 0;
+  while(len < cap && is_log_msg_published(ring, position + len)) {
+    ++len;
+  }
+  if(len == 0 && drop_oldest) {
+    atomic_store_explicit(&cursor->position, position, memory_order_release);
+  }
+  *pos = position;
+  return len;
+}
+
+/**
+ * Moves a cursor past messages it has claimed and read, returning the blocks of the messages
+ * every output has read and waking producers waiting for their slots
+ * \param ring the ring
+ * \param cursor the cursor
+ * \param pos the position of the first message read
+ * \param len the number of messages read
+ */
+static void advance_log_cursor(struct log_ring * ring, struct log_cursor * cursor, size_t pos, size_t len) {
+  atomic_store_explicit(&cursor->position, pos + len, memory_order_seq_cst);
+  reclaim_log_msg_blocks(ring);
+}
+
+/**
+ * Checks whether a message is published after any of a range of cursors
+ * \param ring the ring
+ * \param cursors the cursors
+ * \param cursor_len the number of cursors
+ * \return true if a message may be read
+ */
+static bool has_log_msgs(struct log_ring * ring, struct log_cursor * cursors, size_t cursor_len) {
+  for(size_t i = 0; i < cursor_len; ++i) {
+    size_t pos = atomic_load_explicit(&cursors[i].position, memory_order_relaxed) & ~LOG_CURSOR_READING;
+    if(is_log_msg_published(ring, pos)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Puts a writer to sleep until a message is published after any of its cursors or the ring stops
+ * \param ring the ring
+ * \param cursors the cursors of the outputs of the writer
+ * \param cursor_len the number of cursors
+ * \param timeout the maximum time to sleep or NULL to sleep until woken
+ */
+static void wait_for_log_msg(struct log_ring * ring, struct log_cursor * cursors, size_t cursor_len, const struct timespec * timeout) {
+  for(unsigned int spin = 0; spin < LOG_SPIN_COUNT; ++spin) {
+    if(has_log_msgs(ring, cursors, cursor_len)) {
+      return;
+    }
+  }
+  unsigned int published = atomic_load_explicit(&ring->published, memory_order_seq_cst);
+  atomic_fetch_add_explicit(&ring->consumers_sleeping, 1, memory_order_seq_cst);
+  atomic_thread_fence(memory_order_seq_cst);
+  if(!has_log_msgs(ring, cursors, cursor_len) && atomic_load_explicit(&ring->running, memory_order_seq_cst)) {
+    wait_on_futex(&ring->published, published, timeout);
+  }
+  atomic_fetch_sub_explicit(&ring->consumers_sleeping, 1, memory_order_relaxed);
+}
+
+/**
+ * Tells all outputs reading the ring to stop once they have read everything
+ * \param ring the ring
+ */
+static void stop_log_ring(struct log_ring * ring) {
+  atomic_store_explicit(&ring->running, false, memory_order_seq_cst);
+  atomic_fetch_add_explicit(&ring->published, 1, memory_order_seq_cst);
+  wake_futex(&ring->published);
+}
+
+/*
+ * Log segment functions
+ */
+
+/**
+ * Creates, allocates and maps the next segment file, skipping the indices already taken
+ * \param segment the segments, without open segment
+ * \return 0 on success, -1 on failure
+ */
+static int open_log_segment(struct log_segment * segment) {
+  size_t name_cap = strlen(segment->path) + 16;
+  char * name = (char *)malloc(name_cap);
+  if(name == NULL) {
+    return -1;
+  }
+  segment->fd = -1;
+  while(segment->fd < 0) {
+    snprintf(name, name_cap, "%s.%u", segment->path, segment->index);
+    segment->fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(segment->fd < 0 && (errno != EEXIST || segment->index == UINT_MAX)) {
+      free(name);
+      return -1;
+    }
+    if(segment->fd < 0) {
+      ++segment->index;
+    }
+  }
+
+  // blocks allocated up front never fail a write through the mapping
+  segment->map = NULL;
+  if(posix_fallocate(segment->fd, 0, (off_t)segment->options.segment_size) == 0) {
+    void * map = mmap(NULL, segment->options.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    segment->map = map != MAP_FAILED ? (char *)map : NULL;
+  }
+  if(segment->map == NULL) {
+    // the index is free again for the next attempt
+    unlink(name);
+    free(name);
+    close(segment->fd);
+    segment->fd = -1;
+    return -1;
+  }
+  free(name);
+  segment->len = 0;
+  segment->synced = 0;
+  segment->msgs = 0;
+  segment->opened = get_log_time();
+  segment->sync_time = segment->opened;
+  return 0;
+}
+
+/**
+ * Starts the writeback of the pages written since the last one, without waiting for it
+ * \param segment the segments, with open segment
+ */
+static void sync_log_segment(struct log_segment * segment) {
+  if(segment->len != segment->synced) {
+    sync_file_range(segment->fd, (off_t)segment->synced, (off_t)(segment->len - segment->synced), SYNC_FILE_RANGE_WRITE);
+    segment->synced = segment->len;
+  }
+  segment->sync_time = get_log_time();
+}
+
+/**
+ * Unmaps the current segment and cuts its file to the written length
+ * \param segment the segments
+ */
+static void close_log_segment(struct log_segment * segment) {
+  if(segment->fd < 0) {
+    return;
+  }
+  sync_log_segment(segment);
+  munmap(segment->map, segment->options.segment_size);
+  if(ftruncate(segment->fd, (off_t)segment->len) != 0) {
+    // the end of the segment stays filled with NUL bytes
+  }
+  close(segment->fd);
+  segment->fd = -1;
+  segment->map = NULL;
+  segment->len = 0;
+  segment->msgs = 0;
+}
+
+/**
+ * Copies bytes into the current segment, starting writeback if it is due
+ * \param segment the segments
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return the number of bytes copied, less if they do not fit or no segment is open
+ */
+static size_t write_log_segment(struct log_segment * segment, const char * data, size_t len) {
+  if(segment->fd < 0) {
+    return 0;
+  }
+  if(len > segment->options.segment_size - segment->len) {
+    len = segment->options.segment_size - segment->len;
+  }
+  memcpy(segment->map + segment->len, data, len);
+  segment->len += len;
+  if(segment->options.sync_interval != 0
+     && get_log_time() - segment->sync_time >= segment->options.sync_interval * 1000000ULL) {
+    sync_log_segment(segment);
+  }
+  return len;
+}
+
+/**
+ * Checks whether a file output has to roll to a new segment before a message
+ * \param segment the segments
+ * \param len the number of bytes the message adds to the segment, counting what is buffered
+ * \param time the time of the batch, in nanoseconds of the monotonic clock
+ * \return true if the segment holds messages and the message does not fit or the segment is due
+ */
+static bool is_log_segment_full(const struct log_segment * segment, size_t len, unsigned long long time) {
+  if(segment->msgs == 0) {
+    return false;
+  }
+  return segment->len + len > segment->options.segment_size
+    || (segment->options.roll_interval != 0 && time - segment->opened >= segment->options.roll_interval * 1000000000ULL);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/*
+ * Log io_uring functions
+ */
+
+/**
+ * Counts a write that is done, written in full or not, and frees its registered buffer
+ * \param uring the instance
+ * \param index the index of the registered buffer
+ */
+static void complete_log_uring_write(struct log_uring * uring, unsigned int index) {
+  const struct log_uring_write * write = uring->writes + index;
+  if(write->waited) {
+    uring->waited_bytes += write->done;
+  } else if(write->done == write->len) {
+    uring->written_bytes += write->done;
+    uring->written_msgs += write->msgs;
+  } else {
+    uring->written_bytes += write->done;
+    uring->dropped_msgs += write->msgs;
+  }
+  uring->free |= 1U << index;
+  --uring->in_flight;
+}
+
+/**
+ * Queues the rest of the write of a registered buffer and submits it
+ * \param uring the instance
+ * \param index the index of the registered buffer
+ */
+static void submit_log_uring_write(struct log_uring * uring, unsigned int index) {
+  const struct log_uring_write * write = uring->writes + index;
+  unsigned int tail = atomic_load_explicit(uring->sq_tail, memory_order_relaxed);
+  unsigned int entry = tail & uring->sq_mask;
+  struct io_uring_sqe * sqe = uring->sqes + entry;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = uring->target;
+  sqe->addr = (unsigned long long)(uintptr_t)(uring->buffers + index * LOG_URING_BUFFER_SIZE + write->done);
+  sqe->len = (unsigned int)(write->len - write->done);
+  sqe->off = write->offset == (unsigned long long)-1 ? write->offset : write->offset + write->done;
+  sqe->buf_index = (unsigned short)index;
+  sqe->user_data = index;
+  uring->sq_array[entry] = entry;
+  atomic_store_explicit(uring->sq_tail, tail + 1, memory_order_release);
+  long result;
+  while((result = syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL, 0)) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+  }
+  if(result < 1) {
+    // the kernel did not take the entry, the write is done with what it wrote so far
+    atomic_store_explicit(uring->sq_tail, tail, memory_order_release);
+    complete_log_uring_write(uring, index);
+  }
+}
+
+/**
+ * Handles the completed writes of an io_uring instance
+ * Short writes are submitted again for the rest, failed ones are counted for the output
+ * \param uring the instance
+ * \param wait whether to wait for a write to complete if none has
+ */
+static void reap_log_uring(struct log_uring * uring, bool wait) {
+  unsigned int head = atomic_load_explicit(uring->cq_head, memory_order_relaxed);
+  if(wait && head == atomic_load_explicit(uring->cq_tail, memory_order_acquire)) {
+    syscall(__NR_io_uring_enter, uring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  }
+  unsigned int tail = atomic_load_explicit(uring->cq_tail, memory_order_acquire);
+  for(; head != tail; ++head) {
+    const struct io_uring_cqe * cqe = uring->cqes + (head & uring->cq_mask);
+    unsigned int index = (unsigned int)cqe->user_data;
+    struct log_uring_write * write = uring->writes + index;
+    if(cqe->res > 0) {
+      write->done += (size_t)cqe->res;
+    }
+    if((cqe->res > 0 || cqe->res == -EINTR || cqe->res == -EAGAIN) && write->done < write->len) {
+      submit_log_uring_write(uring, index);
+    } else {
+      complete_log_uring_write(uring, index);
+    }
+  }
+  atomic_store_explicit(uring->cq_head, head, memory_order_release);
+}
+
+/**
+ * Waits for the writes in flight of an io_uring instance
+ * \param uring the instance
+ */
+static void wait_for_log_uring(struct log_uring * uring) {
+  while(uring->in_flight != 0) {
+    reap_log_uring(uring, true);
+  }
+}
+
+/**
+ * Moves the counts of the completed writes of an io_uring instance to the caller
+ * \param uring the instance
+ * \param bytes receives the number of bytes written
+ * \param msgs receives the number of messages written
+ * \param dropped receives the number of messages of failed or short writes
+ */
+static void take_log_uring_counts(struct log_uring * uring, size_t * bytes, size_t * msgs, size_t * dropped) {
+  *bytes = uring->written_bytes;
+  *msgs = uring->written_msgs;
+  *dropped = uring->dropped_msgs;
+  uring->written_bytes = 0;
+  uring->written_msgs = 0;
+  uring->dropped_msgs = 0;
+}
+
+/**
+ * Destroys an io_uring instance, waiting for its writes in flight
+ * Later writes to the file descriptor continue where the instance stopped
+ * \param uring the instance
+ */
+static void destroy_log_uring(struct log_uring * uring) {
+  if(uring->fd >= 0) {
+    wait_for_log_uring(uring);
+    if(uring->offset != (unsigned long long)-1) {
+      lseek(uring->target, (off_t)uring->offset, SEEK_SET);
+    }
+  }
+  if(uring->sqes != MAP_FAILED) {
+    munmap(uring->sqes, uring->sqe_len * sizeof(struct io_uring_sqe));
+  }
+  if(uring->cq_map != MAP_FAILED) {
+    munmap(uring->cq_map, uring->cq_map_len);
+  }
+  if(uring->sq_map != MAP_FAILED) {
+    munmap(uring->sq_map, uring->sq_map_len);
+  }
+  if(uring->fd >= 0) {
+    close(uring->fd);
+  }
+  free(uring->buffers);
+  free(uring);
+}
+
+/**
+ * Creates an io_uring instance writing to a file descriptor
+ * Files that can seek get several writes in flight at explicit offsets, anything else one write
+ * at a time at the file position, so the bytes keep their order
+ * \param target the file descriptor to write to
+ * \return the instance, or NULL if io_uring is unavailable or on failure
+ */
+static struct log_uring * create_log_uring(int target) {
+  struct log_uring * uring = (struct log_uring *)calloc(1, sizeof(struct log_uring));
+  if(uring == NULL) {
+    return NULL;
+  }
+  uring->target = target;
+  uring->offset = (unsigned long long)-1;
+  uring->sq_map = MAP_FAILED;
+  uring->cq_map = MAP_FAILED;
+  uring->sqes = (struct io_uring_sqe *)MAP_FAILED;
+  uring->buffers = (char *)malloc(LOG_URING_BUFFERS * LOG_URING_BUFFER_SIZE);
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  uring->fd = (int)syscall(__NR_io_uring_setup, LOG_URING_BUFFERS, &params);
+  if(uring->buffers == NULL || uring->fd < 0) {
+    destroy_log_uring(uring);
+    return NULL;
+  }
+
+  uring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  uring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if((params.features & IORING_FEAT_SINGLE_MMAP) != 0 && uring->cq_map_len > uring->sq_map_len) {
+    uring->sq_map_len = uring->cq_map_len;
+  }
+  uring->sq_map = mmap(NULL, uring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+  if(uring->sq_map != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+    uring->cq_map = mmap(NULL, uring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+  }
+  uring->sqe_len = params.sq_entries;
+  uring->sqes = (struct io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+  char * cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0 ? (char *)uring->sq_map : (char *)uring->cq_map;
+  if(uring->sq_map == MAP_FAILED || cq_map == MAP_FAILED || uring->sqes == MAP_FAILED) {
+    destroy_log_uring(uring);
+    return NULL;
+  }
+
+  char * sq_map = (char *)uring->sq_map;
+  uring->sq_tail = (atomic_uint *)(sq_map + params.sq_off.tail);
+  uring->sq_mask = *(unsigned int *)(sq_map + params.sq_off.ring_mask);
+  uring->sq_array = (unsigned int *)(sq_map + params.sq_off.array);
+  uring->cq_head = (atomic_uint *)(cq_map + params.cq_off.head);
+  uring->cq_tail = (atomic_uint *)(cq_map + params.cq_off.tail);
+  uring->cq_mask = *(unsigned int *)(cq_map + params.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe *)(cq_map + params.cq_off.cqes);
+
+  // registered buffers spare the kernel mapping the pages of every write
+  struct iovec iovecs[LOG_URING_BUFFERS];
+  for(unsigned int i = 0; i < LOG_URING_BUFFERS; ++i) {
+    iovecs[i].iov_base = uring->buffers + i * LOG_URING_BUFFER_SIZE;
+    iovecs[i].iov_len = LOG_URING_BUFFER_SIZE;
+  }
+  if(syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, iovecs, LOG_URING_BUFFERS) != 0) {
+    destroy_log_uring(uring);
+    return NULL;
+  }
+  uring->free = (1U << LOG_URING_BUFFERS) - 1;
+
+  // appending files ignore offsets, so only plain seekable files take writes out of order
+  off_t offset = lseek(target, 0, SEEK_CUR);
+  int flags = fcntl(target, F_GETFL);
+  if(offset >= 0 && flags >= 0 && (flags & O_APPEND) == 0) {
+    uring->offset = (unsigned long long)offset;
+    uring->max_in_flight = LOG_URING_BUFFERS;
+  } else {
+    uring->max_in_flight = 1;
+  }
+  return uring;
+}
+
+/**
+ * Returns the index of a registered buffer
+ * \param uring the instance
+ * \param buffer the buffer
+ * \return the index, or -1 if the buffer is not registered
+ */
+static int get_log_uring_buffer_index(const struct log_uring * uring, const char * buffer) {
+  for(int i = 0; i < LOG_URING_BUFFERS; ++i) {
+    if(buffer == uring->buffers + i * LOG_URING_BUFFER_SIZE) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Takes a free registered buffer, waiting for a write to complete if none is free
+ * \param uring the instance
+ * \return the buffer, LOG_URING_BUFFER_SIZE bytes
+ */
+static char * take_log_uring_buffer(struct log_uring * uring) {
+  reap_log_uring(uring, false);
+  while(uring->free == 0) {
+    reap_log_uring(uring, true);
+  }
+  int index = __builtin_ctz(uring->free);
+  uring->free &= ~(1U << index);
+  return uring->buffers + index * LOG_URING_BUFFER_SIZE;
+}
+
+/**
+ * Gives back a registered buffer taken but not written
+ * \param uring the instance
+ * \param buffer the buffer
+ */
+static void release_log_uring_buffer(struct log_uring * uring, const char * buffer) {
+  uring->free |= 1U << get_log_uring_buffer_index(uring, buffer);
+}
+
+/**
+ * Submits the write of a taken registered buffer
+ * \param uring the instance
+ * \param index the index of the buffer
+ * \param len the number of bytes to write
+ * \param msgs the number of messages the bytes hold
+ * \param waited whether the caller waits for the write and counts its bytes itself
+ */
+static void submit_log_uring_buffer(struct log_uring * uring, unsigned int index, size_t len, size_t msgs, bool waited) {
+  while(uring->in_flight >= uring->max_in_flight) {
+    reap_log_uring(uring, true);
+  }
+  struct log_uring_write * write = uring->writes + index;
+  write->len = len;
+  write->done = 0;
+  write->offset = uring->offset;
+  write->msgs = msgs;
+  write->waited = waited;
+  if(uring->offset != (unsigned long long)-1) {
+    uring->offset += len;
+  }
+  ++uring->in_flight;
+  submit_log_uring_write(uring, index);
+}
+
+/**
+ * Writes a taken registered buffer without waiting, its bytes and messages are counted when the
+ * write completes
+ * \param uring the instance
+ * \param buffer the buffer
+ * \param len the number of bytes to write
+ * \param msgs the number of messages the bytes hold
+ */
+static void write_log_uring_buffer(struct log_uring * uring, const char * buffer, size_t len, size_t msgs) {
+  unsigned int index = (unsigned int)get_log_uring_buffer_index(uring, buffer);
+  if(len == 0) {
+    uring->free |= 1U << index;
+    return;
+  }
+  submit_log_uring_buffer(uring, index, len, msgs, false);
+}
+
+/**
+ * Writes bytes through an io_uring instance, copying them into registered buffers, and waits
+ * for the writes
+ * \param uring the instance
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return the number of bytes written
+ */
+static size_t write_log_uring(struct log_uring * uring, const char * data, size_t len) {
+  uring->waited_bytes = 0;
+  for(size_t written = 0; written < len; written += LOG_URING_BUFFER_SIZE) {
+    size_t chunk = len - written < LOG_URING_BUFFER_SIZE ? len - written : LOG_URING_BUFFER_SIZE;
+    char * buffer = take_log_uring_buffer(uring);
+    memcpy(buffer, data + written, chunk);
+    submit_log_uring_buffer(uring, (unsigned int)get_log_uring_buffer_index(uring, buffer), chunk, 0, true);
+  }
+  wait_for_log_uring(uring);
+  return uring->waited_bytes;
+}
+
+#else
+
+/*
+ * Without the io_uring header no instance is ever created and outputs asking for one write
+ * directly, so the functions below are never called with an instance
+ */
+
+static struct log_uring * create_log_uring(int target) {
+  (void)target;
+  return NULL;
+}
+
+static void wait_for_log_uring(struct log_uring * uring) {
+  (void)uring;
+}
+
+static void take_log_uring_counts(struct log_uring * uring, size_t * bytes, size_t * msgs, size_t * dropped) {
+  (void)uring;
+  *bytes = 0;
+  *msgs = 0;
+  *dropped = 0;
+}
+
+static void destroy_log_uring(struct log_uring * uring) {
+  (void)uring;
+}
+
+static int get_log_uring_buffer_index(const struct log_uring * uring, const char * buffer) {
+  (void)uring;
+  (void)buffer;
+  return -1;
+}
+
+static char * take_log_uring_buffer(struct log_uring * uring) {
+  (void)uring;
+  return NULL;
+}
+
+static void release_log_uring_buffer(struct log_uring * uring, const char * buffer) {
+  (void)uring;
+  (void)buffer;
+}
+
+static void write_log_uring_buffer(struct log_uring * uring, const char * buffer, size_t len, size_t msgs) {
+  (void)uring;
+  (void)buffer;
+  (void)len;
+  (void)msgs;
+}
+
+static size_t write_log_uring(struct log_uring * uring, const char * data, size_t len) {
+  (void)uring;
+  (void)data;
+  (void)len;
+  return 0;
+}
+
+#endif
+
+/*
+ * Log output functions
+ */
+
+/**
+ * Compiles the line template of an output into render operations
+ * \param output the output, with the copy of its line template
+ * \return 0 on success, -1 if the template is invalid or on failure
+ */
+static int compile_log_template(struct log_output * output) {
+  const char * c = output->line_template;
+  // every character yields at most one operation
+  output->ops = (struct log_render_op *)malloc((strlen(c) + 1) * sizeof(struct log_render_op));
+  output->op_len = 0;
+  if(output->ops == NULL) {
+    return -1;
+  }
+
+  while(*c != '\0') {
+    struct log_render_op * op = output->ops + output->op_len++;
+    op->json = false;
+    op->text = c;
+    op->len = 0;
+    if(*c != '%') {
+      op->kind = LOG_RENDER_TEXT;
+      while(c[op->len] != '\0' && c[op->len] != '%') {
+	++op->len;
+      }
+      c += op->len;
+      continue;
+    }
+
+    ++c;
+    if(*c == 'j') {
+      op->json = true;
+      ++c;
+    }
+    switch(*c) {
+    case '%':
+      op->kind = LOG_RENDER_TEXT;
+      op->text = c;
+      op->len = 1;
+      break;
+    case 't':
+      op->kind = LOG_RENDER_TIME;
+      break;
+    case 'T':
+      op->kind = LOG_RENDER_THREAD;
+      break;
+    case 'l':
+      op->kind = LOG_RENDER_LEVEL_LABEL;
+      break;
+    case 'L':
+      op->kind = LOG_RENDER_LEVEL_NAME;
+      break;
+    case 'f':
+      op->kind = LOG_RENDER_FILE;
+      break;
+    case 'n':
+      op->kind = LOG_RENDER_LINE;
+      break;
+    case 'm':
+      op->kind = LOG_RENDER_MESSAGE;
+      break;
+    case 'F':
+      op->kind = LOG_RENDER_FIELDS;
+      break;
+    default:
+      return -1;
+    }
+    if(op->json && op->kind != LOG_RENDER_FILE && op->kind != LOG_RENDER_MESSAGE && op->kind != LOG_RENDER_FIELDS) {
+      return -1;
+    }
+    ++c;
+  }
+  return 0;
+}
+
+/**
+ * Makes sure the write buffer of an output has room for more bytes
+ * \param output the output
+ * \param len the number of bytes to be appended
+ * \return 0 on success, -1 on failure
+ */
+static int reserve_log_output_buffer(struct log_output * output, size_t len) {
+  if(output->len + len <= output->cap) {
+    return 0;
+  }
+  size_t cap = output->cap == 0 ? DEFAULT_LOG_OUTPUT_BUFFER_SIZE : output->cap;
+  while(cap < output->len + len) {
+    cap *= 2;
+  }
+  char * buffer;
+  if(output->uring != NULL && get_log_uring_buffer_index(output->uring, output->buffer) >= 0) {
+    // registered buffers have a fixed size, the output renders into the heap until its next flush
+    buffer = (char *)malloc(cap);
+    if(buffer != NULL) {
+      memcpy(buffer, output->buffer, output->len);
+      release_log_uring_buffer(output->uring, output->buffer);
+    }
+  } else {
+    buffer = (char *)realloc(output->buffer, cap);
+  }
+  if(buffer == NULL) {
+    return -1;
+  }
+  output->buffer = buffer;
+  output->cap = cap;
+  return 0;
+}
+
+/**
+ * Appends bytes to the write buffer of an output
+ * \param output the output
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_bytes(struct log_output * output, const void * data, size_t len) {
+  if(reserve_log_output_buffer(output, len) != 0) {
+    return -1;
+  }
+  memcpy(output->buffer + output->len, data, len);
+  output->len += len;
+  return 0;
+}
+
+/**
+ * Appends a string to the write buffer of an output
+ * \param output the output
+ * \param string the string
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_string(struct log_output * output, const char * string) {
+  return append_log_bytes(output, string, strlen(string));
+}
+
+/**
+ * Appends an integer in decimal notation to the write buffer of an output
+ * \param output the output
+ * \param value the integer
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_int(struct log_output * output, int value) {
+  char digits[16];
+  size_t i = sizeof(digits);
+  unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+  do {
+    digits[--i] = (char)('0' + u % 10);
+    u /= 10;
+  } while(u != 0);
+  if(value < 0) {
+    digits[--i] = '-';
+  }
+  return append_log_bytes(output, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * Appends the wall clock time of a message to the write buffer of an output
+ * \param output the output
+ * \param time the time in nanoseconds since the epoch
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_time(struct log_output * output, long long time) {
+  long long second = time / 1000000000LL;
+  long long microseconds = time % 1000000000LL / 1000;
+  if(second != output->time_second || microseconds < 0) {
+    format_log_time(time, output->time_text);
+    output->time_second = second;
+  } else {
+    for(int i = 1; i <= 6; ++i) {
+      output->time_text[LOG_TIME_LENGTH - i] = (char)('0' + microseconds % 10);
+      microseconds /= 10;
+    }
+  }
+  return append_log_bytes(output, output->time_text, LOG_TIME_LENGTH);
+}
+
+/**
+ * Appends bytes escaped for a JSON string to the write buffer of an output
+ * \param output the output
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_json(struct log_output * output, const char * data, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  size_t i = 0;
+  while(i < len) {
+    size_t run = i;
+    while(run < len && (unsigned char)data[run] >= 0x20 && data[run] != '"' && data[run] != '\\') {
+      ++run;
+    }
+    if(append_log_bytes(output, data + i, run - i) != 0) {
+      return -1;
+    }
+    if(run == len) {
+      break;
+    }
+
+    unsigned char c = (unsigned char)data[run];
+    char escape[6] = { '\\', (char)c };
+    size_t escape_len = 2;
+    switch(c) {
+    case '"':
+    case '\\':
+      break;
+    case '\n':
+      escape[1] = 'n';
+      break;
+    case '\r':
+      escape[1] = 'r';
+      break;
+    case '\t':
+      escape[1] = 't';
+      break;
+    default:
+      escape[1] = 'u';
+      escape[2] = '0';
+      escape[3] = '0';
+      escape[4] = digits[c >> 4];
+      escape[5] = digits[c & 15];
+      escape_len = 6;
+    }
+    if(append_log_bytes(output, escape, escape_len) != 0) {
+      return -1;
+    }
+    i = run + 1;
+  }
+  return 0;
+}
+
+/**
+ * Escapes the bytes at the end of the write buffer of an output for a JSON string
+ * \param output the output
+ * \param start the position of the first byte to escape
+ * \return 0 on success, -1 on failure
+ */
+static int escape_log_json(struct log_output * output, size_t start) {
+  size_t len = output->len - start;
+  size_t i = 0;
+  while(i < len && (unsigned char)output->buffer[start + i] >= 0x20 && output->buffer[start + i] != '"' && output->buffer[start + i] != '\\') {
+    ++i;
+  }
+  if(i == len) {
+    return 0;
+  }
+
+  if(len > output->scratch_cap) {
+    char * scratch = (char *)realloc(output->scratch, len);
+    if(scratch == NULL) {
+      return -1;
+    }
+    output->scratch = scratch;
+    output->scratch_cap = len;
+  }
+  memcpy(output->scratch, output->buffer + start, len);
+  output->len = start;
+  return append_log_json(output, output->scratch, len);
+}
+
+/**
+ * Renders the text of a deferred message into the write buffer of an output
+ * \param output the output
+ * \param msg the message
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_args(struct log_output * output, const struct log_msg * msg) {
+  assert(msg->payload == LOG_PAYLOAD_ARGS);
+
+  if(reserve_log_output_buffer(output, 1) != 0) {
+    return -1;
+  }
+  int len = render_log_args(msg->format, msg->buffer, msg->len, output->buffer + output->len, output->cap - output->len);
+  if(len >= 0 && (size_t)len >= output->cap - output->len) {
+    if(reserve_log_output_buffer(output, (size_t)len + 1) != 0) {
+      return -1;
+    }
+    len = render_log_args(msg->format, msg->buffer, msg->len, output->buffer + output->len, output->cap - output->len);
+  }
+  if(len < 0) {
+    return -1;
+  }
+  output->len += (size_t)len;
+  return 0;
+}
+
+/**
+ * Appends the text of a message to the write buffer of an output
+ * \param output the output
+ * \param msg the message
+ * \param json whether the text is escaped for a JSON string
+ * \return 0 on success, -1 on failure
+ */
+static int append_log_text(struct log_output * output, const struct log_msg * msg, bool json) {
+  if(msg->payload == LOG_PAYLOAD_FIELDS) {
+    // the format string of a structured message is its text
+    if(json) {
+      return append_log_json(output, msg->format, strlen(msg->format));
+    }
+    return append_log_string(output, msg->format);
+  }
+  if(msg->payload == LOG_PAYLOAD_TEXT) {
+    if(json) {
+      return append_log_json(output, msg->buffer, msg->len);
+    }
+    return append_log_bytes(output, msg->buffer, msg->len);
+  }
+  size_t start = output->len;
+  if(append_log_args(output, msg) != 0) {
+    return -1;
   }
+  return json ? escape_log_json(output, start) : 0;
 }
 
 /**
- * Clears all messages from the log queue
+ * Renders the fields of a structured message into the write buffer of an output
+ * Other messages have no fields and append nothing
+ * \param output the output
+ * \param msg the message
+ * \param json whether the fields are rendered as a JSON object member
+ * \return 0 on success, -1 on failure
  */
-int clear_log_queue(struct log_queue * q) {
-  assert(q != NULL);
-  int result = release_log_entries(q->head);
-  q->head = NULL;
-  q->tail = NULL;
-  return result;
+static int append_log_fields(struct log_output * output, const struct log_msg * msg, bool json) {
+  if(msg->payload != LOG_PAYLOAD_FIELDS) {
+    return 0;
+  }
+  if(reserve_log_output_buffer(output, 1) != 0) {
+    return -1;
+  }
+  int len = render_log_fields(msg->buffer, msg->len, json, output->buffer + output->len, output->cap - output->len);
+  if(len >= 0 && (size_t)len >= output->cap - output->len) {
+    if(reserve_log_output_buffer(output, (size_t)len + 1) != 0) {
+      return -1;
+    }
+    len = render_log_fields(msg->buffer, msg->len, json, output->buffer + output->len, output->cap - output->len);
+  }
+  if(len < 0) {
+    return -1;
+  }
+  output->len += (size_t)len;
+  return 0;
+}
+
+/**
+ * Renders a log message as a line of text into the write buffer of an output, following the
+ * render operations of the output
+ * \param output the output
+ * \param msg the message to be printed
+ */
+static void print_log_msg(struct log_output * output, const struct log_msg * msg) {
+  assert(output != NULL);
+  assert(msg != NULL);
+
+  size_t start = output->len;
+  int result = 0;
+  for(size_t i = 0; i < output->op_len; ++i) {
+    const struct log_render_op * op = output->ops + i;
+    switch(op->kind) {
+    case LOG_RENDER_TEXT:
+      result |= append_log_bytes(output, op->text, op->len);
+      break;
+    case LOG_RENDER_TIME:
+      result |= append_log_time(output, (long long)get_log_msg_time(&output->clock, msg->time) + output->clock.wall_offset);
+      break;
+    case LOG_RENDER_THREAD:
+      result |= append_log_int(output, (int)msg->thread);
+      break;
+    case LOG_RENDER_LEVEL_LABEL:
+      result |= append_log_string(output, get_log_level_label(msg->level));
+      break;
+    case LOG_RENDER_LEVEL_NAME:
+      result |= append_log_string(output, get_log_level_name(msg->level));
+      break;
+    case LOG_RENDER_FILE:
+      if(op->json) {
+	result |= append_log_json(output, msg->file, strlen(msg->file));
+      } else {
+	result |= append_log_string(output, msg->file);
+      }
+      break;
+    case LOG_RENDER_LINE:
+      result |= append_log_int(output, msg->line);
+      break;
+    case LOG_RENDER_MESSAGE:
+      result |= append_log_text(output, msg, op->json);
+      break;
+    case LOG_RENDER_FIELDS:
+      result |= append_log_fields(output, msg, op->json);
+      break;
+    }
+  }
+  if(result != 0) {
+    // never write half a line
+    output->len = start;
+  }
 }
+
 /**
- * Destroys the log queue, recycling all the messages
- * May block
- * \param q the queue
- * \return 0 if all entries were recovered, -1 otherwise
+ * Appends a string with its length to the write buffer of a binary output
+ * \param output the output
+ * \param string the string
+ * \return 0 on success, -1 on failure
  */
-int dispose_log_queue(struct log_queue * q) {
-  assert(q != NULL);
-  return release_log_entries(q->head);
+static int append_log_record_string(struct log_output * output, const char * string) {
+  uint32_t len = (uint32_t)strlen(string);
+  if(append_log_bytes(output, &len, sizeof(len)) != 0) {
+    return -1;
+  }
+  return append_log_bytes(output, string, len);
 }
 
-/*
- * Log output functions
+/**
+ * Appends the record of a call site to the write buffer of a binary output, unless it has
+ * already been written
+ * \param output the output
+ * \param msg a message from the call site
+ * \return the identifier of the call site or 0 on failure
  */
+static uint32_t write_log_site(struct log_output * output, const struct log_msg * msg) {
+  uint32_t id = get_log_site_id(msg->site);
+  if(id >= output->written_site_cap) {
+    size_t cap = output->written_site_cap == 0 ? 64 : output->written_site_cap;
+    while(cap <= id) {
+      cap *= 2;
+    }
+    bool * written_sites = (bool *)realloc(output->written_sites, cap * sizeof(bool));
+    if(written_sites == NULL) {
+      return 0;
+    }
+    memset(written_sites + output->written_site_cap, 0, (cap - output->written_site_cap) * sizeof(bool));
+    output->written_sites = written_sites;
+    output->written_site_cap = cap;
+  }
+
+  if(!output->written_sites[id]) {
+    uint8_t type = LOG_RECORD_SITE;
+    int32_t line = msg->line;
+    size_t start = output->len;
+    int result = append_log_bytes(output, &type, sizeof(type));
+    result |= append_log_bytes(output, &id, sizeof(id));
+    result |= append_log_bytes(output, &line, sizeof(line));
+    result |= append_log_record_string(output, msg->file);
+    result |= append_log_record_string(output, msg->format);
+    if(result != 0) {
+      output->len = start;
+      return 0;
+    }
+    output->written_sites[id] = true;
+  }
+  return id;
+}
 
 /**
- * Print the log messages
- * \param file the output file
- * \param msg the message to be printed
+ * Appends a log message to the write buffer of a binary output
+ * \param output the output
+ * \param msg the message to be written
  */
-static void print_log_msg(FILE * file, struct log_msg * msg) {
-  assert(file != NULL);
+static void write_log_msg(struct log_output * output, const struct log_msg * msg) {
+  assert(output != NULL);
   assert(msg != NULL);
-  
-  fprintf(file, "%s %s:%d: %s\n", log_level_labels[(int)msg->level], msg->file, msg->line, msg->buffer);
+
+  uint8_t level = (uint8_t)msg->level;
+  uint32_t thread = msg->thread;
+  int64_t time = (int64_t)get_log_msg_time(&output->clock, msg->time) + output->clock.wall_offset;
+  uint32_t len = (uint32_t)msg->len;
+  size_t start = output->len;
+  int result;
+  if(msg->site != NULL) {
+    uint32_t id = write_log_site(output, msg);
+    if(id == 0) {
+      return;
+    }
+    uint8_t type = LOG_RECORD_MESSAGE;
+    uint8_t payload = msg->payload;
+    start = output->len;
+    result = append_log_bytes(output, &type, sizeof(type));
+    result |= append_log_bytes(output, &id, sizeof(id));
+    result |= append_log_bytes(output, &level, sizeof(level));
+    result |= append_log_bytes(output, &payload, sizeof(payload));
+    result |= append_log_bytes(output, &thread, sizeof(thread));
+    result |= append_log_bytes(output, &time, sizeof(time));
+  } else {
+    uint8_t type = LOG_RECORD_TEXT;
+    int32_t line = msg->line;
+    result = append_log_bytes(output, &type, sizeof(type));
+    result |= append_log_bytes(output, &level, sizeof(level));
+    result |= append_log_bytes(output, &thread, sizeof(thread));
+    result |= append_log_bytes(output, &time, sizeof(time));
+    result |= append_log_bytes(output, &line, sizeof(line));
+    result |= append_log_record_string(output, msg->file);
+  }
+  result |= append_log_bytes(output, &len, sizeof(len));
+  result |= append_log_bytes(output, msg->buffer, len);
+  if(result != 0) {
+    output->len = start;
+  }
 }
 
 /**
- * Prints the log messages on the queue
- * \param file the output file
- * \param q a queue of messages
+ * Renders a message into the write buffer of an output, as text or binary record
+ * \param output the output
+ * \param msg the message
  */
-static void print_log_queue(FILE * file, const struct log_queue * q) {
-  assert(file != NULL);
-  assert(q != NULL);
-  
-  struct log_entry * entry = q->head;
-  while(entry != NULL) {
-    
-    print_log_msg(file, entry->msg);
+static void render_log_msg(struct log_output * output, const struct log_msg * msg) {
+  if(output->options.binary) {
+    write_log_msg(output, msg);
+  } else {
+    print_log_msg(output, msg);
+  }
+}
+
+/**
+ * Appends the magic bytes and version starting a binary output, nothing for text outputs
+ * \param output the output
+ */
+static void append_log_header(struct log_output * output) {
+  if(output->options.binary) {
+    uint32_t version = LOG_BINARY_VERSION;
+    append_log_bytes(output, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LENGTH);
+    append_log_bytes(output, &version, sizeof(version));
+  }
+}
+
+/**
+ * Writes bytes to the file descriptor of an output or copies them into its segment
+ * A short write marks the buffered messages of the output as dropped
+ * \param output the output
+ * \param data the bytes
+ * \param len the number of bytes
+ * \return the number of bytes written
+ */
+static size_t write_log_output(struct log_output * output, const char * data, size_t len) {
+  size_t written = 0;
+  if(output->segment != NULL) {
+    written = write_log_segment(output->segment, data, len);
+    output->write_failed |= written < len;
+    return written;
+  }
+  if(output->uring != NULL) {
+    written = write_log_uring(output->uring, data, len);
+    output->write_failed |= written < len;
+    return written;
+  }
+  while(written < len) {
+    ssize_t result = write(output->fd, data + written, len - written);
+    if(result < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      // nowhere to report this, drop the buffered messages
+      break;
+    }
+    written += (size_t)result;
+  }
+  output->write_failed |= written < len;
+  return written;
+}
+
+/**
+ * Compresses bytes into the stream of an output, writing what comes out
+ * \param output the compressed output
+ * \param data the bytes
+ * \param len the number of bytes
+ * \param flush Z_SYNC_FLUSH to make everything so far decompressible, Z_FINISH to end the stream
+ * \return the number of compressed bytes written
+ */
+static size_t deflate_log_output(struct log_output * output, const char * data, size_t len, int flush) {
+  z_stream * stream = output->deflater;
+  stream->next_in = (Bytef *)data;
+  stream->avail_in = (uInt)len;
+  size_t written = 0;
+  do {
+    stream->next_out = (Bytef *)output->compressed;
+    stream->avail_out = LOG_COMPRESSED_BUFFER_SIZE;
+    // only fails when there is nothing left to do
+    deflate(stream, flush);
+    written += write_log_output(output, output->compressed, LOG_COMPRESSED_BUFFER_SIZE - stream->avail_out);
+  } while(stream->avail_out == 0);
+  return written;
+}
+
+/**
+ * Ends the compressed stream of an output, the next write starts a new one
+ * \param output the output
+ */
+static void finish_log_output(struct log_output * output) {
+  if(output->deflater != NULL) {
+    count_log_output_write(output, deflate_log_output(output, NULL, 0, Z_FINISH));
+    deflateReset(output->deflater);
+  }
+}
+
+/**
+ * Computes how many bytes the write buffer of an output takes at most once written
+ * \param output the output
+ * \return the number of bytes
+ */
+static size_t get_log_output_write_bound(struct log_output * output) {
+  if(output->deflater == NULL) {
+    return output->len;
+  }
+  return deflateBound(output->deflater, output->len) + LOG_DEFLATE_OVERHEAD;
+}
+
+/**
+ * Counts the writes of an output writing through io_uring that completed since it last counted
+ * them, the messages of failed or short writes as dropped
+ * \param output the output
+ */
+static void count_log_uring_writes(struct log_output * output) {
+  size_t bytes;
+  size_t msgs;
+  size_t dropped;
+  take_log_uring_counts(output->uring, &bytes, &msgs, &dropped);
+  atomic_store_explicit(&output->written_bytes, atomic_load_explicit(&output->written_bytes, memory_order_relaxed) + bytes, memory_order_relaxed);
+  atomic_store_explicit(&output->written_msgs, atomic_load_explicit(&output->written_msgs, memory_order_relaxed) + msgs, memory_order_relaxed);
+  atomic_fetch_add_explicit(&output->cursor->dropped, dropped, memory_order_relaxed);
+}
+
+/**
+ * Writes the write buffer of an output, compressed if the output says so
+ * \param output the output
+ */
+static void flush_log_output(struct log_output * output) {
+  PROFILE_BEGIN("log flush");
+  size_t written;
+  if(output->deflater != NULL) {
+    written = deflate_log_output(output, output->buffer, output->len, Z_SYNC_FLUSH);
+  } else if(output->uring != NULL && output->len != 0) {
+    // the write buffer goes to the kernel as is, rendering continues in a free registered buffer
+    if(get_log_uring_buffer_index(output->uring, output->buffer) >= 0) {
+      // the bytes and messages are counted when the write completes, the latencies on submission
+      written = 0;
+      write_log_uring_buffer(output->uring, output->buffer, output->len, output->pending_msgs);
+      output->pending_msgs = 0;
+    } else {
+      written = write_log_output(output, output->buffer, output->len);
+      free(output->buffer);
+    }
+    output->buffer = take_log_uring_buffer(output->uring);
+    output->cap = LOG_URING_BUFFER_SIZE;
+  } else {
+    written = write_log_output(output, output->buffer, output->len);
+  }
+  count_log_output_write(output, written);
+  if(output->uring != NULL) {
+    count_log_uring_writes(output);
+  }
+  output->len = 0;
+  if(output->options.flush_policy == LOG_FLUSH_INTERVAL) {
+    clock_gettime(CLOCK_MONOTONIC, &output->flushed);
+  }
+  PROFILE_END();
+}
+
+/**
+ * Opens the next segment of a file output that has none open
+ * Every segment of a binary output starts with the header and writes the call sites again
+ * \param output the output, with nothing buffered
+ */
+static void reopen_log_output(struct log_output * output) {
+  if(open_log_segment(output->segment) != 0) {
+    // nowhere to report this, messages are dropped until a later batch opens a segment
+    return;
+  }
+  if(output->written_site_cap != 0) {
+    memset(output->written_sites, 0, output->written_site_cap * sizeof(bool));
+  }
+  append_log_header(output);
+}
+
+/**
+ * Moves a file output to a new segment after writing what it buffers to the current one
+ * \param output the output
+ */
+static void roll_log_output(struct log_output * output) {
+  flush_log_output(output);
+  finish_log_output(output);
+  close_log_segment(output->segment);
+  ++output->segment->index;
+  reopen_log_output(output);
+}
+
+/**
+ * Renders a batch of log messages straight from the ring into the write buffer of an output
+ * \param output the output
+ * \param ring the ring
+ * \param pos the position of the first message
+ * \param len the number of messages
+ */
+static void print_log_msgs(struct log_output * output, struct log_ring * ring, size_t pos, size_t len) {
+  assert(output != NULL);
+  assert(ring != NULL);
+
+  if(output->segment != NULL && output->segment->fd < 0) {
+    // a segment failed to open when rolling, what is buffered for it is dropped before trying again
+    flush_log_output(output);
+    reopen_log_output(output);
+  }
+
+  // the clocks are read once, every message of the batch is converted with them
+  read_log_clock(&output->clock);
+  for(size_t i = 0; i < len; ++i) {
+    const struct log_msg * msg = &ring->slots[(pos + i) & (ring->capacity - 1)].msg;
+    if(msg->dropped) {
+      continue;
+    }
+    size_t start = output->len;
+    render_log_msg(output, msg);
+    if(output->segment != NULL) {
+      if(is_log_segment_full(output->segment, get_log_output_write_bound(output), output->clock.time)) {
+	// the message opens the next segment, after the header of a binary output
+	output->len = start;
+	roll_log_output(output);
+	start = output->len;
+	render_log_msg(output, msg);
+      }
+      if(output->segment->fd >= 0) {
+	++output->segment->msgs;
+      }
+    }
+    if(output->len != start) {
+      ++output->pending_msgs;
+      if(output->pending_time_len < LOG_LATENCY_SAMPLES) {
+	output->pending_times[output->pending_time_len++] = get_log_msg_time(&output->clock, msg->time);
+      }
+    }
+  }
+}
+
+/**
+ * Computes the time until an output flushing by time has to flush
+ * \param output the output
+ * \param timeout receives the time left, zero if the output is due
+ */
+static void get_log_flush_timeout(const struct log_output * output, struct timespec * timeout) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long elapsed = (now.tv_sec - output->flushed.tv_sec) * 1000000000LL + (now.tv_nsec - output->flushed.tv_nsec);
+  long long left = (long long)output->options.flush_interval * 1000000LL - elapsed;
+  if(left < 0) {
+    left = 0;
+  }
+  timeout->tv_sec = (time_t)(left / 1000000000LL);
+  timeout->tv_nsec = (long)(left % 1000000000LL);
+}
+
+/**
+ * Writes the write buffer of an output if its flush policy says so
+ * \param output the output
+ */
+static void flush_log_output_if_due(struct log_output * output) {
+  if(output->len == 0) {
+    return;
+  }
+  switch(output->options.flush_policy) {
+  case LOG_FLUSH_BATCH:
+    flush_log_output(output);
+    break;
+  case LOG_FLUSH_SIZE:
+    if(output->len >= output->options.flush_size) {
+      flush_log_output(output);
+    }
+    break;
+  case LOG_FLUSH_INTERVAL: {
+    struct timespec timeout;
+    get_log_flush_timeout(output, &timeout);
+    // the size threshold bounds the memory buffered between intervals
+    if((timeout.tv_sec == 0 && timeout.tv_nsec == 0) || output->len >= output->options.flush_size) {
+      flush_log_output(output);
+    }
+    break;
+  }
+  }
+}
+
+/**
+ * Computes the time until the first output of a writer flushing by time has to flush
+ * \param writer the writer
+ * \param timeout receives the time left
+ * \return true if an output has messages waiting for its interval, false otherwise
+ */
+static bool get_log_writer_timeout(const struct log_writer * writer, struct timespec * timeout) {
+  bool pending = false;
+  for(size_t i = writer->first; i < writer->first + writer->len; ++i) {
+    const struct log_output * output = outputs + i;
+    if(output->options.flush_policy != LOG_FLUSH_INTERVAL || output->len == 0) {
+      continue;
+    }
+    struct timespec output_timeout;
+    get_log_flush_timeout(output, &output_timeout);
+    if(!pending || output_timeout.tv_sec < timeout->tv_sec
+       || (output_timeout.tv_sec == timeout->tv_sec && output_timeout.tv_nsec < timeout->tv_nsec)) {
+      *timeout = output_timeout;
+    }
+    pending = true;
+  }
+  return pending;
+}
+
+/**
+ * Prepares an output for writing on the thread of its writer
+ * \param output the output
+ */
+static void open_log_output(struct log_output * output) {
+  // anything written through the file before the logger took over goes first
+  if(output->file != NULL) {
+    fflush(output->file);
+  }
+  // without io_uring the output writes directly
+  if(output->options.io_uring && output->segment == NULL) {
+    output->uring = create_log_uring(output->fd);
+    if(output->uring != NULL) {
+      free(output->buffer);
+      output->buffer = take_log_uring_buffer(output->uring);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &output->flushed);
+  append_log_header(output);
+}
+
+/**
+ * Writes what an output still buffers and frees its buffers
+ * \param output the output
+ */
+static void close_log_output(struct log_output * output) {
+  flush_log_output(output);
+  finish_log_output(output);
+  if(output->deflater != NULL) {
+    deflateEnd(output->deflater);
+  }
+  if(output->segment != NULL) {
+    close_log_segment(output->segment);
+  }
+  if(output->uring != NULL) {
+    if(get_log_uring_buffer_index(output->uring, output->buffer) >= 0) {
+      output->buffer = NULL;
+    }
+    wait_for_log_uring(output->uring);
+    count_log_uring_writes(output);
+    destroy_log_uring(output->uring);
+  }
+  free(output->deflater);
+  free(output->compressed);
+  free(output->buffer);
+  free(output->written_sites);
+  free(output->pending_times);
+}
+
+/**
+ * Reads a batch of messages for an output
+ * \param output the output
+ * \return true if the output read messages
+ */
+static bool read_log_output(struct log_output * output) {
+  size_t pos;
+  size_t len = claim_log_msgs(ring, output->cursor, LOG_BATCH_SIZE, &pos);
+  if(len == 0) {
+    return false;
+  }
+  PROFILE_BEGIN("log batch");
+  count_log_queue_depth(output, ring, pos);
+  print_log_msgs(output, ring, pos, len);
+  advance_log_cursor(ring, output->cursor, pos, len);
+  flush_log_output_if_due(output);
+  PROFILE_END();
+  return true;
+}
 
-    entry = entry->next;
+/**
+ * Log writer thread function
+ * \param arg the writer cast as a void *
+ * \return always NULL
+ */
+static void * run_log_writer(void * arg) {
+
+  struct log_writer * writer = (struct log_writer *)arg;
+  struct log_output * first = outputs + writer->first;
+  struct log_output * last = first + writer->len;
+  pthread_setname_np(pthread_self(), "log writer");
+  register_profile_thread();
+
+  // thread attributes only take the real time policies, and nice values are per thread on
+  // Linux, a failure leaves the writer scheduled like the thread starting the logger
+  if(writer_options.scheduling != LOG_SCHEDULING_DEFAULT) {
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), writer_options.scheduling == LOG_SCHEDULING_BATCH ? SCHED_BATCH : SCHED_IDLE, &param);
+  }
+  if(writer_options.nice != 0) {
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), writer_options.nice);
+  }
+  for(struct log_output * output = first; output != last; ++output) {
+    open_log_output(output);
+  }
+
+  while(true) {
+    // read the flag before reading the ring, so nothing published before the stop signal is missed
+    bool run = atomic_load_explicit(&ring->running, memory_order_acquire);
+    bool read = false;
+    for(struct log_output * output = first; output != last; ++output) {
+      read = read_log_output(output) || read;
+    }
+    if(read) {
+      continue;
+    } else if(!run) {
+      break;
+    }
+    struct timespec timeout;
+    bool pending = get_log_writer_timeout(writer, &timeout);
+    wait_for_log_msg(ring, first->cursor, writer->len, pending ? &timeout : NULL);
+    if(pending) {
+      for(struct log_output * output = first; output != last; ++output) {
+	flush_log_output_if_due(output);
+      }
+    }
+  }
+
+  for(struct log_output * output = first; output != last; ++output) {
+    close_log_output(output);
+  }
+  return NULL;
+}
+
+/**
+ * Prepares an output for starting, allocating its buffers
+ * \param output the output
+ * \param cursor the read position of the output in the ring
+ * \return 0 on success, -1 otherwise
+ */
+static int start_log_output(struct log_output * output, struct log_cursor * cursor) {
+  assert(output != NULL);
+  assert(cursor != NULL);
+  output->cursor = cursor;
+  output->buffer = (char *)malloc(DEFAULT_LOG_OUTPUT_BUFFER_SIZE);
+  output->len = 0;
+  output->cap = DEFAULT_LOG_OUTPUT_BUFFER_SIZE;
+  output->written_sites = NULL;
+  output->written_site_cap = 0;
+  output->time_second = -1;
+  output->pending_times = (unsigned long long *)malloc(LOG_LATENCY_SAMPLES * sizeof(unsigned long long));
+  output->pending_time_len = 0;
+  output->pending_msgs = 0;
+  output->write_failed = false;
+  atomic_init(&output->max_queue_depth, 0);
+  atomic_init(&output->written_msgs, 0);
+  atomic_init(&output->written_bytes, 0);
+  for(size_t i = 0; i < LOG_LATENCY_BUCKETS; ++i) {
+    atomic_init(&output->latencies[i], 0);
+  }
+  if(output->buffer == NULL || output->pending_times == NULL) {
+    free(output->buffer);
+    free(output->pending_times);
+    return -1;
+  }
+
+  output->deflater = NULL;
+  output->compressed = NULL;
+  if(output->options.compression == LOG_COMPRESSION_GZIP) {
+    output->deflater = (z_stream *)calloc(1, sizeof(z_stream));
+    output->compressed = (char *)malloc(LOG_COMPRESSED_BUFFER_SIZE);
+    if(output->deflater == NULL || output->compressed == NULL
+       || deflateInit2(output->deflater, output->options.compression_level, Z_DEFLATED, LOG_GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      free(output->deflater);
+      output->deflater = NULL;
+    }
+  }
+  if((output->options.compression == LOG_COMPRESSION_GZIP && output->deflater == NULL)
+     || (output->segment != NULL && open_log_segment(output->segment) != 0)) {
+    if(output->deflater != NULL) {
+      deflateEnd(output->deflater);
+    }
+    free(output->deflater);
+    free(output->compressed);
+    free(output->buffer);
+    free(output->pending_times);
+    return -1;
+  }
+  output->uring = NULL;
+  return 0;
+}
+
+/**
+ * Starts the thread of a writer on the cores of the writer options
+ * \param writer the writer
+ * \return 0 on success, -1 otherwise
+ */
+static int start_log_writer(struct log_writer * writer) {
+  assert(writer != NULL);
+
+  pthread_attr_t attr;
+  if(pthread_attr_init(&attr) != 0) {
+    return -1;
+  }
+  int result = 0;
+  if(writer_options.cpu_mask != 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for(int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; ++cpu) {
+      if((writer_options.cpu_mask >> cpu & 1) != 0) {
+	CPU_SET(cpu, &cpus);
+      }
+    }
+    result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  if(result == 0) {
+    result = pthread_create(&writer->thread, &attr, run_log_writer, writer);
+  }
+  pthread_attr_destroy(&attr);
+  return result == 0 ? 0 : -1;
+}
+
+/**
+ * Stops the ring and waits for the writers to write what it holds
+ * The outputs of writers that did not start get closed here
+ * \param started the number of writers that have actually started
+ */
+static void stop_log_writers(size_t started) {
+  stop_log_ring(ring);
+  for(size_t i = 0; i < started; ++i) {
+    pthread_join(writers[i].thread, NULL);
+  }
+  for(size_t i = started; i < writer_len; ++i) {
+    for(size_t j = writers[i].first; j < writers[i].first + writers[i].len; ++j) {
+      close_log_output(outputs + j);
+    }
+  }
+  free(writers);
+  writers = NULL;
+  writer_len = 0;
+}
+
+/*
+ * Frame buffer functions
+ */
+
+/**
+ * Returns the frame buffer of this thread, creating it on the first message of the thread
+ * \return the frame buffer or NULL on failure
+ */
+static struct log_frame_buffer * get_log_frame_buffer() {
+  if(frame_buffer != NULL && frame_buffer_generation == frame_generation) {
+    return frame_buffer;
+  }
+  size_t cap = CACHE_LINE_SIZE;
+  while(cap < frame_buffer_size) {
+    cap *= 2;
+  }
+  struct log_frame_buffer * buffer = (struct log_frame_buffer *)aligned_alloc(CACHE_LINE_SIZE, sizeof(struct log_frame_buffer));
+  char * data = (char *)malloc(cap);
+  if(buffer == NULL || data == NULL) {
+    free(buffer);
+    free(data);
+    return NULL;
   }
+  buffer->data = data;
+  buffer->cap = cap;
+  atomic_init(&buffer->head, 0);
+  buffer->cached_tail = 0;
+  atomic_init(&buffer->tail, 0);
+
+  pthread_mutex_lock(&frame_buffer_mutex);
+  buffer->next = frame_buffers;
+  frame_buffers = buffer;
+  pthread_mutex_unlock(&frame_buffer_mutex);
+  frame_buffer = buffer;
+  frame_buffer_generation = frame_generation;
+  return buffer;
 }
 
 /**
- * Log output worker thread function
- * \param arg the output cast as a void *
- * \return always NULL
+ * Reserves room for a record in the frame buffer of this thread
+ * Room for a message of the maximum size is needed, as the size is only known once formatted
+ * \param buffer the frame buffer of this thread
+ * \param head receives the position of the record
+ * \return the record or NULL if the buffer is full
  */
-static void * run_log_output(void * arg) {
-  
-  struct log_output * output = (struct log_output *)arg;
-  struct log_queue q;
-
-  init_log_queue(&q);
-  
-  bool run = true;
-  
-  if(pthread_mutex_lock(&output->mutex) != 0) {
+static struct log_frame_record * reserve_log_frame_record(struct log_frame_buffer * buffer, size_t * head) {
+  size_t record_cap = (sizeof(struct log_frame_record) + ring->max_msg_size + 7) & ~(size_t)7;
+  if(record_cap > buffer->cap) {
     return NULL;
   }
-  do {
-    if(!output->running) {
-      run = false;
-    }
-    if(run && output->queue.head == NULL) {
-      if(pthread_cond_wait(&output->cond, &output->mutex) != 0) {
-	break;
-      }
-    }
-    if(!output->running) {
-      run = false;
-    }
-    move_between_log_queues(&q, &output->queue);
-    if(pthread_mutex_unlock(&output->mutex) != 0) {
-      return NULL;
-    }
-
-    print_log_queue(output->file, &q);
-
-    if(clear_log_queue(&q) != 0) {
-      return NULL;
-    }
-    
-    if(pthread_mutex_lock(&output->mutex) != 0) {
+  *head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  size_t offset = *head & (buffer->cap - 1);
+  // records never wrap, the rest of the buffer is skipped instead
+  size_t skip = buffer->cap - offset < record_cap ? buffer->cap - offset : 0;
+  if(*head + skip + record_cap - buffer->cached_tail > buffer->cap) {
+    buffer->cached_tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if(*head + skip + record_cap - buffer->cached_tail > buffer->cap) {
       return NULL;
     }
-  } while(run);
+  }
+  if(skip != 0) {
+    ((struct log_frame_record *)(buffer->data + offset))->size = 0;
+    *head += skip;
+    offset = 0;
+  }
+  return (struct log_frame_record *)(buffer->data + offset);
+}
 
-  pthread_mutex_unlock(&output->mutex);
-  
-  dispose_log_queue(&q);
-  return NULL;
+/**
+ * Completes a record with its payload and adds it to the frame buffer of this thread
+ * \param buffer the frame buffer of this thread
+ * \param record the record, with its payload and length
+ * \param head the position of the record
+ * \param site the call site or NULL
+ * \param level the log level
+ * \param file the file where the message originates from
+ * \param line the line where the message originates from
+ * \param format the format string or the text of a structured message
+ */
+static void commit_log_frame_record(struct log_frame_buffer * buffer, struct log_frame_record * record, size_t head, struct log_site * site, enum log_level level, const char * file, int line, const char * format) {
+  record->site = site;
+  record->file = file;
+  record->format = format;
+  record->time = get_log_ticks();
+  record->line = line;
+  record->level = level;
+  record->thread = get_log_thread_id();
+  // text keeps its terminating NUL
+  record->size = (sizeof(struct log_frame_record) + record->len + 1 + 7) & ~(size_t)7;
+  atomic_store_explicit(&buffer->head, head + record->size, memory_order_release);
 }
 
 /**
- * Starts a log output
- * \param output the output
- * \return 0 on success, -1 otherwise
+ * Appends a message to the frame buffer of this thread
+ * \param buffer the frame buffer of this thread
+ * \param site the call site or NULL
+ * \param level the log level
+ * \param file the file where the message originates from
+ * \param line the line where the message originates from
+ * \param format the format string
+ * \param arg_count the number of arguments to capture, -1 to format them
+ * \param args the arguments
+ * \return 0 on success, -1 if the buffer is full or on failure
  */
-static int start_log_output(struct log_output * output) {
-  assert(output != NULL);
-  if(pthread_mutex_init(&output->mutex, NULL) != 0) {
+static int add_log_frame_msg(struct log_frame_buffer * buffer, struct log_site * site, enum log_level level, const char * file, int line, const char * format, int arg_count, va_list args) {
+  size_t head;
+  struct log_frame_record * record = reserve_log_frame_record(buffer, &head);
+  if(record == NULL) {
     return -1;
   }
-  if(pthread_cond_init(&output->cond, NULL) != 0) {
-    pthread_mutex_destroy(&output->mutex);
-    return -1;
+  size_t max_len = ring->max_msg_size;
+  record->payload = LOG_PAYLOAD_TEXT;
+  record->truncated = false;
+  if(arg_count >= 0) {
+    va_list args2;
+    va_copy(args2, args);
+    size_t len = capture_log_args(site->arg_kinds, arg_count, args2, record->data, max_len);
+    va_end(args2);
+    if(len <= max_len) {
+      record->len = len;
+      record->payload = LOG_PAYLOAD_ARGS;
+    }
   }
-  output->running = true;
-  init_log_queue(&output->queue);
-
-  if(pthread_create(&output->thread, NULL, run_log_output, output) != 0) {
-    pthread_cond_destroy(&output->cond);
-    pthread_mutex_destroy(&output->mutex);
-    return -1;
+  if(record->payload == LOG_PAYLOAD_TEXT) {
+    // the caller formats the arguments again if this fails
+    va_list args2;
+    va_copy(args2, args);
+    int result = vsnprintf(record->data, max_len, format, args2);
+    va_end(args2);
+    if(result < 0) {
+      return -1;
+    }
+    record->truncated = (size_t)result >= max_len;
+    record->len = (size_t)result < max_len ? (size_t)result : max_len - 1;
   }
+  commit_log_frame_record(buffer, record, head, site, level, file, line, format);
   return 0;
 }
 
-
 /**
- * Add log entries to the outputs
- * \param head a linked list of entries with a message
+ * Appends a structured message to the frame buffer of this thread
+ * \param buffer the frame buffer of this thread
+ * \param site the call site
+ * \param level the log level
+ * \param message the text of the message
+ * \param fields the fields
+ * \param field_len the number of fields
+ * \return 0 on success, -1 if the buffer is full
  */
-static int add_log_entries_to_outputs(struct log_entry * head) {
-  for(size_t i = 0; i < output_len; ++i) {
-    assert(head != NULL);
-    struct log_entry * next = head;
-
-    if(pthread_mutex_lock(&outputs[i].mutex) != 0) {  
-      return -1;
-    }
-    push_onto_log_queue(&outputs[i].queue, head);
-    if(pthread_mutex_unlock(&outputs[i].mutex) != 0) {
-      return -1;
-    }
+static int add_log_frame_fields(struct log_frame_buffer * buffer, struct log_site * site, enum log_level level, const char * message, const struct log_field * fields, size_t field_len) {
+  size_t head;
+  struct log_frame_record * record = reserve_log_frame_record(buffer, &head);
+  if(record == NULL) {
+    return -1;
   }
+  record->payload = LOG_PAYLOAD_FIELDS;
+  record->truncated = encode_log_fields(fields, field_len, record->data, ring->max_msg_size, &record->len) > ring->max_msg_size;
+  commit_log_frame_record(buffer, record, head, site, level, site->file, site->line, message);
   return 0;
 }
 
 /**
- * Signals the output that it has to stop logging
- * \param output the output
- * \return 0 on success, -1 on failure
+ * Copies a record of a frame buffer into the ring
+ * A record that gets no block is dropped or waits for one as the overflow policy says
+ * \param record the record
  */
-static int signal_log_output_stop(struct log_output * output) {
-  assert(output != NULL);
-  if(pthread_mutex_lock(&output->mutex) != 0) {
-    return -1;
+static void publish_log_frame_record(const struct log_frame_record * record) {
+  size_t pos;
+  struct log_msg * msg = reserve_log_msg_for_level(ring, record->level, &pos);
+  if(msg == NULL) {
+    return;
   }
-  output->running = false;
-  if(pthread_cond_signal(&output->cond) != 0) {
-    return -1;
+  size_t size = record->payload == LOG_PAYLOAD_TEXT ? record->len + 1 : record->len;
+  msg->dropped = false;
+  // records never exceed the maximum message size, so they fit once they have a block
+  if(size > msg->cap && acquire_log_msg_block(ring, &msg, size, record->level, &pos) != 0) {
+    // the outputs skip it
+    publish_log_msg(ring, pos);
+    return;
   }
-  if(pthread_mutex_unlock(&output->mutex) != 0) {
-    return -1;
+  if(record->truncated) {
+    atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
   }
-  return 0;
+  memcpy(msg->buffer, record->data, size);
+  msg->len = record->len;
+  msg->payload = record->payload;
+  msg->level = record->level;
+  msg->file = record->file;
+  msg->line = record->line;
+  msg->site = record->site;
+  msg->format = record->format;
+  msg->time = record->time;
+  msg->thread = record->thread;
+  publish_log_msg(ring, pos);
 }
 
 /**
- * Wait for an output to stop
- * \param the output
+ * Copies the records of a frame buffer into the ring and frees their space
+ * \param buffer the frame buffer
  */
-static void wait_for_log_output_stop(struct log_output * output) {
-  assert(output != NULL);
-  pthread_join(output->thread, NULL);
+static void publish_log_frame_buffer(struct log_frame_buffer * buffer) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  while(tail != head) {
+    size_t offset = tail & (buffer->cap - 1);
+    const struct log_frame_record * record = (const struct log_frame_record *)(buffer->data + offset);
+    if(record->size == 0) {
+      tail += buffer->cap - offset;
+      continue;
+    }
+    publish_log_frame_record(record);
+    tail += record->size;
+  }
+  atomic_store_explicit(&buffer->tail, tail, memory_order_release);
 }
 
-/**
- * Disposes the output
- * \param output the output
+/*
+ * Rate limit functions
  */
-static void dispose_log_output(struct log_output * output) {
-  assert(output != NULL);
-  pthread_cond_destroy(&output->cond);
-  pthread_mutex_destroy(&output->mutex);
-  dispose_log_queue(&output->queue);
-}
 
 /**
- * Stops all outputs
- * \param started the number of log outputs that has actually started
+ * Takes a token from a rate limit if one is left
+ * \param limit the rate limit state
+ * \param interval the time it takes to earn a token, in milliseconds
+ * \param burst the maximum number of tokens
+ * \return true if a token was taken
  */
-static void stop_and_dispose_log_outputs(size_t started) {
-  for(size_t i = 0; i < started; ++i) {
-    if(signal_log_output_stop(outputs + i) != 0) {
-	// no sense trying
-      return;
+static bool try_take_log_limit_token(struct log_limit * limit, unsigned int interval, unsigned int burst) {
+  // the coarse clock is read without a system call, its resolution is plenty for rate limits
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  long long now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  long long cost = (long long)interval * 1000000LL;
+
+  long long next = atomic_load_explicit(&limit->next, memory_order_relaxed);
+  while(true) {
+    long long new_next = (next > now ? next : now) + cost;
+    if(new_next - now > cost * (long long)burst) {
+      return false;
+    }
+    if(atomic_compare_exchange_weak_explicit(&limit->next, &next, new_next, memory_order_relaxed, memory_order_relaxed)) {
+      return true;
     }
   }
-  for(size_t i = 0; i < started; ++i) {
-    wait_for_log_output_stop(outputs + i);
-    dispose_log_output(outputs + i);
+}
+
+/**
+ * Adds a rate limit to the limits flush_log_limits reports, once
+ * \param limit the rate limit state
+ * \param site the limited call site
+ * \param level the log level of the call site
+ * \param interval the time it takes to earn a token, in milliseconds
+ * \param burst the maximum number of tokens
+ */
+static void register_log_limit(struct log_limit * limit, const struct log_site * site, enum log_level level, unsigned int interval, unsigned int burst) {
+  unsigned int registered = 0;
+  if(!atomic_compare_exchange_strong_explicit(&limit->registered, &registered, 1, memory_order_relaxed, memory_order_relaxed)) {
+    return;
   }
+  limit->site.file = site->file;
+  limit->site.line = site->line;
+  limit->level = level;
+  limit->interval = interval;
+  limit->burst = burst;
+  struct log_limit * head = atomic_load_explicit(&log_limits, memory_order_relaxed);
+  do {
+    limit->next_limit = head;
+  } while(!atomic_compare_exchange_weak_explicit(&log_limits, &head, limit, memory_order_release, memory_order_relaxed));
+  atomic_store_explicit(&limit->registered, 2, memory_order_release);
 }
 
 /*
@@ -659,21 +3947,81 @@ static void stop_and_dispose_log_outputs(size_t started) {
  */
 
 int init_logger(enum log_level min_level_) {
-  messages = NULL;
-  entries = NULL;
-  if(pthread_mutex_init(&mutex, NULL) != 0) {
+  struct log_memory_options options;
+  init_log_memory_options(&options);
+  return init_logger_with_options(min_level_, &options);
+}
+
+void init_log_memory_options(struct log_memory_options * options) {
+  assert(options != NULL);
+  options->memory_limit = DEFAULT_LOG_MEMORY_LIMIT;
+  options->max_msg_size = DEFAULT_LOG_MAX_MSG_SIZE;
+  options->overflow_policy = LOG_OVERFLOW_BLOCK;
+  options->drop_level = LOG_LEVEL_WARNING;
+}
+
+int init_logger_with_options(enum log_level min_level_, const struct log_memory_options * options) {
+  assert(options != NULL);
+
+  ring = create_log_ring(options);
+  if(ring == NULL) {
     return -1;
   }
-  min_level = min_level_;
+  use_tsc = has_invariant_tsc();
+  start_ticks = get_log_ticks();
+  start_time = get_log_time();
+  pthread_mutex_lock(&module_level_mutex);
+  atomic_store_explicit(&min_level, (int)min_level_, memory_order_relaxed);
+  module_level_len = 0;
+  update_log_level_threshold();
+  pthread_mutex_unlock(&module_level_mutex);
+  formatting = LOG_FORMATTING_IMMEDIATE;
+  init_log_writer_options(&writer_options);
+  writers = NULL;
+  writer_len = 0;
+  frame_buffer_size = 0;
+  frame_buffers = NULL;
+  ++frame_generation;
   outputs = NULL;
   output_len = 0;
   output_cap = 0;
   return 0;
 }
 
+void init_log_output_options(struct log_output_options * options) {
+  assert(options != NULL);
+  options->binary = false;
+  options->line_template = LOG_TEMPLATE_DEFAULT;
+  options->flush_policy = LOG_FLUSH_BATCH;
+  options->flush_size = DEFAULT_LOG_FLUSH_SIZE;
+  options->flush_interval = DEFAULT_LOG_FLUSH_INTERVAL;
+  options->compression = LOG_COMPRESSION_NONE;
+  options->compression_level = DEFAULT_LOG_COMPRESSION_LEVEL;
+  options->io_uring = false;
+}
+
 int add_logger_output(FILE * file) {
-  assert(file != NULL);
+  struct log_output_options options;
+  init_log_output_options(&options);
+  return add_logger_output_with_options(file, &options);
+}
+
+int add_logger_binary_output(FILE * file) {
+  struct log_output_options options;
+  init_log_output_options(&options);
+  options.binary = true;
+  return add_logger_output_with_options(file, &options);
+}
 
+/**
+ * Adds an output to the logger
+ * \param file the output file or NULL for a file output
+ * \param fd the file descriptor of the output file or -1 for a file output
+ * \param segment the segments of a file output or NULL, owned by the output on success
+ * \param options the options of the output
+ * \return 0 on success, -1 if the line template is invalid or on failure
+ */
+static int add_log_output(FILE * file, int fd, struct log_segment * segment, const struct log_output_options * options) {
   if(output_len == output_cap) {
     size_t new_cap;
     if(output_cap == 0){
@@ -688,23 +4036,192 @@ int add_logger_output(FILE * file) {
     outputs = buf;
     output_cap = new_cap;
   }
-  outputs[output_len].file = file;
+  struct log_output * output = outputs + output_len;
+  output->file = file;
+  output->fd = fd;
+  output->segment = segment;
+  output->options = *options;
+  output->line_template = strdup(options->line_template != NULL ? options->line_template : LOG_TEMPLATE_DEFAULT);
+  output->ops = NULL;
+  output->scratch = NULL;
+  output->scratch_cap = 0;
+  if(output->line_template == NULL || compile_log_template(output) != 0) {
+    free(output->line_template);
+    free(output->ops);
+    return -1;
+  }
   ++output_len;
   return 0;
 }
 
+int add_logger_output_with_options(FILE * file, const struct log_output_options * options) {
+  assert(file != NULL);
+  assert(options != NULL);
+
+  int fd = fileno(file);
+  if(fd < 0) {
+    return -1;
+  }
+  return add_log_output(file, fd, NULL, options);
+}
+
+void init_log_file_options(struct log_file_options * options) {
+  assert(options != NULL);
+  options->segment_size = DEFAULT_LOG_SEGMENT_SIZE;
+  options->roll_interval = 0;
+  options->sync_interval = DEFAULT_LOG_SYNC_INTERVAL;
+}
+
+int add_logger_file_output(const char * path, const struct log_output_options * options, const struct log_file_options * file_options) {
+  assert(path != NULL);
+  assert(options != NULL);
+  assert(file_options != NULL);
+
+  if(file_options->segment_size == 0) {
+    return -1;
+  }
+  struct log_segment * segment = (struct log_segment *)malloc(sizeof(struct log_segment));
+  if(segment == NULL) {
+    return -1;
+  }
+  segment->path = strdup(path);
+  segment->options = *file_options;
+  segment->index = 0;
+  segment->fd = -1;
+  segment->map = NULL;
+  segment->len = 0;
+  segment->msgs = 0;
+  if(segment->path == NULL || add_log_output(NULL, -1, segment, options) != 0) {
+    free(segment->path);
+    free(segment);
+    return -1;
+  }
+  return 0;
+}
+
+void set_log_formatting(enum log_formatting formatting_) {
+  formatting = formatting_;
+}
+
+void set_log_frame_buffering(size_t buffer_size) {
+  frame_buffer_size = buffer_size;
+}
+
+void init_log_writer_options(struct log_writer_options * options) {
+  assert(options != NULL);
+  options->thread_count = 0;
+  options->cpu_mask = 0;
+  options->scheduling = LOG_SCHEDULING_DEFAULT;
+  options->nice = 0;
+}
+
+void set_log_writer_options(const struct log_writer_options * options) {
+  assert(options != NULL);
+  writer_options = *options;
+}
+
 int start_logger() {
+  if(output_len == 0) {
+    return 0;
+  }
+  if(start_log_ring(ring, output_len) != 0) {
+    return -1;
+  }
+
+  size_t prepared = 0;
+  while(prepared < output_len && start_log_output(outputs + prepared, ring->cursors + prepared) == 0) {
+    ++prepared;
+  }
+  size_t count = writer_options.thread_count;
+  if(count == 0 || count > output_len) {
+    count = output_len;
+  }
+  writers = prepared == output_len ? (struct log_writer *)malloc(count * sizeof(struct log_writer)) : NULL;
+  if(writers == NULL) {
+    stop_log_ring(ring);
+    for(size_t i = 0; i < prepared; ++i) {
+      close_log_output(outputs + i);
+    }
+    return -1;
+  }
+
+  // the outputs are shared out in consecutive ranges, so the cursors of a writer are too
+  writer_len = count;
+  for(size_t i = 0; i < count; ++i) {
+    writers[i].first = i * (output_len / count) + (i < output_len % count ? i : output_len % count);
+    writers[i].len = output_len / count + (i < output_len % count ? 1 : 0);
+  }
   size_t started = 0;
-  int result = 0;
-  for(; result == 0 && started < output_len; ++started) {
-    int r = start_log_output(outputs + started);
-    if(r != 0) {
-      result = r;
+  while(started < writer_len && start_log_writer(writers + started) == 0) {
+    ++started;
+  }
+  if(started != writer_len) {
+    stop_log_writers(started);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Creates and publishes a log message
+ * \param site the call site or NULL
+ * \param level the log level
+ * \param file the file where the message originates from
+ * \param line the line where the message originates from
+ * \param format the format string
+ * \param args the parameters for formatting
+ * \return 0 on success, -1 on failure
+ */
+static int add_log_msg(struct log_site * site, enum log_level level, const char * file, int line, const char * format, va_list args) {
+  if(ring == NULL || !atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+    return -1;
+  }
+  unsigned long long time = get_log_ticks();
+
+  int arg_count = -1;
+  if(site != NULL && formatting == LOG_FORMATTING_DEFERRED) {
+    arg_count = get_log_site_arg_count(site, format);
+  }
+
+  if(frame_buffer_size != 0) {
+    struct log_frame_buffer * buffer = get_log_frame_buffer();
+    // a message that does not fit goes to the ring right away
+    if(buffer != NULL && add_log_frame_msg(buffer, site, level, file, line, format, arg_count, args) == 0) {
+      return 0;
     }
   }
-  if(result != 0) {
-    stop_and_dispose_log_outputs(started);
+
+  size_t pos;
+  struct log_msg * msg = reserve_log_msg_for_level(ring, level, &pos);
+  if(msg == NULL) {
+    return -1;
+  }
+
+  msg->dropped = false;
+  int result = -1;
+  if(arg_count >= 0) {
+    va_list args2;
+    va_copy(args2, args);
+    result = capture_log_msg(ring, &msg, level, &pos, site, arg_count, args2);
+    va_end(args2);
   }
+  bool deferred = result == 0;
+  if(!deferred && !msg->dropped) {
+    // arguments too large to capture get formatted and truncated instead
+    result = format_log_msg(ring, &msg, level, &pos, format, args);
+  }
+
+  msg->level = level;
+  msg->file = file;
+  msg->line = line;
+  msg->site = site;
+  msg->format = format;
+  msg->time = time;
+  msg->thread = get_log_thread_id();
+  msg->payload = deferred ? LOG_PAYLOAD_ARGS : LOG_PAYLOAD_TEXT;
+  // the slot is reserved either way, failed messages are published so the outputs can skip them
+  msg->dropped = result != 0;
+  publish_log_msg(ring, pos);
   return result;
 }
 
@@ -712,56 +4229,298 @@ int add_log_message(enum log_level level, const char * file, int line, const cha
   assert(file != NULL);
   assert(format != NULL);
 
-  struct log_entry * head = acquire_log_entries();
-  if(head == NULL) {
-    return -1;
-  }
-  struct log_msg * msg = head->msg;
-  
+  PROFILE_BEGIN("log message");
+  va_list args;
+  va_start(args, format);
+  int result = add_log_msg(NULL, level, file, line, format, args);
+  va_end(args);
+  PROFILE_END();
+  return result;
+}
+
+int add_log_site_message(struct log_site * site, enum log_level level, const char * format, ...) {
+  assert(site != NULL);
+  assert(format != NULL);
+
+  PROFILE_BEGIN("log message");
   va_list args;
   va_start(args, format);
-  int result = vsnprintf(msg->buffer, msg->cap, format, args);
+  int result = add_log_msg(site, level, site->file, site->line, format, args);
   va_end(args);
+  PROFILE_END();
+  return result;
+}
+
+int add_log_site_fields(struct log_site * site, enum log_level level, const char * message, const struct log_field * fields, size_t field_len) {
+  assert(site != NULL);
+  assert(message != NULL);
+  assert(fields != NULL || field_len == 0);
 
-  if(result < 0) {
-    destroy_log_entries_and_msg(head);
+  if(ring == NULL || !atomic_load_explicit(&ring->running, memory_order_relaxed)) {
     return -1;
   }
-  
-  if(result + 1 >= (int)msg->cap) {
-    // allocate bigger buffer and try again
-    if(realloc_log_msg_buffer(head->msg, (size_t)(result + 1)) != 0) {
-      destroy_log_entries_and_msg(head);
-      return -1;
+  unsigned long long time = get_log_ticks();
+
+  if(frame_buffer_size != 0) {
+    struct log_frame_buffer * buffer = get_log_frame_buffer();
+    if(buffer != NULL && add_log_frame_fields(buffer, site, level, message, fields, field_len) == 0) {
+      return 0;
     }
-    
-    va_list args2;
-    va_start(args2, format);
-    result = vsnprintf(msg->buffer, msg->cap, format, args2);
-    va_end(args2);
-    if(result < 0 || result + 1 >= (int)msg->cap) {
-      destroy_log_entries_and_msg(head);
-      return -1;
+  }
+
+  size_t pos;
+  struct log_msg * msg = reserve_log_msg_for_level(ring, level, &pos);
+  if(msg == NULL) {
+    return -1;
+  }
+
+  // fields beyond the maximum message size or that get no block are left out, the message itself is kept
+  msg->dropped = false;
+  size_t size = encode_log_fields(fields, field_len, msg->buffer, msg->cap, &msg->len);
+  if(size > msg->cap) {
+    size_t block_size = size < ring->max_msg_size ? size : ring->max_msg_size;
+    if(block_size > msg->cap && acquire_log_msg_block(ring, &msg, block_size, level, &pos) == 0) {
+      size = encode_log_fields(fields, field_len, msg->buffer, msg->cap, &msg->len);
+    }
+    if(size > msg->cap && !msg->dropped) {
+      atomic_fetch_add_explicit(&ring->truncated, 1, memory_order_relaxed);
     }
   }
-  
-  msg->buffer[result] = '\0';
+
   msg->level = level;
-  msg->file = file;
-  msg->line = line;
-  return add_log_entries_to_outputs(head);
+  msg->file = site->file;
+  msg->line = site->line;
+  msg->site = site;
+  msg->format = message;
+  msg->time = time;
+  msg->thread = get_log_thread_id();
+  msg->payload = LOG_PAYLOAD_FIELDS;
+  publish_log_msg(ring, pos);
+  return msg->dropped ? -1 : 0;
 }
 
 enum log_level get_min_log_level() {
-  return min_level;
+  return (enum log_level)atomic_load_explicit(&min_level, memory_order_relaxed);
+}
+
+void set_min_log_level(enum log_level level) {
+  pthread_mutex_lock(&module_level_mutex);
+  atomic_store_explicit(&min_level, (int)level, memory_order_relaxed);
+  update_log_level_threshold();
+  pthread_mutex_unlock(&module_level_mutex);
+}
+
+int set_log_module_level(const char * module, enum log_level level) {
+  assert(module != NULL);
+  if(strlen(module) >= sizeof(module_levels[0].module)) {
+    return -1;
+  }
+
+  int result = 0;
+  pthread_mutex_lock(&module_level_mutex);
+  size_t i = find_log_module_level(module);
+  if(i == module_level_len) {
+    if(module_level_len == LOG_MAX_MODULE_LEVELS) {
+      result = -1;
+    } else {
+      strcpy(module_levels[i].module, module);
+      ++module_level_len;
+    }
+  }
+  if(result == 0) {
+    module_levels[i].level = level;
+    update_log_level_threshold();
+  }
+  pthread_mutex_unlock(&module_level_mutex);
+  return result;
+}
+
+void clear_log_module_level(const char * module) {
+  assert(module != NULL);
+
+  pthread_mutex_lock(&module_level_mutex);
+  size_t i = find_log_module_level(module);
+  if(i != module_level_len) {
+    module_levels[i] = module_levels[--module_level_len];
+    update_log_level_threshold();
+  }
+  pthread_mutex_unlock(&module_level_mutex);
+}
+
+bool take_log_limit_token(struct log_limit * limit, const struct log_site * site, enum log_level level, unsigned int interval, unsigned int burst) {
+  assert(limit != NULL);
+  assert(site != NULL);
+
+  if(try_take_log_limit_token(limit, interval, burst)) {
+    return true;
+  }
+  if(atomic_load_explicit(&limit->registered, memory_order_relaxed) == 0) {
+    register_log_limit(limit, site, level, interval, burst);
+  }
+  atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed);
+  return false;
+}
+
+void report_suppressed_log_messages(struct log_limit * limit) {
+  assert(limit != NULL);
+
+  // counts of a limit still being registered are left to the next report
+  if(atomic_load_explicit(&limit->suppressed, memory_order_relaxed) == 0
+     || atomic_load_explicit(&limit->registered, memory_order_acquire) != 2) {
+    return;
+  }
+  unsigned int suppressed = atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+  if(suppressed != 0
+     && (int)limit->level >= atomic_load_explicit(&log_level_threshold, memory_order_relaxed)
+     && is_log_site_enabled(&limit->site, limit->level)) {
+    add_log_site_message(&limit->site, limit->level, "last message repeated %u times", suppressed);
+  }
+}
+
+void flush_log_limits() {
+  for(struct log_limit * limit = atomic_load_explicit(&log_limits, memory_order_acquire); limit != NULL; limit = limit->next_limit) {
+    if(atomic_load_explicit(&limit->suppressed, memory_order_relaxed) != 0
+       && try_take_log_limit_token(limit, limit->interval, limit->burst)) {
+      report_suppressed_log_messages(limit);
+    }
+  }
+}
+
+int update_log_site_level(struct log_site * site) {
+  assert(site != NULL);
+
+  pthread_mutex_lock(&module_level_mutex);
+  // read the epoch under the mutex, so it matches the levels used
+  unsigned int epoch = atomic_load_explicit(&log_filter_epoch, memory_order_relaxed);
+  int level = atomic_load_explicit(&min_level, memory_order_relaxed);
+  for(size_t i = 0; i < module_level_len; ++i) {
+    if(is_in_log_module(site->file, module_levels[i].module)) {
+      level = (int)module_levels[i].level;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&module_level_mutex);
+
+  atomic_store_explicit(&site->filter, epoch | (unsigned int)level, memory_order_relaxed);
+  return level;
+}
+
+size_t get_log_output_drop_count(size_t output) {
+  if(ring == NULL || output >= ring->cursor_len) {
+    return 0;
+  }
+  return atomic_load_explicit(&ring->cursors[output].dropped, memory_order_relaxed);
+}
+
+int get_log_output_stats(size_t index, struct log_output_stats * stats) {
+  assert(stats != NULL);
+  if(ring == NULL || index >= ring->cursor_len) {
+    return -1;
+  }
+
+  struct log_output * output = outputs + index;
+  struct log_cursor * cursor = ring->cursors + index;
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t position = atomic_load_explicit(&cursor->position, memory_order_relaxed) & ~LOG_CURSOR_READING;
+  stats->queue_depth = head > position ? head - position : 0;
+  if(stats->queue_depth > ring->capacity) {
+    stats->queue_depth = ring->capacity;
+  }
+  stats->max_queue_depth = atomic_load_explicit(&output->max_queue_depth, memory_order_relaxed);
+  stats->written_msgs = atomic_load_explicit(&output->written_msgs, memory_order_relaxed);
+  stats->written_bytes = atomic_load_explicit(&output->written_bytes, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&cursor->dropped, memory_order_relaxed);
+  stats->reserved = head;
+  stats->reserve_waits = atomic_load_explicit(&ring->reserve_waits, memory_order_relaxed);
+  stats->truncated = atomic_load_explicit(&ring->truncated, memory_order_relaxed);
+  for(size_t i = 0; i < LOG_LATENCY_BUCKETS; ++i) {
+    stats->latencies[i] = atomic_load_explicit(&output->latencies[i], memory_order_relaxed);
+  }
+  return 0;
+}
+
+size_t get_log_latency_bucket(unsigned long long latency) {
+  if(latency < 4) {
+    return (size_t)latency;
+  }
+  // the highest bit selects a group of four buckets, the two bits below it the bucket
+  int high_bit = 63 - __builtin_clzll(latency);
+  return 4 + (size_t)(high_bit - 2) * 4 + (size_t)((latency >> (high_bit - 2)) & 3);
+}
+
+unsigned long long get_log_latency_bucket_value(size_t bucket) {
+  if(bucket < 4) {
+    return bucket;
+  }
+  size_t high_bit = (bucket - 4) / 4 + 2;
+  return (4ULL + (bucket - 4) % 4) << (high_bit - 2);
+}
+
+unsigned long long get_log_latency_percentile(const unsigned long long * latencies, double percentile) {
+  assert(latencies != NULL);
+
+  unsigned long long total = 0;
+  for(size_t i = 0; i < LOG_LATENCY_BUCKETS; ++i) {
+    total += latencies[i];
+  }
+  if(total == 0) {
+    return 0;
+  }
+  unsigned long long rank = (unsigned long long)(percentile / 100.0 * (double)total);
+  if(rank >= total) {
+    rank = total - 1;
+  }
+  unsigned long long count = 0;
+  size_t bucket = 0;
+  while(count + latencies[bucket] <= rank) {
+    count += latencies[bucket++];
+  }
+  return get_log_latency_bucket_value(bucket);
+}
+
+int publish_log_frame() {
+  if(ring == NULL || !atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+    return -1;
+  }
+  pthread_mutex_lock(&frame_buffer_mutex);
+  for(struct log_frame_buffer * buffer = frame_buffers; buffer != NULL; buffer = buffer->next) {
+    publish_log_frame_buffer(buffer);
+  }
+  pthread_mutex_unlock(&frame_buffer_mutex);
+  return 0;
 }
 
 int stop_logger() {
-  stop_and_dispose_log_outputs(output_len);
+  if(ring != NULL && atomic_load_explicit(&ring->running, memory_order_relaxed)) {
+    // counts no message followed are reported whether their limits have a token or not
+    for(struct log_limit * limit = atomic_load_explicit(&log_limits, memory_order_acquire); limit != NULL; limit = limit->next_limit) {
+      report_suppressed_log_messages(limit);
+    }
+    publish_log_frame();
+    stop_log_writers(writer_len);
+  }
+  return 0;
 }
 
 void dispose_logger() {
-  pthread_mutex_destroy(&mutex);
-  destroy_log_buffers();
+  if(ring != NULL) {
+    destroy_log_ring(ring);
+    ring = NULL;
+  }
+  while(frame_buffers != NULL) {
+    struct log_frame_buffer * buffer = frame_buffers;
+    frame_buffers = buffer->next;
+    free(buffer->data);
+    free(buffer);
+  }
+  for(size_t i = 0; i < output_len; ++i) {
+    free(outputs[i].line_template);
+    free(outputs[i].ops);
+    free(outputs[i].scratch);
+    if(outputs[i].segment != NULL) {
+      free(outputs[i].segment->path);
+      free(outputs[i].segment);
+    }
+  }
   free(outputs);
 }
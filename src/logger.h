@@ -21,8 +21,43 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+/**
+ * The maximum number of arguments the format string of a call site may consume for
+ * formatting to be deferred
+ */
+#define LOG_SITE_MAX_ARGS 16
+
+/**
+ * The lowest log level compiled in, as a number: 0 for debug, 1 for info, 2 for warning
+ * and 3 for error
+ * The log macros for lower levels expand to nothing, set it with configure --with-log-level
+ */
+#ifndef LOG_MIN_COMPILED_LEVEL
+#define LOG_MIN_COMPILED_LEVEL 0
+#endif
+
+/**
+ * The maximum number of modules with their own log level
+ */
+#define LOG_MAX_MODULE_LEVELS 16
+
+/**
+ * The number of buckets of a latency histogram
+ * Latencies in nanoseconds are bucketed by their highest bit and the two bits below it, so
+ * every bucket spans at most a quarter of its value
+ */
+#define LOG_LATENCY_BUCKETS 252
+
+/**
+ * The maximum number of messages an output samples the latency of per write
+ */
+#define LOG_LATENCY_SAMPLES 1024
+
 /**
  * The log levels
  */
@@ -49,12 +84,494 @@ enum log_level {
 };
 
 /**
- * Initializes the logger
+ * Where the text of log messages gets formatted
+ */
+enum log_formatting {
+		     /**
+		      * Messages are formatted by the thread logging them
+		      */
+		     LOG_FORMATTING_IMMEDIATE,
+
+		     /**
+		      * Messages from the log macros only have their arguments copied by the thread
+		      * logging them and are formatted by the outputs
+		      */
+		     LOG_FORMATTING_DEFERRED
+};
+
+/**
+ * A call site of the log macros, declared statically by LOG_MSG
+ */
+struct log_site {
+
+  /**
+   * The file of the call site
+   */
+  const char * file;
+
+  /**
+   * The line of the call site
+   */
+  int line;
+
+  /**
+   * The identifier of the call site in binary outputs, assigned on first use, 0 until then
+   */
+  atomic_uint id;
+
+  /**
+   * The filter epoch the minimum level of the call site was computed in plus that level,
+   * cached in a single word so both are always read together
+   */
+  atomic_uint filter;
+
+  /**
+   * The number of arguments of the format string plus one, 0 until parsed and -1 while
+   * being parsed or if formatting can not be deferred
+   */
+  atomic_int arg_count;
+
+  /**
+   * The kinds of the arguments of the format string
+   */
+  unsigned char arg_kinds[LOG_SITE_MAX_ARGS];
+};
+
+/**
+ * The maximum length of the key of a structured log field, longer keys are cut
+ */
+#define LOG_FIELD_MAX_KEY_LENGTH 255
+
+/**
+ * The types of the values of structured log fields
+ */
+enum log_field_type {
+		     /**
+		      * A signed integer
+		      */
+		     LOG_FIELD_INT,
+
+		     /**
+		      * A floating point number
+		      */
+		     LOG_FIELD_FLOAT,
+
+		     /**
+		      * A NUL terminated string, copied when the message is logged
+		      */
+		     LOG_FIELD_STRING,
+
+		     /**
+		      * The identifier of an entity
+		      */
+		     LOG_FIELD_ENTITY
+};
+
+/**
+ * A typed key/value field of a structured log message, see LOG_FIELDS
+ */
+struct log_field {
+
+  /**
+   * The key, usually a string literal
+   */
+  const char * key;
+
+  /**
+   * The type of the value
+   */
+  enum log_field_type type;
+
+  /**
+   * The value, the member matching the type
+   */
+  union {
+    long long integer;
+    double real;
+    const char * string;
+    unsigned long long entity;
+  } value;
+};
+
+/**
+ * Utility macros for the fields of structured log messages
+ */
+#define LOG_INT(key_, value_) ((struct log_field){ .key = (key_), .type = LOG_FIELD_INT, .value.integer = (value_) })
+#define LOG_FLOAT(key_, value_) ((struct log_field){ .key = (key_), .type = LOG_FIELD_FLOAT, .value.real = (value_) })
+#define LOG_STRING(key_, value_) ((struct log_field){ .key = (key_), .type = LOG_FIELD_STRING, .value.string = (value_) })
+#define LOG_ENTITY(key_, value_) ((struct log_field){ .key = (key_), .type = LOG_FIELD_ENTITY, .value.entity = (value_) })
+
+/**
+ * The default layout of the lines of text outputs: time, thread, level, file, line, text and
+ * the fields of structured messages
+ * Templates consist of literal text and conversions: %t the local time, %T the thread,
+ * %l the level label, %L the level name, %f the file, %n the line, %m the text of the message,
+ * %F the fields of a structured message as key=value pairs, each after a space, and %% a percent
+ * sign. %jf and %jm escape the file and text for JSON strings, %jF renders the fields as a
+ * "fields" object member, after a comma.
+ */
+#define LOG_TEMPLATE_DEFAULT "%t [%T] %l %f:%n: %m%F\n"
+
+/**
+ * A template for JSON lines
+ */
+#define LOG_TEMPLATE_JSON "{\"time\":\"%t\",\"thread\":%T,\"level\":\"%L\",\"file\":\"%jf\",\"line\":%n,\"message\":\"%jm\"%jF}\n"
+
+/**
+ * When outputs write their buffered messages
+ */
+enum log_flush_policy {
+		       /**
+			* After every batch of messages taken from the log ring
+			*/
+		       LOG_FLUSH_BATCH,
+
+		       /**
+			* Once the buffered messages reach a size threshold
+			*/
+		       LOG_FLUSH_SIZE,
+
+		       /**
+			* Once a time interval has passed since the last write
+			*/
+		       LOG_FLUSH_INTERVAL
+};
+
+/**
+ * How outputs compress what they write
+ */
+enum log_compression {
+			/**
+			 * Written as is
+			 */
+			LOG_COMPRESSION_NONE,
+
+			/**
+			 * A gzip stream, flushed with every write so it can be expanded up to the last one, to be
+			 * expanded by the log_cat tool or any gzip decompressor
+			 */
+			LOG_COMPRESSION_GZIP
+};
+
+/**
+ * Options of a log output
+ */
+struct log_output_options {
+
+  /**
+   * Whether messages are written in the binary format, to be expanded by the log_decode tool
+   * Deferred messages never get formatted by a binary output
+   */
+  bool binary;
+
+  /**
+   * The layout of the lines of a text output, see LOG_TEMPLATE_DEFAULT
+   * It is compiled when the output is added, so it need not outlive the call
+   */
+  const char * line_template;
+
+  /**
+   * When the output writes its buffered messages
+   */
+  enum log_flush_policy flush_policy;
+
+  /**
+   * The number of buffered bytes that triggers a write with LOG_FLUSH_SIZE, also written
+   * early with LOG_FLUSH_INTERVAL
+   */
+  size_t flush_size;
+
+  /**
+   * The interval between writes with LOG_FLUSH_INTERVAL, in milliseconds
+   */
+  unsigned int flush_interval;
+
+  /**
+   * How the output compresses what it writes, larger writes compress better, see flush_policy
+   */
+  enum log_compression compression;
+
+  /**
+   * The compression level from 1 to 9, higher levels spend more time of the writer for smaller
+   * output
+   */
+  int compression_level;
+
+  /**
+   * Whether the output writes through io_uring, with several writes in flight while its writer
+   * renders further messages, so a slow disk does not stall its queue
+   * The output writes directly where io_uring is unavailable, at run time or in builds without
+   * the io_uring header, file outputs ignore this as they write into memory mappings
+   */
+  bool io_uring;
+};
+
+/**
+ * Options of a file output, writing into memory mapped segment files
+ */
+struct log_file_options {
+
+  /**
+   * The size of a segment file in bytes, allocated on disk and mapped when the segment opens
+   * A single message larger than a segment is cut
+   */
+  size_t segment_size;
+
+  /**
+   * The age at which the output rolls to a new segment, in seconds, 0 to roll by size only
+   */
+  unsigned int roll_interval;
+
+  /**
+   * The interval between starting the writeback of written pages, in milliseconds, 0 to leave
+   * it to the kernel
+   */
+  unsigned int sync_interval;
+};
+
+/**
+ * How the scheduler treats the threads writing the outputs
+ */
+enum log_writer_scheduling {
+			    /**
+			     * The policy of the thread starting the logger
+			     */
+			    LOG_SCHEDULING_DEFAULT,
+
+			    /**
+			     * SCHED_BATCH, the writers never preempt running threads when they wake up
+			     */
+			    LOG_SCHEDULING_BATCH,
+
+			    /**
+			     * SCHED_IDLE, the writers only run on cores with nothing else to do
+			     */
+			    LOG_SCHEDULING_IDLE
+};
+
+/**
+ * Options of the threads writing the outputs
+ */
+struct log_writer_options {
+
+  /**
+   * The number of writer threads, each serving its share of the outputs in turn, 0 for one
+   * thread per output
+   */
+  size_t thread_count;
+
+  /**
+   * The cores the writers may run on, bit n standing for core n, 0 to run on any core
+   */
+  unsigned long long cpu_mask;
+
+  /**
+   * The scheduling policy of the writers
+   */
+  enum log_writer_scheduling scheduling;
+
+  /**
+   * The nice value of the writers, higher values lower their priority, 0 to inherit it
+   * Going below the inherited value needs privileges, without them the writers keep it
+   */
+  int nice;
+};
+
+/**
+ * What producers do when the log ring is full because an output falls behind
+ */
+enum log_overflow_policy {
+			  /**
+			   * The producer waits until the slowest output has read a message
+			   */
+			  LOG_OVERFLOW_BLOCK,
+
+			  /**
+			   * The new message is dropped
+			   */
+			  LOG_OVERFLOW_DROP_NEWEST,
+
+			  /**
+			   * The oldest messages not yet read by the slow outputs are dropped for them
+			   */
+			  LOG_OVERFLOW_DROP_OLDEST,
+
+			  /**
+			   * New messages below the drop level are dropped, the others wait
+			   */
+			  LOG_OVERFLOW_DROP_BELOW_LEVEL
+};
+
+/**
+ * Memory options of the logger, all message memory is allocated up front by the logger
+ */
+struct log_memory_options {
+
+  /**
+   * The maximum number of bytes used for queued messages, including their text
+   * Half of it holds the queue with short messages inline, the rest holds longer messages in
+   * blocks of a few size classes
+   */
+  size_t memory_limit;
+
+  /**
+   * The maximum size of a message, longer text is truncated
+   * Messages too long to be stored inline need a block, when none is free the overflow policy
+   * applies as it does when the queue is full: the message is dropped or the producer waits
+   */
+  size_t max_msg_size;
+
+  /**
+   * What producers do when the queue is full or no block is free for a long message
+   */
+  enum log_overflow_policy overflow_policy;
+
+  /**
+   * The level below which messages are dropped with LOG_OVERFLOW_DROP_BELOW_LEVEL
+   */
+  enum log_level drop_level;
+};
+
+/**
+ * Statistics of a log output, counted since the logger was started
+ */
+struct log_output_stats {
+
+  /**
+   * The number of messages queued for the output
+   */
+  size_t queue_depth;
+
+  /**
+   * The highest number of messages queued for the output when it read them
+   */
+  size_t max_queue_depth;
+
+  /**
+   * The number of messages written
+   */
+  unsigned long long written_msgs;
+
+  /**
+   * The number of bytes written, after compression
+   */
+  unsigned long long written_bytes;
+
+  /**
+   * The number of messages dropped for the output by the overflow policy or lost to a write
+   * that failed or came up short
+   */
+  size_t dropped;
+
+  /**
+   * The number of slots reserved by producers, shared by all outputs
+   */
+  size_t reserved;
+
+  /**
+   * The number of times a producer found the queue full or no free block for a long message,
+   * shared by all outputs
+   */
+  size_t reserve_waits;
+
+  /**
+   * The number of messages truncated because they exceed the maximum message size, shared by
+   * all outputs
+   */
+  size_t truncated;
+
+  /**
+   * Histogram of the time from logging a message to its write, with one bucket for each
+   * range of nanoseconds, see get_log_latency_bucket_value
+   * Up to LOG_LATENCY_SAMPLES messages are sampled per write
+   */
+  unsigned long long latencies[LOG_LATENCY_BUCKETS];
+};
+
+/**
+ * The rate limit state of a call site, declared statically by the limited log macros
+ * Limits are enforced with a single word as a token bucket: a call is accepted if it does not
+ * push the theoretical time of the next accepted call more than burst intervals past now
+ * A limit is registered when it first suppresses a call, so flush_log_limits can report counts
+ * no message follows.
+ */
+struct log_limit {
+
+  /**
+   * The theoretical time of the next accepted call, in nanoseconds on the coarse monotonic clock
+   */
+  atomic_llong next;
+
+  /**
+   * The number of rejected calls since the last report
+   */
+  atomic_uint suppressed;
+
+  /**
+   * 0 until the limit is registered, 1 while it is being registered, 2 once it is registered
+   */
+  atomic_uint registered;
+
+  /**
+   * The call site the suppressed counts are reported from, at the file and line of the limited
+   * call site, as their format differs
+   */
+  struct log_site site;
+
+  /**
+   * The log level of the limited call site
+   */
+  enum log_level level;
+
+  /**
+   * The time it takes to earn a token, in milliseconds
+   */
+  unsigned int interval;
+
+  /**
+   * The maximum number of tokens
+   */
+  unsigned int burst;
+
+  /**
+   * The limit registered before this one or NULL
+   */
+  struct log_limit * next_limit;
+};
+
+/**
+ * The lowest log level any call site currently accepts, checked inline by the log macros
+ */
+extern atomic_int log_level_threshold;
+
+/**
+ * Incremented by four whenever a log level changes, invalidating the levels cached by the
+ * call sites, the lower two bits are always clear
+ */
+extern atomic_uint log_filter_epoch;
+
+/**
+ * Initializes the logger with the default memory options
  * \param min_level all messages with lower priority get discarded
  * \return 0 on success, -1 otherwise
  */
 int init_logger(enum log_level min_level);
 
+/**
+ * Initializes memory options to their defaults: a few megabytes of messages of up to 512 bytes,
+ * producers wait while the queue is full
+ * \param options the options
+ */
+void init_log_memory_options(struct log_memory_options * options);
+
+/**
+ * Initializes the logger, allocating all message memory
+ * \param min_level all messages with lower priority get discarded
+ * \param options the memory options
+ * \return 0 on success, -1 otherwise
+ */
+int init_logger_with_options(enum log_level min_level, const struct log_memory_options * options);
+
 /**
  * Adds an output file to the logger
  * This function may only be called after initialization of but before starting the log system
@@ -63,12 +580,100 @@ int init_logger(enum log_level min_level);
  */
 int add_logger_output(FILE * file);
 
+/**
+ * Adds a binary output file to the logger, to be expanded by the log_decode tool
+ * Messages are written with their captured arguments, so deferred messages never get formatted
+ * This function may only be called after initialization of but before starting the log system
+ * \param file a pointer to the file to write to
+ * \return 0 on success, -1 otherwise
+ */
+int add_logger_binary_output(FILE * file);
+
+/**
+ * Initializes output options to their defaults: text messages in the default layout, written
+ * uncompressed after every batch
+ * \param options the options
+ */
+void init_log_output_options(struct log_output_options * options);
+
+/**
+ * Adds an output file with options to the logger
+ * Messages are written to the file descriptor of the file, bypassing its stdio buffer
+ * This function may only be called after initialization of but before starting the log system
+ * \param file a pointer to the file to write to
+ * \param options the options of the output
+ * \return 0 on success, -1 if the line template is invalid or on failure
+ */
+int add_logger_output_with_options(FILE * file, const struct log_output_options * options);
+
+/**
+ * Initializes file options to their defaults: 16 MiB segments rolled by size, with writeback
+ * started every second
+ * \param options the options
+ */
+void init_log_file_options(struct log_file_options * options);
+
+/**
+ * Adds a file output to the logger, writing into memory mapped segment files named after the
+ * path with an index appended, e.g. guard.log.0, guard.log.1 and so on
+ * Every run starts a new segment after the existing ones. Writing a batch is a copy into the
+ * mapping, the pages still hold what was written if the program crashes, a segment is only cut
+ * to its length when it is closed. Every segment of a compressed output is a stream of its own.
+ * This function may only be called after initialization of but before starting the log system
+ * \param path the path of the segments
+ * \param options the options of the output
+ * \param file_options the options of the segments
+ * \return 0 on success, -1 if the line template is invalid or on failure
+ */
+int add_logger_file_output(const char * path, const struct log_output_options * options, const struct log_file_options * file_options);
+
+/**
+ * Selects where log messages get formatted, formatting is immediate by default
+ * This function may only be called after initialization of but before starting the log system
+ * \param formatting the formatting mode
+ */
+void set_log_formatting(enum log_formatting formatting);
+
+/**
+ * Initializes writer options to their defaults: one thread per output, scheduled like the
+ * thread starting the logger
+ * \param options the options
+ */
+void init_log_writer_options(struct log_writer_options * options);
+
+/**
+ * Selects the threads writing the outputs
+ * This function may only be called after initialization of but before starting the log system
+ * \param options the writer options
+ */
+void set_log_writer_options(const struct log_writer_options * options);
+
+/**
+ * Makes every thread keep its messages in a buffer of its own until the end of the frame
+ * Appending to the buffer takes no lock and no atomic read-modify-write, publish_log_frame hands
+ * all buffers to the outputs. A message that does not fit in the buffer of its thread goes to
+ * the outputs right away, ahead of the messages buffered before it. The buffers are freed
+ * when the logger is disposed.
+ * This function may only be called after initialization of but before starting the log system
+ * \param buffer_size the size of the buffer of each thread, 0 to hand every message to the
+ * outputs right away, which is the default
+ */
+void set_log_frame_buffering(size_t buffer_size);
+
 /**
  * Starts the logger
  * \return 0 on success, -1 on error
  */
 int start_logger();
 
+/**
+ * Hands the messages all threads buffered since the last call to the outputs, to be called
+ * once at the end of every frame with frame buffering
+ * Stopping the logger hands over what is left.
+ * \return 0 on success, -1 if the logger is not running
+ */
+int publish_log_frame();
+
 /**
  * Creates and adds a log message
  * Users should use the utility macro's instead for better performance
@@ -77,15 +682,148 @@ int start_logger();
  * \line the line where the lessage originates from
  * \format the format string
  * \... optional parameters for formatting						
- * \return 0 on success, -1 on failure
+ * \return 0 on success, -1 on failure or if the message was dropped
  */
 int add_log_message(enum log_level level, const char * file, int line, const char * format, ...);
 
+/**
+ * Creates and adds a log message from a call site of the log macros
+ * With deferred formatting, only the arguments are copied if the format string allows it
+ * \param site the call site
+ * \param level the log level
+ * \param format the format string, the same on every call from the site
+ * \param ... optional parameters for formatting
+ * \return 0 on success, -1 on failure or if the message was dropped
+ */
+int add_log_site_message(struct log_site * site, enum log_level level, const char * format, ...);
+
+/**
+ * Creates and adds a structured log message from a call site of the log macros
+ * The fields are encoded in a compact binary form and only rendered by text outputs, binary
+ * outputs store them as they are. Fields that do not fit in the maximum message size are left
+ * out.
+ * \param site the call site
+ * \param level the log level
+ * \param message the text of the message, the same on every call from the site
+ * \param fields the fields
+ * \param field_len the number of fields
+ * \return 0 on success, -1 on failure or if the message was dropped
+ */
+int add_log_site_fields(struct log_site * site, enum log_level level, const char * message, const struct log_field * fields, size_t field_len);
+
 /**
  * Returns the minimum log level, all messages with lower priority are discarded
  */
 enum log_level get_min_log_level();
 
+/**
+ * Sets the minimum log level, may be called at any time from any thread
+ * \param level the minimum log level for all modules without their own level
+ */
+void set_min_log_level(enum log_level level);
+
+/**
+ * Sets the minimum log level of a module, may be called at any time from any thread
+ * A module is a source file, it matches every file path ending in it after a '/',
+ * e.g. "window.c" or "src/window.c"
+ * \param module the module
+ * \param level the minimum log level for the module
+ * \return 0 on success, -1 if LOG_MAX_MODULE_LEVELS modules already have their own level
+ */
+int set_log_module_level(const char * module, enum log_level level);
+
+/**
+ * Makes a module use the minimum log level again, may be called at any time from any thread
+ * \param module the module
+ */
+void clear_log_module_level(const char * module);
+
+/**
+ * Takes a token from the rate limit of a call site, registering the limit when it first
+ * suppresses a call
+ * \param limit the rate limit state
+ * \param site the call site
+ * \param level the log level of the call site
+ * \param interval the time it takes to earn a token, in milliseconds
+ * \param burst the maximum number of tokens
+ * \return true if the call may log, false if it is suppressed
+ */
+bool take_log_limit_token(struct log_limit * limit, const struct log_site * site, enum log_level level, unsigned int interval, unsigned int burst);
+
+/**
+ * Logs how many calls of a rate limited call site have been suppressed, if any
+ * \param limit the rate limit state of the call site
+ */
+void report_suppressed_log_messages(struct log_limit * limit);
+
+/**
+ * Logs how many calls have been suppressed for every rate limited call site whose limit has a
+ * token, taking it, so a count is reported within an interval even if no message follows
+ * To be called once per frame, the game loop does so. Stopping the logger reports what is left.
+ */
+void flush_log_limits();
+
+/**
+ * Returns the number of messages an output has lost to the overflow policy
+ * \param output the index of the output, in the order the outputs were added
+ * \return the number of messages dropped for the output since the logger was started
+ */
+size_t get_log_output_drop_count(size_t output);
+
+/**
+ * Reads the statistics of an output, may be called at any time from any thread
+ * The counters are read one by one while the output keeps running, so they may be slightly
+ * out of step with each other
+ * \param output the index of the output, in the order the outputs were added
+ * \param stats receives the statistics
+ * \return 0 on success, -1 if the output does not exist or the logger has never been started
+ */
+int get_log_output_stats(size_t output, struct log_output_stats * stats);
+
+/**
+ * Finds the bucket of a latency histogram counting a latency
+ * \param latency the latency in nanoseconds
+ * \return the index of the bucket
+ */
+size_t get_log_latency_bucket(unsigned long long latency);
+
+/**
+ * Returns the lowest latency counted in a bucket of a latency histogram
+ * \param bucket the index of the bucket
+ * \return the latency in nanoseconds
+ */
+unsigned long long get_log_latency_bucket_value(size_t bucket);
+
+/**
+ * Computes a percentile of a latency histogram
+ * \param latencies the histogram, LOG_LATENCY_BUCKETS counts
+ * \param percentile the percentile, between 0 and 100
+ * \return the lowest latency of the bucket holding the percentile, in nanoseconds, 0 without samples
+ */
+unsigned long long get_log_latency_percentile(const unsigned long long * latencies, double percentile);
+
+/**
+ * Computes and caches the minimum log level of a call site
+ * \param site the call site
+ * \return the minimum log level
+ */
+int update_log_site_level(struct log_site * site);
+
+/**
+ * Checks whether a call site accepts messages of a log level
+ * Only takes the slow path once after a log level changes
+ * \param site the call site
+ * \param level the log level
+ * \return true if messages are accepted
+ */
+static inline bool is_log_site_enabled(struct log_site * site, enum log_level level) {
+  unsigned int filter = atomic_load_explicit(&site->filter, memory_order_relaxed);
+  if((filter & ~3u) != atomic_load_explicit(&log_filter_epoch, memory_order_relaxed)) {
+    return (int)level >= update_log_site_level(site);
+  }
+  return (int)level >= (int)(filter & 3u);
+}
+
 /**
  * Stops the logger, blocking until all log messages have been written
  * \return 0 on success, -1 on error
@@ -99,27 +837,121 @@ void dispose_logger();
 
 /**
  * Utility macro for log messages
+ * Messages below the threshold are rejected with a single inline load
+ */
+#define LOG_MSG(level, ...) do {					\
+    static struct log_site log_site_ = { .file = __FILE__, .line = __LINE__ };	\
+    if((int)(level) >= LOG_MIN_COMPILED_LEVEL				\
+       && (int)(level) >= atomic_load_explicit(&log_level_threshold, memory_order_relaxed) \
+       && is_log_site_enabled(&log_site_, (level))) {			\
+      add_log_site_message(&log_site_, (level), __VA_ARGS__);		\
+    }									\
+  } while(0)
+
+/**
+ * Utility macro for rate limited log messages
+ * At most burst messages are logged in a row, after which one more is allowed every interval
+ * milliseconds. Suppressed messages are rejected before any formatting and counted, the count is
+ * reported with the next message that gets through or by flush_log_limits.
  */
-#define LOG_MSG(level, ...) if(get_min_log_level() <= (level)) add_log_message((level), __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_MSG_LIMITED(level, interval, burst, ...) do {		\
+    static struct log_site log_site_ = { .file = __FILE__, .line = __LINE__ };	\
+    static struct log_limit log_limit_;					\
+    if((int)(level) >= LOG_MIN_COMPILED_LEVEL				\
+       && (int)(level) >= atomic_load_explicit(&log_level_threshold, memory_order_relaxed) \
+       && is_log_site_enabled(&log_site_, (level))			\
+       && take_log_limit_token(&log_limit_, &log_site_, (level), (interval), (burst))) { \
+      report_suppressed_log_messages(&log_limit_);			\
+      add_log_site_message(&log_site_, (level), __VA_ARGS__);		\
+    }									\
+  } while(0)
 
 /**
- * Utility macro for debug messages
+ * Utility macro for throttled log messages, e.g. inside a per-frame loop
+ * Logs the first message, then at most one every interval milliseconds, each one reporting how
+ * many repeats were suppressed
  */
+#define LOG_MSG_THROTTLED(level, interval, ...) LOG_MSG_LIMITED((level), (interval), 1, __VA_ARGS__)
+
+/**
+ * Utility macro for structured log messages, a constant text followed by at least one field
+ * made with LOG_INT, LOG_FLOAT, LOG_STRING or LOG_ENTITY, e.g.
+ * LOG_FIELDS(LOG_LEVEL_INFO, "hit", LOG_ENTITY("target", id), LOG_FLOAT("damage", 12.5))
+ */
+#define LOG_FIELDS(level, message, ...) do {				\
+    static struct log_site log_site_ = { .file = __FILE__, .line = __LINE__ };	\
+    if((int)(level) >= LOG_MIN_COMPILED_LEVEL				\
+       && (int)(level) >= atomic_load_explicit(&log_level_threshold, memory_order_relaxed) \
+       && is_log_site_enabled(&log_site_, (level))) {			\
+      const struct log_field log_fields_[] = { __VA_ARGS__ };		\
+      add_log_site_fields(&log_site_, (level), (message), log_fields_, sizeof(log_fields_) / sizeof(log_fields_[0])); \
+    }									\
+  } while(0)
+
+/**
+ * Utility macro for log messages compiled out, the arguments are still type checked but
+ * never evaluated
+ */
+#define LOG_DISCARD(...) do {						\
+    if(0) {								\
+      add_log_message(LOG_LEVEL_DEBUG, __FILE__, __LINE__, __VA_ARGS__); \
+    }									\
+  } while(0)
+
+/**
+ * Utility macro for structured log messages compiled out
+ */
+#define LOG_DISCARD_FIELDS(message, ...) do {				\
+    if(0) {								\
+      const struct log_field log_fields_[] = { __VA_ARGS__ };		\
+      add_log_site_fields(NULL, LOG_LEVEL_DEBUG, (message), log_fields_, sizeof(log_fields_) / sizeof(log_fields_[0])); \
+    }									\
+  } while(0)
+
+/**
+ * Utility macros for debug messages
+ */
+#if LOG_MIN_COMPILED_LEVEL <= 0
 #define LOG_DEBUG(...) LOG_MSG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_DEBUG_THROTTLED(interval, ...) LOG_MSG_THROTTLED(LOG_LEVEL_DEBUG, (interval), __VA_ARGS__)
+#define LOG_DEBUG_FIELDS(...) LOG_FIELDS(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_DEBUG_THROTTLED(interval, ...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_DEBUG_FIELDS(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
 
 /**
- * Utility macro for info messages
+ * Utility macros for info messages
  */
+#if LOG_MIN_COMPILED_LEVEL <= 1
 #define LOG_INFO(...) LOG_MSG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_INFO_THROTTLED(interval, ...) LOG_MSG_THROTTLED(LOG_LEVEL_INFO, (interval), __VA_ARGS__)
+#define LOG_INFO_FIELDS(...) LOG_FIELDS(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_INFO_THROTTLED(interval, ...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_INFO_FIELDS(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
 
 /**
- * Utility macro for warning messages
+ * Utility macros for warning messages
  */
+#if LOG_MIN_COMPILED_LEVEL <= 2
 #define LOG_WARNING(...) LOG_MSG(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_WARNING_THROTTLED(interval, ...) LOG_MSG_THROTTLED(LOG_LEVEL_WARNING, (interval), __VA_ARGS__)
+#define LOG_WARNING_FIELDS(...) LOG_FIELDS(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_WARNING_THROTTLED(interval, ...) LOG_DISCARD(__VA_ARGS__)
+#define LOG_WARNING_FIELDS(...) LOG_DISCARD_FIELDS(__VA_ARGS__)
+#endif
 
 /**
- * Utility macro for error messages
+ * Utility macros for error messages
  */
 #define LOG_ERROR(...) LOG_MSG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_ERROR_THROTTLED(interval, ...) LOG_MSG_THROTTLED(LOG_LEVEL_ERROR, (interval), __VA_ARGS__)
+#define LOG_ERROR_FIELDS(...) LOG_FIELDS(LOG_LEVEL_ERROR, __VA_ARGS__)
 
 #endif
@@ -0,0 +1,520 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Throughput and latency benchmark for the logging subsystem
+ * Usage: logger_bench [-t max producer threads] [-n messages per thread] [-s message size]
+ *                     [-o outputs] [-k null|file|pipe] [-d directory] [-m immediate|deferred]
+ *                     [-w writer threads, 0 for one per output] [-z compression level, 0 for none]
+ *                     [-u, write through io_uring]
+ * Runs a round for 1, 2, 4 ... max producer threads and prints one line of key=value pairs
+ * per round, to be compared across builds
+ */
+
+#include "logger.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_MESSAGES_PER_THREAD 100000
+#define DEFAULT_MESSAGE_SIZE 64
+#define DEFAULT_OUTPUTS 1
+
+/**
+ * The room the text of a message takes besides its payload, the producer and message numbers
+ * and the terminating NUL
+ */
+#define MESSAGE_PREFIX_SIZE 64
+
+/**
+ * The number of messages of the maximum size the message memory holds at least, so long
+ * messages do not make the producers wait for every block
+ */
+#define MIN_QUEUED_MESSAGES 1024
+
+/**
+ * The default directory of file sinks, a tmpfs on most systems
+ */
+#define DEFAULT_SINK_DIRECTORY "/dev/shm"
+
+/**
+ * Where the outputs write to
+ */
+enum sink_kind {
+		/**
+		 * /dev/null
+		 */
+		SINK_NULL,
+
+		/**
+		 * A file in the sink directory, removed after each round
+		 */
+		SINK_FILE,
+
+		/**
+		 * A pipe drained by a thread of the benchmark
+		 */
+		SINK_PIPE
+};
+
+/**
+ * The names of the sink kinds
+ */
+static const char * const sink_names[] = { "null", "file", "pipe" };
+
+/**
+ * The benchmark settings
+ */
+struct settings {
+
+  /**
+   * The maximum number of producer threads
+   */
+  size_t max_threads;
+
+  /**
+   * The number of messages each producer logs
+   */
+  size_t messages_per_thread;
+
+  /**
+   * The size of the text each message carries
+   */
+  size_t message_size;
+
+  /**
+   * The number of outputs
+   */
+  size_t outputs;
+
+  /**
+   * Where the outputs write to
+   */
+  enum sink_kind sink;
+
+  /**
+   * The directory of file sinks
+   */
+  const char * directory;
+
+  /**
+   * Where the messages get formatted
+   */
+  enum log_formatting formatting;
+
+  /**
+   * The number of writer threads, 0 for one per output
+   */
+  size_t writers;
+
+  /**
+   * The compression level of the outputs, 0 for uncompressed outputs
+   */
+  int compression_level;
+
+  /**
+   * Whether the outputs write through io_uring
+   */
+  bool io_uring;
+};
+
+/**
+ * A sink of an output
+ */
+struct sink {
+
+  /**
+   * The file the output writes to
+   */
+  FILE * file;
+
+  /**
+   * The path of a file sink
+   */
+  char path[256];
+
+  /**
+   * The read end of a pipe sink
+   */
+  int pipe_fd;
+
+  /**
+   * The thread draining a pipe sink
+   */
+  pthread_t drain_thread;
+};
+
+/**
+ * A producer thread
+ */
+struct producer {
+
+  /**
+   * The thread
+   */
+  pthread_t thread;
+
+  /**
+   * The index of the producer
+   */
+  size_t index;
+
+  /**
+   * Histogram of the time each log call took
+   */
+  unsigned long long latencies[LOG_LATENCY_BUCKETS];
+};
+
+/**
+ * The benchmark settings
+ */
+static struct settings settings;
+
+/**
+ * The text each message carries
+ */
+static char * payload;
+
+/**
+ * Returns the current monotonic time in nanoseconds
+ * \return the time
+ */
+static unsigned long long get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Producer thread function
+ * \param arg the producer cast as a void *
+ * \return always NULL
+ */
+static void * run_producer(void * arg) {
+  struct producer * producer = (struct producer *)arg;
+  for(size_t i = 0; i < settings.messages_per_thread; ++i) {
+    unsigned long long start = get_time();
+    LOG_INFO("producer %zu message %zu %s", producer->index, i, payload);
+    ++producer->latencies[get_log_latency_bucket(get_time() - start)];
+  }
+  return NULL;
+}
+
+/**
+ * Pipe drain thread function
+ * \param arg the sink cast as a void *
+ * \return always NULL
+ */
+static void * run_drain(void * arg) {
+  struct sink * sink = (struct sink *)arg;
+  char buffer[65536];
+  while(read(sink->pipe_fd, buffer, sizeof(buffer)) > 0) {
+  }
+  return NULL;
+}
+
+/**
+ * Opens a sink
+ * \param sink the sink
+ * \param index the index of the output
+ * \return 0 on success, -1 on failure
+ */
+static int open_sink(struct sink * sink, size_t index) {
+  sink->file = NULL;
+  sink->pipe_fd = -1;
+  switch(settings.sink) {
+  case SINK_NULL:
+    sink->file = fopen("/dev/null", "w");
+    break;
+  case SINK_FILE:
+    snprintf(sink->path, sizeof(sink->path), "%s/logger_bench.%ld.%zu.log", settings.directory, (long)getpid(), index);
+    sink->file = fopen(sink->path, "w");
+    break;
+  case SINK_PIPE: {
+    int fds[2];
+    if(pipe(fds) != 0) {
+      return -1;
+    }
+    sink->pipe_fd = fds[0];
+    sink->file = fdopen(fds[1], "w");
+    if(sink->file == NULL) {
+      close(fds[0]);
+      close(fds[1]);
+      return -1;
+    }
+    if(pthread_create(&sink->drain_thread, NULL, run_drain, sink) != 0) {
+      fclose(sink->file);
+      close(fds[0]);
+      return -1;
+    }
+    break;
+  }
+  }
+  return sink->file == NULL ? -1 : 0;
+}
+
+/**
+ * Closes a sink, once the logger stopped writing to it
+ * \param sink the sink
+ */
+static void close_sink(struct sink * sink) {
+  fclose(sink->file);
+  switch(settings.sink) {
+  case SINK_NULL:
+    break;
+  case SINK_FILE:
+    remove(sink->path);
+    break;
+  case SINK_PIPE:
+    pthread_join(sink->drain_thread, NULL);
+    close(sink->pipe_fd);
+    break;
+  }
+}
+
+/**
+ * Runs a single round of the benchmark
+ * \param thread_count the number of producer threads
+ * \return 0 on success, -1 on failure
+ */
+static int run_round(size_t thread_count) {
+  struct producer * producers = (struct producer *)calloc(thread_count, sizeof(struct producer));
+  struct sink * sinks = (struct sink *)calloc(settings.outputs, sizeof(struct sink));
+  if(producers == NULL || sinks == NULL) {
+    free(producers);
+    free(sinks);
+    return -1;
+  }
+
+  // every message has to be logged whole, or long messages would measure shorter ones
+  struct log_memory_options memory_options;
+  init_log_memory_options(&memory_options);
+  if(memory_options.max_msg_size < settings.message_size + MESSAGE_PREFIX_SIZE) {
+    memory_options.max_msg_size = settings.message_size + MESSAGE_PREFIX_SIZE;
+  }
+  if(memory_options.memory_limit / MIN_QUEUED_MESSAGES < memory_options.max_msg_size) {
+    memory_options.memory_limit = memory_options.max_msg_size * MIN_QUEUED_MESSAGES;
+  }
+  int result = init_logger_with_options(LOG_LEVEL_DEBUG, &memory_options);
+  struct log_output_options output_options;
+  init_log_output_options(&output_options);
+  if(settings.compression_level != 0) {
+    output_options.compression = LOG_COMPRESSION_GZIP;
+    output_options.compression_level = settings.compression_level;
+  }
+  output_options.io_uring = settings.io_uring;
+  size_t opened = 0;
+  while(result == 0 && opened < settings.outputs) {
+    result = open_sink(sinks + opened, opened);
+    if(result == 0) {
+      ++opened;
+      result = add_logger_output_with_options(sinks[opened - 1].file, &output_options);
+    }
+  }
+  if(result == 0) {
+    struct log_writer_options writer_options;
+    init_log_writer_options(&writer_options);
+    writer_options.thread_count = settings.writers;
+    set_log_writer_options(&writer_options);
+    set_log_formatting(settings.formatting);
+    result = start_logger();
+  }
+
+  unsigned long long start = get_time();
+  size_t started = 0;
+  while(result == 0 && started < thread_count) {
+    producers[started].index = started;
+    if(pthread_create(&producers[started].thread, NULL, run_producer, producers + started) != 0) {
+      result = -1;
+    } else {
+      ++started;
+    }
+  }
+  for(size_t i = 0; i < started; ++i) {
+    pthread_join(producers[i].thread, NULL);
+  }
+  unsigned long long produced = get_time();
+  stop_logger();
+  unsigned long long written = get_time();
+
+  if(result == 0) {
+    unsigned long long latencies[LOG_LATENCY_BUCKETS] = { 0 };
+    for(size_t i = 0; i < thread_count; ++i) {
+      for(size_t j = 0; j < LOG_LATENCY_BUCKETS; ++j) {
+	latencies[j] += producers[i].latencies[j];
+      }
+    }
+    // the slowest output tells how far behind the writes were
+    struct log_output_stats stats;
+    unsigned long long write_p99 = 0;
+    unsigned long long written_msgs = 0;
+    unsigned long long written_bytes = 0;
+    size_t dropped = 0;
+    size_t truncated = 0;
+    for(size_t i = 0; i < settings.outputs; ++i) {
+      if(get_log_output_stats(i, &stats) == 0) {
+	written_msgs += stats.written_msgs;
+	written_bytes += stats.written_bytes;
+	truncated = stats.truncated;
+	unsigned long long p99 = get_log_latency_percentile(stats.latencies, 99.0);
+	if(p99 > write_p99) {
+	  write_p99 = p99;
+	}
+	dropped += stats.dropped;
+      }
+    }
+
+    double count = (double)(thread_count * settings.messages_per_thread);
+    double enqueue_seconds = (double)(produced - start) * 1e-9;
+    double total_seconds = (double)(written - start) * 1e-9;
+    printf("threads=%zu outputs=%zu writers=%zu io_uring=%d sink=%s size=%zu formatting=%s messages=%.0f"
+	   " enqueue_seconds=%.6f enqueue_per_second=%.0f total_seconds=%.6f total_per_second=%.0f"
+	   " p50_ns=%llu p99_ns=%llu p999_ns=%llu write_p99_ns=%llu written_msgs=%llu written_bytes=%llu dropped=%zu"
+	   " truncated=%zu\n",
+	   thread_count, settings.outputs, settings.writers != 0 && settings.writers < settings.outputs ? settings.writers : settings.outputs, settings.io_uring ? 1 : 0, sink_names[settings.sink], settings.message_size,
+	   settings.formatting == LOG_FORMATTING_DEFERRED ? "deferred" : "immediate", count,
+	   enqueue_seconds, count / enqueue_seconds, total_seconds, count / total_seconds,
+	   get_log_latency_percentile(latencies, 50.0), get_log_latency_percentile(latencies, 99.0),
+	   get_log_latency_percentile(latencies, 99.9), write_p99, written_msgs, written_bytes, dropped, truncated);
+  }
+
+  dispose_logger();
+  for(size_t i = 0; i < opened; ++i) {
+    close_sink(sinks + i);
+  }
+  free(producers);
+  free(sinks);
+  return result;
+}
+
+/**
+ * Parses the command line into the settings
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return 0 on success, -1 on invalid arguments
+ */
+static int parse_settings(int arg_count, char * args[]) {
+  settings.max_threads = DEFAULT_MAX_THREADS;
+  settings.messages_per_thread = DEFAULT_MESSAGES_PER_THREAD;
+  settings.message_size = DEFAULT_MESSAGE_SIZE;
+  settings.outputs = DEFAULT_OUTPUTS;
+  settings.sink = SINK_NULL;
+  settings.directory = DEFAULT_SINK_DIRECTORY;
+  settings.formatting = LOG_FORMATTING_IMMEDIATE;
+  settings.writers = 0;
+  settings.compression_level = 0;
+  settings.io_uring = false;
+
+  int option;
+  while((option = getopt(arg_count, args, "t:n:s:o:k:d:m:w:z:u")) != -1) {
+    switch(option) {
+    case 't':
+      settings.max_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      settings.messages_per_thread = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      settings.message_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'o':
+      settings.outputs = strtoul(optarg, NULL, 10);
+      break;
+    case 'k': {
+      size_t i = 0;
+      while(i < sizeof(sink_names) / sizeof(sink_names[0]) && strcmp(optarg, sink_names[i]) != 0) {
+	++i;
+      }
+      if(i == sizeof(sink_names) / sizeof(sink_names[0])) {
+	return -1;
+      }
+      settings.sink = (enum sink_kind)i;
+      break;
+    }
+    case 'd':
+      settings.directory = optarg;
+      break;
+    case 'm':
+      if(strcmp(optarg, "immediate") == 0) {
+	settings.formatting = LOG_FORMATTING_IMMEDIATE;
+      } else if(strcmp(optarg, "deferred") == 0) {
+	settings.formatting = LOG_FORMATTING_DEFERRED;
+      } else {
+	return -1;
+      }
+      break;
+    case 'w':
+      settings.writers = strtoul(optarg, NULL, 10);
+      break;
+    case 'z':
+      settings.compression_level = atoi(optarg);
+      break;
+    case 'u':
+      settings.io_uring = true;
+      break;
+    default:
+      return -1;
+    }
+  }
+  if(optind != arg_count || settings.max_threads == 0 || settings.outputs == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if the benchmark ran, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, char * args[]) {
+  if(parse_settings(arg_count, args) != 0) {
+    fputs("usage: logger_bench [-t max producer threads] [-n messages per thread] [-s message size]\n"
+	  "                    [-o outputs] [-k null|file|pipe] [-d directory] [-m immediate|deferred]\n"
+	  "                    [-w writer threads, 0 for one per output] [-z compression level, 0 for none]\n"
+	  "                    [-u, write through io_uring]\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  payload = (char *)malloc(settings.message_size + 1);
+  if(payload == NULL) {
+    fputs("out of memory\n", stderr);
+    return EXIT_FAILURE;
+  }
+  memset(payload, 'x', settings.message_size);
+  payload[settings.message_size] = '\0';
+
+  int result = 0;
+  for(size_t threads = 1; result == 0 && threads <= settings.max_threads; threads *= 2) {
+    result = run_round(threads);
+  }
+  free(payload);
+
+  if(result == 0) {
+    return EXIT_SUCCESS;
+  } else {
+    fputs("benchmark failed\n", stderr);
+    return EXIT_FAILURE;
+  }
+}
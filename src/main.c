@@ -14,18 +14,286 @@
  * 
  */
 
+#include "ecs.h"
+#include "job.h"
 #include "logger.h"
+#include "profiler.h"
+#include "sprite.h"
+#include "status.h"
 #include "window.h"
 
 #include <stdlib.h>
 
+#include <unistd.h>
+
+/**
+ * The size of the frame buffer of each thread logging, its messages are published once per frame
+ */
+#define LOG_FRAME_BUFFER_SIZE 65536
+
+/**
+ * The default number of entities moving around
+ */
+#define DEFAULT_ENTITY_COUNT 1000
+
+/**
+ * The maximum speed of an entity, in pixels per second
+ */
+#define MAX_ENTITY_SPEED 100.0f
+
+/**
+ * The size of an entity on screen, in pixels
+ */
+#define ENTITY_SIZE 16
+
+/**
+ * The size of the sprite atlas, in pixels
+ */
+#define ATLAS_SIZE 256
+
+/**
+ * A position or velocity in the plane of the window
+ */
+struct vector {
+  float x;
+  float y;
+};
+
+/**
+ * What the movement system needs to know about the step
+ */
+struct movement {
+
+  /**
+   * The simulated time, in seconds
+   */
+  float step;
+
+  /**
+   * The width of the area entities move in
+   */
+  float width;
+
+  /**
+   * The height of the area entities move in
+   */
+  float height;
+};
+
+/**
+ * The position component
+ */
+static int position_component;
+
+/**
+ * The position component before the last update, frames are drawn between it and the position
+ */
+static int previous_position_component;
+
+/**
+ * The velocity component
+ */
+static int velocity_component;
+
+/**
+ * The atlas of the sprites
+ */
+static struct sprite_atlas * atlas;
+
+/**
+ * The image of an entity in the atlas
+ */
+static struct sprite_region entity_region;
+
+/**
+ * The sprites of a frame
+ */
+static struct sprite_batch sprite_batch;
+
+/**
+ * System moving entities by their velocity, bouncing them off the edges of the window
+ * \param view the entities
+ * \param data the movement cast as a void *
+ */
+static void move_entities(const struct ecs_view * view, void * data) {
+  const struct movement * movement = (const struct movement *)data;
+  struct vector * positions = (struct vector *)get_ecs_column(view, (ecs_component)position_component);
+  struct vector * previous_positions = (struct vector *)get_ecs_column(view, (ecs_component)previous_position_component);
+  struct vector * velocities = (struct vector *)get_ecs_column(view, (ecs_component)velocity_component);
+  for(size_t i = 0; i < view->count; ++i) {
+    previous_positions[i] = positions[i];
+    positions[i].x += velocities[i].x * movement->step;
+    positions[i].y += velocities[i].y * movement->step;
+    if((positions[i].x < 0.0f && velocities[i].x < 0.0f) || (positions[i].x > movement->width && velocities[i].x > 0.0f)) {
+      velocities[i].x = -velocities[i].x;
+    }
+    if((positions[i].y < 0.0f && velocities[i].y < 0.0f) || (positions[i].y > movement->height && velocities[i].y > 0.0f)) {
+      velocities[i].y = -velocities[i].y;
+    }
+  }
+}
+
+/**
+ * System adding a sprite per entity to the sprite batch, placed between the previous and the
+ * current position of the entity
+ * \param view the entities
+ * \param data how far the frame lies between the last two updates, a float cast as a void *
+ */
+static void add_entity_sprites(const struct ecs_view * view, void * data) {
+  float alpha = *(const float *)data;
+  const struct vector * positions = (const struct vector *)get_ecs_column(view, (ecs_component)position_component);
+  const struct vector * previous_positions = (const struct vector *)get_ecs_column(view, (ecs_component)previous_position_component);
+  struct sprite sprite = { &entity_region, 0.0f, 0.0f, ENTITY_SIZE, ENTITY_SIZE, 0.0f, { 255, 255, 255, 255 }, 0 };
+  for(size_t i = 0; i < view->count; ++i) {
+    sprite.x = previous_positions[i].x + (positions[i].x - previous_positions[i].x) * alpha;
+    sprite.y = previous_positions[i].y + (positions[i].y - previous_positions[i].y) * alpha;
+    add_sprite(&sprite_batch, &sprite);
+  }
+}
+
+/**
+ * Creates the sprite atlas, with a square as the image of entities
+ * \return 0 on success, -1 on failure
+ */
+static int create_sprites() {
+  init_sprite_batch(&sprite_batch);
+  atlas = create_sprite_atlas(ATLAS_SIZE, ATLAS_SIZE);
+  if(atlas == NULL) {
+    return -1;
+  }
+  SDL_Surface * image = SDL_CreateRGBSurfaceWithFormat(0, ENTITY_SIZE, ENTITY_SIZE, 32, SDL_PIXELFORMAT_RGBA32);
+  if(image == NULL) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    return -1;
+  }
+  SDL_FillRect(image, NULL, SDL_MapRGBA(image->format, 200, 60, 40, 255));
+  int result = add_sprite_atlas_image(atlas, image, &entity_region);
+  SDL_FreeSurface(image);
+  if(result != 0) {
+    return -1;
+  }
+  return upload_sprite_atlas(atlas, get_window_renderer());
+}
+
+/**
+ * Frees the sprites
+ */
+static void dispose_sprites() {
+  dispose_sprite_batch(&sprite_batch);
+  destroy_sprite_atlas(atlas);
+  atlas = NULL;
+}
+
+/**
+ * Creates the entities of the game, spread over the window
+ * \param count the number of entities
+ * \param options the options of the window
+ * \return 0 on success, -1 on failure
+ */
+static int create_game(size_t count, const struct window_options * options) {
+  position_component = register_ecs_component(sizeof(struct vector), _Alignof(struct vector));
+  previous_position_component = register_ecs_component(sizeof(struct vector), _Alignof(struct vector));
+  velocity_component = register_ecs_component(sizeof(struct vector), _Alignof(struct vector));
+  if(position_component < 0 || previous_position_component < 0 || velocity_component < 0) {
+    return -1;
+  }
+  unsigned int random = 1;
+  for(size_t i = 0; i < count; ++i) {
+    ecs_entity entity = create_ecs_entity(ECS_MASK(position_component) | ECS_MASK(previous_position_component) | ECS_MASK(velocity_component));
+    if(entity == ECS_NULL_ENTITY) {
+      return -1;
+    }
+    float values[4];
+    for(size_t j = 0; j < 4; ++j) {
+      random = random * 1103515245U + 12345U;
+      values[j] = (float)(random >> 8) / (float)(1U << 24);
+    }
+    struct vector * position = (struct vector *)get_ecs_component(entity, (ecs_component)position_component);
+    struct vector * previous_position = (struct vector *)get_ecs_component(entity, (ecs_component)previous_position_component);
+    struct vector * velocity = (struct vector *)get_ecs_component(entity, (ecs_component)velocity_component);
+    position->x = values[0] * (float)options->width;
+    position->y = values[1] * (float)options->height;
+    *previous_position = *position;
+    velocity->x = (values[2] * 2.0f - 1.0f) * MAX_ENTITY_SPEED;
+    velocity->y = (values[3] * 2.0f - 1.0f) * MAX_ENTITY_SPEED;
+  }
+  return 0;
+}
+
+/**
+ * Advances the game by one fixed step
+ * \param data the options of the window
+ * \param step the simulated time, in seconds
+ */
+static void update_game(void * data, double step) {
+  const struct window_options * options = (const struct window_options *)data;
+  struct movement movement = { (float)step, (float)options->width, (float)options->height };
+  struct ecs_query query = { ECS_MASK(position_component) | ECS_MASK(previous_position_component) | ECS_MASK(velocity_component), 0 };
+  if(run_ecs_system_jobs(&query, move_entities, &movement) != 0) {
+    LOG_ERROR("could not move the entities: %s", get_status_label(get_status()));
+    clear_status();
+  }
+}
+
+/**
+ * Draws the game, interpolating between the last two updates so motion stays smooth when the
+ * frame rate differs from the update rate
+ * \param data unused
+ * \param renderer the renderer of the window
+ * \param alpha how far the frame lies between the last two updates
+ */
+static void render_game(void * data, SDL_Renderer * renderer, double alpha) {
+  (void)data;
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+  float blend = (float)alpha;
+  struct ecs_query query = { ECS_MASK(position_component) | ECS_MASK(previous_position_component), 0 };
+  run_ecs_system(&query, add_entity_sprites, &blend);
+  if(draw_sprite_batch(&sprite_batch, renderer) < 0) {
+    LOG_ERROR_THROTTLED(1000, "could not draw the sprites: '%s'", SDL_GetError());
+    clear_status();
+  }
+}
+
 /**
  * Main function
+ * Usage: guard [-n frames] [-e entities] [-p trace] [-s], runs until the window is closed
+ * without a number of frames, writes a Chrome trace of the run with a trace path and renders in
+ * software with -s, which also runs headless with SDL_VIDEODRIVER=dummy
  * \param arg_count the number of arguments
  * \param args the arguments
  * \return EXIT_SUCESS if the program closes normally, EXIT_FAILURE otherwise
  */
-int main(int arg_count, const char * args[]) {
+int main(int arg_count, char * args[]) {
+
+  struct window_options window_options;
+  init_window_options(&window_options);
+  const char * trace_path = NULL;
+  size_t entity_count = DEFAULT_ENTITY_COUNT;
+  int option;
+  while((option = getopt(arg_count, args, "n:e:p:s")) != -1) {
+    switch(option) {
+    case 'n':
+      window_options.max_frames = strtoull(optarg, NULL, 10);
+      break;
+    case 'e':
+      entity_count = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      trace_path = optarg;
+      break;
+    case 's':
+      window_options.software_renderer = true;
+      break;
+    default:
+      fputs("usage: guard [-n frames] [-e entities] [-p trace] [-s]\n", stderr);
+      return EXIT_FAILURE;
+    }
+  }
+  if(trace_path != NULL && start_profiler(trace_path) != 0) {
+    fputs("profiler could not be started, it may not be compiled in\n", stderr);
+    return EXIT_FAILURE;
+  }
 
   if(init_logger(LOG_LEVEL_INFO) != 0) {
     fputs("logger failed to initialize\n", stderr);
@@ -35,19 +303,35 @@ int main(int arg_count, const char * args[]) {
     fputs("logger output could not be set\n", stderr);
     return EXIT_FAILURE;
   }
+  set_log_frame_buffering(LOG_FRAME_BUFFER_SIZE);
   if(start_logger() != 0) {
     fputs("logger could not be started\n", stderr);
     return EXIT_FAILURE;
   }
 
-  int result = init_window();
+  int result = init_window_with_options(&window_options);
   
   if(result == 0) {
+    if(init_jobs() != 0 || init_ecs() != 0 || create_game(entity_count, &window_options) != 0 || create_sprites() != 0) {
+      LOG_ERROR("could not create the game: %s", get_status_label(get_status()));
+      result = -1;
+    } else {
+      struct window_loop loop = { update_game, render_game, &window_options };
+      result = run_window(&loop);
+      log_window_frame_times();
+    }
+    dispose_sprites();
+    dispose_ecs();
+    dispose_jobs();
     dispose_window();
   }
   
   stop_logger();
   dispose_logger();
+  if(trace_path != NULL) {
+    stop_profiler();
+    dispose_profiler();
+  }
   
   if(result == 0) {
     return EXIT_SUCCESS;
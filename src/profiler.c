@@ -0,0 +1,524 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+// for naming threads
+#define _GNU_SOURCE
+
+#include "profiler.h"
+
+#if PROFILER_ENABLED
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The size of a cache line, separating what the recording and the draining thread write
+ */
+#define PROFILE_CACHE_LINE_SIZE 64
+
+/**
+ * The interval between drains of the buffers in milliseconds
+ */
+#define PROFILE_DRAIN_INTERVAL 10
+
+/**
+ * The maximum length of a thread name, including the NUL
+ */
+#define PROFILE_THREAD_NAME_SIZE 16
+
+/**
+ * A recorded scope
+ */
+struct profile_event {
+
+  /**
+   * The name of the scope
+   */
+  const char * name;
+
+  /**
+   * The time the scope opened in nanoseconds on the monotonic clock
+   */
+  unsigned long long start;
+
+  /**
+   * The time the scope was open in nanoseconds
+   */
+  unsigned long long duration;
+};
+
+/**
+ * A scope of a thread that is open
+ */
+struct profile_scope {
+
+  /**
+   * The name of the scope
+   */
+  const char * name;
+
+  /**
+   * The time the scope opened, 0 if it is not recorded
+   */
+  unsigned long long start;
+};
+
+/**
+ * The buffer of a thread, a ring of events with a single producer, the thread, and a single
+ * consumer, the drain
+ */
+struct profile_buffer {
+
+  /**
+   * The events
+   */
+  struct profile_event events[PROFILE_BUFFER_EVENTS];
+
+  /**
+   * The buffer of the thread that recorded before
+   */
+  struct profile_buffer * next;
+
+  /**
+   * The identifier of the thread in the trace
+   */
+  unsigned int thread;
+
+  /**
+   * The name of the thread when it first recorded
+   */
+  char name[PROFILE_THREAD_NAME_SIZE];
+
+  /**
+   * Whether the name of the thread is in the trace, only used by the drain
+   */
+  bool named;
+
+  /**
+   * The position after the last event, only moved by the thread
+   */
+  _Alignas(PROFILE_CACHE_LINE_SIZE) atomic_size_t head;
+
+  /**
+   * The tail as last read by the thread, so it only reads the tail when the buffer looks full
+   */
+  size_t cached_tail;
+
+  /**
+   * The position of the first event not yet drained, only moved by the drain
+   */
+  _Alignas(PROFILE_CACHE_LINE_SIZE) atomic_size_t tail;
+};
+
+/**
+ * Whether scopes are recorded
+ */
+static atomic_bool running;
+
+/**
+ * The number of scopes dropped since the profiler started
+ */
+static atomic_ullong dropped;
+
+/**
+ * The buffers of all threads that recorded, the last one first
+ */
+static struct profile_buffer * buffers;
+
+/**
+ * The number of buffers, the identifier of the next thread is one more
+ */
+static unsigned int buffer_len;
+
+/**
+ * Mutex guarding the list of buffers and the stop flag of the drain
+ */
+static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Condition signalling the drain to stop
+ */
+static pthread_cond_t drain_cond;
+
+/**
+ * Whether the drain stops, guarded by the buffer mutex
+ */
+static bool stopping;
+
+/**
+ * The drain thread
+ */
+static pthread_t drain_thread;
+
+/**
+ * The trace file
+ */
+static FILE * trace;
+
+/**
+ * Whether an event has been written to the trace, so the next one needs a comma
+ */
+static bool trace_started;
+
+/**
+ * The time the profiler started, the origin of the trace
+ */
+static unsigned long long start_time;
+
+/**
+ * The process identifier in the trace
+ */
+static int trace_pid;
+
+/**
+ * Counts the disposals of the profiler, the buffer of a thread belongs to one
+ */
+static unsigned int generation;
+
+/**
+ * The buffer of this thread
+ */
+static __thread struct profile_buffer * thread_buffer;
+
+/**
+ * The disposal of the profiler the buffer of this thread belongs to
+ */
+static __thread unsigned int thread_buffer_generation;
+
+/**
+ * The open scopes of this thread, the innermost last
+ */
+static __thread struct profile_scope scopes[PROFILE_MAX_DEPTH];
+
+/**
+ * The number of open scopes of this thread, including those too deep to be recorded
+ */
+static __thread unsigned int depth;
+
+/*
+ * Profile buffer functions
+ */
+
+/**
+ * Returns the time on the monotonic clock
+ * \return the time in nanoseconds
+ */
+static unsigned long long get_profile_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Returns the buffer of this thread
+ * \return the buffer or NULL if the thread is not registered
+ */
+static struct profile_buffer * get_profile_buffer() {
+  if(thread_buffer != NULL && thread_buffer_generation == generation) {
+    return thread_buffer;
+  }
+  return NULL;
+}
+
+/**
+ * Creates the buffer of this thread and adds it to the buffers the drain writes
+ * \return the buffer or NULL on failure
+ */
+static struct profile_buffer * create_profile_buffer() {
+  struct profile_buffer * new_buffer = (struct profile_buffer *)aligned_alloc(PROFILE_CACHE_LINE_SIZE, sizeof(struct profile_buffer));
+  if(new_buffer == NULL) {
+    return NULL;
+  }
+  if(pthread_getname_np(pthread_self(), new_buffer->name, sizeof(new_buffer->name)) != 0) {
+    new_buffer->name[0] = '\0';
+  }
+  new_buffer->named = false;
+  atomic_init(&new_buffer->head, 0);
+  new_buffer->cached_tail = 0;
+  atomic_init(&new_buffer->tail, 0);
+
+  pthread_mutex_lock(&buffer_mutex);
+  new_buffer->thread = ++buffer_len;
+  new_buffer->next = buffers;
+  buffers = new_buffer;
+  pthread_mutex_unlock(&buffer_mutex);
+  thread_buffer = new_buffer;
+  thread_buffer_generation = generation;
+  return new_buffer;
+}
+
+/**
+ * Adds an event to the buffer of this thread, dropping it if the buffer is full
+ * \param buffer the buffer of this thread
+ * \param event the event
+ */
+static void add_profile_event(struct profile_buffer * buffer, const struct profile_event * event) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  if(head - buffer->cached_tail == PROFILE_BUFFER_EVENTS) {
+    buffer->cached_tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if(head - buffer->cached_tail == PROFILE_BUFFER_EVENTS) {
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return;
+    }
+  }
+  buffer->events[head % PROFILE_BUFFER_EVENTS] = *event;
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+/*
+ * Trace functions
+ */
+
+/**
+ * Writes a string to the trace as a JSON string
+ * \param text the string
+ */
+static void write_trace_string(const char * text) {
+  putc('"', trace);
+  for(const char * c = text; *c != '\0'; ++c) {
+    if(*c == '"' || *c == '\\') {
+      putc('\\', trace);
+      putc(*c, trace);
+    } else if((unsigned char)*c < 0x20) {
+      fprintf(trace, "\\u%04x", (unsigned int)(unsigned char)*c);
+    } else {
+      putc(*c, trace);
+    }
+  }
+  putc('"', trace);
+}
+
+/**
+ * Starts the next event in the trace
+ */
+static void start_trace_event() {
+  fputs(trace_started ? ",\n" : "\n", trace);
+  trace_started = true;
+}
+
+/**
+ * Writes the events of a buffer to the trace, preceded by the name of its thread
+ * \param buffer the buffer
+ */
+static void drain_profile_buffer(struct profile_buffer * buffer) {
+  size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+  if(head == tail) {
+    return;
+  }
+  if(!buffer->named && buffer->name[0] != '\0') {
+    start_trace_event();
+    fprintf(trace, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":", trace_pid, buffer->thread);
+    write_trace_string(buffer->name);
+    fputs("}}", trace);
+  }
+  buffer->named = true;
+  for(; tail != head; ++tail) {
+    const struct profile_event * event = buffer->events + tail % PROFILE_BUFFER_EVENTS;
+    // scopes opened before the profiler started are cut at its start
+    unsigned long long start = event->start > start_time ? event->start - start_time : 0;
+    unsigned long long end = event->start + event->duration - start_time;
+    start_trace_event();
+    fputs("{\"name\":", trace);
+    write_trace_string(event->name);
+    fprintf(trace, ",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%u}",
+	    start / 1000, start % 1000, (end - start) / 1000, (end - start) % 1000, trace_pid, buffer->thread);
+  }
+  atomic_store_explicit(&buffer->tail, tail, memory_order_release);
+}
+
+/**
+ * Writes the events of all buffers to the trace
+ */
+static void drain_profile_buffers() {
+  pthread_mutex_lock(&buffer_mutex);
+  struct profile_buffer * first = buffers;
+  pthread_mutex_unlock(&buffer_mutex);
+  // buffers are only added in front and only freed once the drain stopped
+  for(struct profile_buffer * buffer = first; buffer != NULL; buffer = buffer->next) {
+    drain_profile_buffer(buffer);
+  }
+}
+
+/**
+ * Drain thread function, draining the buffers until the profiler stops
+ * \param arg unused
+ * \return always NULL
+ */
+static void * run_profile_drain(void * arg) {
+  (void)arg;
+  pthread_setname_np(pthread_self(), "profile drain");
+
+  pthread_mutex_lock(&buffer_mutex);
+  while(!stopping) {
+    struct timespec timeout;
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_nsec += PROFILE_DRAIN_INTERVAL * 1000000L;
+    if(timeout.tv_nsec >= 1000000000L) {
+      timeout.tv_nsec -= 1000000000L;
+      ++timeout.tv_sec;
+    }
+    int result = pthread_cond_timedwait(&drain_cond, &buffer_mutex, &timeout);
+    if(result == ETIMEDOUT && !stopping) {
+      pthread_mutex_unlock(&buffer_mutex);
+      drain_profile_buffers();
+      pthread_mutex_lock(&buffer_mutex);
+    }
+  }
+  pthread_mutex_unlock(&buffer_mutex);
+  return NULL;
+}
+
+/*
+ * Public API implementation
+ */
+
+int register_profile_thread() {
+  if(get_profile_buffer() != NULL) {
+    return 0;
+  }
+  return create_profile_buffer() != NULL ? 0 : -1;
+}
+
+int start_profiler(const char * path) {
+  assert(path != NULL);
+
+  if(atomic_load_explicit(&running, memory_order_relaxed) || trace != NULL
+     || register_profile_thread() != 0) {
+    return -1;
+  }
+  trace = fopen(path, "w");
+  if(trace == NULL) {
+    return -1;
+  }
+  pthread_condattr_t attr;
+  if(pthread_condattr_init(&attr) != 0) {
+    fclose(trace);
+    trace = NULL;
+    return -1;
+  }
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  int result = pthread_cond_init(&drain_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  if(result != 0) {
+    fclose(trace);
+    trace = NULL;
+    return -1;
+  }
+
+  // events left over from an earlier run are not part of this trace
+  pthread_mutex_lock(&buffer_mutex);
+  for(struct profile_buffer * buffer = buffers; buffer != NULL; buffer = buffer->next) {
+    atomic_store_explicit(&buffer->tail, atomic_load_explicit(&buffer->head, memory_order_acquire), memory_order_release);
+    buffer->named = false;
+  }
+  stopping = false;
+  pthread_mutex_unlock(&buffer_mutex);
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace);
+  trace_started = false;
+  trace_pid = (int)getpid();
+  start_time = get_profile_time();
+  atomic_store_explicit(&dropped, 0, memory_order_relaxed);
+
+  if(pthread_create(&drain_thread, NULL, run_profile_drain, NULL) != 0) {
+    pthread_cond_destroy(&drain_cond);
+    fclose(trace);
+    trace = NULL;
+    return -1;
+  }
+  atomic_store_explicit(&running, true, memory_order_release);
+  return 0;
+}
+
+int stop_profiler() {
+  if(!atomic_load_explicit(&running, memory_order_relaxed)) {
+    return -1;
+  }
+  atomic_store_explicit(&running, false, memory_order_relaxed);
+  pthread_mutex_lock(&buffer_mutex);
+  stopping = true;
+  pthread_cond_signal(&drain_cond);
+  pthread_mutex_unlock(&buffer_mutex);
+  pthread_join(drain_thread, NULL);
+  pthread_cond_destroy(&drain_cond);
+
+  // scopes closing while the profiler stops may still land, they are dropped when it starts again
+  drain_profile_buffers();
+  fputs("\n]}\n", trace);
+  int result = ferror(trace) ? -1 : 0;
+  if(fclose(trace) != 0) {
+    result = -1;
+  }
+  trace = NULL;
+  return result;
+}
+
+void dispose_profiler() {
+  assert(!atomic_load_explicit(&running, memory_order_relaxed));
+
+  pthread_mutex_lock(&buffer_mutex);
+  struct profile_buffer * buffer = buffers;
+  buffers = NULL;
+  buffer_len = 0;
+  ++generation;
+  pthread_mutex_unlock(&buffer_mutex);
+  while(buffer != NULL) {
+    struct profile_buffer * next = buffer->next;
+    free(buffer);
+    buffer = next;
+  }
+}
+
+unsigned long long get_profile_drop_count() {
+  return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+void begin_profile_scope(const char * name) {
+  if(depth < PROFILE_MAX_DEPTH) {
+    scopes[depth].name = name;
+    scopes[depth].start = atomic_load_explicit(&running, memory_order_relaxed) ? get_profile_time() : 0;
+  }
+  ++depth;
+}
+
+void end_profile_scope() {
+  // an end without begin is ignored rather than closing a scope of the caller
+  if(depth == 0) {
+    return;
+  }
+  --depth;
+  if(depth >= PROFILE_MAX_DEPTH || scopes[depth].start == 0 || !atomic_load_explicit(&running, memory_order_relaxed)) {
+    return;
+  }
+  // the buffer is allocated when the thread registers, never inside a measured scope
+  struct profile_buffer * buffer = get_profile_buffer();
+  if(buffer == NULL) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return;
+  }
+  struct profile_event event = { scopes[depth].name, scopes[depth].start, get_profile_time() - scopes[depth].start };
+  add_profile_event(buffer, &event);
+}
+
+#endif
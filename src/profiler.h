@@ -0,0 +1,127 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Scoped profiling of where threads spend their time, exported as a Chrome trace
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/**
+ * Whether the profiler is compiled in, without it the scope macros expand to nothing and the
+ * profiler can not be started
+ */
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0
+#endif
+
+#if PROFILER_ENABLED
+
+/**
+ * The number of events each thread buffers until the drain writes them, further events are
+ * dropped
+ */
+#define PROFILE_BUFFER_EVENTS 16384
+
+/**
+ * The deepest nesting of scopes recorded, deeper scopes are skipped
+ */
+#define PROFILE_MAX_DEPTH 32
+
+/**
+ * Registers this thread with the profiler, allocating the buffer its scopes are recorded in
+ * Threads call this once when they start, after naming themselves, scopes of threads that did
+ * not register are dropped
+ * \return 0 on success, -1 on failure
+ */
+int register_profile_thread();
+
+/**
+ * Starts recording scopes and draining them into a trace file in the background
+ * The file is in the Chrome trace event format, to be opened with Perfetto or about:tracing
+ * Registers the calling thread
+ * \param path the path of the trace file, overwritten
+ * \return 0 on success, -1 on failure or if the profiler runs
+ */
+int start_profiler(const char * path);
+
+/**
+ * Stops recording, writes what is still buffered and completes the trace file
+ * \return 0 on success, -1 if the profiler is not running or the file could not be written
+ */
+int stop_profiler();
+
+/**
+ * Frees the buffers of the threads, once no thread records scopes anymore
+ * Threads register again to record scopes afterwards
+ */
+void dispose_profiler();
+
+/**
+ * Returns the number of scopes dropped because their thread was not registered or its buffer
+ * was full
+ * \return the number of scopes since the profiler started
+ */
+unsigned long long get_profile_drop_count();
+
+/**
+ * Opens a scope on this thread
+ * Users should use the utility macros instead
+ * \param name the name of the scope, a string constant
+ */
+void begin_profile_scope(const char * name);
+
+/**
+ * Closes the innermost scope of this thread, recording it if the profiler runs
+ * Users should use the utility macros instead
+ */
+void end_profile_scope();
+
+/**
+ * Utility macros marking the start and end of a scope, scopes nest and never allocate
+ */
+#define PROFILE_BEGIN(name) begin_profile_scope(name)
+#define PROFILE_END() end_profile_scope()
+
+#else
+
+#define PROFILE_BEGIN(name) do { } while(0)
+#define PROFILE_END() do { } while(0)
+
+static inline int register_profile_thread() {
+  return -1;
+}
+
+static inline int start_profiler(const char * path) {
+  (void)path;
+  return -1;
+}
+
+static inline int stop_profiler() {
+  return -1;
+}
+
+static inline void dispose_profiler() {
+}
+
+static inline unsigned long long get_profile_drop_count() {
+  return 0;
+}
+
+#endif
+
+#endif
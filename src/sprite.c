@@ -0,0 +1,405 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+#include "sprite.h"
+#include "status.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * The number of sprites a batch makes room for first
+ */
+#define SPRITE_BATCH_MIN_CAP 1024
+
+/**
+ * The bits of a sort key holding the index of a sprite, the layer and the atlas are above
+ */
+#define SPRITE_INDEX_BITS 32
+
+struct sprite_atlas {
+
+  /**
+   * The images, until the atlas is uploaded
+   */
+  SDL_Surface * surface;
+
+  /**
+   * The texture, once the atlas is uploaded
+   */
+  SDL_Texture * texture;
+
+  /**
+   * The size of the atlas
+   */
+  int width;
+  int height;
+
+  /**
+   * Where the next image goes on the current shelf
+   */
+  int shelf_x;
+
+  /**
+   * The top of the current shelf
+   */
+  int shelf_y;
+
+  /**
+   * The height of the current shelf, its tallest image and padding
+   */
+  int shelf_height;
+
+  /**
+   * The identifier sorting the sprites of the atlas together, 0 is left to sprites without image
+   */
+  uint16_t id;
+};
+
+/**
+ * The identifier of the next atlas
+ */
+static uint16_t next_atlas_id = 1;
+
+/*
+ * Sprite batch functions
+ */
+
+/**
+ * Makes room for more sprites in a batch
+ * \param batch the sprite batch
+ * \return 0 on success, -1 on failure
+ */
+static int grow_sprite_batch(struct sprite_batch * batch) {
+  size_t cap = batch->cap == 0 ? SPRITE_BATCH_MIN_CAP : batch->cap * 2;
+  // the index of a sprite has to fit its sort key, the vertex count an int
+  if(cap > UINT32_MAX || cap > INT_MAX / 6) {
+    SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+    return -1;
+  }
+  struct sprite * sprites = (struct sprite *)realloc(batch->sprites, cap * sizeof(struct sprite));
+  if(sprites != NULL) {
+    batch->sprites = sprites;
+  }
+  uint64_t * keys = (uint64_t *)realloc(batch->keys, cap * sizeof(uint64_t));
+  if(keys != NULL) {
+    batch->keys = keys;
+  }
+  uint64_t * sorted_keys = (uint64_t *)realloc(batch->sorted_keys, cap * sizeof(uint64_t));
+  if(sorted_keys != NULL) {
+    batch->sorted_keys = sorted_keys;
+  }
+  SDL_Vertex * vertices = (SDL_Vertex *)realloc(batch->vertices, 4 * cap * sizeof(SDL_Vertex));
+  if(vertices != NULL) {
+    batch->vertices = vertices;
+  }
+  int * indices = (int *)realloc(batch->indices, 6 * cap * sizeof(int));
+  if(indices != NULL) {
+    batch->indices = indices;
+  }
+  // arrays that did grow are kept, the capacity only counts once all did
+  if(sprites == NULL || keys == NULL || sorted_keys == NULL || vertices == NULL || indices == NULL) {
+    SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+    return -1;
+  }
+  for(size_t i = batch->cap; i < cap; ++i) {
+    int vertex = (int)(4 * i);
+    int * quad = batch->indices + 6 * i;
+    quad[0] = vertex;
+    quad[1] = vertex + 1;
+    quad[2] = vertex + 2;
+    quad[3] = vertex + 2;
+    quad[4] = vertex + 3;
+    quad[5] = vertex;
+  }
+  batch->cap = cap;
+  return 0;
+}
+
+/**
+ * Sorts the keys of a batch by layer and atlas, keeping the order of sprites with equal ones
+ * A least significant digit radix sort over the bytes above the sprite index, skipping bytes
+ * all keys share, which with few layers and atlases are most of them
+ * \param batch the sprite batch
+ */
+static void sort_sprite_keys(struct sprite_batch * batch) {
+  size_t counts[4][256] = { { 0 } };
+  for(size_t i = 0; i < batch->len; ++i) {
+    uint64_t key = batch->keys[i];
+    for(size_t digit = 0; digit < 4; ++digit) {
+      ++counts[digit][key >> (SPRITE_INDEX_BITS + 8 * digit) & 0xff];
+    }
+  }
+  for(size_t digit = 0; digit < 4; ++digit) {
+    size_t * count = counts[digit];
+    unsigned int shift = SPRITE_INDEX_BITS + 8 * (unsigned int)digit;
+    if(count[batch->keys[0] >> shift & 0xff] == batch->len) {
+      continue;
+    }
+    size_t offset = 0;
+    for(size_t i = 0; i < 256; ++i) {
+      size_t next = offset + count[i];
+      count[i] = offset;
+      offset = next;
+    }
+    for(size_t i = 0; i < batch->len; ++i) {
+      uint64_t key = batch->keys[i];
+      batch->sorted_keys[count[key >> shift & 0xff]++] = key;
+    }
+    uint64_t * keys = batch->keys;
+    batch->keys = batch->sorted_keys;
+    batch->sorted_keys = keys;
+  }
+}
+
+/**
+ * Writes the four vertices of a sprite, clockwise from the top left corner
+ * \param sprite the sprite
+ * \param vertices the vertices
+ */
+static void write_sprite_vertices(const struct sprite * sprite, SDL_Vertex * vertices) {
+  float half_width = sprite->width * 0.5f;
+  float half_height = sprite->height * 0.5f;
+  float dx[4] = { -half_width, half_width, half_width, -half_width };
+  float dy[4] = { -half_height, -half_height, half_height, half_height };
+  if(sprite->angle != 0.0f) {
+    float c = cosf(sprite->angle);
+    float s = sinf(sprite->angle);
+    for(size_t i = 0; i < 4; ++i) {
+      float x = dx[i] * c - dy[i] * s;
+      dy[i] = dx[i] * s + dy[i] * c;
+      dx[i] = x;
+    }
+  }
+  const struct sprite_region * region = sprite->region;
+  float u[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  if(region != NULL) {
+    u[0] = u[3] = region->u0;
+    u[1] = u[2] = region->u1;
+    v[0] = v[1] = region->v0;
+    v[2] = v[3] = region->v1;
+  }
+  for(size_t i = 0; i < 4; ++i) {
+    vertices[i].position.x = sprite->x + dx[i];
+    vertices[i].position.y = sprite->y + dy[i];
+    vertices[i].color = sprite->color;
+    vertices[i].tex_coord.x = u[i];
+    vertices[i].tex_coord.y = v[i];
+  }
+}
+
+/**
+ * Returns the texture a sprite is drawn with
+ * \param sprite the sprite
+ * \return the texture or NULL
+ */
+static SDL_Texture * get_sprite_texture(const struct sprite * sprite) {
+  return sprite->region != NULL ? sprite->region->atlas->texture : NULL;
+}
+
+/*
+ * Public API implementation
+ */
+
+struct sprite_atlas * create_sprite_atlas(int width, int height) {
+  if(width <= 0 || height <= 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return NULL;
+  }
+  struct sprite_atlas * atlas = (struct sprite_atlas *)malloc(sizeof(struct sprite_atlas));
+  if(atlas == NULL) {
+    SET_STATUS(STATUS_CODE_OUT_OF_MEMORY);
+    return NULL;
+  }
+  atlas->surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+  if(atlas->surface == NULL) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    free(atlas);
+    return NULL;
+  }
+  SDL_FillRect(atlas->surface, NULL, SDL_MapRGBA(atlas->surface->format, 0, 0, 0, 0));
+  atlas->texture = NULL;
+  atlas->width = width;
+  atlas->height = height;
+  atlas->shelf_x = 0;
+  atlas->shelf_y = 0;
+  atlas->shelf_height = 0;
+  atlas->id = next_atlas_id++;
+  // ids wrap after many atlases, atlases sharing one only cost extra draw calls
+  if(next_atlas_id == 0) {
+    next_atlas_id = 1;
+  }
+  return atlas;
+}
+
+int add_sprite_atlas_image(struct sprite_atlas * atlas, SDL_Surface * image, struct sprite_region * region) {
+  assert(atlas != NULL);
+  assert(image != NULL);
+  assert(region != NULL);
+
+  if(atlas->surface == NULL) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  if(atlas->shelf_x + image->w > atlas->width) {
+    atlas->shelf_y += atlas->shelf_height;
+    atlas->shelf_x = 0;
+    atlas->shelf_height = 0;
+  }
+  if(image->w > atlas->width || atlas->shelf_y + image->h > atlas->height) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+
+  // the image replaces the pixels of the atlas, alpha included, instead of blending onto them
+  SDL_BlendMode blend_mode;
+  SDL_GetSurfaceBlendMode(image, &blend_mode);
+  SDL_SetSurfaceBlendMode(image, SDL_BLENDMODE_NONE);
+  SDL_Rect target = { atlas->shelf_x, atlas->shelf_y, image->w, image->h };
+  int result = SDL_BlitSurface(image, NULL, atlas->surface, &target);
+  SDL_SetSurfaceBlendMode(image, blend_mode);
+  if(result != 0) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    return -1;
+  }
+
+  region->atlas = atlas;
+  region->u0 = (float)atlas->shelf_x / (float)atlas->width;
+  region->v0 = (float)atlas->shelf_y / (float)atlas->height;
+  region->u1 = (float)(atlas->shelf_x + image->w) / (float)atlas->width;
+  region->v1 = (float)(atlas->shelf_y + image->h) / (float)atlas->height;
+  region->width = image->w;
+  region->height = image->h;
+  atlas->shelf_x += image->w + SPRITE_ATLAS_PADDING;
+  if(image->h + SPRITE_ATLAS_PADDING > atlas->shelf_height) {
+    atlas->shelf_height = image->h + SPRITE_ATLAS_PADDING;
+  }
+  return 0;
+}
+
+int upload_sprite_atlas(struct sprite_atlas * atlas, SDL_Renderer * renderer) {
+  assert(atlas != NULL);
+  assert(renderer != NULL);
+
+  if(atlas->surface == NULL) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    return -1;
+  }
+  atlas->texture = SDL_CreateTextureFromSurface(renderer, atlas->surface);
+  if(atlas->texture == NULL || SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND) != 0) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    if(atlas->texture != NULL) {
+      SDL_DestroyTexture(atlas->texture);
+      atlas->texture = NULL;
+    }
+    return -1;
+  }
+  SDL_FreeSurface(atlas->surface);
+  atlas->surface = NULL;
+  return 0;
+}
+
+SDL_Texture * get_sprite_atlas_texture(const struct sprite_atlas * atlas) {
+  assert(atlas != NULL);
+  return atlas->texture;
+}
+
+void destroy_sprite_atlas(struct sprite_atlas * atlas) {
+  if(atlas == NULL) {
+    return;
+  }
+  if(atlas->surface != NULL) {
+    SDL_FreeSurface(atlas->surface);
+  }
+  if(atlas->texture != NULL) {
+    SDL_DestroyTexture(atlas->texture);
+  }
+  free(atlas);
+}
+
+void init_sprite_batch(struct sprite_batch * batch) {
+  assert(batch != NULL);
+  batch->sprites = NULL;
+  batch->len = 0;
+  batch->cap = 0;
+  batch->keys = NULL;
+  batch->sorted_keys = NULL;
+  batch->vertices = NULL;
+  batch->indices = NULL;
+  batch->draw_calls = 0;
+}
+
+int add_sprite(struct sprite_batch * batch, const struct sprite * sprite) {
+  assert(batch != NULL);
+  assert(sprite != NULL);
+
+  if(batch->len == batch->cap && grow_sprite_batch(batch) != 0) {
+    return -1;
+  }
+  batch->sprites[batch->len++] = *sprite;
+  return 0;
+}
+
+int draw_sprite_batch(struct sprite_batch * batch, SDL_Renderer * renderer) {
+  assert(batch != NULL);
+  assert(renderer != NULL);
+
+  batch->draw_calls = 0;
+  if(batch->len == 0) {
+    return 0;
+  }
+  for(size_t i = 0; i < batch->len; ++i) {
+    const struct sprite * sprite = batch->sprites + i;
+    uint64_t atlas = sprite->region != NULL ? sprite->region->atlas->id : 0;
+    batch->keys[i] = (uint64_t)sprite->layer << (SPRITE_INDEX_BITS + 16) | atlas << SPRITE_INDEX_BITS | i;
+  }
+  sort_sprite_keys(batch);
+
+  // a run ends where the layer or the texture changes, and becomes one geometry call
+  int result = 0;
+  size_t run = 0;
+  for(size_t i = 0; i < batch->len; ++i) {
+    const struct sprite * sprite = batch->sprites + (batch->keys[i] & UINT32_MAX);
+    write_sprite_vertices(sprite, batch->vertices + 4 * i);
+    SDL_Texture * texture = get_sprite_texture(sprite);
+    if(i + 1 < batch->len && batch->keys[i + 1] >> SPRITE_INDEX_BITS == batch->keys[i] >> SPRITE_INDEX_BITS
+       && get_sprite_texture(batch->sprites + (batch->keys[i + 1] & UINT32_MAX)) == texture) {
+      continue;
+    }
+    int count = (int)(i + 1 - run);
+    if(SDL_RenderGeometry(renderer, texture, batch->vertices + 4 * run, 4 * count, batch->indices, 6 * count) != 0) {
+      SET_STATUS(STATUS_CODE_SDL_ERROR);
+      result = -1;
+    }
+    ++batch->draw_calls;
+    run = i + 1;
+  }
+  batch->len = 0;
+  return result == 0 ? (int)batch->draw_calls : -1;
+}
+
+void dispose_sprite_batch(struct sprite_batch * batch) {
+  assert(batch != NULL);
+  free(batch->sprites);
+  free(batch->keys);
+  free(batch->sorted_keys);
+  free(batch->vertices);
+  free(batch->indices);
+  init_sprite_batch(batch);
+}
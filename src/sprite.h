@@ -0,0 +1,221 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Batched sprite rendering: sprites are sorted by layer and texture and drawn with a single
+ * geometry call per run of sprites sharing both, with atlases so most layers are a single run
+ */
+
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+/**
+ * The number of transparent pixels between the images of an atlas, so filtering never samples
+ * a neighbouring image
+ */
+#define SPRITE_ATLAS_PADDING 1
+
+/**
+ * Images packed into a single texture, in rows called shelves
+ */
+struct sprite_atlas;
+
+/**
+ * The area of an image in an atlas
+ */
+struct sprite_region {
+
+  /**
+   * The atlas holding the image
+   */
+  const struct sprite_atlas * atlas;
+
+  /**
+   * The texture coordinates of the left and top edges, from 0 to 1
+   */
+  float u0;
+  float v0;
+
+  /**
+   * The texture coordinates of the right and bottom edges, from 0 to 1
+   */
+  float u1;
+  float v1;
+
+  /**
+   * The width of the image in pixels
+   */
+  int width;
+
+  /**
+   * The height of the image in pixels
+   */
+  int height;
+};
+
+/**
+ * A sprite to draw
+ */
+struct sprite {
+
+  /**
+   * The image of the sprite
+   */
+  const struct sprite_region * region;
+
+  /**
+   * The position of the center of the sprite, in pixels
+   */
+  float x;
+  float y;
+
+  /**
+   * The size of the sprite, in pixels
+   */
+  float width;
+  float height;
+
+  /**
+   * The clockwise rotation around the center, in radians
+   */
+  float angle;
+
+  /**
+   * The color the image is multiplied with
+   */
+  SDL_Color color;
+
+  /**
+   * The layer of the sprite, lower layers are drawn first and sprites of a layer in the order
+   * they were added
+   */
+  uint16_t layer;
+};
+
+/**
+ * Sprites collected for a frame, with the arrays drawing them reused from frame to frame
+ */
+struct sprite_batch {
+
+  /**
+   * The sprites
+   */
+  struct sprite * sprites;
+
+  /**
+   * The number of sprites
+   */
+  size_t len;
+
+  /**
+   * The capacity of the sprite array and the arrays below
+   */
+  size_t cap;
+
+  /**
+   * The sort keys of the sprites and a buffer to sort them
+   */
+  uint64_t * keys;
+  uint64_t * sorted_keys;
+
+  /**
+   * The vertices of the sprites, four per sprite
+   */
+  SDL_Vertex * vertices;
+
+  /**
+   * The indices of two triangles per sprite, shared by every run as they start at vertex 0
+   */
+  int * indices;
+
+  /**
+   * The number of geometry calls of the last frame
+   */
+  size_t draw_calls;
+};
+
+/**
+ * Creates an empty atlas
+ * \param width the width of the atlas texture
+ * \param height the height of the atlas texture
+ * \return the atlas or NULL on failure
+ */
+struct sprite_atlas * create_sprite_atlas(int width, int height);
+
+/**
+ * Packs an image into an atlas, before the atlas is uploaded
+ * \param atlas the atlas
+ * \param image the image, copied including its alpha channel
+ * \param region receives the area of the image
+ * \return 0 on success, -1 if the image does not fit or on failure
+ */
+int add_sprite_atlas_image(struct sprite_atlas * atlas, SDL_Surface * image, struct sprite_region * region);
+
+/**
+ * Creates the texture of an atlas, after which no images can be added
+ * \param atlas the atlas
+ * \param renderer the renderer drawing the sprites
+ * \return 0 on success, -1 on failure
+ */
+int upload_sprite_atlas(struct sprite_atlas * atlas, SDL_Renderer * renderer);
+
+/**
+ * Returns the texture of an atlas
+ * \param atlas the atlas
+ * \return the texture, NULL before the atlas is uploaded
+ */
+SDL_Texture * get_sprite_atlas_texture(const struct sprite_atlas * atlas);
+
+/**
+ * Frees an atlas and its texture
+ * \param atlas the atlas
+ */
+void destroy_sprite_atlas(struct sprite_atlas * atlas);
+
+/**
+ * Initializes an empty sprite batch
+ * \param batch the sprite batch
+ */
+void init_sprite_batch(struct sprite_batch * batch);
+
+/**
+ * Adds a sprite to draw with the batch
+ * \param batch the sprite batch
+ * \param sprite the sprite, copied
+ * \return 0 on success, -1 on failure
+ */
+int add_sprite(struct sprite_batch * batch, const struct sprite * sprite);
+
+/**
+ * Draws the sprites of a batch and empties it
+ * \param batch the sprite batch
+ * \param renderer the renderer
+ * \return the number of geometry calls, or -1 if one failed
+ */
+int draw_sprite_batch(struct sprite_batch * batch, SDL_Renderer * renderer);
+
+/**
+ * Frees the arrays of a sprite batch
+ * \param batch the sprite batch
+ */
+void dispose_sprite_batch(struct sprite_batch * batch);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Stress benchmark for the sprite batch, drawing sprites of an atlas on several layers offscreen
+ * with SDL's software renderer, so it runs without display
+ * Usage: sprite_bench [-n max sprites] [-l layers] [-i images] [-z sprite size] [-f frames]
+ *                     [-m batch|copy] [-r, rotate sprites]
+ * Runs a round for 1024, 2048 ... max sprites and prints one line of key=value pairs per round,
+ * copy draws each sprite with its own SDL_RenderCopyExF call as a baseline
+ */
+
+#include "sprite.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <SDL2/SDL.h>
+
+#define DEFAULT_MAX_SPRITES 65536
+#define DEFAULT_LAYERS 4
+#define DEFAULT_IMAGES 16
+#define DEFAULT_SPRITE_SIZE 16
+#define DEFAULT_FRAMES 60
+
+/**
+ * The size of the offscreen target
+ */
+#define TARGET_WIDTH 1280
+#define TARGET_HEIGHT 720
+
+/**
+ * The size of the atlas
+ */
+#define ATLAS_SIZE 1024
+
+/**
+ * The smallest round
+ */
+#define MIN_SPRITES 1024
+
+/**
+ * The benchmark settings
+ */
+struct settings {
+
+  /**
+   * The maximum number of sprites
+   */
+  size_t max_sprites;
+
+  /**
+   * The number of layers the sprites are spread over
+   */
+  unsigned int layers;
+
+  /**
+   * The number of images in the atlas
+   */
+  size_t images;
+
+  /**
+   * The width and height of the images and sprites
+   */
+  int sprite_size;
+
+  /**
+   * The number of frames per round
+   */
+  size_t frames;
+
+  /**
+   * Whether sprites are drawn one by one instead of batched
+   */
+  bool copy;
+
+  /**
+   * Whether sprites are rotated
+   */
+  bool rotate;
+};
+
+static struct settings settings;
+
+/**
+ * Returns the current monotonic time in nanoseconds
+ * \return the time
+ */
+static unsigned long long get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * Returns the next pseudo random number
+ * \param state the state of the generator
+ * \return a number from 0 to 1
+ */
+static float get_random(unsigned int * state) {
+  *state = *state * 1103515245U + 12345U;
+  return (float)(*state >> 8) / (float)(1U << 24);
+}
+
+/**
+ * Fills an atlas with images, squares of different colors with a lighter center
+ * \param atlas the atlas
+ * \param regions receives the areas of the images
+ * \return 0 on success, -1 on failure
+ */
+static int fill_atlas(struct sprite_atlas * atlas, struct sprite_region * regions) {
+  SDL_Surface * image = SDL_CreateRGBSurfaceWithFormat(0, settings.sprite_size, settings.sprite_size, 32, SDL_PIXELFORMAT_RGBA32);
+  if(image == NULL) {
+    return -1;
+  }
+  int result = 0;
+  for(size_t i = 0; result == 0 && i < settings.images; ++i) {
+    Uint8 r = (Uint8)(64 + 48 * (i % 4));
+    Uint8 g = (Uint8)(64 + 48 * (i / 4 % 4));
+    Uint8 b = (Uint8)(64 + 12 * (i % 16));
+    SDL_Rect center = { settings.sprite_size / 4, settings.sprite_size / 4, settings.sprite_size / 2, settings.sprite_size / 2 };
+    SDL_FillRect(image, NULL, SDL_MapRGBA(image->format, r, g, b, 255));
+    SDL_FillRect(image, &center, SDL_MapRGBA(image->format, 255, 255, 255, 192));
+    result = add_sprite_atlas_image(atlas, image, regions + i);
+  }
+  SDL_FreeSurface(image);
+  return result;
+}
+
+/**
+ * Runs a single round of the benchmark
+ * \param renderer the renderer
+ * \param regions the images
+ * \param sprites the sprites, as many as the maximum
+ * \param count the number of sprites drawn
+ * \return 0 on success, -1 on failure
+ */
+static int run_round(SDL_Renderer * renderer, const struct sprite_region * regions, struct sprite * sprites, size_t count) {
+  struct sprite_batch batch;
+  init_sprite_batch(&batch);
+  SDL_Texture * texture = get_sprite_atlas_texture(regions[0].atlas);
+  int result = 0;
+  size_t draw_calls = 0;
+  unsigned long long submit_time = 0;
+
+  unsigned long long start = get_time();
+  for(size_t frame = 0; result == 0 && frame < settings.frames; ++frame) {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    unsigned long long submit = get_time();
+    for(size_t i = 0; result == 0 && i < count; ++i) {
+      struct sprite * sprite = sprites + i;
+      // sprites drift, so every frame draws different pixels
+      sprite->x = sprite->x + 1.0f < TARGET_WIDTH ? sprite->x + 1.0f : 0.0f;
+      if(settings.rotate) {
+	sprite->angle += 0.01f;
+      }
+      if(!settings.copy) {
+	result = add_sprite(&batch, sprite);
+	continue;
+      }
+      const struct sprite_region * region = sprite->region;
+      SDL_Rect source = { (int)(region->u0 * ATLAS_SIZE + 0.5f), (int)(region->v0 * ATLAS_SIZE + 0.5f), region->width, region->height };
+      SDL_FRect target = { sprite->x - sprite->width * 0.5f, sprite->y - sprite->height * 0.5f, sprite->width, sprite->height };
+      if(SDL_RenderCopyExF(renderer, texture, &source, &target, sprite->angle * 57.29578f, NULL, SDL_FLIP_NONE) != 0) {
+	result = -1;
+      }
+      ++draw_calls;
+    }
+    if(result == 0 && !settings.copy) {
+      int calls = draw_sprite_batch(&batch, renderer);
+      if(calls < 0) {
+	result = -1;
+      } else {
+	draw_calls += (size_t)calls;
+      }
+    }
+    submit_time += get_time() - submit;
+    SDL_RenderPresent(renderer);
+  }
+  unsigned long long time = get_time() - start;
+  dispose_sprite_batch(&batch);
+
+  if(result == 0) {
+    double frames = (double)settings.frames;
+    printf("mode=%s sprites=%zu layers=%u images=%zu size=%d rotate=%d frames=%zu draw_calls_per_frame=%.1f submit_us_per_frame=%.1f frame_us=%.1f sprites_per_second=%.0f\n",
+	   settings.copy ? "copy" : "batch", count, settings.layers, settings.images, settings.sprite_size, settings.rotate ? 1 : 0,
+	   settings.frames, (double)draw_calls / frames, (double)submit_time * 1e-3 / frames, (double)time * 1e-3 / frames,
+	   (double)count * frames / ((double)time * 1e-9));
+  }
+  return result;
+}
+
+/**
+ * Parses the command line into the settings
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return 0 on success, -1 on invalid arguments
+ */
+static int parse_settings(int arg_count, char * args[]) {
+  settings.max_sprites = DEFAULT_MAX_SPRITES;
+  settings.layers = DEFAULT_LAYERS;
+  settings.images = DEFAULT_IMAGES;
+  settings.sprite_size = DEFAULT_SPRITE_SIZE;
+  settings.frames = DEFAULT_FRAMES;
+  settings.copy = false;
+  settings.rotate = false;
+
+  int option;
+  while((option = getopt(arg_count, args, "n:l:i:z:f:m:r")) != -1) {
+    switch(option) {
+    case 'n':
+      settings.max_sprites = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      settings.layers = (unsigned int)strtoul(optarg, NULL, 10);
+      break;
+    case 'i':
+      settings.images = strtoul(optarg, NULL, 10);
+      break;
+    case 'z':
+      settings.sprite_size = atoi(optarg);
+      break;
+    case 'f':
+      settings.frames = strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      if(strcmp(optarg, "batch") == 0) {
+	settings.copy = false;
+      } else if(strcmp(optarg, "copy") == 0) {
+	settings.copy = true;
+      } else {
+	return -1;
+      }
+      break;
+    case 'r':
+      settings.rotate = true;
+      break;
+    default:
+      return -1;
+    }
+  }
+  if(optind != arg_count || settings.max_sprites == 0 || settings.layers == 0 || settings.layers > UINT16_MAX + 1U
+     || settings.images == 0 || settings.sprite_size <= 0 || settings.frames == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Main function
+ * \param arg_count the number of arguments
+ * \param args the arguments
+ * \return EXIT_SUCESS if the benchmark ran, EXIT_FAILURE otherwise
+ */
+int main(int arg_count, char * args[]) {
+  if(parse_settings(arg_count, args) != 0) {
+    fputs("usage: sprite_bench [-n max sprites] [-l layers] [-i images] [-z sprite size] [-f frames]\n"
+	  "                    [-m batch|copy] [-r, rotate sprites]\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  SDL_Surface * target = SDL_CreateRGBSurfaceWithFormat(0, TARGET_WIDTH, TARGET_HEIGHT, 32, SDL_PIXELFORMAT_RGBA32);
+  SDL_Renderer * renderer = target != NULL ? SDL_CreateSoftwareRenderer(target) : NULL;
+  struct sprite_atlas * atlas = create_sprite_atlas(ATLAS_SIZE, ATLAS_SIZE);
+  struct sprite_region * regions = (struct sprite_region *)malloc(settings.images * sizeof(struct sprite_region));
+  struct sprite * sprites = (struct sprite *)malloc(settings.max_sprites * sizeof(struct sprite));
+  int result = -1;
+  if(renderer != NULL && atlas != NULL && regions != NULL && sprites != NULL
+     && fill_atlas(atlas, regions) == 0 && upload_sprite_atlas(atlas, renderer) == 0) {
+    unsigned int random = 1;
+    for(size_t i = 0; i < settings.max_sprites; ++i) {
+      struct sprite * sprite = sprites + i;
+      sprite->region = regions + (size_t)(get_random(&random) * (float)settings.images) % settings.images;
+      sprite->x = get_random(&random) * TARGET_WIDTH;
+      sprite->y = get_random(&random) * TARGET_HEIGHT;
+      sprite->width = (float)settings.sprite_size;
+      sprite->height = (float)settings.sprite_size;
+      sprite->angle = 0.0f;
+      sprite->color.r = 255;
+      sprite->color.g = 255;
+      sprite->color.b = 255;
+      sprite->color.a = 255;
+      sprite->layer = (uint16_t)((size_t)(get_random(&random) * (float)settings.layers) % settings.layers);
+    }
+    result = 0;
+    for(size_t count = MIN_SPRITES; result == 0 && count < 2 * settings.max_sprites; count *= 2) {
+      result = run_round(renderer, regions, sprites, count < settings.max_sprites ? count : settings.max_sprites);
+    }
+  } else {
+    fprintf(stderr, "could not set up rendering: '%s'\n", SDL_GetError());
+  }
+
+  free(sprites);
+  free(regions);
+  destroy_sprite_atlas(atlas);
+  if(renderer != NULL) {
+    SDL_DestroyRenderer(renderer);
+  }
+  if(target != NULL) {
+    SDL_FreeSurface(target);
+  }
+
+  if(result == 0) {
+    return EXIT_SUCCESS;
+  } else {
+    fputs("benchmark failed\n", stderr);
+    return EXIT_FAILURE;
+  }
+}
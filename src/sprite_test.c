@@ -0,0 +1,268 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Tests the sprite batch headless, drawing offscreen with SDL's software renderer
+ */
+
+#include "sprite.h"
+#include "status.h"
+#include "test.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The size of the offscreen target
+ */
+#define TARGET_SIZE 64
+
+/**
+ * The size of the atlases
+ */
+#define ATLAS_SIZE 32
+
+/**
+ * The number of layers of the batching test
+ */
+#define LAYER_COUNT 3
+
+/**
+ * The number of sprites of the batching test
+ */
+#define SPRITE_COUNT 300
+
+/**
+ * The number of images in the first atlas
+ */
+#define IMAGE_COUNT 4
+
+/**
+ * The colors of the images of the first atlas: red, green, blue and white
+ */
+static const SDL_Color image_colors[IMAGE_COUNT] = {
+  { 255, 0, 0, 255 },
+  { 0, 255, 0, 255 },
+  { 0, 0, 255, 255 },
+  { 255, 255, 255, 255 }
+};
+
+/**
+ * The renderer of the offscreen target
+ */
+static SDL_Renderer * renderer;
+
+/**
+ * The images of the first atlas, the blue one is 4 by 12 pixels, the others 8 by 8
+ */
+static struct sprite_region regions[IMAGE_COUNT];
+
+/**
+ * The yellow image of the second atlas
+ */
+static struct sprite_region other_region;
+
+/**
+ * Adds an image filled with a color to an atlas
+ * \param atlas the atlas
+ * \param width the width of the image
+ * \param height the height of the image
+ * \param color the color
+ * \param region receives the area of the image
+ * \return 0 on success, -1 on failure
+ */
+static int add_image(struct sprite_atlas * atlas, int width, int height, SDL_Color color, struct sprite_region * region) {
+  SDL_Surface * image = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+  if(image == NULL) {
+    return -1;
+  }
+  SDL_FillRect(image, NULL, SDL_MapRGBA(image->format, color.r, color.g, color.b, color.a));
+  int result = add_sprite_atlas_image(atlas, image, region);
+  SDL_FreeSurface(image);
+  return result;
+}
+
+/**
+ * Returns a sprite of an image, at its size and without rotation or tint
+ * \param region the image
+ * \param x the horizontal position of the center
+ * \param y the vertical position of the center
+ * \param layer the layer
+ * \return the sprite
+ */
+static struct sprite make_sprite(const struct sprite_region * region, float x, float y, uint16_t layer) {
+  struct sprite sprite = { region, x, y, (float)region->width, (float)region->height, 0.0f, { 255, 255, 255, 255 }, layer };
+  return sprite;
+}
+
+/**
+ * Clears the target to black
+ */
+static void clear_target() {
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+}
+
+/**
+ * Checks the color of a pixel of the target, allowing for rounding while blending
+ * \param x the horizontal position
+ * \param y the vertical position
+ * \param r the expected red
+ * \param g the expected green
+ * \param b the expected blue
+ * \return whether the pixel has about the color
+ */
+static bool is_pixel(int x, int y, int r, int g, int b) {
+  Uint8 pixel[4];
+  SDL_Rect rect = { x, y, 1, 1 };
+  if(SDL_RenderReadPixels(renderer, &rect, SDL_PIXELFORMAT_RGBA32, pixel, sizeof(pixel)) != 0) {
+    return false;
+  }
+  return abs(pixel[0] - r) <= 2 && abs(pixel[1] - g) <= 2 && abs(pixel[2] - b) <= 2;
+}
+
+/**
+ * Checks packing images into atlases
+ * \param atlas the first atlas, with room to spare
+ * \param other the second atlas
+ */
+static void test_atlas(struct sprite_atlas * atlas, struct sprite_atlas * other) {
+  for(size_t i = 0; i < IMAGE_COUNT; ++i) {
+    int width = i == 2 ? 4 : 8;
+    int height = i == 2 ? 12 : 8;
+    CHECK(add_image(atlas, width, height, image_colors[i], regions + i) == 0);
+    CHECK(regions[i].atlas == atlas && regions[i].width == width && regions[i].height == height);
+    CHECK(regions[i].u0 >= 0.0f && regions[i].u0 < regions[i].u1 && regions[i].u1 <= 1.0f);
+    CHECK(regions[i].v0 >= 0.0f && regions[i].v0 < regions[i].v1 && regions[i].v1 <= 1.0f);
+  }
+  for(size_t i = 0; i < IMAGE_COUNT; ++i) {
+    for(size_t j = i + 1; j < IMAGE_COUNT; ++j) {
+      bool apart = regions[i].u1 <= regions[j].u0 || regions[j].u1 <= regions[i].u0
+	|| regions[i].v1 <= regions[j].v0 || regions[j].v1 <= regions[i].v0;
+      CHECK(apart);
+    }
+  }
+  struct sprite_region region;
+  CHECK(add_image(atlas, ATLAS_SIZE + 1, 4, image_colors[0], &region) == -1);
+  CHECK(get_status() == STATUS_CODE_INVALID_ARGUMENT);
+  clear_status();
+  CHECK(add_image(other, 8, 8, (SDL_Color){ 255, 255, 0, 255 }, &other_region) == 0);
+
+  CHECK(get_sprite_atlas_texture(atlas) == NULL);
+  CHECK(upload_sprite_atlas(atlas, renderer) == 0);
+  CHECK(upload_sprite_atlas(other, renderer) == 0);
+  CHECK(get_sprite_atlas_texture(atlas) != NULL);
+  // uploaded atlases take no more images
+  CHECK(add_image(atlas, 4, 4, image_colors[0], &region) == -1);
+  clear_status();
+}
+
+/**
+ * Checks sprites of an atlas take one draw call per layer, whatever order they were added in
+ * \param batch the sprite batch
+ */
+static void test_batching(struct sprite_batch * batch) {
+  unsigned int random = 1;
+  for(size_t i = 0; i < SPRITE_COUNT; ++i) {
+    random = random * 1103515245U + 12345U;
+    const struct sprite_region * region = regions + (random >> 8) % IMAGE_COUNT;
+    random = random * 1103515245U + 12345U;
+    struct sprite sprite = make_sprite(region, (float)((random >> 8) % TARGET_SIZE), (float)((random >> 16) % TARGET_SIZE), (uint16_t)(i % LAYER_COUNT));
+    CHECK(add_sprite(batch, &sprite) == 0);
+  }
+  clear_target();
+  CHECK(draw_sprite_batch(batch, renderer) == LAYER_COUNT);
+  CHECK(batch->draw_calls == LAYER_COUNT);
+  CHECK(batch->len == 0);
+  CHECK(draw_sprite_batch(batch, renderer) == 0);
+
+  // a second atlas on a layer takes a second call, as do sprites without an image
+  for(size_t i = 0; i < 10; ++i) {
+    struct sprite sprite = make_sprite(i % 2 == 0 ? regions : &other_region, 8.0f, 8.0f, 0);
+    CHECK(add_sprite(batch, &sprite) == 0);
+  }
+  struct sprite plain = make_sprite(regions, 8.0f, 8.0f, 0);
+  plain.region = NULL;
+  CHECK(add_sprite(batch, &plain) == 0);
+  CHECK(draw_sprite_batch(batch, renderer) == 3);
+}
+
+/**
+ * Checks what the sprites draw: layers in order, sprites of a layer in the order they were
+ * added, rotated and tinted as told
+ * \param batch the sprite batch
+ */
+static void test_drawing(struct sprite_batch * batch) {
+  clear_target();
+  // red above green, although added first
+  struct sprite red = make_sprite(regions, 12.0f, 12.0f, 1);
+  struct sprite green = make_sprite(regions + 1, 12.0f, 12.0f, 0);
+  // within a layer, the later sprite is on top
+  struct sprite first = make_sprite(regions, 36.0f, 12.0f, 0);
+  struct sprite second = make_sprite(&other_region, 36.0f, 12.0f, 0);
+  // the blue 4 by 12 image turned by a quarter lies flat
+  struct sprite blue = make_sprite(regions + 2, 40.0f, 40.0f, 2);
+  blue.angle = 1.5707963f;
+  // white tinted cyan
+  struct sprite cyan = make_sprite(regions + 3, 12.0f, 40.0f, 0);
+  cyan.color = (SDL_Color){ 0, 255, 255, 255 };
+  CHECK(add_sprite(batch, &red) == 0);
+  CHECK(add_sprite(batch, &green) == 0);
+  CHECK(add_sprite(batch, &first) == 0);
+  CHECK(add_sprite(batch, &second) == 0);
+  CHECK(add_sprite(batch, &blue) == 0);
+  CHECK(add_sprite(batch, &cyan) == 0);
+  CHECK(draw_sprite_batch(batch, renderer) >= 0);
+
+  CHECK(is_pixel(12, 12, 255, 0, 0));
+  CHECK(is_pixel(36, 12, 255, 255, 0));
+  CHECK(is_pixel(45, 40, 0, 0, 255));
+  CHECK(is_pixel(34, 40, 0, 0, 255));
+  CHECK(is_pixel(40, 45, 0, 0, 0));
+  CHECK(is_pixel(40, 35, 0, 0, 0));
+  CHECK(is_pixel(12, 40, 0, 255, 255));
+  // outside every sprite
+  CHECK(is_pixel(24, 24, 0, 0, 0));
+  CHECK(is_pixel(12, 20, 0, 0, 0));
+}
+
+/**
+ * Main function
+ * \return EXIT_SUCCESS if all checks pass, EXIT_FAILURE otherwise
+ */
+int main() {
+  SDL_Surface * target = SDL_CreateRGBSurfaceWithFormat(0, TARGET_SIZE, TARGET_SIZE, 32, SDL_PIXELFORMAT_RGBA32);
+  renderer = target != NULL ? SDL_CreateSoftwareRenderer(target) : NULL;
+  struct sprite_atlas * atlas = create_sprite_atlas(ATLAS_SIZE, ATLAS_SIZE);
+  struct sprite_atlas * other = create_sprite_atlas(ATLAS_SIZE, ATLAS_SIZE);
+  if(renderer == NULL || atlas == NULL || other == NULL) {
+    fprintf(stderr, "could not set up rendering: '%s'\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+
+  struct sprite_batch batch;
+  init_sprite_batch(&batch);
+  test_atlas(atlas, other);
+  test_batching(&batch);
+  test_drawing(&batch);
+  dispose_sprite_batch(&batch);
+
+  destroy_sprite_atlas(other);
+  destroy_sprite_atlas(atlas);
+  SDL_DestroyRenderer(renderer);
+  SDL_FreeSurface(target);
+  return TEST_RESULT();
+}
@@ -16,17 +16,66 @@
 
 #include "status.h"
 
+#include <stdatomic.h>
+#include <string.h>
+
 #include <pthread.h>
 
+/**
+ * The size of a cache line, used to keep counters written by different threads apart
+ */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * The error frames of a thread, a ring overwriting its oldest frames
+ */
+struct status_frames {
+
+  /**
+   * The frames
+   */
+  struct status_frame frames[STATUS_FRAME_CAPACITY];
+
+  /**
+   * The number of frames pushed, the next one goes to this index modulo the capacity
+   */
+  unsigned int count;
+};
+
+/**
+ * The number of errors recorded with a status code, on its own cache line
+ */
+struct status_counter {
+
+  /**
+   * The number of errors
+   */
+  _Alignas(CACHE_LINE_SIZE) atomic_ullong count;
+};
+
+_Static_assert((STATUS_FRAME_CAPACITY & (STATUS_FRAME_CAPACITY - 1)) == 0, "the frame capacity must be a power of two");
+
 __thread enum status_code cur_status = STATUS_CODE_OK;
 
+/**
+ * The error frames of this thread, in static thread local storage so recording never allocates
+ */
+static __thread struct status_frames status_frames;
+
+/**
+ * The number of errors recorded with each code, by all threads
+ */
+static struct status_counter status_counts[STATUS_CODE_COUNT];
+
 static const char * status_labels[] = {
-  "ok"
+  "ok",
+  "out of memory",
+  "invalid argument",
+  "input/output error",
+  "SDL error"
 };
 
-void clear_status() {
-  cur_status = STATUS_CODE_OK;
-}
+_Static_assert(sizeof(status_labels) / sizeof(status_labels[0]) == STATUS_CODE_COUNT, "every status code needs a label");
 
 void set_status(enum status_code status) {
   cur_status = status;
@@ -36,6 +85,49 @@ enum status_code get_status() {
   return cur_status;
 }
 
+void push_status_frame(enum status_code status, const char * file, int line, const void * payload, size_t payload_len) {
+  struct status_frame * frame = status_frames.frames + (status_frames.count++ & (STATUS_FRAME_CAPACITY - 1));
+  if(payload == NULL || payload_len > STATUS_PAYLOAD_SIZE) {
+    payload_len = payload == NULL ? 0 : STATUS_PAYLOAD_SIZE;
+  }
+  frame->code = status;
+  frame->file = file;
+  frame->line = line;
+  frame->payload_len = (unsigned int)payload_len;
+  if(payload_len != 0) {
+    memcpy(frame->payload, payload, payload_len);
+  }
+  cur_status = status;
+  if((size_t)status < STATUS_CODE_COUNT) {
+    atomic_fetch_add_explicit(&status_counts[(size_t)status].count, 1, memory_order_relaxed);
+  }
+}
+
+size_t get_status_frames(struct status_frame * frames, size_t cap) {
+  size_t len = status_frames.count < STATUS_FRAME_CAPACITY ? status_frames.count : STATUS_FRAME_CAPACITY;
+  if(len > cap) {
+    len = cap;
+  }
+  for(size_t i = 0; i < len; ++i) {
+    frames[i] = status_frames.frames[(status_frames.count - 1 - i) & (STATUS_FRAME_CAPACITY - 1)];
+  }
+  return len;
+}
+
+void clear_status_frames() {
+  status_frames.count = 0;
+}
+
+unsigned long long get_status_count(enum status_code status) {
+  if((size_t)status >= STATUS_CODE_COUNT) {
+    return 0;
+  }
+  return atomic_load_explicit(&status_counts[(size_t)status].count, memory_order_relaxed);
+}
+
 const char * get_status_label(enum status_code status) {
+  if((size_t)status >= STATUS_CODE_COUNT) {
+    return "unknown status";
+  }
   return status_labels[(size_t)status];
 }
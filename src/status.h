@@ -17,6 +17,18 @@
 #ifndef STATUS_H
 #define STATUS_H
 
+#include <stddef.h>
+
+/**
+ * The number of error frames each thread keeps, older frames get overwritten
+ */
+#define STATUS_FRAME_CAPACITY 16
+
+/**
+ * The maximum size of the payload of an error frame, larger payloads are cut
+ */
+#define STATUS_PAYLOAD_SIZE 16
+
 /**
  * Status codes for errors
  */
@@ -24,13 +36,77 @@ enum status_code {
 		  /**
 		   * Everything is OK
 		   */
-		  STATUS_CODE_OK
+		  STATUS_CODE_OK,
+
+		  /**
+		   * Memory could not be allocated
+		   */
+		  STATUS_CODE_OUT_OF_MEMORY,
+
+		  /**
+		   * An argument is out of range or otherwise invalid
+		   */
+		  STATUS_CODE_INVALID_ARGUMENT,
+
+		  /**
+		   * Reading or writing a file or device failed
+		   */
+		  STATUS_CODE_IO_ERROR,
+
+		  /**
+		   * A call into SDL failed
+		   */
+		  STATUS_CODE_SDL_ERROR,
+
+		  /**
+		   * The number of status codes, not a status code itself
+		   */
+		  STATUS_CODE_COUNT
+};
+
+/**
+ * An error recorded by a thread, where it happened and what it carried
+ */
+struct status_frame {
+
+  /**
+   * The status code
+   */
+  enum status_code code;
+
+  /**
+   * The file where the error was recorded
+   */
+  const char * file;
+
+  /**
+   * The line where the error was recorded
+   */
+  int line;
+
+  /**
+   * The number of payload bytes
+   */
+  unsigned int payload_len;
+
+  /**
+   * Optional bytes describing the error, e.g. the value that was rejected
+   */
+  unsigned char payload[STATUS_PAYLOAD_SIZE];
 };
 
 /**
- * Clears the status flag for this thread
+ * The status flag of this thread, use the functions below
+ */
+extern __thread enum status_code cur_status;
+
+/**
+ * Clears the status flag for this thread, a single store so it costs nothing on success paths
+ * The error frames of the thread are kept
  */
-void clear_status();
+static inline void clear_status() {
+  cur_status = STATUS_CODE_OK;
+}
 
 /**
  * Sets the status flag for this thread
@@ -44,11 +120,54 @@ void set_status(enum status_code status);
  */
 enum status_code get_status();
 
+/**
+ * Records an error for this thread: sets the status flag, pushes an error frame and counts the
+ * code, without allocating
+ * Users should use the utility macros instead
+ * \param status the status code
+ * \param file the file where the error was recorded
+ * \param line the line where the error was recorded
+ * \param payload the payload or NULL
+ * \param payload_len the number of payload bytes
+ */
+void push_status_frame(enum status_code status, const char * file, int line, const void * payload, size_t payload_len);
+
+/**
+ * Copies the error frames of this thread, the most recent first
+ * \param frames the array receiving the frames
+ * \param cap the capacity of the array
+ * \return the number of frames copied
+ */
+size_t get_status_frames(struct status_frame * frames, size_t cap);
+
+/**
+ * Drops the error frames of this thread
+ */
+void clear_status_frames();
+
+/**
+ * Returns how often a status code was recorded, by all threads since the program started
+ * \param status the status code
+ * \return the number of error frames pushed with the code, 0 for an unknown code
+ */
+unsigned long long get_status_count(enum status_code status);
+
 /**
  * Returns a string constant describing the specified status code
  * \param status the status code
- * \return a string constant
+ * \return a string constant, "unknown status" for an unknown code
  */
 const char * get_status_label(enum status_code status);
 
+/**
+ * Utility macro recording an error where it happens
+ */
+#define SET_STATUS(status) push_status_frame((status), __FILE__, __LINE__, NULL, 0)
+
+/**
+ * Utility macro recording an error with a small payload, at most STATUS_PAYLOAD_SIZE bytes are
+ * kept
+ */
+#define SET_STATUS_WITH_PAYLOAD(status, payload, payload_len) push_status_frame((status), __FILE__, __LINE__, (payload), (payload_len))
+
 #endif
@@ -0,0 +1,53 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Checks for the test programs run by make check
+ * A failed check is reported and counted, the test goes on so one run shows all failures
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * The exit status telling make check a test was skipped
+ */
+#define TEST_SKIPPED 77
+
+/**
+ * The number of failed checks
+ */
+static int test_failures = 0;
+
+/**
+ * Checks a condition, reporting and counting it if it does not hold
+ */
+#define CHECK(condition) do {						\
+    if(!(condition)) {							\
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++test_failures;							\
+    }									\
+  } while(0)
+
+/**
+ * Returns the exit status of a test program
+ */
+#define TEST_RESULT() (test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif
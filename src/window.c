@@ -15,20 +15,315 @@
  */
 
 #include "logger.h"
+#include "profiler.h"
+#include "status.h"
 #include "window.h"
 
+#include <assert.h>
+#include <stdbool.h>
+
+#include <errno.h>
+#include <time.h>
+
 #include <SDL2/SDL.h>
 
+/**
+ * The default title of the window
+ */
+#define DEFAULT_WINDOW_TITLE "guard"
+
+/**
+ * The default width of the window
+ */
+#define DEFAULT_WINDOW_WIDTH 1280
+
+/**
+ * The default height of the window
+ */
+#define DEFAULT_WINDOW_HEIGHT 720
+
+/**
+ * The default number of simulation steps per second
+ */
+#define DEFAULT_UPDATE_RATE 120
+
+/**
+ * The default number of frames per second
+ */
+#define DEFAULT_FRAME_RATE 60
+
+/**
+ * The default maximum number of updates in a single frame
+ */
+#define DEFAULT_MAX_UPDATES 8
+
+/**
+ * The default time before a frame deadline the loop spins, in microseconds
+ */
+#define DEFAULT_SPIN_TIME 2000
+
+/**
+ * The default interval between logging frame time statistics, in seconds
+ */
+#define DEFAULT_LOG_INTERVAL 10
+
+/**
+ * The highest update or frame rate, a step or frame period has to last at least a nanosecond
+ */
+#define MAX_WINDOW_RATE 1000000000U
+
+/**
+ * The window or NULL if it is not initialized
+ */
+static SDL_Window * window;
+
+/**
+ * The renderer of the window
+ */
+static SDL_Renderer * renderer;
+
+/**
+ * The options of the window
+ */
+static struct window_options window_options;
+
+/**
+ * Whether the game loop stops after the current frame
+ */
+static bool closing;
+
+/**
+ * The times of the last frames, a ring indexed by the frame number
+ */
+static struct window_frame_time frame_times[WINDOW_FRAME_HISTORY];
+
+/**
+ * The number of frames the game loop ran
+ */
+static unsigned long long frame_count;
+
+/**
+ * Returns the time of the monotonic clock
+ * \return the time in nanoseconds
+ */
+static unsigned long long get_window_time() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (unsigned long long)time.tv_sec * 1000000000ULL + (unsigned long long)time.tv_nsec;
+}
+
+/**
+ * Waits until a frame deadline, sleeping while the deadline is further away than the spin
+ * time and then spinning, which keeps a core busy only for the last moments of the frame
+ * \param deadline the deadline, in nanoseconds of the monotonic clock
+ */
+static void wait_for_frame_deadline(unsigned long long deadline) {
+  unsigned long long spin = window_options.spin_time * 1000ULL;
+  if(get_window_time() + spin < deadline) {
+    struct timespec wake = { (time_t)((deadline - spin) / 1000000000ULL), (long)((deadline - spin) % 1000000000ULL) };
+    // a sleep that fails for any reason but a signal leaves the rest of the wait to the spin
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+    }
+  }
+  while(get_window_time() < deadline) {
+  }
+}
+
+void init_window_options(struct window_options * options) {
+  assert(options != NULL);
+  options->title = DEFAULT_WINDOW_TITLE;
+  options->width = DEFAULT_WINDOW_WIDTH;
+  options->height = DEFAULT_WINDOW_HEIGHT;
+  options->update_rate = DEFAULT_UPDATE_RATE;
+  options->frame_rate = DEFAULT_FRAME_RATE;
+  options->max_updates = DEFAULT_MAX_UPDATES;
+  options->spin_time = DEFAULT_SPIN_TIME;
+  options->log_interval = DEFAULT_LOG_INTERVAL;
+  options->max_frames = 0;
+  options->software_renderer = false;
+}
+
 int init_window() {
+  struct window_options options;
+  init_window_options(&options);
+  return init_window_with_options(&options);
+}
+
+int init_window_with_options(const struct window_options * options) {
+  assert(options != NULL);
+  assert(window == NULL);
+
+  if(options->update_rate == 0 || options->update_rate > MAX_WINDOW_RATE || options->frame_rate > MAX_WINDOW_RATE
+     || options->max_updates == 0 || options->width <= 0 || options->height <= 0) {
+    SET_STATUS(STATUS_CODE_INVALID_ARGUMENT);
+    LOG_ERROR("invalid window options");
+    return -1;
+  }
+  window_options = *options;
+
   LOG_DEBUG("initializing SDL");
   if(SDL_Init(SDL_INIT_VIDEO) != 0) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
     LOG_ERROR("could not initialize SDL: '%s'", SDL_GetError());
     return -1;
   }
+  window = SDL_CreateWindow(options->title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, options->width, options->height, 0);
+  if(window == NULL) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    LOG_ERROR("could not create the window: '%s'", SDL_GetError());
+    SDL_Quit();
+    return -1;
+  }
+  // the loop paces frames itself, the renderer does not wait for vertical sync
+  renderer = SDL_CreateRenderer(window, -1, options->software_renderer ? SDL_RENDERER_SOFTWARE : 0);
+  if(renderer == NULL) {
+    SET_STATUS(STATUS_CODE_SDL_ERROR);
+    LOG_ERROR("could not create the renderer: '%s'", SDL_GetError());
+    SDL_DestroyWindow(window);
+    window = NULL;
+    SDL_Quit();
+    return -1;
+  }
+  LOG_INFO("window opened with the %s video driver", SDL_GetCurrentVideoDriver());
+  return 0;
+}
+
+int run_window(const struct window_loop * loop) {
+  assert(loop != NULL);
+  assert(window != NULL);
+
+  unsigned long long step = 1000000000ULL / window_options.update_rate;
+  unsigned long long period = window_options.frame_rate == 0 ? 0 : 1000000000ULL / window_options.frame_rate;
+  unsigned long long accumulator = 0;
+  unsigned long long previous = get_window_time();
+  unsigned long long deadline = previous + period;
+  unsigned long long logged = previous;
+  closing = false;
+  frame_count = 0;
+
+  while(!closing && (window_options.max_frames == 0 || frame_count < window_options.max_frames)) {
+    PROFILE_BEGIN("frame");
+    unsigned long long start = get_window_time();
+    SDL_Event event;
+    while(SDL_PollEvent(&event)) {
+      if(event.type == SDL_QUIT) {
+	closing = true;
+      }
+    }
+
+    struct window_frame_time * time = frame_times + frame_count % WINDOW_FRAME_HISTORY;
+    accumulator += start - previous;
+    previous = start;
+    time->updates = 0;
+    PROFILE_BEGIN("update");
+    while(accumulator >= step && time->updates < window_options.max_updates) {
+      if(loop->update != NULL) {
+	loop->update(loop->data, (double)step * 1e-9);
+      }
+      accumulator -= step;
+      ++time->updates;
+    }
+    if(accumulator >= step) {
+      // the simulation fell behind, it slows down rather than catching up in bursts
+      accumulator %= step;
+    }
+    PROFILE_END();
+    unsigned long long updated = get_window_time();
+
+    PROFILE_BEGIN("render");
+    if(loop->render != NULL) {
+      loop->render(loop->data, renderer, (double)accumulator / (double)step);
+    }
+    SDL_RenderPresent(renderer);
+    flush_log_limits();
+    publish_log_frame();
+    PROFILE_END();
+    unsigned long long rendered = get_window_time();
+
+    if(period != 0) {
+      PROFILE_BEGIN("wait");
+      wait_for_frame_deadline(deadline);
+      PROFILE_END();
+      deadline += period;
+      // after a frame that missed its deadline, pacing starts over instead of rushing frames
+      unsigned long long now = get_window_time();
+      if(deadline < now) {
+	deadline = now + period;
+      }
+    }
+    unsigned long long end = get_window_time();
+    time->update = updated - start;
+    time->render = rendered - updated;
+    time->idle = end - rendered;
+    ++frame_count;
+    PROFILE_END();
+
+    if(window_options.log_interval != 0 && end - logged >= window_options.log_interval * 1000000000ULL) {
+      log_window_frame_times();
+      logged = end;
+    }
+  }
   return 0;
 }
 
+void close_window() {
+  closing = true;
+}
+
+SDL_Renderer * get_window_renderer() {
+  return renderer;
+}
+
+size_t get_window_frame_times(struct window_frame_time * times, size_t cap) {
+  size_t len = frame_count < WINDOW_FRAME_HISTORY ? (size_t)frame_count : WINDOW_FRAME_HISTORY;
+  if(len > cap) {
+    len = cap;
+  }
+  for(size_t i = 0; i < len; ++i) {
+    times[i] = frame_times[(frame_count - 1 - i) % WINDOW_FRAME_HISTORY];
+  }
+  return len;
+}
+
+void log_window_frame_times() {
+  struct window_frame_time times[WINDOW_FRAME_HISTORY];
+  size_t len = get_window_frame_times(times, WINDOW_FRAME_HISTORY);
+  if(len == 0) {
+    return;
+  }
+  unsigned long long update = 0, render = 0, idle = 0, max_update = 0, max_render = 0, max_frame = 0, updates = 0;
+  for(size_t i = 0; i < len; ++i) {
+    unsigned long long frame = times[i].update + times[i].render + times[i].idle;
+    update += times[i].update;
+    render += times[i].render;
+    idle += times[i].idle;
+    updates += times[i].updates;
+    max_update = times[i].update > max_update ? times[i].update : max_update;
+    max_render = times[i].render > max_render ? times[i].render : max_render;
+    max_frame = frame > max_frame ? frame : max_frame;
+  }
+  // averages and maxima in microseconds
+  LOG_INFO_FIELDS("frame times",
+		  LOG_INT("frames", (long long)len),
+		  LOG_FLOAT("fps", (double)len * 1e9 / (double)(update + render + idle)),
+		  LOG_FLOAT("updates", (double)updates / (double)len),
+		  LOG_INT("update_us", (long long)(update / len / 1000)),
+		  LOG_INT("update_max_us", (long long)(max_update / 1000)),
+		  LOG_INT("render_us", (long long)(render / len / 1000)),
+		  LOG_INT("render_max_us", (long long)(max_render / 1000)),
+		  LOG_INT("idle_us", (long long)(idle / len / 1000)),
+		  LOG_INT("frame_max_us", (long long)(max_frame / 1000)));
+}
+
 void dispose_window() {
   LOG_DEBUG("shutting down SDL");
+  if(renderer != NULL) {
+    SDL_DestroyRenderer(renderer);
+    renderer = NULL;
+  }
+  if(window != NULL) {
+    SDL_DestroyWindow(window);
+    window = NULL;
+  }
   SDL_Quit();
 }
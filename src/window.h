@@ -17,12 +17,183 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <SDL2/SDL.h>
+
 /**
- * Initializes the window
+ * The number of frames whose times the window keeps
+ */
+#define WINDOW_FRAME_HISTORY 256
+
+/**
+ * Options of the window and its game loop
+ */
+struct window_options {
+
+  /**
+   * The title of the window
+   */
+  const char * title;
+
+  /**
+   * The width of the window in pixels
+   */
+  int width;
+
+  /**
+   * The height of the window in pixels
+   */
+  int height;
+
+  /**
+   * The number of simulation steps per second, each update advances the simulation by the
+   * inverse of this, at most 1000000000
+   */
+  unsigned int update_rate;
+
+  /**
+   * The number of frames per second the loop paces itself to, at most 1000000000, 0 to render
+   * as fast as possible
+   */
+  unsigned int frame_rate;
+
+  /**
+   * The maximum number of updates in a single frame, the simulation falls behind rather than
+   * spiralling when updates take longer than the time they simulate
+   */
+  unsigned int max_updates;
+
+  /**
+   * The time before a frame deadline the loop stops sleeping and spins, in microseconds, as
+   * sleeps overshoot by about the scheduler tick
+   */
+  unsigned int spin_time;
+
+  /**
+   * The interval between logging frame time statistics, in seconds, 0 to never log them
+   */
+  unsigned int log_interval;
+
+  /**
+   * The number of frames after which the loop stops, 0 to run until the window is closed
+   */
+  unsigned long long max_frames;
+
+  /**
+   * Whether to render with SDL's software renderer, which also works with the dummy video driver
+   */
+  bool software_renderer;
+};
+
+/**
+ * The callbacks of the game loop
+ */
+struct window_loop {
+
+  /**
+   * Advances the simulation by one fixed step
+   * \param data the data of the loop
+   * \param step the simulated time, in seconds
+   */
+  void (*update)(void * data, double step);
+
+  /**
+   * Draws a frame, blending the last two simulation states
+   * \param data the data of the loop
+   * \param renderer the renderer of the window, presented after the call
+   * \param alpha how far the frame lies between the previous and the current state, from 0 to 1
+   */
+  void (*render)(void * data, SDL_Renderer * renderer, double alpha);
+
+  /**
+   * The data passed to the callbacks
+   */
+  void * data;
+};
+
+/**
+ * Where the time of a frame went, in nanoseconds
+ */
+struct window_frame_time {
+
+  /**
+   * The time spent updating the simulation
+   */
+  unsigned long long update;
+
+  /**
+   * The time spent rendering, presenting and publishing the log messages of the frame
+   */
+  unsigned long long render;
+
+  /**
+   * The time spent waiting for the frame deadline
+   */
+  unsigned long long idle;
+
+  /**
+   * The number of updates in the frame
+   */
+  unsigned int updates;
+};
+
+/**
+ * Initializes the options with the defaults
+ * \param options the options
+ */
+void init_window_options(struct window_options * options);
+
+/**
+ * Initializes the window with the default options
  * \return 0 on success, -1 on error
  */
 int init_window();
 
+/**
+ * Initializes the window
+ * Runs headless with SDL_VIDEODRIVER=dummy
+ * \param options the options
+ * \return 0 on success, -1 on error
+ */
+int init_window_with_options(const struct window_options * options);
+
+/**
+ * Runs the game loop until the window is closed, close_window is called or the maximum number
+ * of frames is reached
+ * Updates run at a fixed rate, driven by an accumulator of the elapsed time, frames get
+ * rendered once per iteration and are paced by sleeping and then spinning until their deadline.
+ * Messages of frame buffered logging get published once per frame.
+ * \param loop the callbacks
+ * \return 0 on success, -1 on error
+ */
+int run_window(const struct window_loop * loop);
+
+/**
+ * Makes the game loop stop after the current frame, called from the callbacks
+ */
+void close_window();
+
+/**
+ * Returns the renderer of the window, e.g. to create textures
+ * \return the renderer or NULL if the window is not initialized
+ */
+SDL_Renderer * get_window_renderer();
+
+/**
+ * Copies the times of the last frames, the most recent first
+ * \param times the array receiving the times
+ * \param cap the capacity of the array, at most WINDOW_FRAME_HISTORY frames are kept
+ * \return the number of frame times copied
+ */
+size_t get_window_frame_times(struct window_frame_time * times, size_t cap);
+
+/**
+ * Logs statistics of the times of the last frames
+ */
+void log_window_frame_times();
+
 /**
  * Disposes the window
  */
@@ -0,0 +1,172 @@
+/*
+ *
+ * This file is part of guard.
+ *
+ * guard is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, 
+ * either version 3 of the License, or (at your option) any later version.
+ * 
+ * guard is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+ * See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with guard. 
+ * If not, see <https://www.gnu.org/licenses/>. 
+ * 
+ */
+
+/**
+ * Tests the game loop headless, with the dummy video driver and the software renderer
+ */
+
+#include "test.h"
+#include "window.h"
+
+#include <stdlib.h>
+
+/**
+ * The number of frames the paced loop runs
+ */
+#define TEST_FRAMES 30
+
+/**
+ * The frame after which the loop closes the window
+ */
+#define CLOSE_FRAME 5
+
+/**
+ * What the callbacks saw
+ */
+struct loop_record {
+
+  /**
+   * The number of updates
+   */
+  unsigned long long updates;
+
+  /**
+   * The number of rendered frames
+   */
+  unsigned long long frames;
+
+  /**
+   * The number of frames rendered with alpha outside [0, 1)
+   */
+  unsigned long long bad_alphas;
+
+  /**
+   * The number of updates with a step other than the fixed step
+   */
+  unsigned long long bad_steps;
+
+  /**
+   * The fixed step, in seconds
+   */
+  double step;
+
+  /**
+   * The frame after which the window is closed, 0 to keep it open
+   */
+  unsigned long long close_frame;
+};
+
+/**
+ * Counts an update
+ * \param data the record
+ * \param step the simulated time, in seconds
+ */
+static void update(void * data, double step) {
+  struct loop_record * record = (struct loop_record *)data;
+  ++record->updates;
+  // the loop keeps the step in whole nanoseconds
+  if(step < record->step - 1e-9 || step > record->step + 1e-9) {
+    ++record->bad_steps;
+  }
+}
+
+/**
+ * Counts a frame
+ * \param data the record
+ * \param renderer the renderer of the window
+ * \param alpha how far the frame lies between the last two updates
+ */
+static void render(void * data, SDL_Renderer * renderer, double alpha) {
+  struct loop_record * record = (struct loop_record *)data;
+  ++record->frames;
+  if(alpha < 0.0 || alpha >= 1.0) {
+    ++record->bad_alphas;
+  }
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+  SDL_RenderClear(renderer);
+  if(record->frames == record->close_frame) {
+    close_window();
+  }
+}
+
+/**
+ * Main function
+ * \return EXIT_SUCCESS if all checks pass, EXIT_FAILURE otherwise or TEST_SKIPPED without the
+ * dummy video driver
+ */
+int main() {
+  setenv("SDL_VIDEODRIVER", "dummy", 1);
+  struct window_options options;
+  init_window_options(&options);
+  options.software_renderer = true;
+  options.update_rate = 120;
+  options.frame_rate = 60;
+  options.log_interval = 0;
+  options.max_frames = TEST_FRAMES;
+  if(init_window_with_options(&options) != 0) {
+    fprintf(stderr, "could not open a window with the dummy video driver: '%s'\n", SDL_GetError());
+    return TEST_SKIPPED;
+  }
+  CHECK(get_window_renderer() != NULL);
+
+  // the paced loop runs its frames at the frame rate with about two updates each
+  struct loop_record record = { 0, 0, 0, 0, 1.0 / options.update_rate, 0 };
+  struct window_loop loop = { update, render, &record };
+  CHECK(run_window(&loop) == 0);
+  CHECK(record.frames == TEST_FRAMES);
+  CHECK(record.bad_alphas == 0);
+  CHECK(record.bad_steps == 0);
+
+  struct window_frame_time times[WINDOW_FRAME_HISTORY];
+  size_t len = get_window_frame_times(times, WINDOW_FRAME_HISTORY);
+  CHECK(len == TEST_FRAMES);
+  unsigned long long total = 0;
+  unsigned long long updates = 0;
+  for(size_t i = 0; i < len; ++i) {
+    total += times[i].update + times[i].render + times[i].idle;
+    updates += times[i].updates;
+    CHECK(times[i].updates <= options.max_updates);
+  }
+  CHECK(updates == record.updates);
+  // sleeping may overshoot but pacing never runs frames early, the first frame starts right away
+  unsigned long long period = 1000000000ULL / options.frame_rate;
+  CHECK(total >= (TEST_FRAMES - 1) * period);
+  // the updates follow the elapsed time, give or take the first and last frame
+  double elapsed_updates = (double)total * 1e-9 * options.update_rate;
+  CHECK(updates + 2 * options.max_updates >= elapsed_updates && updates <= elapsed_updates + 1.0);
+  CHECK(get_window_frame_times(times, 4) == 4);
+
+  // closing from a callback stops the loop after the frame, unpaced frames run right away
+  options.frame_rate = 0;
+  record.updates = 0;
+  record.frames = 0;
+  record.close_frame = CLOSE_FRAME;
+  dispose_window();
+  CHECK(init_window_with_options(&options) == 0);
+  CHECK(run_window(&loop) == 0);
+  CHECK(record.frames == CLOSE_FRAME);
+  CHECK(get_window_frame_times(times, WINDOW_FRAME_HISTORY) == CLOSE_FRAME);
+  dispose_window();
+
+  options.update_rate = 0;
+  CHECK(init_window_with_options(&options) == -1);
+  options.update_rate = 1000000001;
+  CHECK(init_window_with_options(&options) == -1);
+  options.update_rate = 120;
+  options.frame_rate = 1000000001;
+  CHECK(init_window_with_options(&options) == -1);
+  return TEST_RESULT();
+}